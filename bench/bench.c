@@ -0,0 +1,459 @@
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <lib/llvm.h>
+
+// Builds synthetic modules of a configurable shape and times every emission
+// entry point on them. Each measurement is printed as one JSON object per
+// line, so runs can be diffed or fed to a dashboard:
+//
+//   bench/bench --functions 2000 --blocks 4 --instructions 8 --steps 3
+//
+// `--steps` doubles the function count after each round, which makes it easy
+// to see whether throughput stays flat as the module grows.
+
+typedef struct bench_config_t {
+    size_t functions;
+    size_t blocks;       // basic blocks per function
+    size_t instructions; // instructions per basic block, including the terminator
+    size_t types;        // named struct declarations
+    size_t depth;        // nesting depth of each declared struct
+    size_t globals;
+    double call_density; // fraction of non-terminator instructions that are calls
+    size_t variables;    // builder variables per function, 0 for none
+    size_t threads;      // for `llvm_generate_parallel`
+    size_t repeat;       // each measurement keeps the best of this many runs
+    size_t steps;
+    u64 seed;
+} bench_config_t;
+
+typedef struct bench_option_t {
+    const char *name;
+    size_t *size;
+    double *real;
+} bench_option_t;
+
+// Allocation counts need the linker to route malloc and friends through the
+// wrappers below (see the `bench` target); without that they are reported
+// as null.
+#ifdef BENCH_COUNT_ALLOCATIONS
+static atomic_size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+#endif
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Resets the kernel's high-water mark where that is possible, so each
+// measurement reports its own peak rather than the largest one so far.
+static void peak_rss_reset(void) {
+#if defined(__linux__)
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if (file != NULL) {
+        fputs("5", file);
+        fclose(file);
+    }
+#endif
+}
+
+// In KiB, or -1 when the platform offers no cheap way to read it.
+static long peak_rss_kb(void) {
+#if defined(__linux__)
+    FILE *file = fopen("/proc/self/status", "r");
+    if (file != NULL) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), file) != NULL)
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(file);
+        return kb;
+    }
+    return -1;
+#elif defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+#else
+    return -1;
+#endif
+}
+
+static u64 next_random(u64 *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static str format_name(llvm_generator_t *gen, const char *prefix, size_t index) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s%zu", prefix, index);
+    return arena_strdup(&gen->arena, STR(name));
+}
+
+static llvm_type_t *nested_type(llvm_generator_t *gen, size_t seed, size_t depth) {
+    llvm_type_t *leaf = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_INT(8 << (seed % 4)));
+    if (depth == 0)
+        return leaf;
+    llvm_type_t *inner = nested_type(gen, seed + 1, depth - 1);
+    array(llvm_type_ptr_t) members = array_new_arena(llvm_type_ptr_t)(&gen->arena);
+    array_push(llvm_type_ptr_t)(&members, leaf);
+    array_push(llvm_type_ptr_t)(&members, LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_POINTER(*inner)));
+    array_push(llvm_type_ptr_t)(&members, LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_ARRAY(*inner, (int)(2 + seed % 3))));
+    return LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_STRUCTURE(members, seed % 5 == 0));
+}
+
+typedef struct bench_module_t {
+    size_t instructions;
+    size_t strings; // the even-numbered globals are strings
+} bench_module_t;
+
+// Every function takes an `i1` and an `i32`. Its blocks form a chain of
+// diamonds: each one branches on the `i1` to the next block or the one after
+// it, and only the last returns, so the module stays valid IR whatever its
+// shape. The other instructions are getelementptrs into the string globals
+// and calls, either to printf with the most recent pointer or to another
+// function of the module with the most recent result. With `--variables`,
+// call results are written to builder variables instead and read back, so
+// the joins get phis.
+static bench_module_t build_module(llvm_generator_t *gen, bench_config_t *config, size_t functions) {
+    bench_module_t module = {0};
+    u64 state = config->seed;
+
+    for (size_t i = 0; i < config->types; i++)
+        llvm_add_type_declaration(gen, (llvm_type_declaration_t){.name = format_name(gen, "T", i), .type = *nested_type(gen, i, config->depth)});
+
+    llvm_type_t *char_type = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_INT(8));
+    llvm_type_t *int_type = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_INT(32));
+    llvm_type_t *string_type = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_POINTER(*char_type));
+    size_t globals = MAX(config->globals, 1);
+    llvm_type_t **string_types = arena_alloc(&gen->arena, sizeof(llvm_type_t *) * globals);
+    str *string_names = arena_alloc(&gen->arena, sizeof(str) * globals);
+    for (size_t i = 0; i < globals; i++) {
+        str name = format_name(gen, "g", i);
+        if (i % 2 == 0) {
+            str text = format_name(gen, "global string ", i);
+            string_names[module.strings] = name;
+            string_types[module.strings++] = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_ARRAY(*char_type, (int)text.count + 1));
+            llvm_add_global(gen, (llvm_global_t){
+                .name = name,
+                .linkage = LLVM_LINKAGE_INTERNAL,
+                .is_constant = true,
+                .type = string_types[module.strings - 1],
+                .value = {LLVM_VALUE_CSTRING_, .cstring_ = text},
+            });
+        } else {
+            llvm_add_global(gen, (llvm_global_t){
+                .name = name,
+                .linkage = LLVM_LINKAGE_INTERNAL,
+                .is_global = true,
+                .type = int_type,
+                .value = LLVM_VALUE_INT((int)i),
+                .alignment = 4,
+            });
+        }
+    }
+
+    array(llvm_type_t) printf_args = array_new_arena(llvm_type_t)(&gen->arena);
+    array_push(llvm_type_t)(&printf_args, *string_type);
+    llvm_add_function(gen, (llvm_function_t){
+        .name = STR("printf"),
+        .return_type = *int_type,
+        .args = printf_args,
+        .is_vararg = true,
+        .is_native = true,
+    });
+
+    llvm_type_t *bool_type = LLVM_NEW(gen, llvm_type_t, LLVM_TYPE_INT(1));
+    u64 call_threshold = (u64)(config->call_density * (double)UINT32_MAX);
+    size_t blocks = MAX(config->blocks, 1);
+    size_t per_block = MAX(config->instructions, 1);
+    llvm_builder_t builder;
+    llvm_builder_init(&builder, gen);
+    for (size_t f = 0; f < functions; f++) {
+        array(llvm_type_t) params = array_new_arena(llvm_type_t)(&gen->arena);
+        array_push(llvm_type_t)(&params, *bool_type);
+        array_push(llvm_type_t)(&params, *int_type);
+        llvm_builder_begin(&builder, (llvm_function_t){
+            .name = format_name(gen, "f", f),
+            .linkage = LLVM_LINKAGE_INTERNAL,
+            .return_type = *int_type,
+            .args = params,
+        });
+        for (size_t b = 0; b < blocks; b++)
+            llvm_builder_create_block(&builder, b == 0 ? STR("entry") : format_name(gen, "b", b));
+        llvm_value_t condition = llvm_builder_arg(&builder, 0);
+        for (size_t v = 0; v < config->variables; v++)
+            llvm_builder_write_variable(&builder, llvm_builder_declare_variable(&builder, *int_type), llvm_builder_arg(&builder, 1));
+
+        size_t written = 0;
+        for (size_t b = 0; b < blocks; b++) {
+            // Blocks only branch forward, so every predecessor is complete.
+            llvm_builder_position(&builder, (uint)b);
+            llvm_builder_seal_block(&builder, (uint)b);
+            bool has_pointer = false;
+            llvm_value_t pointer = {0};
+            llvm_value_t result = b == 0 ? llvm_builder_arg(&builder, 1) : LLVM_VALUE_INT(0);
+            for (size_t k = 0; k + 1 < per_block; k++) {
+                bool is_call = (next_random(&state) & UINT32_MAX) < call_threshold;
+                if (!is_call) {
+                    size_t target = next_random(&state) % module.strings;
+                    pointer = llvm_builder_gep(&builder, true, string_names[target], *string_types[target], LLVM_VALUE_INT(0), LLVM_VALUE_INT(0));
+                    has_pointer = true;
+                    continue;
+                }
+                if (has_pointer && next_random(&state) % 2 == 0) {
+                    result = llvm_builder_call(&builder, *int_type, STR("printf"), &(llvm_function_arg_t){*string_type, pointer}, 1);
+                } else {
+                    llvm_value_t value = result;
+                    if (config->variables > 0)
+                        value = llvm_builder_read_variable(&builder, (uint)(next_random(&state) % config->variables));
+                    llvm_function_arg_t args[] = {{*bool_type, condition}, {*int_type, value}};
+                    str callee = format_name(gen, "f", next_random(&state) % functions);
+                    result = llvm_builder_call(&builder, *int_type, callee, args, 2);
+                }
+                if (config->variables > 0)
+                    llvm_builder_write_variable(&builder, (uint)(written++ % config->variables), result);
+            }
+            if (b + 2 < blocks)
+                llvm_builder_cond_br(&builder, condition, (uint)b + 1, (uint)b + 2);
+            else if (b + 1 < blocks)
+                llvm_builder_br(&builder, (uint)b + 1);
+            else if (config->variables > 0)
+                llvm_builder_ret(&builder, *int_type, llvm_builder_read_variable(&builder, 0));
+            else
+                llvm_builder_ret(&builder, *int_type, result);
+            module.instructions += per_block;
+        }
+        llvm_builder_finish(&builder);
+    }
+    llvm_builder_free(&builder);
+    return module;
+}
+
+typedef enum bench_entry_t {
+    BENCH_GENERATE,
+    BENCH_GENERATE_TO_SINK,
+    BENCH_GENERATE_PARALLEL,
+    BENCH_GENERATE_BITCODE,
+    BENCH_GENERATE_INCREMENTAL,
+    BENCH_PARSE,
+    BENCH_ENTRY_COUNT,
+} bench_entry_t;
+
+static const char *bench_entry_names[BENCH_ENTRY_COUNT] = {
+    "generate",
+    "generate_to_sink",
+    "generate_parallel",
+    "generate_bitcode",
+    "generate_incremental",
+    "parse",
+};
+
+static bool count_bytes(void *ctx, const char *data, size_t size) {
+    UNUSED(data);
+    *(size_t *)ctx += size;
+    return true;
+}
+
+// Runs one entry point and returns the number of bytes it produced (or, for
+// the parser, consumed). Anything it allocates is released before returning,
+// but outside of the timed region.
+static size_t run_entry(bench_entry_t entry, llvm_generator_t *gen, bench_config_t *config, str text, double *seconds) {
+    size_t bytes = 0;
+    double start = now();
+    switch (entry) {
+        case BENCH_GENERATE: {
+            str output = llvm_generate(gen);
+            *seconds = now() - start;
+            bytes = output.count;
+            str_free(&output);
+        } break;
+        case BENCH_GENERATE_TO_SINK: {
+            if (!llvm_generate_to_sink(gen, sink_callback(count_bytes, &bytes)))
+                fatal("sink failed.");
+            *seconds = now() - start;
+        } break;
+        case BENCH_GENERATE_PARALLEL: {
+            str output = llvm_generate_parallel(gen, (int)config->threads);
+            *seconds = now() - start;
+            bytes = output.count;
+            str_free(&output);
+        } break;
+        case BENCH_GENERATE_BITCODE: {
+            str output = llvm_generate_bitcode(gen);
+            *seconds = now() - start;
+            bytes = output.count;
+            str_free(&output);
+        } break;
+        case BENCH_GENERATE_INCREMENTAL: {
+            // Regenerates a warm cache after one function has changed.
+            llvm_cache_enable(gen, true);
+            str output = llvm_generate(gen);
+            str_free(&output);
+            llvm_touch_function(gen, &gen->functions.data[gen->functions.size / 2]);
+            start = now();
+            output = llvm_generate(gen);
+            *seconds = now() - start;
+            bytes = output.count;
+            str_free(&output);
+            llvm_cache_enable(gen, false);
+        } break;
+        case BENCH_PARSE: {
+            llvm_generator_t parsed;
+            llvm_init(&parsed);
+            llvm_parse_error_t error;
+            if (!llvm_parse(&parsed, text, &error))
+                fatal("parse failed at %zu:%zu: %s", error.line, error.column, error.message);
+            *seconds = now() - start;
+            bytes = text.count;
+            llvm_free(&parsed);
+        } break;
+        case BENCH_ENTRY_COUNT: break;
+    }
+    return bytes;
+}
+
+static bool parse_options(bench_config_t *config, int argc, char **argv) {
+    bench_option_t options[] = {
+        {"functions", &config->functions, NULL},
+        {"blocks", &config->blocks, NULL},
+        {"instructions", &config->instructions, NULL},
+        {"types", &config->types, NULL},
+        {"depth", &config->depth, NULL},
+        {"globals", &config->globals, NULL},
+        {"call-density", NULL, &config->call_density},
+        {"variables", &config->variables, NULL},
+        {"threads", &config->threads, NULL},
+        {"repeat", &config->repeat, NULL},
+        {"steps", &config->steps, NULL},
+    };
+    for (int i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0)
+            return false;
+        arg += 2;
+        char *value = strchr(arg, '=');
+        size_t length = value != NULL ? (size_t)(value - arg) : strlen(arg);
+        if (value != NULL)
+            value++;
+        else if (i + 1 < argc)
+            value = argv[++i];
+        else
+            return false;
+
+        bool found = false;
+        for (size_t j = 0; j < sizeof(options) / sizeof(options[0]); j++) {
+            if (strlen(options[j].name) != length || strncmp(options[j].name, arg, length) != 0)
+                continue;
+            if (options[j].size != NULL)
+                *options[j].size = strtoull(value, NULL, 10);
+            else
+                *options[j].real = strtod(value, NULL);
+            found = true;
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bench_config_t config = {
+        .functions = 1000,
+        .blocks = 4,
+        .instructions = 8,
+        .types = 16,
+        .depth = 3,
+        .globals = 16,
+        .call_density = 0.5,
+        .threads = 4,
+        .repeat = 3,
+        .steps = 4,
+        .seed = 0x9E3779B97F4A7C15ull,
+    };
+    if (!parse_options(&config, argc, argv)) {
+        fprintf(stderr, "usage: %s [--functions N] [--blocks N] [--instructions N] [--types N] [--depth N]\n"
+                        "       [--globals N] [--call-density F] [--variables N] [--threads N] [--repeat N]\n"
+                        "       [--steps N]\n", argv[0]);
+        return 1;
+    }
+
+    size_t functions = config.functions;
+    for (size_t step = 0; step < config.steps; step++, functions *= 2) {
+        llvm_generator_t gen;
+        llvm_init(&gen);
+        bench_module_t module = build_module(&gen, &config, functions);
+        str text = llvm_generate(&gen);
+
+        for (bench_entry_t entry = 0; entry < BENCH_ENTRY_COUNT; entry++) {
+            double best = 0;
+            size_t bytes = 0;
+            long allocation_count = -1;
+            long peak_kb = -1;
+            for (size_t run = 0; run < MAX(config.repeat, 1); run++) {
+                llvm_stats_reset(&gen);
+#ifdef BENCH_COUNT_ALLOCATIONS
+                size_t before = atomic_load(&allocations);
+#endif
+                peak_rss_reset();
+                double seconds;
+                bytes = run_entry(entry, &gen, &config, text, &seconds);
+                peak_kb = MAX(peak_kb, peak_rss_kb());
+#ifdef BENCH_COUNT_ALLOCATIONS
+                allocation_count = (long)(atomic_load(&allocations) - before);
+#endif
+                if (run == 0 || seconds < best)
+                    best = seconds;
+            }
+
+            printf("{\"benchmark\":\"%s\",\"functions\":%zu,\"blocks\":%zu,\"instructions_per_block\":%zu,"
+                   "\"types\":%zu,\"depth\":%zu,\"globals\":%zu,\"call_density\":%.3f,\"variables\":%zu,\"threads\":%zu,"
+                   "\"instructions\":%zu,\"bytes\":%zu,\"seconds\":%.6f,\"mb_per_s\":%.2f,\"instructions_per_s\":%.0f,",
+                   bench_entry_names[entry], functions, config.blocks, config.instructions,
+                   config.types, config.depth, config.globals, config.call_density, config.variables, config.threads,
+                   module.instructions, bytes, best, (double)bytes / best / 1e6, (double)module.instructions / best);
+            if (allocation_count >= 0) printf("\"allocations\":%ld,", allocation_count);
+            else printf("\"allocations\":null,");
+            if (peak_kb >= 0) printf("\"peak_rss_kb\":%ld,", peak_kb);
+            else printf("\"peak_rss_kb\":null,");
+            str_builder_t stats;
+            str_builder_init(&stats);
+            llvm_stats_to_json(&gen, &stats);
+            printf("\"stats\":%.*s}\n", (int)stats.count, stats.chars);
+            str_builder_free(&stats);
+            fflush(stdout);
+        }
+
+        str_free(&text);
+        llvm_free(&gen);
+    }
+    return 0;
+}
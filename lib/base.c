@@ -1,155 +1,394 @@
 #include <lib/base.h>
 
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif // defined(_WIN32) || defined(_WIN64)
+
 void arena_init(arena_t *a) {
-    a->ptr = NULL;
-    a->size = 0;
-    a->capacity = 0;
+    a->chunk = NULL;
+    a->chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+}
+
+static void arena_free_chunks(arena_chunk_t *chunk, arena_chunk_t *until) {
+    while (chunk != until) {
+        arena_chunk_t *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
 }
 
 void arena_free(arena_t *a) {
-    free(a->ptr);
-    a->ptr = NULL;
-    a->size = 0;
-    a->capacity = 0;
+    arena_free_chunks(a->chunk, NULL);
+    a->chunk = NULL;
 }
 
-void *arena_alloc(arena_t *a, size_t size) {
-    if (a->size + size > a->capacity) {
-        size_t new_capacity = a->capacity * 2;
-        if (new_capacity < 16) {
-            new_capacity = 16;
-        }
-        if (new_capacity < a->size + size) {
-            new_capacity = a->size + size;
-        }
+static char *arena_align(arena_chunk_t *chunk, size_t align) {
+    uintptr_t top = (uintptr_t)(chunk->data + chunk->size);
+    return (char *)((top + align - 1) & ~(uintptr_t)(align - 1));
+}
 
-        char *new_ptr = (char *)malloc(new_capacity);
-        if (!new_ptr) {
-            fprintf(stderr, "failed to allocate memory for new_ptr");
-            return NULL;
+void *arena_alloc_aligned(arena_t *a, size_t size, size_t align) {
+    assert(align != 0 && (align & (align - 1)) == 0);
+    arena_chunk_t *chunk = a->chunk;
+    if (chunk != NULL) {
+        char *ptr = arena_align(chunk, align);
+        if (ptr + size <= chunk->data + chunk->capacity) {
+            chunk->size = (size_t)(ptr - chunk->data) + size;
+            return ptr;
         }
+    }
 
-        memcpy(new_ptr, a->ptr, a->size);
-        free(a->ptr);
-        a->ptr = new_ptr;
-        a->capacity = new_capacity;
+    // Oversized requests get a chunk of their own; the rest of the current
+    // chunk is abandoned, which bounds the waste to one chunk per overflow.
+    size_t capacity = MAX(a->chunk_size, size + align);
+    chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + capacity);
+    if (!chunk) {
+        fatal("failed to allocate %zu byte arena chunk.", capacity);
     }
+    chunk->prev = a->chunk;
+    chunk->size = 0;
+    chunk->capacity = capacity;
+    a->chunk = chunk;
 
-    void *result = a->ptr + a->size;
-    a->size += size;
-    return result;
+    char *ptr = arena_align(chunk, align);
+    chunk->size = (size_t)(ptr - chunk->data) + size;
+    return ptr;
 }
 
-void arena_clear(arena_t *a) {
-    a->size = 0;
+void *arena_alloc(arena_t *a, size_t size) {
+    return arena_alloc_aligned(a, size, _Alignof(max_align_t));
 }
 
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size, size_t align) {
+    arena_chunk_t *chunk = a->chunk;
+    if (ptr != NULL && chunk != NULL && (char *)ptr + old_size == chunk->data + chunk->size) {
+        size_t offset = (size_t)((char *)ptr - chunk->data);
+        if (offset + new_size <= chunk->capacity) {
+            chunk->size = offset + new_size;
+            return ptr;
+        }
+    }
+
+    void *new_ptr = arena_alloc_aligned(a, new_size, align);
+    if (ptr != NULL)
+        memcpy(new_ptr, ptr, MIN(old_size, new_size));
+    return new_ptr;
+}
+
+void *arena_dup(arena_t *a, const void *data, size_t size, size_t align) {
+    if (size == 0)
+        return NULL;
+    void *ptr = arena_alloc_aligned(a, size, align);
+    memcpy(ptr, data, size);
+    return ptr;
+}
+
+str arena_strdup(arena_t *a, str s) {
+    char *chars = arena_alloc_aligned(a, s.count + 1, 1);
+    memcpy(chars, s.chars, s.count);
+    chars[s.count] = '\0';
+    return (str){chars, s.count};
+}
+
+arena_mark_t arena_mark(arena_t *a) {
+    return (arena_mark_t){a->chunk, a->chunk ? a->chunk->size : 0};
+}
+
+void arena_rollback(arena_t *a, arena_mark_t mark) {
+    arena_free_chunks(a->chunk, mark.chunk);
+    a->chunk = mark.chunk;
+    if (a->chunk != NULL)
+        a->chunk->size = mark.size;
+}
+
+void arena_clear(arena_t *a) {
+    // Keep the oldest chunk around so that reusing the arena for a similar
+    // workload does not go back to malloc straight away.
+    arena_chunk_t *oldest = a->chunk;
+    while (oldest != NULL && oldest->prev != NULL)
+        oldest = oldest->prev;
+    if (oldest == NULL)
+        return;
+    arena_rollback(a, (arena_mark_t){oldest, 0});
+}
 
 char str_at(str *s, size_t idx) {
     assert(idx < s->count);
     return s->chars[idx];
 }
 
+static inline u64 str_load64(const char *p) {
+    u64 word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+static inline u32 str_load32(const char *p) {
+    u32 word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
 bool str_eq(str s1, str s2) {
     if (s1.count != s2.count) {
         return false;
     }
+    if (s1.chars == s2.chars) {
+        return true;
+    }
 
-    for (size_t i = 0; i < s1.count; i++) {
-        if (s1.chars[i] != s2.chars[i]) {
+    // Whole words at a time. The last word of each string is compared
+    // separately and may overlap bytes that were already checked.
+    const char *a = s1.chars, *b = s2.chars;
+    size_t n = s1.count;
+    if (n >= 8) {
+        size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= n; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xffff) {
+                return false;
+            }
+        }
+#endif
+        for (; i + 8 <= n; i += 8) {
+            if (str_load64(a + i) != str_load64(b + i)) {
+                return false;
+            }
+        }
+        return str_load64(a + n - 8) == str_load64(b + n - 8);
+    }
+    if (n >= 4) {
+        return str_load32(a) == str_load32(b) && str_load32(a + n - 4) == str_load32(b + n - 4);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i]) {
             return false;
         }
     }
-
     return true;
 }
 
-void str_append(str *s1, str s2) {
-    size_t new_length = s1->count + s2.count;
+str str_substring(str s, size_t start, size_t end) {
+    if (start > s.count || end > s.count)
+        return (str){NULL, 0};
+    return (str){s.chars + start, end - start};
+}
 
-    char *new_chars = (char *)malloc((new_length + 1) * sizeof(char));
-    if (!new_chars) {
-        fprintf(stderr, "failed to allocate memory for new_chars");
+void str_free(str *s) {
+    free(s->chars);
+    s->chars = NULL;
+    s->count = 0;
+}
+
+u64 str_hash(str s) {
+    // FNV-1a.
+    u64 hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < s.count; i++) {
+        hash ^= (u8)s.chars[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+u64 hash_combine(u64 hash, u64 value) {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+void str_builder_init(str_builder_t *sb) {
+    sb->chars = NULL;
+    sb->count = 0;
+    sb->capacity = 0;
+#ifdef BASE_STATS
+    sb->appends = 0;
+    sb->growths = 0;
+#endif
+}
+
+void str_builder_free(str_builder_t *sb) {
+    free(sb->chars);
+    str_builder_init(sb);
+}
+
+void str_builder_clear(str_builder_t *sb) {
+    sb->count = 0;
+}
+
+void str_builder_reserve(str_builder_t *sb, size_t additional) {
+    // One extra byte is always kept for the terminator written by
+    // `str_builder_view` and `str_builder_take`.
+    size_t needed = sb->count + additional + 1;
+#ifdef BASE_STATS
+    sb->appends += additional > 0;
+#endif
+    if (needed <= sb->capacity) {
         return;
     }
 
-    memcpy(new_chars, s1->chars, s1->count * sizeof(char));
-    memcpy(new_chars + s1->count, s2.chars, s2.count * sizeof(char));
-    new_chars[new_length] = '\0';
+    size_t new_capacity = MAX(sb->capacity * 2, 64);
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
 
-    s1->chars = new_chars;
-    s1->count = new_length;
+    char *new_chars = (char *)realloc(sb->chars, new_capacity);
+    if (!new_chars) {
+        fatal("failed to grow string builder to %zu bytes.", new_capacity);
+    }
+
+    sb->chars = new_chars;
+    sb->capacity = new_capacity;
+#ifdef BASE_STATS
+    sb->growths++;
+#endif
 }
 
-void str_append_cstr(str *s1, char *s2) {
-    str_append(s1, STR(s2));
+void str_builder_shrink(str_builder_t *sb) {
+    if (sb->chars == NULL || sb->capacity == sb->count + 1) {
+        return;
+    }
+
+    char *new_chars = (char *)realloc(sb->chars, sb->count + 1);
+    if (new_chars) {
+        sb->chars = new_chars;
+        sb->capacity = sb->count + 1;
+    }
 }
 
-void str_append_int(str *s1, int i) {
-    char buf[32];
-    sprintf_s(buf, 32, "%d", i);
-    str_append_cstr(s1, buf);
+void str_builder_append(str_builder_t *sb, str s) {
+    if (s.count == 0) {
+        return;
+    }
+    str_builder_reserve(sb, s.count);
+    memcpy(sb->chars + sb->count, s.chars, s.count);
+    sb->count += s.count;
 }
 
-void str_append_float(str *s1, float f) {
-    char buf[32];
-    sprintf_s(buf, 32, "%f", f);
-    str_append_cstr(s1, buf);
+void str_builder_append_cstr(str_builder_t *sb, char *s) {
+    str_builder_append(sb, STR(s));
 }
 
-void str_append_double(str *s1, double d) {
-    char buf[32];
-    sprintf_s(buf, 32, "%f", d);
-    str_append_cstr(s1, buf);
+#define str_builder_appendf(sb, fmt, value) \
+    do { \
+        size_t space = 32; \
+        for (;;) { \
+            str_builder_reserve(sb, space); \
+            int n = snprintf((sb)->chars + (sb)->count, space + 1, fmt, value); \
+            if (n < 0) { \
+                break; \
+            } \
+            if ((size_t)n <= space) { \
+                (sb)->count += (size_t)n; \
+                break; \
+            } \
+            space = (size_t)n; \
+        } \
+    } while (0)
+
+void str_builder_append_int(str_builder_t *sb, int i) {
+    str_builder_append_i64(sb, i);
 }
 
-void str_append_char(str *s1, char c) {
-    char buf[2];
-    buf[0] = c;
-    buf[1] = '\0';
-    str_append_cstr(s1, buf);
+void str_builder_append_i64(str_builder_t *sb, i64 i) {
+    str_builder_reserve(sb, FORMAT_MAX_CHARS);
+    sb->count += format_i64(sb->chars + sb->count, i);
 }
 
-str str_substring(str s, size_t start, size_t end) {
-    if (start > s.count || end > s.count)
-        return (str){NULL, 0};
-    return (str){s.chars + start, end - start};
+void str_builder_append_u64(str_builder_t *sb, u64 u) {
+    str_builder_reserve(sb, FORMAT_MAX_CHARS);
+    sb->count += format_u64(sb->chars + sb->count, u);
 }
 
-void str_free(str *s) {
-    free(s->chars);
-    s->chars = NULL;
-    s->count = 0;
+void str_builder_append_float(str_builder_t *sb, float f) {
+    str_builder_append_double(sb, f);
+}
+
+void str_builder_append_double(str_builder_t *sb, double d) {
+    // Values too large or too precise for the fast path are rare.
+    str_builder_reserve(sb, FORMAT_MAX_CHARS);
+    size_t count = format_double_exact(sb->chars + sb->count, d);
+    if (count == 0)
+        str_builder_appendf(sb, "%f", d);
+    sb->count += count;
 }
 
-str file_read_to_str(str path) {
-    FILE* filepoint;
-    errno_t err;
+void str_builder_append_char(str_builder_t *sb, char c) {
+    str_builder_reserve(sb, 1);
+    sb->chars[sb->count++] = c;
+}
 
-    if ((err = fopen_s(&filepoint, path.chars, "rb")) != 0) {
-        fatal("Failed to open file '" STR_ARG "' for reading.\n", STR_FMT(path));
-    } else {
-        fseek(filepoint, 0, SEEK_END);
-        long size = ftell(filepoint);
-        fseek(filepoint, 0, SEEK_SET);
+str str_builder_view(str_builder_t *sb) {
+    str_builder_reserve(sb, 0);
+    sb->chars[sb->count] = '\0';
+    return (str){sb->chars, sb->count};
+}
 
-        char* raw_contents = malloc(size + 1);
-        fread(raw_contents, 1, size, filepoint);
-        raw_contents[size] = '\0';
+str str_builder_take(str_builder_t *sb) {
+    str s = str_builder_view(sb);
+    str_builder_init(sb);
+    return s;
+}
 
-        fclose(filepoint);
-        return STR(raw_contents);
+static bool sink_fd_write(void *ctx, const char *data, size_t size) {
+    int fd = (int)(intptr_t)ctx;
+    while (size > 0) {
+        // Large chunks are split so a single call never exceeds what every
+        // platform's `write` accepts.
+        size_t chunk = MIN(size, (size_t)1 << 30);
+#if defined(_WIN32) || defined(_WIN64)
+        long written = (long)_write(fd, data, (unsigned)chunk);
+#else
+        long written = (long)write(fd, data, (unsigned)chunk);
+#endif // defined(_WIN32) || defined(_WIN64)
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
     }
+    return true;
 }
 
-void file_write(str path, str contents) {
-    FILE* filepoint;
-    errno_t err;
+static bool sink_file_write(void *ctx, const char *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *)ctx) == size;
+}
+
+static bool sink_str_builder_write(void *ctx, const char *data, size_t size) {
+    str_builder_append((str_builder_t *)ctx, (str){(char *)data, size});
+    return true;
+}
+
+sink_t sink_fd(int fd) {
+    return (sink_t){sink_fd_write, (void *)(intptr_t)fd};
+}
+
+sink_t sink_file(FILE *file) {
+    return (sink_t){sink_file_write, file};
+}
+
+sink_t sink_str_builder(str_builder_t *sb) {
+    return (sink_t){sink_str_builder_write, sb};
+}
+
+sink_t sink_callback(bool (*write)(void *ctx, const char *data, size_t size), void *ctx) {
+    return (sink_t){write, ctx};
+}
 
-    if ((err = fopen_s(&filepoint, path.chars, "wb")) != 0) {
-        fatal("Failed to open file '" STR_ARG "' for writing.\n", STR_FMT(path));
-    } else {
-        fwrite(contents.chars, 1, contents.count, filepoint);
-        fclose(filepoint);
+bool sink_write(sink_t sink, str s) {
+    if (s.count == 0) {
+        return true;
     }
+    return sink.write(sink.ctx, s.chars, s.count);
 }
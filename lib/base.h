@@ -1,6 +1,11 @@
 #ifndef BASE_H
 #define BASE_H
 
+// Instrumentation of the containers below follows the library's switch.
+#if defined(LLVM_STATS) && !defined(BASE_STATS)
+#define BASE_STATS
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -89,6 +94,8 @@ typedef unsigned int uint;
 #define array_init(type) array_##type##_init
 #define array_new(type) array_##type##_new
 #define array_new_with_values(type) array_##type##_new_with_values
+#define array_init_arena(type) array_##type##_init_arena
+#define array_new_arena(type) array_##type##_new_arena
 #define array_push(type) array_##type##_push
 #define array_pop(type) array_##type##_pop
 #define array_free(type) array_##type##_free
@@ -97,9 +104,12 @@ typedef unsigned int uint;
         type *data; \
         size_t size; \
         size_t capacity; \
+        struct arena_t *arena; \
     } array(type); \
     void array_init(type)(array(type) *array); \
+    void array_init_arena(type)(array(type) *array, struct arena_t *arena); \
     array(type) array_new(type)(); \
+    array(type) array_new_arena(type)(struct arena_t *arena); \
     array(type) array_new_with_values(type)(size_t count, ...); \
     void array_push(type)(array(type) *array, type value); \
     type array_pop(type)(array(type) *array); \
@@ -110,12 +120,22 @@ typedef unsigned int uint;
         array->data = NULL; \
         array->size = 0; \
         array->capacity = 0; \
+        array->arena = NULL; \
+    } \
+    void array_init_arena(type)(array(type) *array, struct arena_t *arena) { \
+        array_init(type)(array); \
+        array->arena = arena; \
     } \
     array(type) array_new(type)() { \
         array(type) arr; \
         array_init(type)(&arr); \
         return arr; \
     } \
+    array(type) array_new_arena(type)(struct arena_t *arena) { \
+        array(type) arr; \
+        array_init_arena(type)(&arr, arena); \
+        return arr; \
+    } \
     array(type) array_new_with_values(type)(size_t count, ...) { \
         array(type) arr = array_new(type)(); \
         va_list args; \
@@ -128,8 +148,12 @@ typedef unsigned int uint;
     } \
     void array_push(type)(array(type) *array, type value) { \
         if (array->size == array->capacity) { \
-            array->capacity = MAX(array->capacity * 2, 1); \
-            array->data = realloc(array->data, array->capacity * sizeof(type)); \
+            size_t new_capacity = MAX(array->capacity * 2, 1); \
+            if (array->arena != NULL) \
+                array->data = arena_realloc(array->arena, array->data, array->capacity * sizeof(type), new_capacity * sizeof(type), _Alignof(type)); \
+            else \
+                array->data = realloc(array->data, new_capacity * sizeof(type)); \
+            array->capacity = new_capacity; \
         } \
         array->data[array->size++] = value; \
     } \
@@ -138,7 +162,8 @@ typedef unsigned int uint;
         return array->data[--array->size]; \
     } \
     void array_free(type)(array(type) *array) { \
-        free(array->data); \
+        if (array->arena == NULL) \
+            free(array->data); \
         array->data = NULL; \
         array->size = 0; \
         array->capacity = 0; \
@@ -189,29 +214,136 @@ typedef struct string_view {
 #define STR_ARG "%.*s"
 #define STR_FMT(str) (int)str.count, str.chars
 
-typedef struct arena_t {
-    char *ptr;
+// Chunked bump allocator. Memory handed out stays at the same address until
+// the arena is freed, cleared or rolled back past it.
+typedef struct arena_chunk_t {
+    struct arena_chunk_t *prev;
     size_t size;
     size_t capacity;
+    _Alignas(16) char data[];
+} arena_chunk_t;
+
+typedef struct arena_t {
+    arena_chunk_t *chunk; // newest chunk, the others hang off `prev`
+    size_t chunk_size;
 } arena_t;
 
+typedef struct arena_mark_t {
+    arena_chunk_t *chunk;
+    size_t size;
+} arena_mark_t;
+
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
 void arena_init(arena_t *a);
 void arena_free(arena_t *a);
 void *arena_alloc(arena_t *a, size_t size);
+void *arena_alloc_aligned(arena_t *a, size_t size, size_t align);
+// Grows `ptr` in place when it is the most recent allocation, otherwise
+// copies it into a fresh block. The old block is reclaimed with the arena.
+void *arena_realloc(arena_t *a, void *ptr, size_t old_size, size_t new_size, size_t align);
+// Returns NULL when `size` is 0, in which case `data` may be NULL too.
+void *arena_dup(arena_t *a, const void *data, size_t size, size_t align);
+str arena_strdup(arena_t *a, str s);
+arena_mark_t arena_mark(arena_t *a);
+void arena_rollback(arena_t *a, arena_mark_t mark);
 void arena_clear(arena_t *a);
 
 char str_at(str *s, size_t idx);
 bool str_eq(str s1, str s2);
-void str_append(str *s1, str s2);
-void str_append_cstr(str *s1, char *s2);
-void str_append_int(str *s1, int i);
-void str_append_float(str *s1, float f);
-void str_append_double(str *s1, double d);
-void str_append_char(str *s1, char c);
 str str_substring(str s, size_t start, size_t end);
 void str_free(str *s);
+u64 str_hash(str s);
+u64 hash_combine(u64 hash, u64 value);
+
+// Number formatting without going through printf. Each writes at most
+// `FORMAT_MAX_CHARS` bytes to `out`, without a terminator, and returns how
+// many it wrote.
+#define FORMAT_MAX_CHARS 32
+size_t format_u64(char *out, u64 value);
+size_t format_i64(char *out, i64 value);
+// What `%f` prints for `value`, but only when those six decimals are its
+// exact value; otherwise nothing is written and 0 is returned.
+size_t format_double_exact(char *out, double value);
+// The bits of `value` as `0x` and 16 upper-case hex digits, the exact form
+// LLVM uses for floating point constants.
+size_t format_double_hex(char *out, double value);
+
+// Growable output buffer. Capacity grows geometrically so appending N bytes
+// costs O(N) overall; `str_builder_take` hands the buffer over as a `str`
+// that must be released with `str_free`.
+typedef struct str_builder_t {
+    char *chars;
+    size_t count;
+    size_t capacity;
+#ifdef BASE_STATS
+    size_t appends; // calls that reserved space for more output
+    size_t growths; // reallocations of `chars`
+#endif
+} str_builder_t;
+
+void str_builder_init(str_builder_t *sb);
+void str_builder_free(str_builder_t *sb);
+void str_builder_clear(str_builder_t *sb);
+void str_builder_reserve(str_builder_t *sb, size_t additional);
+void str_builder_shrink(str_builder_t *sb);
+void str_builder_append(str_builder_t *sb, str s);
+void str_builder_append_cstr(str_builder_t *sb, char *s);
+void str_builder_append_int(str_builder_t *sb, int i);
+void str_builder_append_i64(str_builder_t *sb, i64 i);
+void str_builder_append_u64(str_builder_t *sb, u64 u);
+void str_builder_append_float(str_builder_t *sb, float f);
+void str_builder_append_double(str_builder_t *sb, double d);
+void str_builder_append_char(str_builder_t *sb, char c);
+str str_builder_view(str_builder_t *sb);
+str str_builder_take(str_builder_t *sb);
+
+// Destination for streamed output. `write` returns false when the bytes
+// could not be delivered; `ctx` is passed through untouched.
+typedef struct sink_t {
+    bool (*write)(void *ctx, const char *data, size_t size);
+    void *ctx;
+} sink_t;
+
+sink_t sink_fd(int fd);
+sink_t sink_file(FILE *file);
+sink_t sink_str_builder(str_builder_t *sb);
+sink_t sink_callback(bool (*write)(void *ctx, const char *data, size_t size), void *ctx);
+bool sink_write(sink_t sink, str s);
+
+// A read-only view of a whole file. Regular files are mapped rather than
+// read, so nothing is copied; anything else is read into the heap. Either
+// way the view must be released with `file_view_close`.
+typedef struct file_view_t {
+    str contents;
+    bool mapped;
+} file_view_t;
+
+bool file_view_open(file_view_t *view, str path);
+void file_view_close(file_view_t *view);
+
+// Streams into a temporary file next to `path` that is renamed over it on
+// commit, so `path` never holds a partial file. Output is gathered into
+// large blocks; pieces bigger than the buffer are written without a copy.
+typedef struct file_writer_t {
+    int fd;
+    char *buffer;
+    size_t buffered;
+    char *path;
+    char *temp_path;
+    bool failed;
+} file_writer_t;
+
+bool file_writer_open(file_writer_t *w, str path);
+sink_t file_writer_sink(file_writer_t *w);
+// Both release the writer. On failure the temporary file is removed and
+// `path` is left as it was.
+bool file_writer_commit(file_writer_t *w);
+void file_writer_abort(file_writer_t *w);
 
+// Owned, NUL-terminated copy of a file; exits on failure.
 str file_read_to_str(str path);
+// Replaces `path` atomically; exits on failure.
 void file_write(str path, str contents);
 
 #endif // BASE_H
\ No newline at end of file
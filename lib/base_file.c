@@ -0,0 +1,259 @@
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // mmap, posix_madvise, O_CLOEXEC
+#endif
+#include <lib/base.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <process.h>
+#include <windows.h>
+#define file_open _open
+#define file_close _close
+#define file_read _read
+#define file_sys_write _write
+#define file_getpid _getpid
+#define FILE_OPEN_FLAGS O_BINARY
+#else
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define file_open open
+#define file_close close
+#define file_read read
+#define file_sys_write write
+#define file_getpid getpid
+#define FILE_OPEN_FLAGS O_CLOEXEC
+#endif // defined(_WIN32) || defined(_WIN64)
+
+// Output is gathered into blocks of this size before it is written.
+#define FILE_WRITER_BUFFER_SIZE ((size_t)1 << 20)
+// No single read or write is asked for more than this, which every
+// platform accepts.
+#define FILE_MAX_CHUNK ((size_t)1 << 30)
+
+// `path` as a NUL-terminated heap copy, since a `str` need not end in one.
+static char *file_path_cstr(str path) {
+    char *cstr = malloc(path.count + 1);
+    memcpy(cstr, path.chars, path.count);
+    cstr[path.count] = '\0';
+    return cstr;
+}
+
+static bool file_write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        long written = (long)file_sys_write(fd, data, (unsigned)MIN(size, FILE_MAX_CHUNK));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+// Writes `a` and then `b`, in one call where the platform can gather.
+static bool file_write_pair(int fd, const char *a, size_t a_size, const char *b, size_t b_size) {
+#if defined(_WIN32) || defined(_WIN64)
+    return file_write_all(fd, a, a_size) && file_write_all(fd, b, b_size);
+#else
+    while (a_size > 0) {
+        struct iovec iov[2] = {{(void *)a, a_size}, {(void *)b, MIN(b_size, FILE_MAX_CHUNK)}};
+        ssize_t written = writev(fd, iov, 2);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        size_t from_a = MIN((size_t)written, a_size);
+        a += from_a;
+        a_size -= from_a;
+        b += (size_t)written - from_a;
+        b_size -= (size_t)written - from_a;
+    }
+    return file_write_all(fd, b, b_size);
+#endif // defined(_WIN32) || defined(_WIN64)
+}
+
+// Reads `fd` to the end into a heap block. Used where a file cannot be
+// mapped, such as pipes and files whose size is not known up front.
+static bool file_read_all(int fd, size_t size_hint, str *out) {
+    size_t capacity = MAX(size_hint, (size_t)4096), count = 0;
+    char *chars = malloc(capacity);
+    for (;;) {
+        if (count == capacity) {
+            capacity *= 2;
+            chars = realloc(chars, capacity);
+        }
+        long got = (long)file_read(fd, chars + count, (unsigned)MIN(capacity - count, FILE_MAX_CHUNK));
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            free(chars);
+            return false;
+        }
+        if (got == 0)
+            break;
+        count += (size_t)got;
+    }
+    *out = (str){chars, count};
+    return true;
+}
+
+bool file_view_open(file_view_t *view, str path) {
+    *view = (file_view_t){0};
+    char *cpath = file_path_cstr(path);
+    int fd = file_open(cpath, O_RDONLY | FILE_OPEN_FLAGS);
+    free(cpath);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        file_close(fd);
+        return false;
+    }
+    size_t size = (size_t)st.st_size;
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (S_ISREG(st.st_mode) && size > 0) {
+        void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            // Parsing walks the file once from the front.
+            posix_madvise(mapping, size, POSIX_MADV_SEQUENTIAL);
+            file_close(fd);
+            view->contents = (str){mapping, size};
+            view->mapped = true;
+            return true;
+        }
+    }
+#endif // !defined(_WIN32) && !defined(_WIN64)
+    bool ok = file_read_all(fd, size + 1, &view->contents);
+    file_close(fd);
+    return ok;
+}
+
+void file_view_close(file_view_t *view) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (view->mapped) {
+        munmap(view->contents.chars, view->contents.count);
+        *view = (file_view_t){0};
+        return;
+    }
+#endif // !defined(_WIN32) && !defined(_WIN64)
+    free(view->contents.chars);
+    *view = (file_view_t){0};
+}
+
+bool file_writer_open(file_writer_t *w, str path) {
+    static atomic_uint temp_counter;
+    *w = (file_writer_t){.fd = -1};
+    w->path = file_path_cstr(path);
+
+    // The temporary sits next to the target so the rename never crosses
+    // file systems. Its name only has to be unique among live writers.
+    str_builder_t temp;
+    str_builder_init(&temp);
+    for (int attempt = 0; attempt < 100 && w->fd < 0; attempt++) {
+        temp.count = 0;
+        str_builder_append(&temp, path);
+        str_builder_append_cstr(&temp, ".tmp.");
+        str_builder_append_u64(&temp, (u64)file_getpid());
+        str_builder_append_char(&temp, '.');
+        str_builder_append_u64(&temp, atomic_fetch_add(&temp_counter, 1));
+        str_builder_append_char(&temp, '\0');
+        w->fd = file_open(temp.chars, O_WRONLY | O_CREAT | O_EXCL | FILE_OPEN_FLAGS, 0666);
+        if (w->fd < 0 && errno != EEXIST)
+            break;
+    }
+    if (w->fd < 0) {
+        str_builder_free(&temp);
+        free(w->path);
+        *w = (file_writer_t){.fd = -1};
+        return false;
+    }
+    w->temp_path = str_builder_take(&temp).chars;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    // A file that is replaced keeps its permissions.
+    struct stat st;
+    if (stat(w->path, &st) == 0)
+        fchmod(w->fd, st.st_mode & 07777);
+#endif // !defined(_WIN32) && !defined(_WIN64)
+    w->buffer = malloc(FILE_WRITER_BUFFER_SIZE);
+    return true;
+}
+
+static bool file_writer_write(void *ctx, const char *data, size_t size) {
+    file_writer_t *w = ctx;
+    if (w->failed)
+        return false;
+    if (w->buffered + size <= FILE_WRITER_BUFFER_SIZE) {
+        memcpy(w->buffer + w->buffered, data, size);
+        w->buffered += size;
+        return true;
+    }
+    // Whatever does not fit goes out together with the buffer, so large
+    // pieces are never copied.
+    if (!file_write_pair(w->fd, w->buffer, w->buffered, data, size)) {
+        w->failed = true;
+        return false;
+    }
+    w->buffered = 0;
+    return true;
+}
+
+sink_t file_writer_sink(file_writer_t *w) {
+    return (sink_t){file_writer_write, w};
+}
+
+static void file_writer_release(file_writer_t *w) {
+    free(w->buffer);
+    free(w->path);
+    free(w->temp_path);
+    *w = (file_writer_t){.fd = -1};
+}
+
+bool file_writer_commit(file_writer_t *w) {
+    bool ok = !w->failed && file_write_all(w->fd, w->buffer, w->buffered);
+    ok = file_close(w->fd) == 0 && ok;
+#if defined(_WIN32) || defined(_WIN64)
+    ok = ok && MoveFileExA(w->temp_path, w->path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(w->temp_path, w->path) == 0;
+#endif // defined(_WIN32) || defined(_WIN64)
+    if (!ok)
+        remove(w->temp_path);
+    file_writer_release(w);
+    return ok;
+}
+
+void file_writer_abort(file_writer_t *w) {
+    file_close(w->fd);
+    remove(w->temp_path);
+    file_writer_release(w);
+}
+
+str file_read_to_str(str path) {
+    file_view_t view;
+    if (!file_view_open(&view, path))
+        fatal("Failed to open file '" STR_ARG "' for reading.\n", STR_FMT(path));
+    char *chars = malloc(view.contents.count + 1);
+    memcpy(chars, view.contents.chars, view.contents.count);
+    chars[view.contents.count] = '\0';
+    str contents = {chars, view.contents.count};
+    file_view_close(&view);
+    return contents;
+}
+
+void file_write(str path, str contents) {
+    file_writer_t w;
+    if (!file_writer_open(&w, path))
+        fatal("Failed to open file '" STR_ARG "' for writing.\n", STR_FMT(path));
+    if (!sink_write(file_writer_sink(&w), contents) || !file_writer_commit(&w))
+        fatal("Failed to write file '" STR_ARG "'.\n", STR_FMT(path));
+}
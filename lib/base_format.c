@@ -0,0 +1,92 @@
+#include <lib/base.h>
+
+// Two digits at a time, so a 64-bit number takes at most 10 divisions.
+static const char format_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static size_t format_digit_count(u64 value) {
+    size_t count = 1;
+    for (;;) {
+        if (value < 10) return count;
+        if (value < 100) return count + 1;
+        if (value < 1000) return count + 2;
+        if (value < 10000) return count + 3;
+        value /= 10000;
+        count += 4;
+    }
+}
+
+size_t format_u64(char *out, u64 value) {
+    size_t count = format_digit_count(value);
+    char *at = out + count;
+    while (value >= 100) {
+        size_t pair = (size_t)(value % 100) * 2;
+        value /= 100;
+        *--at = format_digit_pairs[pair + 1];
+        *--at = format_digit_pairs[pair];
+    }
+    if (value >= 10) {
+        *--at = format_digit_pairs[value * 2 + 1];
+        *--at = format_digit_pairs[value * 2];
+    } else {
+        *--at = (char)('0' + value);
+    }
+    return count;
+}
+
+size_t format_i64(char *out, i64 value) {
+    if (value >= 0)
+        return format_u64(out, (u64)value);
+    *out = '-';
+    // Negated as unsigned so that the minimum does not overflow.
+    return 1 + format_u64(out + 1, 0 - (u64)value);
+}
+
+size_t format_double_exact(char *out, double value) {
+    // Below 1e9 a double is within 2^-24 of its 6-decimal rounding, so the
+    // digits can only be exact if the scaled value divides back to it.
+    double magnitude = value < 0 ? -value : value;
+    if (!(magnitude < 1e9))
+        return 0;
+    u64 scaled = (u64)(magnitude * 1e6 + 0.5);
+    if ((double)scaled / 1e6 != magnitude)
+        return 0;
+
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    size_t count = 0;
+    if (bits >> 63)
+        out[count++] = '-';
+    count += format_u64(out + count, scaled / 1000000);
+    out[count++] = '.';
+    u64 fraction = scaled % 1000000;
+    count += 6;
+    char *at = out + count;
+    for (int i = 0; i < 3; i++) {
+        size_t pair = (size_t)(fraction % 100) * 2;
+        fraction /= 100;
+        *--at = format_digit_pairs[pair + 1];
+        *--at = format_digit_pairs[pair];
+    }
+    return count;
+}
+
+size_t format_double_hex(char *out, double value) {
+    static const char digits[] = "0123456789ABCDEF";
+    u64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    out[0] = '0';
+    out[1] = 'x';
+    for (size_t i = 0; i < 16; i++)
+        out[2 + i] = digits[(bits >> (60 - 4 * i)) & 15];
+    return 18;
+}
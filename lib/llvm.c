@@ -1,336 +1,689 @@
 #define BASE_IMPL
 #include "llvm.h"
 
+// What emitting a compact body needs besides the instructions themselves.
+typedef struct llvm_code_body_t {
+    llvm_code_t *code;
+    u32 arg_count;
+    u32 *results; // see `llvm_code_results`
+} llvm_code_body_t;
+
+static void llvm_generate_code_instruction(llvm_generator_t *gen, str_builder_t *out, llvm_code_body_t *body, llvm_code_instruction_t instruction);
+
 void llvm_init(llvm_generator_t *gen) {
-    array_init(llvm_type_declaration_t)(&gen->type_declarations);
-    array_init(llvm_global_t)(&gen->globals);
-    array_init(llvm_function_t)(&gen->functions);
+    arena_init(&gen->arena);
+    llvm_type_context_init(&gen->types, &gen->arena);
+    llvm_name_table_init(&gen->names);
+    array_init_arena(llvm_type_declaration_t)(&gen->type_declarations, &gen->arena);
+    array_init_arena(llvm_global_t)(&gen->globals, &gen->arena);
+    array_init_arena(llvm_function_t)(&gen->functions, &gen->arena);
+    gen->scratch = NULL;
+    gen->revision = 0;
+    memset(&gen->cache, 0, sizeof(gen->cache));
+    memset(&gen->constants, 0, sizeof(gen->constants));
+#ifdef LLVM_STATS
+    memset(&gen->stats, 0, sizeof(gen->stats));
+#endif
 }
 
 void llvm_free(llvm_generator_t *gen) {
+    llvm_type_context_free(&gen->types);
+    llvm_name_table_free(&gen->names);
     array_free(llvm_type_declaration_t)(&gen->type_declarations);
     array_free(llvm_global_t)(&gen->globals);
     array_free(llvm_function_t)(&gen->functions);
+    if (gen->scratch != NULL) {
+        llvm_builder_free(gen->scratch);
+        free(gen->scratch);
+        gen->scratch = NULL;
+    }
+    llvm_cache_enable(gen, false);
+    llvm_constant_pool_free(&gen->constants);
+    llvm_stats_reset(gen);
+    arena_free(&gen->arena);
 }
 
 void llvm_add_type_declaration(llvm_generator_t *gen, llvm_type_declaration_t type_declaration) {
+    type_declaration.revision = ++gen->revision;
     array_push(llvm_type_declaration_t)(&gen->type_declarations, type_declaration);
 }
 
-void llvm_add_global(llvm_generator_t *gen, llvm_global_t global) {
+// Names are kept in their interned form, so that equal names share a copy.
+bool llvm_add_global(llvm_generator_t *gen, llvm_global_t global) {
+    u32 name = llvm_name_intern(gen, global.name);
+    if (llvm_symbol_bind(gen, name, LLVM_SYMBOL_GLOBAL(gen->globals.size)) != 0)
+        return false;
+    global.name = llvm_name_text(gen, name);
+    global.revision = ++gen->revision;
     array_push(llvm_global_t)(&gen->globals, global);
+    return true;
 }
 
-void llvm_add_function(llvm_generator_t *gen, llvm_function_t function) {
-    array_push(llvm_function_t)(&gen->functions, function);
-}
-
-str llvm_generate(llvm_generator_t *gen) {
-    str out = STR("");
-    array_foreach(llvm_type_declaration_t, gen->type_declarations, {
-        llvm_type_declaration_t type_declaration = it;
-        str_append_cstr(&out, "%");
-        str_append(&out, type_declaration.name);
-        str_append_cstr(&out, " = type ");
-        str_append(&out, llvm_generate_type(gen, type_declaration.type));
-        str_append_cstr(&out, "\n");
-    });
-    array_foreach(llvm_global_t, gen->globals, {
-        llvm_global_t global = it;
-        str_append_cstr(&out, "@");
-        str_append(&out, global.name);
-        str_append_cstr(&out, " = ");
-        str_append(&out, llvm_generate_linkage_type(global.linkage));
-        if (global.visibility) {
-            switch (global.visibility) {
-                case LLVM_VISIBILITY_DEFAULT: break;
-                case LLVM_VISIBILITY_HIDDEN: str_append_cstr(&out, "hidden "); break;
-                case LLVM_VISIBILITY_PROTECTED: str_append_cstr(&out, "protected "); break;
+// Replays a body built from linked nodes through the scratch builder. The
+// body names its locals itself, so those numbers are mapped to handles.
+static llvm_code_t *llvm_convert_body(llvm_generator_t *gen, llvm_function_t *function) {
+    if (gen->scratch == NULL) {
+        gen->scratch = malloc(sizeof(llvm_builder_t));
+        llvm_builder_init(gen->scratch, gen);
+    }
+    llvm_builder_t *builder = gen->scratch;
+    llvm_builder_begin(builder, *function);
+    builder->maps_locals = true;
+    for (size_t i = 0; i < function->body->basic_blocks.size; i++) {
+        llvm_basic_block_t block = function->body->basic_blocks.data[i];
+        llvm_builder_position(builder, llvm_builder_create_block(builder, block.name));
+        for (size_t j = 0; j < block.instructions.size; j++) {
+            llvm_basic_block_instruction_t slot = block.instructions.data[j];
+            if (slot.local != NULL) {
+                if (slot.local->value.instruction == NULL)
+                    fatal("local %%%u in '" STR_ARG "' is not an instruction.", slot.local->idx, STR_FMT(function->name));
+                llvm_builder_name_local(builder, slot.local->idx, llvm_builder_append(builder, *slot.local->value.instruction));
             }
-        }
-        if (global.dll_storage_class) {
-            switch (global.dll_storage_class) {
-                case LLVM_DLL_STORAGE_CLASS_DLLIMPORT: str_append_cstr(&out, "dllimport "); break;
-                case LLVM_DLL_STORAGE_CLASS_DLLEXPORT: str_append_cstr(&out, "dllexport "); break;
-                case LLVM_DLL_STORAGE_CLASS_DEFAULT: break;
+            if (slot.instruction != NULL) {
+                llvm_builder_append(builder, *slot.instruction);
+                llvm_builder_discard(builder);
             }
         }
-        if (global.address_space) {
-            str_append_cstr(&out, "addrspace(");
-            str_append_int(&out, global.address_space);
-            str_append_cstr(&out, ") ");
+    }
+    builder->maps_locals = false;
+    return llvm_builder_finish_code(builder);
+}
+
+bool llvm_add_function(llvm_generator_t *gen, llvm_function_t function) {
+    u32 name = llvm_name_intern(gen, function.name);
+    if (llvm_symbol_bind(gen, name, LLVM_SYMBOL_FUNCTION(gen->functions.size)) != 0)
+        return false;
+    function.name = llvm_name_text(gen, name);
+    if (function.code == NULL && function.body != NULL && !function.is_native)
+        function.code = llvm_convert_body(gen, &function);
+    function.revision = ++gen->revision;
+    array_push(llvm_function_t)(&gen->functions, function);
+    return true;
+}
+
+bool llvm_replace_function(llvm_generator_t *gen, llvm_function_t function) {
+    llvm_function_t *existing = llvm_find_function(gen, function.name);
+    if (existing == NULL)
+        return false;
+    if (function.code == NULL && function.body != NULL && !function.is_native)
+        function.code = llvm_convert_body(gen, &function);
+    function.name = existing->name;
+    function.revision = ++gen->revision;
+    *existing = function;
+    return true;
+}
+
+static llvm_global_t *llvm_global_of(llvm_generator_t *gen, uint ref) {
+    if (ref == 0 || LLVM_SYMBOL_IS_FUNCTION(ref))
+        return NULL;
+    return &gen->globals.data[LLVM_SYMBOL_INDEX(ref)];
+}
+
+static llvm_function_t *llvm_function_of(llvm_generator_t *gen, uint ref) {
+    if (ref == 0 || !LLVM_SYMBOL_IS_FUNCTION(ref))
+        return NULL;
+    return &gen->functions.data[LLVM_SYMBOL_INDEX(ref)];
+}
+
+llvm_global_t *llvm_find_global(llvm_generator_t *gen, str name) {
+    return llvm_global_of(gen, llvm_symbol_find(gen, name));
+}
+
+llvm_function_t *llvm_find_function(llvm_generator_t *gen, str name) {
+    return llvm_function_of(gen, llvm_symbol_find(gen, name));
+}
+
+llvm_global_t *llvm_find_global_id(llvm_generator_t *gen, u32 name) {
+    return llvm_global_of(gen, llvm_symbol_of(gen, name));
+}
+
+llvm_function_t *llvm_find_function_id(llvm_generator_t *gen, u32 name) {
+    return llvm_function_of(gen, llvm_symbol_of(gen, name));
+}
+
+// Shared by the in-memory and streaming entry points: with a NULL sink the
+// builder simply accumulates the whole module.
+static bool llvm_flush(llvm_generator_t *gen, str_builder_t *out, sink_t *sink, bool force) {
+    if (sink == NULL) {
+        if (force)
+            LLVM_STATS_ADD(gen, bytes_emitted, out->count);
+        return true;
+    }
+    if (!force && out->count < LLVM_SINK_CHUNK_SIZE)
+        return true;
+    LLVM_STATS_ADD(gen, bytes_emitted, out->count);
+    bool ok = sink_write(*sink, (str){out->chars, out->count});
+    str_builder_clear(out);
+    return ok;
+}
+
+static bool llvm_generate_module(llvm_generator_t *gen, str_builder_t *out, sink_t *sink) {
+    LLVM_STATS_ADD(gen, generations, 1);
+    llvm_stats_reserve_functions(gen);
+    llvm_cache_prepare(gen);
+    llvm_cache_t *cache = &gen->cache;
+    LLVM_STATS_START(total_timer, out);
+    LLVM_STATS_START(types_timer, out);
+    for (size_t i = 0; i < gen->type_declarations.size; i++) {
+        llvm_type_declaration_t *type_declaration = &gen->type_declarations.data[i];
+        if (!llvm_cache_fetch(gen, &cache->type_declarations, i, type_declaration->revision, out)) {
+            size_t start = out->count;
+            llvm_generate_type_declaration(gen, out, *type_declaration);
+            llvm_cache_store(gen, &cache->type_declarations, i, type_declaration->revision, (str){out->chars + start, out->count - start});
         }
-        if (global.is_constant) str_append_cstr(&out, "constant ");
-        else if (global.is_global) str_append_cstr(&out, "global ");
-        if (global.type) {
-            str_append(&out, llvm_generate_type(gen, *global.type));
-            str_append_cstr(&out, " ");
-        } else {
-            str_append_cstr(&out, "void ");
+        if (!llvm_flush(gen, out, sink, false)) return false;
+    }
+    LLVM_STATS_PHASE(gen, type_declarations_ns, types_timer);
+    LLVM_STATS_START(globals_timer, out);
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        if (!llvm_cache_fetch(gen, &cache->globals, i, global->revision, out)) {
+            size_t start = out->count;
+            llvm_generate_global(gen, out, *global);
+            llvm_cache_store(gen, &cache->globals, i, global->revision, (str){out->chars + start, out->count - start});
         }
-        str_append(&out, llvm_generate_value(gen, global.value));
-        if (global.alignment) {
-            str_append_cstr(&out, ", align ");
-            str_append_int(&out, global.alignment);
+        if (!llvm_flush(gen, out, sink, false)) return false;
+    }
+    LLVM_STATS_PHASE(gen, globals_ns, globals_timer);
+    LLVM_STATS_START(functions_timer, out);
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        LLVM_STATS_START(function_timer, out);
+        if (!llvm_cache_fetch(gen, &cache->functions, i, function->revision, out)) {
+            size_t start = out->count;
+            llvm_generate_function(gen, out, *function);
+            llvm_cache_store(gen, &cache->functions, i, function->revision, (str){out->chars + start, out->count - start});
         }
-        str_append_cstr(&out, "\n");
-    });
-    array_foreach(llvm_function_t, gen->functions, {
-        llvm_function_t function = it;
-        if (function.is_native) str_append_cstr(&out, "declare ");
-        else str_append_cstr(&out, "define ");
-        str_append(&out, llvm_generate_linkage_type(function.linkage));
-        if (function.visibility) {
-            switch (function.visibility) {
-                case LLVM_VISIBILITY_DEFAULT: break;
-                case LLVM_VISIBILITY_HIDDEN: str_append_cstr(&out, "hidden "); break;
-                case LLVM_VISIBILITY_PROTECTED: str_append_cstr(&out, "protected "); break;
+        LLVM_STATS_FUNCTION(gen, i, function_timer, out);
+        if (!llvm_flush(gen, out, sink, false)) return false;
+    }
+    LLVM_STATS_PHASE(gen, functions_ns, functions_timer);
+    llvm_cache_compact(gen);
+    bool ok = llvm_flush(gen, out, sink, true);
+    LLVM_STATS_PHASE(gen, total_ns, total_timer);
+    LLVM_STATS_ADD(gen, appends, out->appends);
+    LLVM_STATS_ADD(gen, buffer_growths, out->growths);
+    return ok;
+}
+
+str llvm_generate(llvm_generator_t *gen) {
+    str_builder_t out;
+    str_builder_init(&out);
+    llvm_generate_module(gen, &out, NULL);
+    return str_builder_take(&out);
+}
+
+bool llvm_generate_to_sink(llvm_generator_t *gen, sink_t sink) {
+    str_builder_t out;
+    str_builder_init(&out);
+    str_builder_reserve(&out, LLVM_SINK_CHUNK_SIZE);
+    bool ok = llvm_generate_module(gen, &out, &sink);
+    str_builder_free(&out);
+    return ok;
+}
+
+void llvm_generate_type_declaration(llvm_generator_t *gen, str_builder_t *out, llvm_type_declaration_t type_declaration) {
+    str_builder_append_char(out, '%');
+    str_builder_append(out, type_declaration.name);
+    str_builder_append_cstr(out, " = type ");
+    llvm_generate_type(gen, out, type_declaration.type);
+    str_builder_append_char(out, '\n');
+}
+
+void llvm_generate_global(llvm_generator_t *gen, str_builder_t *out, llvm_global_t global) {
+    str_builder_append_char(out, '@');
+    str_builder_append(out, global.name);
+    str_builder_append_cstr(out, " = ");
+    llvm_generate_linkage_type(out, global.linkage);
+    llvm_generate_visibility(out, global.visibility);
+    llvm_generate_dll_storage_class(out, global.dll_storage_class);
+    if (global.is_unnamed_addr) str_builder_append_cstr(out, "unnamed_addr ");
+    if (global.address_space) {
+        str_builder_append_cstr(out, "addrspace(");
+        str_builder_append_int(out, global.address_space);
+        str_builder_append_cstr(out, ") ");
+    }
+    if (global.is_constant) str_builder_append_cstr(out, "constant ");
+    else if (global.is_global) str_builder_append_cstr(out, "global ");
+    if (global.type) {
+        llvm_generate_type(gen, out, *global.type);
+        str_builder_append_char(out, ' ');
+    } else {
+        str_builder_append_cstr(out, "void ");
+    }
+    llvm_generate_value(gen, out, global.value);
+    if (global.alignment) {
+        str_builder_append_cstr(out, ", align ");
+        str_builder_append_int(out, global.alignment);
+    }
+    str_builder_append_char(out, '\n');
+}
+
+void llvm_generate_function(llvm_generator_t *gen, str_builder_t *out, llvm_function_t function) {
+    if (function.is_native) str_builder_append_cstr(out, "declare ");
+    else str_builder_append_cstr(out, "define ");
+    llvm_generate_linkage_type(out, function.linkage);
+    llvm_generate_visibility(out, function.visibility);
+    llvm_generate_dll_storage_class(out, function.dll_storage_class);
+    llvm_generate_call_convention(out, function.call_convention);
+    llvm_generate_type(gen, out, function.return_type);
+    str_builder_append_cstr(out, " @");
+    str_builder_append(out, function.name);
+    str_builder_append_char(out, '(');
+    for (size_t i = 0; i < function.args.size; i++) {
+        llvm_generate_type(gen, out, function.args.data[i]);
+        if (i < function.args.size - 1)
+            str_builder_append_cstr(out, ", ");
+    }
+    if (function.is_vararg)
+        str_builder_append_cstr(out, ", ...");
+    str_builder_append_cstr(out, ") ");
+    if (function.address_space) {
+        str_builder_append_cstr(out, "addrspace(");
+        str_builder_append_int(out, function.address_space);
+        str_builder_append_cstr(out, ") ");
+    }
+    if (function.alignment) {
+        str_builder_append_cstr(out, "align ");
+        str_builder_append_int(out, function.alignment);
+        str_builder_append_char(out, ' ');
+    }
+    if (function.is_native) {
+        str_builder_append_char(out, '\n');
+        return;
+    }
+
+    str_builder_append_cstr(out, "{\n");
+    if (function.code == NULL)
+        fatal("function body is null.");
+    llvm_code_t *code = function.code;
+    u32 scratch[256];
+    llvm_code_body_t body = {code, (u32)function.args.size, llvm_code_results(code, scratch, 256)};
+    for (u32 i = 0; i < code->block_count; i++) {
+        llvm_code_block_t block = code->blocks[i];
+        str_builder_append(out, block.name);
+        str_builder_append_cstr(out, ":\n");
+        for (u32 j = block.first; j < block.first + block.count; j++) {
+            str_builder_append_cstr(out, "  ");
+            if (body.results[j] != (u32)-1) {
+                str_builder_append_char(out, '%');
+                str_builder_append_int(out, (int)(body.arg_count + body.results[j]));
+                str_builder_append_cstr(out, " = ");
             }
+            llvm_generate_code_instruction(gen, out, &body, code->instructions[j]);
+            str_builder_append_char(out, '\n');
         }
-        if (function.dll_storage_class) {
-            switch (function.dll_storage_class) {
-                case LLVM_DLL_STORAGE_CLASS_DLLIMPORT: str_append_cstr(&out, "dllimport "); break;
-                case LLVM_DLL_STORAGE_CLASS_DLLEXPORT: str_append_cstr(&out, "dllexport "); break;
-                case LLVM_DLL_STORAGE_CLASS_DEFAULT: break;
+    }
+    if (body.results != scratch)
+        free(body.results);
+    str_builder_append_cstr(out, "}\n");
+}
+
+static void llvm_generate_ref(llvm_generator_t *gen, str_builder_t *out, llvm_code_body_t *body, llvm_ref_t ref) {
+    switch (LLVM_REF_KIND(ref)) {
+        case LLVM_REF_LOCAL: {
+            u32 index = LLVM_REF_PAYLOAD(ref);
+            str_builder_append_char(out, '%');
+            str_builder_append_int(out, (int)(index < body->arg_count ? index : body->arg_count + body->results[index - body->arg_count]));
+        } break;
+        case LLVM_REF_INT: {
+            str_builder_append_int(out, LLVM_REF_INT_VALUE(ref));
+        } break;
+        case LLVM_REF_UNDEFINED: {
+            // Nothing defines this name, so `llc` rejects it rather than
+            // reading some other value.
+            str_builder_append_cstr(out, "%undefined.");
+            str_builder_append_int(out, (int)LLVM_REF_PAYLOAD(ref));
+        } break;
+        default: {
+            llvm_generate_value(gen, out, llvm_code_value(body->code, ref));
+        } break;
+    }
+}
+
+static void llvm_generate_type_id(llvm_generator_t *gen, str_builder_t *out, u32 id) {
+    LLVM_STATS_ADD(gen, type_renderings, 1);
+    str_builder_append(out, llvm_type_id_text(gen, id));
+}
+
+static void llvm_generate_label(str_builder_t *out, llvm_code_body_t *body, u32 block) {
+    str_builder_append_char(out, '%');
+    if (block < body->code->block_count) {
+        str_builder_append(out, body->code->blocks[block].name);
+    } else {
+        str_builder_append_cstr(out, "undefined.block.");
+        str_builder_append_int(out, (int)block);
+    }
+}
+
+static void llvm_generate_code_instruction(llvm_generator_t *gen, str_builder_t *out, llvm_code_body_t *body, llvm_code_instruction_t instruction) {
+    u32 *operands = &body->code->operands[instruction.operands];
+    switch (instruction.opcode) {
+        case LLVM_INSTR_CALL: {
+            u32 name = body->code->symbols[instruction.symbol];
+            u32 count = instruction.operand_count / 2;
+            str_builder_append_cstr(out, "call ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, " (");
+            llvm_function_t *callee = llvm_find_function_id(gen, name);
+            for (u32 i = 0; i < count; i++) {
+                llvm_generate_type_id(gen, out, operands[count + i]);
+                if (i < count - 1)
+                    str_builder_append_cstr(out, ", ");
             }
-        }
-        if (function.call_convention) {
-            switch (function.call_convention) {
-                case LLVM_CALL_CONVENTION_C: str_append_cstr(&out, "cc "); break;
-                case LLVM_CALL_CONVENTION_FAST: str_append_cstr(&out, "fastcc "); break;
-                case LLVM_CALL_CONVENTION_COLD: str_append_cstr(&out, "coldcc "); break;
-                case LLVM_CALL_CONVENTION_GHC: str_append_cstr(&out, "cc 10 "); break;
+            if (callee != NULL && callee->is_vararg)
+                str_builder_append_cstr(out, ", ...");
+            str_builder_append_cstr(out, ") @");
+            str_builder_append(out, llvm_name_text(gen, name));
+            str_builder_append_char(out, '(');
+            for (u32 i = 0; i < count; i++) {
+                llvm_generate_type_id(gen, out, operands[count + i]);
+                str_builder_append_char(out, ' ');
+                llvm_generate_ref(gen, out, body, operands[i]);
+                if (i < count - 1)
+                    str_builder_append_cstr(out, ", ");
             }
-        }
-        str_append(&out, llvm_generate_type(gen, function.return_type));
-        str_append_cstr(&out, " @");
-        str_append(&out, function.name);
-        str_append_cstr(&out, "(");
-        for (size_t i = 0; i < function.args.size; i++) {
-            llvm_type_t arg = function.args.data[i];
-            str_append(&out, llvm_generate_type(gen, arg));
-            if (i < function.args.size - 1)
-                str_append_cstr(&out, ", ");
-        }
-        if (function.is_vararg)
-            str_append_cstr(&out, ", ...");
-        str_append_cstr(&out, ") ");
-        if (function.address_space) {
-            str_append_cstr(&out, "addrspace(");
-            str_append_int(&out, function.address_space);
-            str_append_cstr(&out, ") ");
-        }
-        if (function.alignment) {
-            str_append_cstr(&out, "align ");
-            str_append_int(&out, function.alignment);
-            str_append_cstr(&out, " ");
-        }
-        if (function.is_native) {
-            str_append_cstr(&out, "\n");
-        } else {
-            str_append_cstr(&out, "{\n");
-            if (function.body == NULL)
-                fatal("function body is null.");
-            for (size_t i = 0; i < function.body->basic_blocks.size; i++) {
-                llvm_basic_block_t basic_block = function.body->basic_blocks.data[i];
-                str_append(&out, basic_block.name);
-                str_append_cstr(&out, ":\n");
-                for (size_t j = 0; j < basic_block.instructions.size; j++) {
-                    llvm_basic_block_instruction_t instruction = basic_block.instructions.data[j];
-                    str_append_cstr(&out, "  ");
-                    if (instruction.local != NULL)
-                        str_append(&out, llvm_generate_local(gen, *instruction.local));
-                    if (instruction.instruction != NULL)
-                        str_append(&out, llvm_generate_instruction(gen, *instruction.instruction));
-                    str_append_cstr(&out, "\n");
-                }
+            str_builder_append_char(out, ')');
+        } break;
+        case LLVM_INSTR_RETURN: {
+            str_builder_append_cstr(out, "ret ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_char(out, ' ');
+            llvm_generate_ref(gen, out, body, operands[0]);
+        } break;
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            bool is_inbounds = instruction.opcode == LLVM_INSTR_GETELEMENTPTR_INBOUNDS;
+            str_builder_append_cstr(out, is_inbounds ? "getelementptr inbounds (" : "getelementptr ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, "* @");
+            str_builder_append(out, llvm_name_text(gen, body->code->symbols[instruction.symbol]));
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_ref(gen, out, body, operands[0]);
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_ref(gen, out, body, operands[1]);
+            if (is_inbounds)
+                str_builder_append_char(out, ')');
+        } break;
+        case LLVM_INSTR_ALLOCA: {
+            str_builder_append_cstr(out, "alloca ");
+            llvm_generate_type_id(gen, out, instruction.type);
+        } break;
+        case LLVM_INSTR_LOAD: {
+            str_builder_append_cstr(out, "load ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, "* ");
+            llvm_generate_ref(gen, out, body, operands[0]);
+        } break;
+        case LLVM_INSTR_STORE: {
+            str_builder_append_cstr(out, "store ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_char(out, ' ');
+            llvm_generate_ref(gen, out, body, operands[0]);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            str_builder_append_cstr(out, "* ");
+            llvm_generate_ref(gen, out, body, operands[1]);
+        } break;
+        case LLVM_INSTR_BR: {
+            str_builder_append_cstr(out, "br label ");
+            llvm_generate_label(out, body, operands[0]);
+        } break;
+        case LLVM_INSTR_COND_BR: {
+            str_builder_append_cstr(out, "br i1 ");
+            llvm_generate_ref(gen, out, body, operands[0]);
+            str_builder_append_cstr(out, ", label ");
+            llvm_generate_label(out, body, operands[1]);
+            str_builder_append_cstr(out, ", label ");
+            llvm_generate_label(out, body, operands[2]);
+        } break;
+        case LLVM_INSTR_PHI: {
+            u32 count = instruction.operand_count / 2;
+            str_builder_append_cstr(out, "phi ");
+            llvm_generate_type_id(gen, out, instruction.type);
+            for (u32 i = 0; i < count; i++) {
+                str_builder_append_cstr(out, i == 0 ? " [ " : ", [ ");
+                llvm_generate_ref(gen, out, body, operands[i]);
+                str_builder_append_cstr(out, ", ");
+                llvm_generate_label(out, body, operands[count + i]);
+                str_builder_append_cstr(out, " ]");
             }
-            str_append_cstr(&out, "}\n");
-        }
-    });
-    return out;
+        } break;
+    }
 }
 
-str llvm_generate_local(llvm_generator_t *gen, llvm_local_t local) {
-    str out = STR("");
-    str_append_cstr(&out, "%");
-    str_append_int(&out, local.idx);
-    str_append_cstr(&out, " = ");
+void llvm_generate_local(llvm_generator_t *gen, str_builder_t *out, llvm_local_t local) {
+    str_builder_append_char(out, '%');
+    str_builder_append_int(out, local.idx);
+    str_builder_append_cstr(out, " = ");
     if (local.value.value != NULL) {
-        str_append(&out, llvm_generate_value(gen, *local.value.value));
+        llvm_generate_value(gen, out, *local.value.value);
     } else if (local.value.instruction != NULL) {
-        str_append(&out, llvm_generate_instruction(gen, *local.value.instruction));
+        llvm_generate_instruction(gen, out, *local.value.instruction);
     }
-    return out;
-}
-
-str llvm_generate_type(llvm_generator_t *gen, llvm_type_t type) {
-    str out = STR("");
-    switch (type.type) {
-        case LLVM_TYPE_INT_: {
-            str_append_cstr(&out, "i");
-            str_append_int(&out, type.int_);
-        } break;
-        case LLVM_TYPE_FLOAT_: {
-            if (type.float_ == 32)
-                str_append_cstr(&out, "float");
-            else if (type.float_ == 64)
-                str_append_cstr(&out, "double");
-            else
-                fatal("invalid float size.");
-        } break;
-        case LLVM_TYPE_POINTER_: {
-            str_append(&out, llvm_generate_type(gen, *type.pointer.inner));
-            str_append_cstr(&out, "*");
-        } break;
-        case LLVM_TYPE_ARRAY_: {
-            str_append_cstr(&out, "[");
-            str_append_int(&out, type.array.size);
-            str_append_cstr(&out, " x ");
-            str_append(&out, llvm_generate_type(gen, *type.array.inner));
-            str_append_cstr(&out, "]");
-        } break;
-        case LLVM_TYPE_VECTOR_: {
-            str_append_cstr(&out, "<");
-            str_append_int(&out, type.vector.size);
-            str_append_cstr(&out, " x ");
-            str_append(&out, llvm_generate_type(gen, *type.vector.inner));
-            str_append_cstr(&out, ">");
-        } break;
-        case LLVM_TYPE_STRUCTURE_: {
-            if (type.structure.is_packed) str_append_cstr(&out, "<");
-            str_append_cstr(&out, "{");
-            for (size_t i = 0; i < type.structure.members.size; i++) {
-                llvm_type_ptr_t member = type.structure.members.data[i];
-                str_append(&out, llvm_generate_type(gen, *member));
-                if (i < type.structure.members.size - 1)
-                    str_append_cstr(&out, ", ");
-            }
-            str_append_cstr(&out, "}");
-            if (type.structure.is_packed) str_append_cstr(&out, ">");
-        } break;
-    }
-    return out;
 }
 
-str llvm_generate_value(llvm_generator_t *gen, llvm_value_t value) {
-    str out = STR("");
+void llvm_generate_type(llvm_generator_t *gen, str_builder_t *out, llvm_type_t type) {
+    LLVM_STATS_ADD(gen, type_renderings, 1);
+    if (gen->types.is_frozen)
+        llvm_type_write(gen, out, type);
+    else
+        str_builder_append(out, llvm_type_text(gen, type));
+}
+
+void llvm_generate_value(llvm_generator_t *gen, str_builder_t *out, llvm_value_t value) {
     switch (value.type) {
         case LLVM_VALUE_STRING_: {
-            str_append_cstr(&out, "\"");
-            str_append(&out, value.string_);
-            str_append_cstr(&out, "\"");
+            str_builder_append_char(out, '"');
+            llvm_generate_escaped_text(out, value.string_);
+            str_builder_append_char(out, '"');
         } break;
         case LLVM_VALUE_CSTRING_: {
-            str_append_cstr(&out, "c\"");
-            str_append(&out, value.cstring_);
-            str_append_cstr(&out, "\\00\"");
+            str_builder_append_cstr(out, "c\"");
+            llvm_generate_escaped_text(out, value.cstring_);
+            str_builder_append_cstr(out, "\\00\"");
+        } break;
+        case LLVM_VALUE_BYTES_: {
+            str_builder_append_cstr(out, "c\"");
+            llvm_generate_escaped_text(out, value.bytes_);
+            str_builder_append_char(out, '"');
         } break;
         case LLVM_VALUE_INT_: {
-            str_append_int(&out, value.int_);
+            str_builder_append_int(out, value.int_);
         } break;
         case LLVM_VALUE_FLOAT_: {
-            str_append_float(&out, value.float_);
+            llvm_generate_float(out, value.float_);
         } break;
         case LLVM_VALUE_DOUBLE_: {
-            str_append_double(&out, value.double_);
+            llvm_generate_float(out, value.double_);
         } break;
         case LLVM_VALUE_LOCAL_: {
-            str_append_cstr(&out, "%");
-            str_append_int(&out, value.local.idx);
+            str_builder_append_char(out, '%');
+            str_builder_append_int(out, value.local.idx);
         } break;
         case LLVM_VALUE_TYPE_: {
-            str_append_cstr(&out, "type ");
-            str_append(&out, llvm_generate_type(gen, value.type_));
+            str_builder_append_cstr(out, "type ");
+            llvm_generate_type(gen, out, value.type_);
+        } break;
+        case LLVM_VALUE_GETELEMENTPTR_: {
+            str_builder_append_cstr(out, value.getelementptr.is_inbounds ? "getelementptr inbounds (" : "getelementptr (");
+            llvm_generate_type(gen, out, *value.getelementptr.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type(gen, out, *value.getelementptr.type);
+            str_builder_append_cstr(out, "* @");
+            str_builder_append(out, value.getelementptr.name);
+            for (int i = 0; i < 2; i++) {
+                str_builder_append_cstr(out, ", i32 ");
+                str_builder_append_int(out, value.getelementptr.indices[i]);
+            }
+            str_builder_append_char(out, ')');
+        } break;
+        case LLVM_VALUE_UNDEF_: {
+            str_builder_append_cstr(out, "undef");
         } break;
     }
-    return out;
 }
 
-str llvm_generate_instruction(llvm_generator_t *gen, llvm_instruction_t instruction) {
-    str out = STR("");
+void llvm_generate_instruction(llvm_generator_t *gen, str_builder_t *out, llvm_instruction_t instruction) {
     switch (instruction.type) {
         case LLVM_INSTR_CALL: {
-            str_append_cstr(&out, "call ");
-            str_append(&out, llvm_generate_type(gen, instruction.call.return_type));
-            str_append_cstr(&out, " (");
-            bool is_vararg = false;
-            for (size_t i = 0; i < gen->functions.size; i++) {
-                llvm_function_t function = gen->functions.data[i];
-                if (str_eq(function.name, instruction.call.function_name)) {
-                    is_vararg = function.is_vararg;
-                    break;
-                }
-            }
+            str_builder_append_cstr(out, "call ");
+            llvm_generate_type(gen, out, instruction.call.return_type);
+            str_builder_append_cstr(out, " (");
+            llvm_function_t *callee = llvm_find_function(gen, instruction.call.function_name);
+            bool is_vararg = callee != NULL && callee->is_vararg;
             for (size_t i = 0; i < instruction.call.args.size; i++) {
                 llvm_function_arg_t arg = instruction.call.args.data[i];
-                str_append(&out, llvm_generate_type(gen, arg.arg_type));
+                llvm_generate_type(gen, out, arg.arg_type);
                 if (i < instruction.call.args.size - 1)
-                    str_append_cstr(&out, ", ");
+                    str_builder_append_cstr(out, ", ");
             }
             if (is_vararg)
-                str_append_cstr(&out, ", ...");
-            str_append_cstr(&out, ") @");
-            str_append(&out, instruction.call.function_name);
-            str_append_cstr(&out, "(");
+                str_builder_append_cstr(out, ", ...");
+            str_builder_append_cstr(out, ") @");
+            str_builder_append(out, instruction.call.function_name);
+            str_builder_append_char(out, '(');
             for (size_t i = 0; i < instruction.call.args.size; i++) {
                 llvm_function_arg_t arg = instruction.call.args.data[i];
-                str_append(&out, llvm_generate_type(gen, arg.arg_type));
-                str_append_cstr(&out, " ");
-                str_append(&out, llvm_generate_value(gen, arg.arg_value));
+                llvm_generate_type(gen, out, arg.arg_type);
+                str_builder_append_char(out, ' ');
+                llvm_generate_value(gen, out, arg.arg_value);
                 if (i < instruction.call.args.size - 1)
-                    str_append_cstr(&out, ", ");
+                    str_builder_append_cstr(out, ", ");
             }
-            str_append_cstr(&out, ")");
+            str_builder_append_char(out, ')');
         } break;
         case LLVM_INSTR_RETURN: {
-            str_append_cstr(&out, "ret ");
-            str_append(&out, llvm_generate_type(gen, instruction.return_.return_type));
-            str_append_cstr(&out, " ");
-            str_append(&out, llvm_generate_value(gen, instruction.return_.value));
+            str_builder_append_cstr(out, "ret ");
+            llvm_generate_type(gen, out, instruction.return_.return_type);
+            str_builder_append_char(out, ' ');
+            llvm_generate_value(gen, out, instruction.return_.value);
         } break;
         case LLVM_INSTR_GETELEMENTPTR: {
-            str_append_cstr(&out, "getelementptr ");
-            str_append(&out, llvm_generate_type(gen, instruction.getelementptr.type));
-            str_append_cstr(&out, ", ");
-            str_append(&out, llvm_generate_type(gen, instruction.getelementptr.type));
-            str_append_cstr(&out, "* @");
-            str_append(&out, instruction.getelementptr.name);
-            str_append_cstr(&out, ", i32 ");
-            str_append(&out, llvm_generate_value(gen, *instruction.getelementptr.value));
-            str_append_cstr(&out, ", i32 ");
-            str_append(&out, llvm_generate_value(gen, *instruction.getelementptr.index));
+            str_builder_append_cstr(out, "getelementptr ");
+            llvm_generate_type(gen, out, instruction.getelementptr.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type(gen, out, instruction.getelementptr.type);
+            str_builder_append_cstr(out, "* @");
+            str_builder_append(out, instruction.getelementptr.name);
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_value(gen, out, *instruction.getelementptr.value);
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_value(gen, out, *instruction.getelementptr.index);
         } break;
         case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
-            str_append_cstr(&out, "getelementptr inbounds (");
-            str_append(&out, llvm_generate_type(gen, instruction.getelementptr.type));
-            str_append_cstr(&out, ", ");
-            str_append(&out, llvm_generate_type(gen, instruction.getelementptr.type));
-            str_append_cstr(&out, "* @");
-            str_append(&out, instruction.getelementptr.name);
-            str_append_cstr(&out, ", i32 ");
-            str_append(&out, llvm_generate_value(gen, *instruction.getelementptr.value));
-            str_append_cstr(&out, ", i32 ");
-            str_append(&out, llvm_generate_value(gen, *instruction.getelementptr.index));
-            str_append_cstr(&out, ")");
+            str_builder_append_cstr(out, "getelementptr inbounds (");
+            llvm_generate_type(gen, out, instruction.getelementptr.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type(gen, out, instruction.getelementptr.type);
+            str_builder_append_cstr(out, "* @");
+            str_builder_append(out, instruction.getelementptr.name);
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_value(gen, out, *instruction.getelementptr.value);
+            str_builder_append_cstr(out, ", i32 ");
+            llvm_generate_value(gen, out, *instruction.getelementptr.index);
+            str_builder_append_char(out, ')');
+        } break;
+        // Without the function at hand, blocks can only be given by index.
+        case LLVM_INSTR_ALLOCA: {
+            str_builder_append_cstr(out, "alloca ");
+            llvm_generate_type(gen, out, instruction.alloca_.type);
+        } break;
+        case LLVM_INSTR_LOAD: {
+            str_builder_append_cstr(out, "load ");
+            llvm_generate_type(gen, out, instruction.load.type);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type(gen, out, instruction.load.type);
+            str_builder_append_cstr(out, "* ");
+            llvm_generate_value(gen, out, instruction.load.pointer);
+        } break;
+        case LLVM_INSTR_STORE: {
+            str_builder_append_cstr(out, "store ");
+            llvm_generate_type(gen, out, instruction.store.type);
+            str_builder_append_char(out, ' ');
+            llvm_generate_value(gen, out, instruction.store.value);
+            str_builder_append_cstr(out, ", ");
+            llvm_generate_type(gen, out, instruction.store.type);
+            str_builder_append_cstr(out, "* ");
+            llvm_generate_value(gen, out, instruction.store.pointer);
+        } break;
+        case LLVM_INSTR_BR: {
+            str_builder_append_cstr(out, "br label %");
+            str_builder_append_int(out, (int)instruction.br.block);
+        } break;
+        case LLVM_INSTR_COND_BR: {
+            str_builder_append_cstr(out, "br i1 ");
+            llvm_generate_value(gen, out, instruction.cond_br.condition);
+            str_builder_append_cstr(out, ", label %");
+            str_builder_append_int(out, (int)instruction.cond_br.if_true);
+            str_builder_append_cstr(out, ", label %");
+            str_builder_append_int(out, (int)instruction.cond_br.if_false);
+        } break;
+        case LLVM_INSTR_PHI: {
+            str_builder_append_cstr(out, "phi ");
+            llvm_generate_type(gen, out, instruction.phi.type);
+            for (size_t i = 0; i < instruction.phi.incoming.size; i++) {
+                str_builder_append_cstr(out, i == 0 ? " [ " : ", [ ");
+                llvm_generate_value(gen, out, instruction.phi.incoming.data[i].value);
+                str_builder_append_cstr(out, ", %");
+                str_builder_append_int(out, (int)instruction.phi.incoming.data[i].block);
+                str_builder_append_cstr(out, " ]");
+            }
         } break;
     }
-    return out;
 }
 
-str llvm_generate_linkage_type(llvm_linkage_type_t linkage) {
+void llvm_generate_float(str_builder_t *out, double d) {
+    // Decimals are only written when they are exact. A `float` is given as
+    // the double it widens to, which LLVM accepts as long as no bits are lost.
+    str_builder_reserve(out, FORMAT_MAX_CHARS);
+    size_t count = format_double_exact(out->chars + out->count, d);
+    if (count == 0)
+        count = format_double_hex(out->chars + out->count, d);
+    out->count += count;
+}
+
+void llvm_generate_linkage_type(str_builder_t *out, llvm_linkage_type_t linkage) {
     if (!linkage)
-        return STR("");
+        return;
     switch (linkage) {
-        case LLVM_LINKAGE_EXTERNAL: return STR("external ");
-        case LLVM_LINKAGE_INTERNAL: return STR("internal ");
-        case LLVM_LINKAGE_PRIVATE: return STR("private ");
-        case LLVM_LINKAGE_LINKONCE: return STR("linkonce ");
-        case LLVM_LINKAGE_WEAK: return STR("weak ");
-        case LLVM_LINKAGE_COMMON: return STR("common ");
-        case LLVM_LINKAGE_APPENDING: return STR("appending ");
-        case LLVM_LINKAGE_EXTERN_WEAK: return STR("extern_weak ");
-        case LLVM_LINKAGE_AVAILABLE_EXTERNALLY: return STR("available_externally ");
+        case LLVM_LINKAGE_EXTERNAL: str_builder_append_cstr(out, "external "); break;
+        case LLVM_LINKAGE_INTERNAL: str_builder_append_cstr(out, "internal "); break;
+        case LLVM_LINKAGE_PRIVATE: str_builder_append_cstr(out, "private "); break;
+        case LLVM_LINKAGE_LINKONCE: str_builder_append_cstr(out, "linkonce "); break;
+        case LLVM_LINKAGE_WEAK: str_builder_append_cstr(out, "weak "); break;
+        case LLVM_LINKAGE_COMMON: str_builder_append_cstr(out, "common "); break;
+        case LLVM_LINKAGE_APPENDING: str_builder_append_cstr(out, "appending "); break;
+        case LLVM_LINKAGE_EXTERN_WEAK: str_builder_append_cstr(out, "extern_weak "); break;
+        case LLVM_LINKAGE_AVAILABLE_EXTERNALLY: str_builder_append_cstr(out, "available_externally "); break;
+    }
+}
+
+void llvm_generate_visibility(str_builder_t *out, llvm_visibility_t visibility) {
+    switch (visibility) {
+        case LLVM_VISIBILITY_DEFAULT: break;
+        case LLVM_VISIBILITY_HIDDEN: str_builder_append_cstr(out, "hidden "); break;
+        case LLVM_VISIBILITY_PROTECTED: str_builder_append_cstr(out, "protected "); break;
     }
-    return STR("");
-}
\ No newline at end of file
+}
+
+void llvm_generate_dll_storage_class(str_builder_t *out, llvm_dll_storage_class_t dll_storage_class) {
+    switch (dll_storage_class) {
+        case LLVM_DLL_STORAGE_CLASS_DEFAULT: break;
+        case LLVM_DLL_STORAGE_CLASS_DLLIMPORT: str_builder_append_cstr(out, "dllimport "); break;
+        case LLVM_DLL_STORAGE_CLASS_DLLEXPORT: str_builder_append_cstr(out, "dllexport "); break;
+    }
+}
+
+void llvm_generate_call_convention(str_builder_t *out, llvm_call_convention_t call_convention) {
+    switch (call_convention) {
+        case LLVM_CALL_CONVENTION_C: break;
+        case LLVM_CALL_CONVENTION_FAST: str_builder_append_cstr(out, "fastcc "); break;
+        case LLVM_CALL_CONVENTION_COLD: str_builder_append_cstr(out, "coldcc "); break;
+        case LLVM_CALL_CONVENTION_GHC: str_builder_append_cstr(out, "cc 10 "); break;
+    }
+}
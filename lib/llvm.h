@@ -7,6 +7,10 @@
 #include <llvm/type.h>
 #include <llvm/value.h>
 
+#ifdef LLVM_STATS
+#include <stdatomic.h>
+#endif
+
 // @<GlobalVarName> = [Linkage] [PreemptionSpecifier] [Visibility]
 //                    [DLLStorageClass] [ThreadLocal]
 //                    [(unnamed_addr|local_unnamed_addr)] [AddrSpace]
@@ -28,6 +32,8 @@ typedef struct llvm_global_t {
     llvm_type_t *type;
     llvm_value_t value;
     int alignment;
+    bool is_unnamed_addr; // only the contents matter, not the address
+    u64 revision; // assigned by `llvm_add_global`, see `llvm_touch_global`
 } llvm_global_t;
 array_proto(llvm_global_t); array_impl(llvm_global_t);
 
@@ -71,6 +77,71 @@ typedef struct llvm_function_body_t {
     array(llvm_basic_block_t) basic_blocks;
 } llvm_function_body_t;
 
+// A value as seen from inside a compact body: 3 bits of kind and 29 bits of
+// payload.
+typedef u32 llvm_ref_t;
+
+#define LLVM_REF_LOCAL 0    // argument index, then argument count + instruction index
+#define LLVM_REF_INT 1      // signed integer stored in place
+#define LLVM_REF_CONSTANT 2 // index into `llvm_code_t.constants`
+#define LLVM_REF_UNDEFINED 3 // a local that was never defined, see `llvm_verify`
+
+#define LLVM_REF(kind, payload) (((u32)(kind) << 29) | ((u32)(payload) & 0x1fffffff))
+#define LLVM_REF_KIND(ref) ((ref) >> 29)
+#define LLVM_REF_PAYLOAD(ref) ((ref) & 0x1fffffff)
+#define LLVM_REF_INT_VALUE(ref) ((int)((ref) << 3) >> 3)
+#define LLVM_REF_INT_FITS(n) ((n) >= -(1 << 28) && (n) < (1 << 28))
+
+// The instruction has a value, but no name is given to it.
+#define LLVM_CODE_DISCARD 1
+
+// Fixed-size instruction. Operands are value refs, except for a call, whose
+// `operand_count` entries are the refs of its arguments followed by their
+// type ids, and a phi, whose refs are followed by the blocks they come from.
+// Branches end in the indices of their target blocks.
+//
+// `operand_count` is 16 bits, so a call passes at most
+// `LLVM_CODE_MAX_ENTRIES` arguments and a phi merges at most that many
+// values. The builder stops with `fatal` on anything larger.
+#define LLVM_CODE_MAX_ENTRIES (0xffffu / 2)
+typedef struct llvm_code_instruction_t {
+    u8 opcode; // one of the `LLVM_INSTR_*` kinds
+    u8 flags;
+    u16 operand_count;
+    u32 type;     // canonical type id: returned, loaded, stored or allocated type, or the GEP source type
+    u32 operands; // first entry in `llvm_code_t.operands`
+    u32 symbol;   // callee or GEP base, index into `llvm_code_t.symbols`
+} llvm_code_instruction_t;
+
+#define LLVM_CODE_REF_COUNT(instruction) \
+    ((instruction).opcode == LLVM_INSTR_CALL || (instruction).opcode == LLVM_INSTR_PHI ? (instruction).operand_count / 2u \
+     : (instruction).opcode == LLVM_INSTR_BR ? 0u \
+     : (instruction).opcode == LLVM_INSTR_COND_BR ? 1u \
+     : (instruction).operand_count)
+
+typedef struct llvm_code_block_t {
+    str name;
+    u32 first; // index of the block's first instruction
+    u32 count;
+} llvm_code_block_t;
+
+// Compact body every defined function is stored as once it is in a module.
+// Instructions are laid out block after block, and all of them are in one
+// arena allocation together with the pools they index.
+typedef struct llvm_code_t {
+    llvm_code_block_t *blocks;
+    llvm_code_instruction_t *instructions;
+    u32 *operands;
+    llvm_value_t *constants; // everything that does not fit in a ref
+    u32 *symbols;            // interned names, see `llvm_name_intern`
+    u32 block_count;
+    u32 instruction_count;
+    u32 operand_count;
+    u32 constant_count;
+    u32 symbol_count;
+    bool is_borrowed; // instructions, operands and symbols live in a snapshot, see `llvm_code_own`
+} llvm_code_t;
+
 // define [linkage] [PreemptionSpecifier] [visibility] [DLLStorageClass]
 //        [cconv] [ret attrs]
 //        <ResultType> @<FunctionName> ([argument list])
@@ -91,36 +162,558 @@ typedef struct llvm_function_t {
     int address_space;
     int alignment;
     llvm_function_body_t *body;
+    llvm_code_t *code; // filled in from `body` by `llvm_add_function`
+    u64 revision;      // assigned by `llvm_add_function`, see `llvm_touch_function`
 } llvm_function_t;
 array_proto(llvm_function_t); array_impl(llvm_function_t);
 
 typedef struct llvm_type_declaration_t {
     str name;
     llvm_type_t type;
+    u64 revision;
 } llvm_type_declaration_t;
 array_proto(llvm_type_declaration_t); array_impl(llvm_type_declaration_t);
 
-#define LLVM_TYPE_DECLARATION(n, t) ((llvm_type_declaration_t){STR(n), t})
+#define LLVM_TYPE_DECLARATION(n, t) ((llvm_type_declaration_t){.name = STR(n), .type = t})
+
+// One slot per unique type. The rendered text lives in the context's text
+// pool so that emitting a type is a single copy.
+typedef struct llvm_type_entry_t {
+    llvm_type_t *type;
+    u64 hash;
+    size_t text_offset;
+    size_t text_count;
+} llvm_type_entry_t;
+array_proto(llvm_type_entry_t); array_impl(llvm_type_entry_t);
+
+// Hash-consing table for types: structurally equal types map to a single
+// canonical node, so type equality is pointer equality.
+typedef struct llvm_type_context_t {
+    arena_t *arena;                   // canonical nodes and their members
+    array(llvm_type_entry_t) entries; // indexed by `id - 1`
+    uint *slots;                      // open addressing over entry ids, 0 is empty
+    size_t slot_count;
+    str_builder_t texts;
+    str_builder_t scratch;
+    bool is_frozen; // no insertions while set, so readers may run concurrently
+} llvm_type_context_t;
+
+typedef struct llvm_name_t {
+    str text;    // canonical copy, in the generator's arena
+    u64 hash;
+    uint symbol; // 0 when unbound, otherwise `(index + 1) << 1 | is_function`
+} llvm_name_t;
+array_proto(llvm_name_t); array_impl(llvm_name_t);
+
+// Every distinct name gets one id, with its hash computed once, so that
+// names can be compared and looked up as integers. The table doubles as the
+// index of globals and functions: both live in the same `@` namespace, so a
+// name can only ever be bound once.
+typedef struct llvm_name_table_t {
+    array(llvm_name_t) names; // indexed by `id - 1`
+    u64 *slots;               // open addressing over ids, 0 is empty; see `LLVM_NAME_SLOT`
+    size_t slot_count;
+    size_t symbol_count;      // names that are bound
+} llvm_name_table_t;
 
+array_proto(u32); array_impl(u32);
+array_proto(str); array_impl(str);
+
+typedef struct llvm_function_stats_t {
+    u64 nanoseconds;
+    u64 bytes;
+} llvm_function_stats_t;
+
+// Counters collected while emitting when the library is built with
+// `-DLLVM_STATS`. The flag changes the layout of `llvm_generator_t`, so every
+// translation unit has to agree on it. Without it none of the collection code
+// is compiled. Everything accumulates until `llvm_stats_reset`.
+typedef struct llvm_stats_t {
+    _Atomic u64 bytes_emitted;
+    _Atomic u64 appends;          // string builder appends
+    _Atomic u64 buffer_growths;   // string builder reallocations
+    _Atomic u64 type_renderings;  // types written into the output
+    _Atomic u64 symbol_lookups;
+    _Atomic u64 symbol_probes;    // slots visited by those lookups
+    _Atomic u64 generations;      // calls to one of the text entry points
+    _Atomic u64 cache_hits;       // entities copied from the output cache
+    _Atomic u64 cache_misses;     // entities rendered while the cache is on
+    _Atomic u64 type_declarations_ns;
+    _Atomic u64 globals_ns;
+    _Atomic u64 functions_ns;
+    _Atomic u64 total_ns;
+    llvm_function_stats_t *functions; // parallel to `llvm_generator_t.functions`
+    size_t function_count;
+} llvm_stats_t;
+
+typedef struct llvm_cache_entry_t {
+    u64 revision; // of the entity when it was rendered, 0 when empty
+    size_t offset;
+    size_t count;
+} llvm_cache_entry_t;
+
+typedef struct llvm_cache_section_t {
+    llvm_cache_entry_t *entries; // parallel to one of the module's lists
+    size_t count;
+} llvm_cache_section_t;
+
+typedef struct llvm_constant_slot_t {
+    u64 hash;
+    str text; // escaped contents, as held by the global
+    str name; // of the global, empty when the slot is free
+    bool is_cstring;
+} llvm_constant_slot_t;
+
+// Globals made by `llvm_intern_cstring` and `llvm_intern_bytes`, indexed by
+// their contents so that each one is emitted once.
+typedef struct llvm_constant_pool_t {
+    llvm_constant_slot_t *slots;
+    size_t slot_count;
+    size_t count;
+    u32 next_name; // suffix of the next `.str.N` or `.bytes.N`
+    str_builder_t scratch;
+} llvm_constant_pool_t;
+
+// Rendered text of every type declaration, global and function, as of the
+// revision it was rendered at. Text generation copies the pieces that are
+// still current and only renders the rest.
+typedef struct llvm_cache_t {
+    bool is_enabled;
+    str_builder_t text; // the pieces, back to back
+    size_t live;        // bytes of `text` some entry still refers to
+    llvm_cache_section_t type_declarations;
+    llvm_cache_section_t globals;
+    llvm_cache_section_t functions;
+    u64 variadic; // digest of the names of variadic functions, which calls to them are rendered with
+} llvm_cache_t;
+
+// Owns every node allocated through it: the generator's own tables as well
+// as anything the caller places in `arena` (see `LLVM_NEW` and
+// `array_new_arena`) is released by a single `llvm_free`.
 typedef struct llvm_generator_t {
+    arena_t arena;
+    llvm_type_context_t types;
+    llvm_name_table_t names;
     array(llvm_type_declaration_t) type_declarations;
     array(llvm_global_t) globals;
     array(llvm_function_t) functions;
+    struct llvm_builder_t *scratch; // converts bodies given to `llvm_add_function`
+    u64 revision;                   // last revision handed out
+    llvm_cache_t cache;
+    llvm_constant_pool_t constants;
+#ifdef LLVM_STATS
+    llvm_stats_t stats;
+#endif
 } llvm_generator_t;
 
+// Copies a node into the generator's arena and returns its stable address,
+// e.g. `LLVM_NEW(&gen, llvm_type_t, LLVM_TYPE_INT(32))`.
+#define LLVM_NEW(gen, type, ...) ((type *)arena_dup(&(gen)->arena, (type[]){__VA_ARGS__}, sizeof(type), _Alignof(type)))
+
 void llvm_init(llvm_generator_t *gen);
 void llvm_free(llvm_generator_t *gen);
 void llvm_add_type_declaration(llvm_generator_t *gen, llvm_type_declaration_t type_declaration);
-void llvm_add_global(llvm_generator_t *gen, llvm_global_t global);
-void llvm_add_function(llvm_generator_t *gen, llvm_function_t function);
+// Both return false, and leave the module untouched, when the name is
+// already used by another global or function.
+bool llvm_add_global(llvm_generator_t *gen, llvm_global_t global);
+bool llvm_add_function(llvm_generator_t *gen, llvm_function_t function);
+// Returned pointers are only valid until the next global/function is added.
+llvm_global_t *llvm_find_global(llvm_generator_t *gen, str name);
+llvm_function_t *llvm_find_function(llvm_generator_t *gen, str name);
+// Same, by interned name, see `llvm_name_intern`.
+llvm_global_t *llvm_find_global_id(llvm_generator_t *gen, u32 name);
+llvm_function_t *llvm_find_function_id(llvm_generator_t *gen, u32 name);
+// Puts a new definition in place of the function of the same name, keeping
+// its position in the module. Returns false when there is no such function.
+bool llvm_replace_function(llvm_generator_t *gen, llvm_function_t function);
+
+// Every entity gets a fresh revision when it is added. Anything changed in
+// place afterwards, e.g. through `llvm_find_function`, has to be touched so
+// that cached output rendered from the old version is not reused.
+void llvm_touch_type_declaration(llvm_generator_t *gen, llvm_type_declaration_t *type_declaration);
+void llvm_touch_global(llvm_generator_t *gen, llvm_global_t *global);
+void llvm_touch_function(llvm_generator_t *gen, llvm_function_t *function);
+// Off by default. While enabled, the text entry points keep the rendered text
+// of every entity and only re-render entities whose revision changed since,
+// at the cost of holding roughly one extra copy of the module's text.
+void llvm_cache_enable(llvm_generator_t *gen, bool enable);
+// Used by the text emitters; all of them do nothing while the cache is off.
+// `llvm_cache_prepare` sizes the sections to the module before a generation,
+// and drops the text of every function when the set of variadic functions
+// changed, since calls are written with their callee's signature.
+void llvm_cache_prepare(llvm_generator_t *gen);
+bool llvm_cache_is_fresh(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision);
+bool llvm_cache_fetch(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision, str_builder_t *out);
+void llvm_cache_store(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision, str text);
+void llvm_cache_compact(llvm_generator_t *gen);
+// Follows entities being removed from the list `section` mirrors: keeps the
+// entries of those with `keep[i]` set, in order.
+void llvm_cache_retain(llvm_generator_t *gen, llvm_cache_section_t *section, const bool *keep);
+
+// Return the internal `unnamed_addr constant` holding `s` followed by a NUL,
+// or the raw bytes of `data`, adding it on first use. Equal contents always
+// give the same global. The pointer is only valid until the next
+// global/function is added.
+llvm_global_t *llvm_intern_cstring(llvm_generator_t *gen, str s);
+llvm_global_t *llvm_intern_bytes(llvm_generator_t *gen, str data);
+void llvm_constant_pool_free(llvm_constant_pool_t *pool);
+
+#define LLVM_SYMBOL_GLOBAL(i) ((uint)((i) + 1) << 1)
+#define LLVM_SYMBOL_FUNCTION(i) (((uint)((i) + 1) << 1) | 1)
+#define LLVM_SYMBOL_IS_FUNCTION(ref) ((ref) & 1)
+#define LLVM_SYMBOL_INDEX(ref) (((ref) >> 1) - 1)
+
+void llvm_name_table_init(llvm_name_table_t *table);
+void llvm_name_table_free(llvm_name_table_t *table);
+// Returns the id of `name`, interning it on first use. Ids start at 1 and
+// stay valid as long as the generator.
+u32 llvm_name_intern(llvm_generator_t *gen, str name);
+// Same, for a name whose `str_hash` is known and whose text outlives the
+// generator, so that it is neither hashed nor copied again.
+u32 llvm_name_adopt(llvm_generator_t *gen, str name, u64 hash);
+// 0 when `name` was never interned; nothing is added.
+u32 llvm_name_find(llvm_generator_t *gen, str name);
+str llvm_name_text(llvm_generator_t *gen, u32 name);
+
+// Binds `name` to `ref` unless it is already bound, in which case the
+// existing ref is returned instead of 0.
+uint llvm_symbol_bind(llvm_generator_t *gen, u32 name, uint ref);
+uint llvm_symbol_insert(llvm_generator_t *gen, str name, uint ref);
+// The ref bound to a name, 0 when there is none. The interned form is a
+// plain array access.
+uint llvm_symbol_of(llvm_generator_t *gen, u32 name);
+uint llvm_symbol_find(llvm_generator_t *gen, str name);
+// Unbinds every name, e.g. before the lists are renumbered.
+void llvm_symbol_clear(llvm_generator_t *gen);
 
+// Returns the canonical node for `type`, creating it (and its members) on
+// first use. Canonical nodes live as long as the generator.
+llvm_type_t *llvm_type_get(llvm_generator_t *gen, llvm_type_t type);
+str llvm_type_text(llvm_generator_t *gen, llvm_type_t type);
+// Direct lookups by the id of a canonical node; neither ever inserts.
+llvm_type_t *llvm_type_by_id(llvm_generator_t *gen, u32 id);
+str llvm_type_id_text(llvm_generator_t *gen, u32 id);
+// Read-only counterparts of the above: unknown types are reported as NULL or
+// rendered without being added to the context.
+llvm_type_t *llvm_type_find(llvm_generator_t *gen, llvm_type_t type);
+void llvm_type_write(llvm_generator_t *gen, str_builder_t *out, llvm_type_t type);
+bool llvm_type_eq(llvm_generator_t *gen, llvm_type_t a, llvm_type_t b);
+void llvm_type_context_init(llvm_type_context_t *ctx, arena_t *arena);
+void llvm_type_context_free(llvm_type_context_t *ctx);
+
+// NULL when the library was built without `LLVM_STATS`.
+const llvm_stats_t *llvm_get_stats(llvm_generator_t *gen);
+void llvm_stats_reset(llvm_generator_t *gen);
+// Appends the stats as a JSON object, or `null` without `LLVM_STATS`.
+void llvm_stats_to_json(llvm_generator_t *gen, str_builder_t *out);
+
+typedef struct llvm_stats_timer_t {
+    u64 start;
+    size_t offset;
+} llvm_stats_timer_t;
+
+u64 llvm_stats_now(void);
+void llvm_stats_reserve_functions(llvm_generator_t *gen);
+void llvm_stats_record_function(llvm_generator_t *gen, size_t index, llvm_stats_timer_t timer, size_t offset);
+
+// Collection points used by the emitters. Disabled, they expand to nothing
+// beyond a reference to `gen` that keeps unused-parameter warnings quiet.
+#ifdef LLVM_STATS
+#define LLVM_STATS_ADD(gen, counter, n) atomic_fetch_add_explicit(&(gen)->stats.counter, (u64)(n), memory_order_relaxed)
+#define LLVM_STATS_START(timer, out) llvm_stats_timer_t timer = {llvm_stats_now(), (out)->count}
+#define LLVM_STATS_PHASE(gen, counter, timer) LLVM_STATS_ADD(gen, counter, llvm_stats_now() - (timer).start)
+#define LLVM_STATS_FUNCTION(gen, index, timer, out) llvm_stats_record_function(gen, index, timer, (out)->count)
+#else
+#define LLVM_STATS_ADD(gen, counter, n) ((void)(gen))
+#define LLVM_STATS_START(timer, out) ((void)0)
+#define LLVM_STATS_PHASE(gen, counter, timer) ((void)(gen))
+#define LLVM_STATS_FUNCTION(gen, index, timer, out) ((void)(gen))
+#endif
+
+// Output is handed to the sink in chunks of roughly this size, so streaming
+// a module needs at most one chunk plus the largest single function in memory.
+#define LLVM_SINK_CHUNK_SIZE (64 * 1024)
+
+// Renders the whole module. The returned string is owned by the caller and
+// must be released with `str_free`.
 str llvm_generate(llvm_generator_t *gen);
-str llvm_generate_local(llvm_generator_t *gen, llvm_local_t local);
-str llvm_generate_type(llvm_generator_t *gen, llvm_type_t type);
-str llvm_generate_value(llvm_generator_t *gen, llvm_value_t value);
-str llvm_generate_instruction(llvm_generator_t *gen, llvm_instruction_t instruction);
+// Renders the whole module into `sink`, flushing as declarations, globals and
+// functions are produced. Returns false as soon as the sink reports a failure.
+bool llvm_generate_to_sink(llvm_generator_t *gen, sink_t sink);
+// Same output as `llvm_generate`, with function bodies rendered on `nthreads`
+// threads. Falls back to the serial path for `nthreads <= 1`.
+str llvm_generate_parallel(llvm_generator_t *gen, int nthreads);
+// Encodes the module as an LLVM bitcode file, ready for `llc` or `opt`. The
+// returned bytes are owned by the caller and must be released with `str_free`.
+str llvm_generate_bitcode(llvm_generator_t *gen);
+typedef struct llvm_parse_error_t {
+    size_t line;
+    size_t column;
+    char message[128];
+} llvm_parse_error_t;
+
+// Reads textual IR, in the subset `llvm_generate` produces, and appends its
+// type declarations, globals and functions to `gen`. Names and string
+// constants point into `source`, which must outlive `gen`. Stops at the first
+// error, leaving whatever was already read in `gen`; `error` may be NULL.
+bool llvm_parse(llvm_generator_t *gen, str source, llvm_parse_error_t *error);
+
+// Saves everything in the module as a versioned binary snapshot, including
+// the name, type and constant tables, so that loading it is mostly a matter
+// of pointing into it. The returned bytes are owned by the caller and must
+// be released with `str_free`.
+str llvm_snapshot_save(llvm_generator_t *gen);
+// Restores a snapshot into `gen`, which has just been initialized. `data`
+// has to be 8-byte aligned, as a mapping from `file_view_open` is, and has to
+// outlive `gen`: names, strings and function bodies are used from it in
+// place until a pass needs to change them. Returns false for snapshots of
+// another version, byte order or layout, and for damaged ones; `gen` then
+// has to be freed without being used.
+bool llvm_snapshot_load(llvm_generator_t *gen, str data);
+// Copies the parts of a loaded body that point into the snapshot into the
+// generator, so that they can be written. Does nothing for other bodies.
+// Passes that rewrite bodies in place call this first.
+void llvm_code_own(llvm_generator_t *gen, llvm_code_t *code);
+
+// A code generator, e.g. `{"llc", "-filetype=obj", NULL}`, run as a child
+// process without a shell. `argv` is NULL-terminated; the program is looked
+// up in `PATH`. Modules are streamed into its standard input as they are
+// generated, and `-o <output>` is added for jobs that name an output.
+typedef struct llvm_backend_t {
+    const char *const *argv;
+    int max_processes; // backends running at once, at least 1
+} llvm_backend_t;
+
+typedef struct llvm_backend_job_t {
+    llvm_generator_t *gen;
+    const char *output; // NULL to leave the choice to the backend, e.g. standard output
+} llvm_backend_job_t;
+
+typedef struct llvm_backend_result_t {
+    bool ok;         // the backend read the whole module and exited with status 0
+    int status;      // exit status, -1 when it did not exit normally or did not start
+    int signal;      // the signal that ended it, or 0
+    int spawn_error; // errno value when it could not be started, or 0
+    str output;      // everything it wrote to standard output
+    str errors;      // everything it wrote to standard error
+} llvm_backend_result_t;
+
+// Compiles every job with its own backend process, keeping at most
+// `max_processes` of them running, and fills `results` in the order of
+// `jobs`. Each module is generated on the thread that feeds its backend, so
+// no two jobs may share a generator. Returns true when every result is ok.
+// Results must be released with `llvm_backend_result_free`.
+bool llvm_backend_run(const llvm_backend_t *backend, const llvm_backend_job_t *jobs, size_t n, llvm_backend_result_t *results);
+void llvm_backend_result_free(llvm_backend_result_t *result);
+
+typedef enum llvm_diagnostic_kind_t {
+    LLVM_DIAGNOSTIC_MISSING_BODY,         // a defined function without code
+    LLVM_DIAGNOSTIC_MISSING_TERMINATOR,   // a block that does not end in `ret` or `br`
+    LLVM_DIAGNOSTIC_MISPLACED_TERMINATOR, // `ret` or `br` before the end of its block
+    LLVM_DIAGNOSTIC_UNDEFINED_VALUE,      // a local used before, or without, its definition
+    LLVM_DIAGNOSTIC_UNKNOWN_SYMBOL,       // a callee or global that is not in the module
+    LLVM_DIAGNOSTIC_ARGUMENT_COUNT,       // a call that does not match the callee's arity
+    LLVM_DIAGNOSTIC_TYPE_MISMATCH,
+    LLVM_DIAGNOSTIC_INVALID_TYPE,         // a type that cannot be used where it is
+    LLVM_DIAGNOSTIC_INVALID_BLOCK,        // a branch to a missing block, or a phi edge from a non-predecessor
+    LLVM_DIAGNOSTIC_MISPLACED_PHI,        // a phi after a block's first non-phi instruction
+    LLVM_DIAGNOSTIC_SYMBOL_CONFLICT,      // two modules being linked define a symbol in ways that cannot be merged
+} llvm_diagnostic_kind_t;
+
+typedef struct llvm_diagnostic_t {
+    llvm_diagnostic_kind_t kind;
+    str symbol;       // the global or function the problem is in
+    str block;        // empty outside of function bodies
+    u32 instruction;  // position within `block`
+    char message[128];
+} llvm_diagnostic_t;
+array_proto(llvm_diagnostic_t); array_impl(llvm_diagnostic_t);
+
+// Checks the whole module in one pass: that callees and globals exist and
+// are used with their declared types, that every local is defined before it
+// is used, and that every block ends in exactly one terminator. Problems are
+// appended to `diagnostics`, which may be NULL. Returns true when there are
+// none. Only the type context changes: types are interned as they are
+// checked, like emitting them would.
+bool llvm_verify(llvm_generator_t *gen, array(llvm_diagnostic_t) *diagnostics);
+
+// Optional cleanup before emitting: turns `getelementptr`s with constant
+// indices into constant expressions, folds calls to functions that only
+// return an argument or a constant, merges phis that only see one value, and
+// drops instructions whose results go unused and that have no effect, as
+// well as blocks that cannot run and anything after a block's terminator.
+// Remaining blocks and values are renumbered. Functions that do not verify
+// are left alone. Returns how many instructions went away.
+size_t llvm_simplify(llvm_generator_t *gen);
+
+// Removes what the output does not need. Functions and globals are kept when
+// they are named in `roots`, are definitions without internal linkage, or
+// are called or indexed into by something kept.
+// Type declarations are kept while their type is still used. Symbols in
+// `roots` that do not exist are ignored. Anything found through
+// `llvm_find_*` before is invalidated. Returns how many entities went away.
+size_t llvm_prune(llvm_generator_t *gen, const str *roots, size_t root_count);
+
+// Appends the modules `srcs` to `dst`, which is not one of them, and
+// resolves their symbols by name. Of the definitions of a name, a strong
+// one replaces `linkonce`, `weak` and `common` ones, which replace
+// `available_externally` ones, which replace declarations; otherwise the
+// first stays. A symbol keeps the position where its name first appears.
+// Internal symbols are renamed with a numeric suffix when their name is
+// taken, as are type declarations that reuse a name for another type;
+// equal type declarations are kept once. Everything copied only points
+// into `dst`, so the sources may be freed afterwards. Returns false, adding
+// to `diagnostics` (which may be NULL) and leaving the modules as they
+// were, when two strong definitions, or a function and a global, share a
+// name. Takes time linear in the size of all modules.
+bool llvm_link_modules(llvm_generator_t *dst, llvm_generator_t *const *srcs, size_t n, array(llvm_diagnostic_t) *diagnostics);
+
+typedef struct llvm_builder_block_t {
+    str name;
+    u32 count;        // instructions appended to the block so far
+    u32 predecessors; // head of the block's list in `llvm_builder_t.edges`, plus one
+    u32 incomplete;   // head of its list in `llvm_builder_t.incomplete`, plus one
+    bool is_sealed;   // no more predecessors will be added
+} llvm_builder_block_t;
+array_proto(llvm_builder_block_t); array_impl(llvm_builder_block_t);
+
+typedef struct llvm_builder_instruction_t {
+    llvm_code_instruction_t code; // local refs are still builder handles
+    u32 block;
+    u32 replacement; // ref standing in for a phi found to be redundant
+} llvm_builder_instruction_t;
+array_proto(llvm_builder_instruction_t); array_impl(llvm_builder_instruction_t);
+
+// Links of the per-block lists kept for SSA variables.
+typedef struct llvm_builder_edge_t {
+    u32 block; // the predecessor
+    u32 next;  // next link, plus one
+} llvm_builder_edge_t;
+array_proto(llvm_builder_edge_t); array_impl(llvm_builder_edge_t);
+
+typedef struct llvm_builder_incomplete_t {
+    u32 variable;
+    u32 phi;  // handle of the phi waiting for its operands
+    u32 next; // next link, plus one
+} llvm_builder_incomplete_t;
+array_proto(llvm_builder_incomplete_t); array_impl(llvm_builder_incomplete_t);
+
+// Current value of a variable at the end of a block.
+typedef struct llvm_builder_definition_t {
+    u64 key; // block << 32 | variable, plus one; 0 for a free slot
+    u32 ref;
+} llvm_builder_definition_t;
+
+// Builds one function body at a time without numbering locals by hand. Every
+// instruction is handed back as an `LLVM_VALUE_LOCAL` handle. SSA numbers are
+// only given out when the body is emitted. `llvm_builder_finish` lays the
+// body out as an `llvm_code_t`. The scratch arrays are kept between
+// functions, so one builder can be reused for a whole module.
+typedef struct llvm_builder_t {
+    llvm_generator_t *gen;
+    llvm_function_t function;
+    uint block; // insertion point
+    array(llvm_builder_block_t) blocks;
+    array(llvm_builder_instruction_t) instructions; // in creation order
+    array(u32) operands;
+    array(llvm_value_t) constants;
+    array(u32) symbols; // interned names
+    array(u32) locals; // local number -> handle + 1, while `maps_locals` is set
+    bool maps_locals;  // operands name locals by number rather than by handle
+    // SSA variables, see `llvm_builder_declare_variable`.
+    array(u32) variables; // type id of each
+    array(llvm_builder_edge_t) edges;
+    array(llvm_builder_incomplete_t) incomplete;
+    array(u32) pending; // phi operands being gathered, used as a stack
+    array(u32) unfilled; // phis in sealed blocks still without operands, each with its variable
+    llvm_builder_definition_t *definitions;
+    size_t definition_slots, definition_count;
+} llvm_builder_t;
+
+void llvm_builder_init(llvm_builder_t *builder, llvm_generator_t *gen);
+void llvm_builder_free(llvm_builder_t *builder);
+// Starts a body for `function`, whose own `body` is ignored.
+void llvm_builder_begin(llvm_builder_t *builder, llvm_function_t function);
+// Blocks are laid out in creation order. The first one becomes the insertion
+// point; use `llvm_builder_position` to move elsewhere. `name` is copied into
+// the generator's arena, so it may be a temporary.
+uint llvm_builder_create_block(llvm_builder_t *builder, str name);
+void llvm_builder_position(llvm_builder_t *builder, uint block);
+llvm_value_t llvm_builder_arg(llvm_builder_t *builder, uint index);
+// Appends `instruction` at the insertion point. Its operands and types are
+// copied, so they may be temporaries. Local operands must be handles given
+// out by this builder.
+llvm_value_t llvm_builder_append(llvm_builder_t *builder, llvm_instruction_t instruction);
+llvm_value_t llvm_builder_call(llvm_builder_t *builder, llvm_type_t return_type, str name, const llvm_function_arg_t *args, size_t count);
+llvm_value_t llvm_builder_gep(llvm_builder_t *builder, bool is_inbounds, str name, llvm_type_t type, llvm_value_t value, llvm_value_t index);
+void llvm_builder_ret(llvm_builder_t *builder, llvm_type_t type, llvm_value_t value);
+llvm_value_t llvm_builder_alloca(llvm_builder_t *builder, llvm_type_t type);
+llvm_value_t llvm_builder_load(llvm_builder_t *builder, llvm_type_t type, llvm_value_t pointer);
+void llvm_builder_store(llvm_builder_t *builder, llvm_type_t type, llvm_value_t value, llvm_value_t pointer);
+void llvm_builder_br(llvm_builder_t *builder, uint block);
+void llvm_builder_cond_br(llvm_builder_t *builder, llvm_value_t condition, uint if_true, uint if_false);
+// Phis always come first in their block, wherever they are appended.
+llvm_value_t llvm_builder_phi(llvm_builder_t *builder, llvm_type_t type, const llvm_phi_incoming_t *incoming, size_t count);
+
+// Variables are an alternative to stack slots: the builder keeps track of
+// their value in every block and places the phis where control flow joins,
+// following Braun et al., "Simple and Efficient Construction of Static
+// Single Assignment Form". Reads in a block whose predecessors may still
+// grow get a phi that is completed once the block is sealed; blocks still
+// open are sealed by `llvm_builder_finish`. Phis that turn out to merge a
+// single value are dropped. Reading a variable on a path where it was never
+// written gives `undef`.
+uint llvm_builder_declare_variable(llvm_builder_t *builder, llvm_type_t type);
+void llvm_builder_write_variable(llvm_builder_t *builder, uint variable, llvm_value_t value);
+llvm_value_t llvm_builder_read_variable(llvm_builder_t *builder, uint variable);
+// Promises that every branch to `block` has been appended.
+void llvm_builder_seal_block(llvm_builder_t *builder, uint block);
+// For bodies that number their own locals, as text does: with `maps_locals`
+// set, operands name locals by those numbers, bound here to the instructions.
+void llvm_builder_name_local(llvm_builder_t *builder, uint idx, llvm_value_t handle);
+bool llvm_builder_has_local(llvm_builder_t *builder, uint idx);
+// Leaves the value of the last instruction appended without a name.
+void llvm_builder_discard(llvm_builder_t *builder);
+// Lays the body out and adds the function to the module. Returns false, like
+// `llvm_add_function`, when the name is already taken.
+bool llvm_builder_finish(llvm_builder_t *builder);
+// Same as `llvm_builder_finish`, returning the code instead of adding it.
+llvm_code_t *llvm_builder_finish_code(llvm_builder_t *builder);
+
+// Index of every instruction among those that produce a named value, or
+// `(u32)-1`. Text numbers these values after the arguments; bitcode numbers
+// them after the function's constants. `scratch` is used when it has room
+// for `code->instruction_count` entries, otherwise the result is malloc'ed.
+u32 *llvm_code_results(llvm_code_t *code, u32 *scratch, size_t scratch_count);
+bool llvm_code_has_result(llvm_code_instruction_t instruction);
+bool llvm_code_is_terminator(llvm_code_instruction_t instruction);
+// Blocks the terminator of `block` can branch to, at most 2. None when the
+// block does not end in a terminator.
+u32 llvm_code_successors(llvm_code_t *code, u32 block, u32 successors[2]);
+// The constant a non-local ref stands for.
+llvm_value_t llvm_code_value(llvm_code_t *code, llvm_ref_t ref);
+
+void llvm_generate_type_declaration(llvm_generator_t *gen, str_builder_t *out, llvm_type_declaration_t type_declaration);
+void llvm_generate_global(llvm_generator_t *gen, str_builder_t *out, llvm_global_t global);
+void llvm_generate_function(llvm_generator_t *gen, str_builder_t *out, llvm_function_t function);
+void llvm_generate_local(llvm_generator_t *gen, str_builder_t *out, llvm_local_t local);
+void llvm_generate_type(llvm_generator_t *gen, str_builder_t *out, llvm_type_t type);
+void llvm_generate_value(llvm_generator_t *gen, str_builder_t *out, llvm_value_t value);
+void llvm_generate_instruction(llvm_generator_t *gen, str_builder_t *out, llvm_instruction_t instruction);
 
-str llvm_generate_linkage_type(llvm_linkage_type_t linkage);
-str llvm_generate_call_convention(llvm_call_convention_t call_convention);
+// Appends a floating point constant of any width, exactly.
+void llvm_generate_float(str_builder_t *out, double d);
+// Appends `bytes` the way the inside of a `c"..."` constant spells them,
+// which is what `LLVM_VALUE_CSTRING` and `LLVM_VALUE_BYTES` hold.
+void llvm_generate_escaped(str_builder_t *out, str bytes);
+// Appends the contents of a string constant, which are in that form
+// already. Escapes that are there are kept; quotes, control and non-ASCII
+// bytes, and backslashes that start no escape are escaped, so the text
+// always reads back as the bytes it stands for.
+void llvm_generate_escaped_text(str_builder_t *out, str text);
+void llvm_generate_linkage_type(str_builder_t *out, llvm_linkage_type_t linkage);
+void llvm_generate_visibility(str_builder_t *out, llvm_visibility_t visibility);
+void llvm_generate_dll_storage_class(str_builder_t *out, llvm_dll_storage_class_t dll_storage_class);
+void llvm_generate_call_convention(str_builder_t *out, llvm_call_convention_t call_convention);
 
 #endif // __LLVM_H
\ No newline at end of file
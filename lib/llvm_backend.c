@@ -0,0 +1,258 @@
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // posix_spawn, pthread_sigmask, poll
+#endif
+#include "llvm.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <threads.h>
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif // !defined(_WIN32) && !defined(_WIN64)
+
+void llvm_backend_result_free(llvm_backend_result_t *result) {
+    str_free(&result->output);
+    str_free(&result->errors);
+    *result = (llvm_backend_result_t){0};
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+bool llvm_backend_run(const llvm_backend_t *backend, const llvm_backend_job_t *jobs, size_t n, llvm_backend_result_t *results) {
+    (void)backend;
+    (void)jobs;
+    for (size_t i = 0; i < n; i++) {
+        str_builder_t errors;
+        str_builder_init(&errors);
+        str_builder_append_cstr(&errors, "backends cannot be started on this platform\n");
+        results[i] = (llvm_backend_result_t){.status = -1, .errors = str_builder_take(&errors)};
+    }
+    return n == 0;
+}
+#else
+// A running backend as seen from the parent: the ends of its three pipes
+// that were kept, each -1 once closed.
+typedef struct llvm_backend_process_t {
+    pid_t pid;
+    int in;
+    int out;
+    int err;
+    str_builder_t output;
+    str_builder_t errors;
+    bool is_broken; // the backend stopped reading before all input was sent
+} llvm_backend_process_t;
+
+typedef struct llvm_backend_pool_t {
+    const llvm_backend_t *backend;
+    const llvm_backend_job_t *jobs;
+    size_t job_count;
+    llvm_backend_result_t *results;
+    atomic_size_t next_job;
+} llvm_backend_pool_t;
+
+// Pipes are created close-on-exec, and only the ends a child needs are
+// duplicated onto its standard streams. Creating them and marking them
+// cannot be one step in POSIX, so both happen under this lock together with
+// the spawn: otherwise a backend started in between would inherit the write
+// end of another one's input, which then never sees the end of it.
+static mtx_t llvm_backend_spawn_lock;
+static once_flag llvm_backend_spawn_once = ONCE_FLAG_INIT;
+
+static void llvm_backend_init_lock(void) {
+    mtx_init(&llvm_backend_spawn_lock, mtx_plain);
+}
+
+static void llvm_backend_close(int *fd) {
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+}
+
+static bool llvm_backend_pipe(int fds[2]) {
+    if (pipe(fds) != 0)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+// Returns 0 once the process runs, otherwise the reason it does not.
+static int llvm_backend_spawn(llvm_backend_process_t *p, char *const *argv) {
+    int in[2] = {-1, -1}, out[2] = {-1, -1}, err[2] = {-1, -1};
+    call_once(&llvm_backend_spawn_once, llvm_backend_init_lock);
+    mtx_lock(&llvm_backend_spawn_lock);
+    int error = llvm_backend_pipe(in) && llvm_backend_pipe(out) && llvm_backend_pipe(err) ? 0 : errno;
+    if (error == 0) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+        // The calling thread ignores SIGPIPE (see `llvm_backend_worker`);
+        // the backend gets the usual behaviour back.
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        sigset_t signals;
+        sigemptyset(&signals);
+        posix_spawnattr_setsigmask(&attributes, &signals);
+        sigaddset(&signals, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attributes, &signals);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+        error = posix_spawnp(&p->pid, argv[0], &actions, &attributes, argv, environ);
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    mtx_unlock(&llvm_backend_spawn_lock);
+
+    llvm_backend_close(&in[0]);
+    llvm_backend_close(&out[1]);
+    llvm_backend_close(&err[1]);
+    p->in = in[1];
+    p->out = out[0];
+    p->err = err[0];
+    if (error != 0) {
+        llvm_backend_close(&p->in);
+        llvm_backend_close(&p->out);
+        llvm_backend_close(&p->err);
+        return error;
+    }
+    fcntl(p->in, F_SETFL, fcntl(p->in, F_GETFL) | O_NONBLOCK);
+    fcntl(p->out, F_SETFL, fcntl(p->out, F_GETFL) | O_NONBLOCK);
+    fcntl(p->err, F_SETFL, fcntl(p->err, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+// Takes whatever `*fd` has ready, closing it at the end of the stream.
+static void llvm_backend_drain(int *fd, str_builder_t *into) {
+    char buffer[16384];
+    while (*fd >= 0) {
+        ssize_t got = read(*fd, buffer, sizeof(buffer));
+        if (got > 0) {
+            str_builder_append(into, (str){buffer, (size_t)got});
+        } else if (got < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (got == 0 || errno != EAGAIN)
+                llvm_backend_close(fd);
+            return;
+        }
+    }
+}
+
+// Waits until the backend's input can take more or it has written
+// something, and collects what it wrote. Both outputs are kept flowing
+// while input is sent, so a backend that reports a lot never blocks on a
+// full pipe while the parent waits to write.
+static void llvm_backend_wait(llvm_backend_process_t *p) {
+    struct pollfd fds[3] = {{p->in, POLLOUT, 0}, {p->out, POLLIN, 0}, {p->err, POLLIN, 0}};
+    if (poll(fds, 3, -1) < 0) {
+        if (errno != EINTR) {
+            llvm_backend_close(&p->out);
+            llvm_backend_close(&p->err);
+        }
+        return;
+    }
+    if (fds[1].revents != 0)
+        llvm_backend_drain(&p->out, &p->output);
+    if (fds[2].revents != 0)
+        llvm_backend_drain(&p->err, &p->errors);
+}
+
+static bool llvm_backend_write(void *ctx, const char *data, size_t size) {
+    llvm_backend_process_t *p = ctx;
+    while (size > 0) {
+        ssize_t written = write(p->in, data, size);
+        if (written >= 0) {
+            data += written;
+            size -= (size_t)written;
+        } else if (errno == EAGAIN) {
+            llvm_backend_wait(p);
+        } else if (errno != EINTR) {
+            // EPIPE: the backend exited or closed its input.
+            p->is_broken = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static void llvm_backend_compile(llvm_backend_pool_t *pool, size_t index) {
+    const llvm_backend_job_t *job = &pool->jobs[index];
+    llvm_backend_result_t *result = &pool->results[index];
+    *result = (llvm_backend_result_t){.status = -1};
+
+    size_t argc = 0;
+    while (pool->backend->argv[argc] != NULL)
+        argc++;
+    char **argv = calloc(argc + 3, sizeof(char *));
+    memcpy(argv, pool->backend->argv, argc * sizeof(char *));
+    if (job->output != NULL) {
+        argv[argc++] = "-o";
+        argv[argc++] = (char *)job->output;
+    }
+
+    llvm_backend_process_t p = {0};
+    str_builder_init(&p.output);
+    str_builder_init(&p.errors);
+    result->spawn_error = llvm_backend_spawn(&p, argv);
+    free(argv);
+    if (result->spawn_error == 0) {
+        // The backend compiles while the rest of the module is generated.
+        llvm_generate_to_sink(job->gen, sink_callback(llvm_backend_write, &p));
+        llvm_backend_close(&p.in);
+        while (p.out >= 0 || p.err >= 0)
+            llvm_backend_wait(&p);
+
+        int status;
+        while (waitpid(p.pid, &status, 0) < 0 && errno == EINTR)
+            ;
+        if (WIFEXITED(status))
+            result->status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status))
+            result->signal = WTERMSIG(status);
+        result->ok = result->status == 0 && !p.is_broken;
+    }
+    result->output = str_builder_take(&p.output);
+    result->errors = str_builder_take(&p.errors);
+}
+
+static int llvm_backend_worker(void *arg) {
+    llvm_backend_pool_t *pool = arg;
+    // A backend that exits early must not take the process down with it;
+    // the failed write is reported instead. The signal is per thread, and
+    // so is this mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    for (;;) {
+        size_t index = atomic_fetch_add(&pool->next_job, 1);
+        if (index >= pool->job_count)
+            return 0;
+        llvm_backend_compile(pool, index);
+    }
+}
+
+bool llvm_backend_run(const llvm_backend_t *backend, const llvm_backend_job_t *jobs, size_t n, llvm_backend_result_t *results) {
+    llvm_backend_pool_t pool = {backend, jobs, n, results, 0};
+    size_t worker_count = MIN((size_t)MAX(backend->max_processes, 1), n);
+    thrd_t *threads = calloc(worker_count, sizeof(thrd_t));
+    for (size_t i = 0; i < worker_count; i++)
+        if (thrd_create(&threads[i], llvm_backend_worker, &pool) != thrd_success)
+            fatal("failed to start backend worker %zu.", i);
+    for (size_t i = 0; i < worker_count; i++)
+        thrd_join(threads[i], NULL);
+    free(threads);
+
+    bool ok = true;
+    for (size_t i = 0; i < n; i++)
+        ok = ok && results[i].ok;
+    return ok;
+}
+#endif // defined(_WIN32) || defined(_WIN64)
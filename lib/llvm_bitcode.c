@@ -0,0 +1,1201 @@
+#include "llvm.h"
+
+#include <ctype.h>
+
+// Writes the module in LLVM's bitcode container (LLVM 14 layout with typed
+// pointers and a string table). Only the records needed to describe what
+// `llvm_generator_t` can express are produced.
+
+enum {
+    BC_ENTER_SUBBLOCK = 1,
+    BC_END_BLOCK = 0,
+    BC_DEFINE_ABBREV = 2,
+    BC_UNABBREV_RECORD = 3,
+    BC_FIRST_ABBREV = 4,
+};
+
+enum {
+    BC_BLOCKINFO_BLOCK = 0,
+    BC_MODULE_BLOCK = 8,
+    BC_CONSTANTS_BLOCK = 11,
+    BC_FUNCTION_BLOCK = 12,
+    BC_IDENTIFICATION_BLOCK = 13,
+    BC_VALUE_SYMTAB_BLOCK = 14,
+    BC_TYPE_BLOCK = 17,
+    BC_STRTAB_BLOCK = 23,
+};
+
+enum {
+    BC_BLOCKINFO_SETBID = 1,
+    BC_IDENTIFICATION_STRING = 1,
+    BC_IDENTIFICATION_EPOCH = 2,
+    BC_MODULE_VERSION = 1,
+    BC_MODULE_GLOBALVAR = 7,
+    BC_MODULE_FUNCTION = 8,
+    BC_TYPE_NUMENTRY = 1,
+    BC_TYPE_FLOAT = 3,
+    BC_TYPE_DOUBLE = 4,
+    BC_TYPE_INTEGER = 7,
+    BC_TYPE_POINTER = 8,
+    BC_TYPE_ARRAY = 11,
+    BC_TYPE_VECTOR = 12,
+    BC_TYPE_STRUCT_ANON = 18,
+    BC_TYPE_STRUCT_NAME = 19,
+    BC_TYPE_STRUCT_NAMED = 20,
+    BC_TYPE_FUNCTION = 21,
+    BC_CST_SETTYPE = 1,
+    BC_CST_UNDEF = 3,
+    BC_CST_INTEGER = 4,
+    BC_CST_FLOAT = 6,
+    BC_CST_STRING = 8,
+    BC_CST_CSTRING = 9,
+    BC_CST_CE_GEP = 12,
+    BC_CST_CE_INBOUNDS_GEP = 20,
+    BC_FUNC_DECLAREBLOCKS = 1,
+    BC_FUNC_INST_RET = 10,
+    BC_FUNC_INST_BR = 11,
+    BC_FUNC_INST_PHI = 16,
+    BC_FUNC_INST_ALLOCA = 19,
+    BC_FUNC_INST_LOAD = 20,
+    BC_FUNC_INST_CALL = 34,
+    BC_FUNC_INST_GEP = 43,
+    BC_FUNC_INST_STORE = 44,
+    BC_VST_BBENTRY = 2,
+    BC_STRTAB_BLOB = 1,
+};
+
+enum {
+    BC_OP_LITERAL,
+    BC_OP_FIXED,
+    BC_OP_VBR,
+    BC_OP_ARRAY,
+    BC_OP_CHAR6,
+    BC_OP_BLOB,
+};
+
+typedef struct bc_op_t {
+    u8 kind;
+    u64 value; // literal value or field width
+} bc_op_t;
+
+typedef struct bc_abbrev_t {
+    bc_op_t ops[6];
+    uint count;
+} bc_abbrev_t;
+
+#define BC_MAX_DEPTH 8
+
+typedef struct bc_stream_t {
+    str_builder_t out;
+    u64 acc;
+    uint bits;
+    uint width;
+    struct {
+        size_t length_offset;
+        uint width;
+    } blocks[BC_MAX_DEPTH];
+    uint depth;
+} bc_stream_t;
+
+// Record operands are collected here before being written out.
+typedef struct bc_record_t {
+    u64 *data;
+    size_t count;
+    size_t capacity;
+} bc_record_t;
+
+typedef struct bc_type_t {
+    u32 code;
+    size_t offset; // into `type_ops`
+    size_t count;
+    u64 hash;
+} bc_type_t;
+
+typedef struct bc_constant_t {
+    u32 type;
+    u8 kind; // an `LLVM_VALUE_*_` kind
+    u64 bits;
+    str text;
+    u32 source;     // getelementptr: the type indexed into, `text` is the global
+                    // and `bits` the pointer type << 1 | is_inbounds
+    int indices[2];
+    u64 hash;
+} bc_constant_t;
+
+// Abbreviations shared by every instance of the constants, function and
+// value symbol table blocks, registered once through the BLOCKINFO block.
+// Their type fields depend on the module, so each writer has its own.
+typedef struct bc_abbrevs_t {
+    bc_abbrev_t settype, integer, float_, string, cstring, gep, inbounds_gep, undef;
+    bc_abbrev_t ret, gep_instruction;
+    bc_abbrev_t bbentry;
+} bc_abbrevs_t;
+
+typedef struct bc_writer_t {
+    llvm_generator_t *gen;
+    bc_stream_t stream;
+    bc_record_t record;
+
+    bc_type_t *types;
+    size_t type_count, type_capacity;
+    u64 *type_ops;
+    size_t type_op_count, type_op_capacity;
+    u32 *type_slots;
+    size_t type_slot_count;
+    u32 *canonical; // canonical llvm type id -> bitcode type index + 1
+    size_t canonical_count;
+    uint type_bits;
+    bc_abbrevs_t abbrevs;
+
+    u32 *function_types; // per function
+    u32 *named_structs;  // per type declaration, 0 when it is not a struct
+    u32 i32_type;
+
+    bc_constant_t *constants;
+    size_t constant_count, constant_capacity;
+    u32 *constant_slots;
+    size_t constant_slot_count;
+
+    u32 *results; // per instruction of the current function, see `llvm_code_results`
+    size_t result_capacity;
+
+    str_builder_t strtab;
+} bc_writer_t;
+
+static void bc_push(bc_record_t *record, u64 value) {
+    if (record->count == record->capacity) {
+        record->capacity = MAX(record->capacity * 2, 32);
+        record->data = realloc(record->data, record->capacity * sizeof(u64));
+    }
+    record->data[record->count++] = value;
+}
+
+static void bc_emit(bc_stream_t *s, u64 value, uint width) {
+    if (width == 0)
+        return;
+    s->acc |= value << s->bits;
+    s->bits += width;
+    if (s->bits >= 32) {
+        u32 word = (u32)s->acc;
+        char bytes[4] = {(char)word, (char)(word >> 8), (char)(word >> 16), (char)(word >> 24)};
+        str_builder_append(&s->out, (str){bytes, 4});
+        s->bits -= 32;
+        // `value` may have had bits beyond what fit into the word.
+        s->acc = s->bits ? value >> (width - s->bits) : 0;
+    }
+}
+
+static void bc_emit_vbr(bc_stream_t *s, u64 value, uint width) {
+    u64 threshold = 1ull << (width - 1);
+    while (value >= threshold) {
+        bc_emit(s, (value & (threshold - 1)) | threshold, width);
+        value >>= width - 1;
+    }
+    bc_emit(s, value, width);
+}
+
+static void bc_align32(bc_stream_t *s) {
+    if (s->bits > 0)
+        bc_emit(s, 0, 32 - s->bits);
+}
+
+static void bc_enter_block(bc_stream_t *s, uint block_id, uint width) {
+    assert(s->depth < BC_MAX_DEPTH);
+    bc_emit(s, BC_ENTER_SUBBLOCK, s->width);
+    bc_emit_vbr(s, block_id, 8);
+    bc_emit_vbr(s, width, 4);
+    bc_align32(s);
+    s->blocks[s->depth].length_offset = s->out.count;
+    s->blocks[s->depth].width = s->width;
+    s->depth++;
+    bc_emit(s, 0, 32);
+    s->width = width;
+}
+
+static void bc_exit_block(bc_stream_t *s) {
+    bc_emit(s, BC_END_BLOCK, s->width);
+    bc_align32(s);
+    s->depth--;
+    size_t offset = s->blocks[s->depth].length_offset;
+    u32 words = (u32)((s->out.count - offset - 4) / 4);
+    for (int i = 0; i < 4; i++)
+        s->out.chars[offset + i] = (char)(words >> (8 * i));
+    s->width = s->blocks[s->depth].width;
+}
+
+static void bc_define_abbrev(bc_stream_t *s, bc_abbrev_t *abbrev) {
+    bc_emit(s, BC_DEFINE_ABBREV, s->width);
+    bc_emit_vbr(s, abbrev->count, 5);
+    for (uint i = 0; i < abbrev->count; i++) {
+        bc_op_t op = abbrev->ops[i];
+        if (op.kind == BC_OP_LITERAL) {
+            bc_emit(s, 1, 1);
+            bc_emit_vbr(s, op.value, 8);
+            continue;
+        }
+        bc_emit(s, 0, 1);
+        bc_emit(s, op.kind, 3);
+        if (op.kind == BC_OP_FIXED || op.kind == BC_OP_VBR)
+            bc_emit_vbr(s, op.value, 5);
+    }
+}
+
+static u32 bc_char6(u64 c) {
+    if (c >= 'a' && c <= 'z') return (u32)(c - 'a');
+    if (c >= 'A' && c <= 'Z') return (u32)(c - 'A' + 26);
+    if (c >= '0' && c <= '9') return (u32)(c - '0' + 52);
+    if (c == '.') return 62;
+    return 63;
+}
+
+static void bc_emit_scalar(bc_stream_t *s, bc_op_t op, u64 value) {
+    switch (op.kind) {
+        case BC_OP_FIXED: bc_emit(s, value, (uint)op.value); break;
+        case BC_OP_VBR: bc_emit_vbr(s, value, (uint)op.value); break;
+        case BC_OP_CHAR6: bc_emit(s, bc_char6(value), 6); break;
+    }
+}
+
+// Writes `code` followed by the collected operands, either through `abbrev`
+// (whose first operand is the literal code) or as an unabbreviated record.
+static void bc_write_record(bc_stream_t *s, u32 code, bc_record_t *record, uint abbrev_id, bc_abbrev_t *abbrev) {
+    if (abbrev == NULL) {
+        bc_emit(s, BC_UNABBREV_RECORD, s->width);
+        bc_emit_vbr(s, code, 6);
+        bc_emit_vbr(s, record->count, 6);
+        for (size_t i = 0; i < record->count; i++)
+            bc_emit_vbr(s, record->data[i], 6);
+        record->count = 0;
+        return;
+    }
+
+    bc_emit(s, abbrev_id, s->width);
+    size_t next = 0;
+    for (uint i = 1; i < abbrev->count; i++) {
+        bc_op_t op = abbrev->ops[i];
+        if (op.kind == BC_OP_LITERAL) {
+            next++;
+        } else if (op.kind == BC_OP_ARRAY) {
+            bc_op_t element = abbrev->ops[++i];
+            bc_emit_vbr(s, record->count - next, 6);
+            for (; next < record->count; next++)
+                bc_emit_scalar(s, element, record->data[next]);
+        } else {
+            bc_emit_scalar(s, op, record->data[next++]);
+        }
+    }
+    record->count = 0;
+}
+
+static void bc_write_blob(bc_stream_t *s, uint abbrev_id, str blob) {
+    bc_emit(s, abbrev_id, s->width);
+    bc_emit_vbr(s, blob.count, 6);
+    bc_align32(s);
+    str_builder_append(&s->out, blob);
+    while (s->out.count % 4 != 0)
+        str_builder_append_char(&s->out, 0);
+}
+
+#define BC_ABBREV(...) ((bc_abbrev_t){{__VA_ARGS__}, sizeof((bc_op_t[]){__VA_ARGS__}) / sizeof(bc_op_t)})
+#define BC_LIT(v) ((bc_op_t){BC_OP_LITERAL, (v)})
+#define BC_FIXED(w) ((bc_op_t){BC_OP_FIXED, (w)})
+#define BC_VBR(w) ((bc_op_t){BC_OP_VBR, (w)})
+#define BC_ARRAY() ((bc_op_t){BC_OP_ARRAY, 0})
+#define BC_CHAR6() ((bc_op_t){BC_OP_CHAR6, 0})
+#define BC_BLOB() ((bc_op_t){BC_OP_BLOB, 0})
+
+// ---------------------------------------------------------------------------
+// Type table
+// ---------------------------------------------------------------------------
+
+static u64 bc_type_hash(u32 code, u64 *ops, size_t count) {
+    u64 hash = hash_combine(0, code);
+    for (size_t i = 0; i < count; i++)
+        hash = hash_combine(hash, ops[i]);
+    return hash;
+}
+
+static u32 bc_type_append(bc_writer_t *w, u32 code, u64 *ops, size_t count, u64 hash) {
+    if (w->type_count == w->type_capacity) {
+        w->type_capacity = MAX(w->type_capacity * 2, 32);
+        w->types = realloc(w->types, w->type_capacity * sizeof(bc_type_t));
+    }
+    if (w->type_op_count + count > w->type_op_capacity) {
+        w->type_op_capacity = MAX(w->type_op_capacity * 2, w->type_op_count + count + 64);
+        w->type_ops = realloc(w->type_ops, w->type_op_capacity * sizeof(u64));
+    }
+    if (count > 0)
+        memcpy(w->type_ops + w->type_op_count, ops, count * sizeof(u64));
+    w->types[w->type_count] = (bc_type_t){code, w->type_op_count, count, hash};
+    w->type_op_count += count;
+    return (u32)w->type_count++;
+}
+
+static void bc_type_slots_grow(bc_writer_t *w) {
+    size_t slot_count = MAX(w->type_slot_count * 2, 64);
+    u32 *slots = calloc(slot_count, sizeof(u32));
+    for (size_t i = 0; i < w->type_count; i++) {
+        if (w->types[i].code == BC_TYPE_STRUCT_NAMED)
+            continue;
+        size_t slot = w->types[i].hash & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (u32)(i + 1);
+    }
+    free(w->type_slots);
+    w->type_slots = slots;
+    w->type_slot_count = slot_count;
+}
+
+// Literal types are structural, so equal records share one table entry.
+static u32 bc_type_intern(bc_writer_t *w, u32 code, u64 *ops, size_t count) {
+    if ((w->type_count + 1) * 2 > w->type_slot_count)
+        bc_type_slots_grow(w);
+    u64 hash = bc_type_hash(code, ops, count);
+    size_t slot = hash & (w->type_slot_count - 1);
+    while (w->type_slots[slot] != 0) {
+        bc_type_t *type = &w->types[w->type_slots[slot] - 1];
+        if (type->hash == hash && type->code == code && type->count == count
+            && (count == 0 || memcmp(w->type_ops + type->offset, ops, count * sizeof(u64)) == 0))
+            return w->type_slots[slot] - 1;
+        slot = (slot + 1) & (w->type_slot_count - 1);
+    }
+    u32 index = bc_type_append(w, code, ops, count, hash);
+    w->type_slots[slot] = index + 1;
+    return index;
+}
+
+static u32 bc_type(bc_writer_t *w, llvm_type_t type) {
+    llvm_type_t *canonical = llvm_type_get(w->gen, type);
+    if (canonical->id > w->canonical_count) {
+        size_t count = MAX(w->canonical_count * 2, (size_t)canonical->id + 64);
+        w->canonical = realloc(w->canonical, count * sizeof(u32));
+        memset(w->canonical + w->canonical_count, 0, (count - w->canonical_count) * sizeof(u32));
+        w->canonical_count = count;
+    }
+    if (w->canonical[canonical->id - 1] != 0)
+        return w->canonical[canonical->id - 1] - 1;
+
+    u32 index;
+    switch (canonical->type) {
+        case LLVM_TYPE_INT_: {
+            u64 ops[] = {(u64)canonical->int_};
+            index = bc_type_intern(w, BC_TYPE_INTEGER, ops, 1);
+        } break;
+        case LLVM_TYPE_FLOAT_: {
+            if (canonical->float_ != 32 && canonical->float_ != 64)
+                fatal("invalid float size.");
+            index = bc_type_intern(w, canonical->float_ == 32 ? BC_TYPE_FLOAT : BC_TYPE_DOUBLE, NULL, 0);
+        } break;
+        case LLVM_TYPE_POINTER_: {
+            u64 ops[] = {bc_type(w, *canonical->pointer.inner), 0};
+            index = bc_type_intern(w, BC_TYPE_POINTER, ops, 2);
+        } break;
+        case LLVM_TYPE_ARRAY_: {
+            u64 ops[] = {(u64)canonical->array.size, bc_type(w, *canonical->array.inner)};
+            index = bc_type_intern(w, BC_TYPE_ARRAY, ops, 2);
+        } break;
+        case LLVM_TYPE_VECTOR_: {
+            u64 ops[] = {(u64)canonical->vector.size, bc_type(w, *canonical->vector.inner)};
+            index = bc_type_intern(w, BC_TYPE_VECTOR, ops, 2);
+        } break;
+        case LLVM_TYPE_STRUCTURE_: {
+            size_t count = canonical->structure.members.size + 1;
+            u64 *ops = malloc(count * sizeof(u64));
+            ops[0] = canonical->structure.is_packed;
+            for (size_t i = 1; i < count; i++)
+                ops[i] = bc_type(w, *canonical->structure.members.data[i - 1]);
+            index = bc_type_intern(w, BC_TYPE_STRUCT_ANON, ops, count);
+            free(ops);
+        } break;
+        default: fatal("unsupported type in bitcode.");
+    }
+    w->canonical[canonical->id - 1] = index + 1;
+    return index;
+}
+
+static u32 bc_function_type(bc_writer_t *w, llvm_type_t return_type, llvm_type_t *args, size_t arg_count, bool is_vararg) {
+    u64 small[16];
+    u64 *ops = arg_count + 2 <= 16 ? small : malloc((arg_count + 2) * sizeof(u64));
+    ops[0] = is_vararg;
+    ops[1] = bc_type(w, return_type);
+    for (size_t i = 0; i < arg_count; i++)
+        ops[i + 2] = bc_type(w, args[i]);
+    u32 index = bc_type_intern(w, BC_TYPE_FUNCTION, ops, arg_count + 2);
+    if (ops != small)
+        free(ops);
+    return index;
+}
+
+static u32 bc_signature(bc_writer_t *w, llvm_function_t *function) {
+    return bc_function_type(w, function->return_type, function->args.data, function->args.size, function->is_vararg);
+}
+
+static u32 bc_type_id(bc_writer_t *w, u32 id) {
+    return bc_type(w, *llvm_type_by_id(w->gen, id));
+}
+
+// Constant expressions refer to types beyond their own.
+static void bc_collect_value(bc_writer_t *w, llvm_value_t value) {
+    if (value.type == LLVM_VALUE_GETELEMENTPTR_) {
+        bc_type(w, *value.getelementptr.type);
+        bc_type(w, LLVM_TYPE_POINTER(*value.getelementptr.type));
+    }
+}
+
+static void bc_collect_instruction(bc_writer_t *w, llvm_code_t *code, llvm_code_instruction_t instruction) {
+    u32 *operands = &code->operands[instruction.operands];
+    switch (instruction.opcode) {
+        case LLVM_INSTR_CALL: {
+            u32 name = code->symbols[instruction.symbol];
+            if (llvm_find_function_id(w->gen, name) == NULL)
+                fatal("call to unknown function '" STR_ARG "'.", STR_FMT(llvm_name_text(w->gen, name)));
+            u32 count = instruction.operand_count / 2;
+            for (u32 i = 0; i < count; i++) {
+                bc_type_id(w, operands[count + i]);
+                if (LLVM_REF_KIND(operands[i]) == LLVM_REF_CONSTANT)
+                    bc_collect_value(w, llvm_code_value(code, operands[i]));
+            }
+        } break;
+        case LLVM_INSTR_RETURN: {
+            if (LLVM_REF_KIND(operands[0]) != LLVM_REF_LOCAL)
+                bc_type_id(w, instruction.type);
+            if (LLVM_REF_KIND(operands[0]) == LLVM_REF_CONSTANT)
+                bc_collect_value(w, llvm_code_value(code, operands[0]));
+        } break;
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            bc_type_id(w, instruction.type);
+        } break;
+        case LLVM_INSTR_ALLOCA:
+        case LLVM_INSTR_LOAD:
+        case LLVM_INSTR_STORE:
+        case LLVM_INSTR_COND_BR:
+        case LLVM_INSTR_PHI: {
+            // Constant operands need the types of the values they stand for.
+            bc_type_id(w, instruction.type);
+            if (instruction.opcode != LLVM_INSTR_COND_BR && instruction.opcode != LLVM_INSTR_PHI)
+                bc_type(w, LLVM_TYPE_POINTER(*llvm_type_by_id(w->gen, instruction.type)));
+            for (u32 i = 0; i < LLVM_CODE_REF_COUNT(instruction); i++)
+                if (LLVM_REF_KIND(operands[i]) == LLVM_REF_CONSTANT)
+                    bc_collect_value(w, llvm_code_value(code, operands[i]));
+        } break;
+    }
+}
+
+static void bc_collect_types(bc_writer_t *w) {
+    llvm_generator_t *gen = w->gen;
+    w->i32_type = bc_type(w, LLVM_TYPE_INT(32));
+
+    w->named_structs = calloc(MAX(gen->type_declarations.size, 1), sizeof(u32));
+    for (size_t i = 0; i < gen->type_declarations.size; i++) {
+        llvm_type_t type = gen->type_declarations.data[i].type;
+        if (type.type != LLVM_TYPE_STRUCTURE_)
+            continue;
+        size_t count = type.structure.members.size + 1;
+        u64 *ops = malloc(count * sizeof(u64));
+        ops[0] = type.structure.is_packed;
+        for (size_t j = 1; j < count; j++)
+            ops[j] = bc_type(w, *type.structure.members.data[j - 1]);
+        w->named_structs[i] = bc_type_append(w, BC_TYPE_STRUCT_NAMED, ops, count, 0) + 1;
+        free(ops);
+    }
+
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        if (global->type == NULL)
+            fatal("global '" STR_ARG "' has no type.", STR_FMT(global->name));
+        bc_type(w, *global->type);
+        bc_collect_value(w, global->value);
+    }
+
+    w->function_types = calloc(MAX(gen->functions.size, 1), sizeof(u32));
+    for (size_t i = 0; i < gen->functions.size; i++)
+        w->function_types[i] = bc_signature(w, &gen->functions.data[i]);
+
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        if (function->is_native || function->code == NULL)
+            continue;
+        for (u32 j = 0; j < function->code->instruction_count; j++)
+            bc_collect_instruction(w, function->code, function->code->instructions[j]);
+    }
+
+    w->type_bits = 1;
+    while ((1ull << w->type_bits) < w->type_count + 1)
+        w->type_bits++;
+}
+
+static void bc_write_types(bc_writer_t *w) {
+    bc_stream_t *s = &w->stream;
+    bc_enter_block(s, BC_TYPE_BLOCK, 4);
+
+    bc_abbrev_t pointer = BC_ABBREV(BC_LIT(BC_TYPE_POINTER), BC_FIXED(w->type_bits), BC_LIT(0));
+    bc_abbrev_t function = BC_ABBREV(BC_LIT(BC_TYPE_FUNCTION), BC_FIXED(1), BC_ARRAY(), BC_FIXED(w->type_bits));
+    bc_abbrev_t structure = BC_ABBREV(BC_LIT(BC_TYPE_STRUCT_ANON), BC_FIXED(1), BC_ARRAY(), BC_FIXED(w->type_bits));
+    bc_abbrev_t array = BC_ABBREV(BC_LIT(BC_TYPE_ARRAY), BC_VBR(8), BC_FIXED(w->type_bits));
+    bc_define_abbrev(s, &pointer);
+    bc_define_abbrev(s, &function);
+    bc_define_abbrev(s, &structure);
+    bc_define_abbrev(s, &array);
+
+    bc_push(&w->record, w->type_count);
+    bc_write_record(s, BC_TYPE_NUMENTRY, &w->record, 0, NULL);
+
+    size_t next_named = 0;
+    for (size_t i = 0; i < w->type_count; i++) {
+        bc_type_t type = w->types[i];
+        if (type.code == BC_TYPE_STRUCT_NAMED) {
+            while (w->named_structs[next_named] != i + 1)
+                next_named++;
+            str name = w->gen->type_declarations.data[next_named++].name;
+            for (size_t j = 0; j < name.count; j++)
+                bc_push(&w->record, (u8)name.chars[j]);
+            bc_write_record(s, BC_TYPE_STRUCT_NAME, &w->record, 0, NULL);
+        }
+        for (size_t j = 0; j < type.count; j++)
+            bc_push(&w->record, w->type_ops[type.offset + j]);
+        switch (type.code) {
+            case BC_TYPE_POINTER: {
+                w->record.count = 1; // the address space is a literal 0
+                bc_write_record(s, type.code, &w->record, BC_FIRST_ABBREV, &pointer);
+            } break;
+            case BC_TYPE_FUNCTION: bc_write_record(s, type.code, &w->record, BC_FIRST_ABBREV + 1, &function); break;
+            case BC_TYPE_STRUCT_ANON: bc_write_record(s, type.code, &w->record, BC_FIRST_ABBREV + 2, &structure); break;
+            case BC_TYPE_ARRAY: bc_write_record(s, type.code, &w->record, BC_FIRST_ABBREV + 3, &array); break;
+            default: bc_write_record(s, type.code, &w->record, 0, NULL); break;
+        }
+    }
+
+    bc_exit_block(s);
+}
+
+// ---------------------------------------------------------------------------
+// Module
+// ---------------------------------------------------------------------------
+
+// The zero linkage is what the textual emitter leaves unspelled, so it is
+// written as the default (external) linkage here as well.
+static u64 bc_linkage(llvm_linkage_type_t linkage) {
+    switch (linkage) {
+        case LLVM_LINKAGE_PRIVATE: return 0;
+        case LLVM_LINKAGE_EXTERNAL: return 0;
+        case LLVM_LINKAGE_INTERNAL: return 3;
+        case LLVM_LINKAGE_AVAILABLE_EXTERNALLY: return 12;
+        case LLVM_LINKAGE_LINKONCE: return 18;
+        case LLVM_LINKAGE_WEAK: return 16;
+        case LLVM_LINKAGE_COMMON: return 8;
+        case LLVM_LINKAGE_APPENDING: return 2;
+        case LLVM_LINKAGE_EXTERN_WEAK: return 7;
+    }
+    return 0;
+}
+
+static u64 bc_call_convention(llvm_call_convention_t call_convention) {
+    switch (call_convention) {
+        case LLVM_CALL_CONVENTION_C: return 0;
+        case LLVM_CALL_CONVENTION_FAST: return 8;
+        case LLVM_CALL_CONVENTION_COLD: return 9;
+        case LLVM_CALL_CONVENTION_GHC: return 10;
+    }
+    return 0;
+}
+
+static u64 bc_alignment(int alignment) {
+    if (alignment <= 0)
+        return 0;
+    if ((alignment & (alignment - 1)) != 0)
+        fatal("alignment %d is not a power of two.", alignment);
+    u64 log2 = 0;
+    while ((1 << log2) < alignment)
+        log2++;
+    return log2 + 1;
+}
+
+static u64 bc_strtab_add(bc_writer_t *w, str name) {
+    u64 offset = w->strtab.count;
+    str_builder_append(&w->strtab, name);
+    return offset;
+}
+
+static u64 bc_signed_vbr(s64 value) {
+    if (value >= 0)
+        return (u64)value << 1;
+    return ((u64)-value << 1) | 1;
+}
+
+// Textual constants may contain `\XX` escapes, which the text form leaves to
+// the IR parser; the bitcode holds the decoded bytes.
+static void bc_push_escaped(bc_record_t *record, str text) {
+    for (size_t i = 0; i < text.count; i++) {
+        char c = text.chars[i];
+        if (c == '\\' && i + 1 < text.count && text.chars[i + 1] == '\\') {
+            bc_push(record, '\\');
+            i++;
+        } else if (c == '\\' && i + 2 < text.count && isxdigit((u8)text.chars[i + 1]) && isxdigit((u8)text.chars[i + 2])) {
+            char hex[3] = {text.chars[i + 1], text.chars[i + 2], 0};
+            bc_push(record, (u64)strtoul(hex, NULL, 16));
+            i += 2;
+        } else {
+            bc_push(record, (u8)c);
+        }
+    }
+}
+
+static u32 bc_add_constant(bc_writer_t *w, bc_constant_t constant);
+
+static bc_constant_t bc_constant(bc_writer_t *w, llvm_type_t type, llvm_value_t value) {
+    bc_constant_t constant = {bc_type(w, type), (u8)value.type, 0, {0}, 0, {0}, 0};
+    switch (value.type) {
+        case LLVM_VALUE_INT_: constant.bits = bc_signed_vbr(value.int_); break;
+        case LLVM_VALUE_FLOAT_:
+        case LLVM_VALUE_DOUBLE_: {
+            // The constant is stored with the width of its type, whichever
+            // field the caller filled in.
+            double d = value.type == LLVM_VALUE_FLOAT_ ? (double)value.float_ : value.double_;
+            llvm_type_t *canonical = llvm_type_get(w->gen, type);
+            if (canonical->type == LLVM_TYPE_FLOAT_ && canonical->float_ == 32) {
+                float f = (float)d;
+                u32 bits;
+                memcpy(&bits, &f, sizeof(bits));
+                constant.bits = bits;
+            } else {
+                memcpy(&constant.bits, &d, sizeof(d));
+            }
+        } break;
+        case LLVM_VALUE_STRING_: constant.text = value.string_; break;
+        case LLVM_VALUE_CSTRING_: constant.text = value.cstring_; break;
+        case LLVM_VALUE_BYTES_: constant.text = value.bytes_; break;
+        case LLVM_VALUE_GETELEMENTPTR_: {
+            // The indices are constants of their own, placed before the
+            // expression that uses them.
+            constant.bits = (u64)bc_type(w, LLVM_TYPE_POINTER(*value.getelementptr.type)) << 1 | value.getelementptr.is_inbounds;
+            constant.text = value.getelementptr.name;
+            constant.source = bc_type(w, *value.getelementptr.type);
+            for (int i = 0; i < 2; i++) {
+                constant.indices[i] = value.getelementptr.indices[i];
+                bc_add_constant(w, bc_constant(w, LLVM_TYPE_INT(32), LLVM_VALUE_INT(constant.indices[i])));
+            }
+        } break;
+        case LLVM_VALUE_UNDEF_: break;
+        case LLVM_VALUE_LOCAL_:
+        case LLVM_VALUE_TYPE_:
+            fatal("value is not a constant.");
+    }
+    return constant;
+}
+
+static u64 bc_constant_hash(bc_constant_t *constant) {
+    u64 hash = hash_combine(hash_combine(0, constant->type), constant->kind);
+    hash = hash_combine(hash_combine(hash, constant->bits), str_hash(constant->text));
+    hash = hash_combine(hash, constant->source);
+    return hash_combine(hash_combine(hash, (u32)constant->indices[0]), (u32)constant->indices[1]);
+}
+
+static void bc_constant_slots_grow(bc_writer_t *w) {
+    size_t slot_count = MAX(w->constant_slot_count * 2, 64);
+    u32 *slots = calloc(slot_count, sizeof(u32));
+    for (size_t i = 0; i < w->constant_count; i++) {
+        size_t slot = w->constants[i].hash & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (u32)(i + 1);
+    }
+    free(w->constant_slots);
+    w->constant_slots = slots;
+    w->constant_slot_count = slot_count;
+}
+
+// Empties the table for the next block of constants. Only the slots in use
+// are cleared, so a large function does not make the ones after it slow.
+static void bc_clear_constants(bc_writer_t *w) {
+    for (size_t i = 0; i < w->constant_count; i++) {
+        size_t slot = w->constants[i].hash & (w->constant_slot_count - 1);
+        while (w->constant_slots[slot] != i + 1)
+            slot = (slot + 1) & (w->constant_slot_count - 1);
+        w->constant_slots[slot] = 0;
+    }
+    w->constant_count = 0;
+}
+
+// Equal constants share one value id within a block.
+static u32 bc_add_constant(bc_writer_t *w, bc_constant_t constant) {
+    if ((w->constant_count + 1) * 2 > w->constant_slot_count)
+        bc_constant_slots_grow(w);
+    constant.hash = bc_constant_hash(&constant);
+    size_t slot = constant.hash & (w->constant_slot_count - 1);
+    while (w->constant_slots[slot] != 0) {
+        bc_constant_t *it = &w->constants[w->constant_slots[slot] - 1];
+        if (it->hash == constant.hash && it->type == constant.type && it->kind == constant.kind && it->bits == constant.bits
+            && str_eq(it->text, constant.text) && it->source == constant.source
+            && it->indices[0] == constant.indices[0] && it->indices[1] == constant.indices[1])
+            return w->constant_slots[slot] - 1;
+        slot = (slot + 1) & (w->constant_slot_count - 1);
+    }
+    if (w->constant_count == w->constant_capacity) {
+        w->constant_capacity = MAX(w->constant_capacity * 2, 16);
+        w->constants = realloc(w->constants, w->constant_capacity * sizeof(bc_constant_t));
+    }
+    w->constants[w->constant_count] = constant;
+    w->constant_slots[slot] = (u32)w->constant_count + 1;
+    return (u32)w->constant_count++;
+}
+
+static u32 bc_symbol_value(bc_writer_t *w, str name);
+
+// Constants are numbered from `first_value` on, in the order they were added.
+static void bc_write_constants(bc_writer_t *w, u32 first_value) {
+    if (w->constant_count == 0)
+        return;
+    bc_stream_t *s = &w->stream;
+    bc_enter_block(s, BC_CONSTANTS_BLOCK, 4);
+    u32 current = (u32)-1;
+    for (size_t i = 0; i < w->constant_count; i++) {
+        bc_constant_t c = w->constants[i];
+        if (c.type != current) {
+            current = c.type;
+            bc_push(&w->record, c.type);
+            bc_write_record(s, BC_CST_SETTYPE, &w->record, BC_FIRST_ABBREV, &w->abbrevs.settype);
+        }
+        switch (c.kind) {
+            case LLVM_VALUE_INT_: {
+                bc_push(&w->record, c.bits);
+                bc_write_record(s, BC_CST_INTEGER, &w->record, BC_FIRST_ABBREV + 1, &w->abbrevs.integer);
+            } break;
+            case LLVM_VALUE_FLOAT_:
+            case LLVM_VALUE_DOUBLE_: {
+                bc_push(&w->record, c.bits);
+                bc_write_record(s, BC_CST_FLOAT, &w->record, BC_FIRST_ABBREV + 2, &w->abbrevs.float_);
+            } break;
+            case LLVM_VALUE_STRING_:
+            case LLVM_VALUE_BYTES_: {
+                bc_push_escaped(&w->record, c.text);
+                bc_write_record(s, BC_CST_STRING, &w->record, BC_FIRST_ABBREV + 3, &w->abbrevs.string);
+            } break;
+            case LLVM_VALUE_CSTRING_: {
+                bc_push_escaped(&w->record, c.text);
+                bc_write_record(s, BC_CST_CSTRING, &w->record, BC_FIRST_ABBREV + 4, &w->abbrevs.cstring);
+            } break;
+            case LLVM_VALUE_GETELEMENTPTR_: {
+                bc_push(&w->record, c.source);
+                bc_push(&w->record, c.bits >> 1);
+                bc_push(&w->record, bc_symbol_value(w, c.text));
+                for (int j = 0; j < 2; j++) {
+                    bc_push(&w->record, w->i32_type);
+                    bc_push(&w->record, first_value + bc_add_constant(w, bc_constant(w, LLVM_TYPE_INT(32), LLVM_VALUE_INT(c.indices[j]))));
+                }
+                if (c.bits & 1)
+                    bc_write_record(s, BC_CST_CE_INBOUNDS_GEP, &w->record, BC_FIRST_ABBREV + 6, &w->abbrevs.inbounds_gep);
+                else
+                    bc_write_record(s, BC_CST_CE_GEP, &w->record, BC_FIRST_ABBREV + 5, &w->abbrevs.gep);
+            } break;
+            case LLVM_VALUE_UNDEF_: {
+                bc_write_record(s, BC_CST_UNDEF, &w->record, BC_FIRST_ABBREV + 7, &w->abbrevs.undef);
+            } break;
+        }
+    }
+    bc_exit_block(s);
+}
+
+// The constants block numbers its abbreviations in the order of
+// `bc_abbrevs_t`, from `BC_FIRST_ABBREV` on; so do the function and value
+// symbol table blocks.
+static void bc_write_blockinfo(bc_writer_t *w) {
+    bc_stream_t *s = &w->stream;
+    bc_abbrevs_t *a = &w->abbrevs;
+    a->settype = BC_ABBREV(BC_LIT(BC_CST_SETTYPE), BC_FIXED(w->type_bits));
+    a->integer = BC_ABBREV(BC_LIT(BC_CST_INTEGER), BC_VBR(8));
+    a->float_ = BC_ABBREV(BC_LIT(BC_CST_FLOAT), BC_VBR(8));
+    a->string = BC_ABBREV(BC_LIT(BC_CST_STRING), BC_ARRAY(), BC_FIXED(8));
+    a->cstring = BC_ABBREV(BC_LIT(BC_CST_CSTRING), BC_ARRAY(), BC_FIXED(8));
+    a->gep = BC_ABBREV(BC_LIT(BC_CST_CE_GEP), BC_FIXED(w->type_bits), BC_ARRAY(), BC_VBR(6));
+    a->inbounds_gep = BC_ABBREV(BC_LIT(BC_CST_CE_INBOUNDS_GEP), BC_FIXED(w->type_bits), BC_ARRAY(), BC_VBR(6));
+    a->undef = BC_ABBREV(BC_LIT(BC_CST_UNDEF));
+    a->ret = BC_ABBREV(BC_LIT(BC_FUNC_INST_RET), BC_VBR(6));
+    a->gep_instruction = BC_ABBREV(BC_LIT(BC_FUNC_INST_GEP), BC_FIXED(1), BC_FIXED(w->type_bits), BC_ARRAY(), BC_VBR(6));
+    a->bbentry = BC_ABBREV(BC_LIT(BC_VST_BBENTRY), BC_VBR(8), BC_ARRAY(), BC_FIXED(8));
+
+    bc_enter_block(s, BC_BLOCKINFO_BLOCK, 2);
+    bc_push(&w->record, BC_CONSTANTS_BLOCK);
+    bc_write_record(s, BC_BLOCKINFO_SETBID, &w->record, 0, NULL);
+    bc_define_abbrev(s, &a->settype);
+    bc_define_abbrev(s, &a->integer);
+    bc_define_abbrev(s, &a->float_);
+    bc_define_abbrev(s, &a->string);
+    bc_define_abbrev(s, &a->cstring);
+    bc_define_abbrev(s, &a->gep);
+    bc_define_abbrev(s, &a->inbounds_gep);
+    bc_define_abbrev(s, &a->undef);
+    bc_push(&w->record, BC_FUNCTION_BLOCK);
+    bc_write_record(s, BC_BLOCKINFO_SETBID, &w->record, 0, NULL);
+    bc_define_abbrev(s, &a->ret);
+    bc_define_abbrev(s, &a->gep_instruction);
+    bc_push(&w->record, BC_VALUE_SYMTAB_BLOCK);
+    bc_write_record(s, BC_BLOCKINFO_SETBID, &w->record, 0, NULL);
+    bc_define_abbrev(s, &a->bbentry);
+    bc_exit_block(s);
+}
+
+// ---------------------------------------------------------------------------
+// Function bodies
+// ---------------------------------------------------------------------------
+
+typedef struct bc_function_state_t {
+    llvm_function_t *function;
+    llvm_code_t *code;
+    u32 first_arg;         // value id of the first argument
+    u32 first_constant;    // value id of the first function-level constant
+    u32 first_instruction; // value id of the first instruction result
+    u32 next_value;        // value id the next instruction result gets
+} bc_function_state_t;
+
+static u32 bc_value(bc_writer_t *w, bc_function_state_t *f, llvm_type_t type, llvm_ref_t ref) {
+    if (LLVM_REF_KIND(ref) == LLVM_REF_LOCAL) {
+        u32 index = LLVM_REF_PAYLOAD(ref);
+        u32 arg_count = (u32)f->function->args.size;
+        if (index < arg_count)
+            return f->first_arg + index;
+        return f->first_instruction + w->results[index - arg_count];
+    }
+    return f->first_constant + bc_add_constant(w, bc_constant(w, type, llvm_code_value(f->code, ref)));
+}
+
+static u32 bc_value_of_type_id(bc_writer_t *w, bc_function_state_t *f, u32 type, llvm_ref_t ref) {
+    if (LLVM_REF_KIND(ref) == LLVM_REF_LOCAL)
+        return bc_value(w, f, LLVM_TYPE_INT(32), ref);
+    return bc_value(w, f, *llvm_type_by_id(w->gen, type), ref);
+}
+
+static u32 bc_symbol_ref_value(bc_writer_t *w, uint ref, str name) {
+    if (ref == 0)
+        fatal("reference to unknown symbol '" STR_ARG "'.", STR_FMT(name));
+    if (LLVM_SYMBOL_IS_FUNCTION(ref))
+        return (u32)(w->gen->globals.size + LLVM_SYMBOL_INDEX(ref));
+    return (u32)LLVM_SYMBOL_INDEX(ref);
+}
+
+static u32 bc_symbol_value(bc_writer_t *w, str name) {
+    return bc_symbol_ref_value(w, llvm_symbol_find(w->gen, name), name);
+}
+
+static u32 bc_symbol_id_value(bc_writer_t *w, u32 name) {
+    return bc_symbol_ref_value(w, llvm_symbol_of(w->gen, name), llvm_name_text(w->gen, name));
+}
+
+// First pass over a body: registers the function-level constants so that
+// their value ids are known before any instruction refers to them.
+static void bc_collect_constants(bc_writer_t *w, bc_function_state_t *f, llvm_code_instruction_t instruction) {
+    u32 *operands = &f->code->operands[instruction.operands];
+    switch (instruction.opcode) {
+        case LLVM_INSTR_CALL: {
+            u32 count = instruction.operand_count / 2;
+            for (u32 i = 0; i < count; i++)
+                if (LLVM_REF_KIND(operands[i]) != LLVM_REF_LOCAL)
+                    bc_value_of_type_id(w, f, operands[count + i], operands[i]);
+        } break;
+        case LLVM_INSTR_RETURN: {
+            if (LLVM_REF_KIND(operands[0]) != LLVM_REF_LOCAL)
+                bc_value_of_type_id(w, f, instruction.type, operands[0]);
+        } break;
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            for (u32 i = 0; i < 2; i++)
+                if (LLVM_REF_KIND(operands[i]) != LLVM_REF_LOCAL)
+                    bc_value(w, f, LLVM_TYPE_INT(32), operands[i]);
+        } break;
+        case LLVM_INSTR_ALLOCA: {
+            bc_value(w, f, LLVM_TYPE_INT(32), LLVM_REF(LLVM_REF_INT, 1)); // the element count
+        } break;
+        case LLVM_INSTR_LOAD:
+        case LLVM_INSTR_STORE: {
+            u32 pointer = instruction.operand_count - 1;
+            if (LLVM_REF_KIND(operands[pointer]) != LLVM_REF_LOCAL)
+                bc_value(w, f, LLVM_TYPE_POINTER(*llvm_type_by_id(w->gen, instruction.type)), operands[pointer]);
+            if (pointer > 0 && LLVM_REF_KIND(operands[0]) != LLVM_REF_LOCAL)
+                bc_value_of_type_id(w, f, instruction.type, operands[0]);
+        } break;
+        case LLVM_INSTR_COND_BR:
+        case LLVM_INSTR_PHI: {
+            for (u32 i = 0; i < LLVM_CODE_REF_COUNT(instruction); i++)
+                if (LLVM_REF_KIND(operands[i]) != LLVM_REF_LOCAL)
+                    bc_value_of_type_id(w, f, instruction.type, operands[i]);
+        } break;
+    }
+}
+
+// Operands are relative to the id of the instruction being written. Values
+// defined further down wrap around, as in LLVM's own writer.
+static void bc_push_operand(bc_writer_t *w, bc_function_state_t *f, u32 value) {
+    bc_push(&w->record, (u32)(f->next_value - value));
+}
+
+// Where the reader expects a value and type pair, the type is only given for
+// values it has not seen yet. Returns whether it was.
+static bool bc_push_typed_operand(bc_writer_t *w, bc_function_state_t *f, u32 value, u32 type) {
+    bc_push_operand(w, f, value);
+    if (value < f->next_value)
+        return false;
+    bc_push(&w->record, type);
+    return true;
+}
+
+// Phis may refer ahead, so their operands are signed.
+static void bc_push_signed_operand(bc_writer_t *w, bc_function_state_t *f, u32 value) {
+    bc_push(&w->record, bc_signed_vbr((s64)f->next_value - (s64)value));
+}
+
+static void bc_write_instruction(bc_writer_t *w, bc_function_state_t *f, llvm_code_instruction_t instruction) {
+    bc_stream_t *s = &w->stream;
+    u32 *operands = &f->code->operands[instruction.operands];
+    switch (instruction.opcode) {
+        case LLVM_INSTR_CALL: {
+            u32 name = f->code->symbols[instruction.symbol];
+            size_t callee = LLVM_SYMBOL_INDEX(llvm_symbol_of(w->gen, name));
+            llvm_function_t *function = &w->gen->functions.data[callee];
+            u32 count = instruction.operand_count / 2;
+            bc_push(&w->record, 0);
+            bc_push(&w->record, (bc_call_convention(function->call_convention) << 1) | (1 << 15));
+            bc_push(&w->record, w->function_types[callee]);
+            bc_push_operand(w, f, bc_symbol_id_value(w, name));
+            for (u32 i = 0; i < count; i++) {
+                u32 value = bc_value_of_type_id(w, f, operands[count + i], operands[i]);
+                if (i >= function->args.size)
+                    bc_push_typed_operand(w, f, value, bc_type_id(w, operands[count + i]));
+                else
+                    bc_push_operand(w, f, value);
+            }
+            bc_write_record(s, BC_FUNC_INST_CALL, &w->record, 0, NULL);
+            f->next_value++;
+        } break;
+        case LLVM_INSTR_RETURN: {
+            u32 value = bc_value_of_type_id(w, f, instruction.type, operands[0]);
+            if (bc_push_typed_operand(w, f, value, bc_type_id(w, instruction.type)))
+                bc_write_record(s, BC_FUNC_INST_RET, &w->record, 0, NULL);
+            else
+                bc_write_record(s, BC_FUNC_INST_RET, &w->record, BC_FIRST_ABBREV, &w->abbrevs.ret);
+        } break;
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            bc_push(&w->record, instruction.opcode == LLVM_INSTR_GETELEMENTPTR_INBOUNDS);
+            bc_push(&w->record, bc_type_id(w, instruction.type));
+            bc_push_operand(w, f, bc_symbol_id_value(w, f->code->symbols[instruction.symbol]));
+            bc_push_typed_operand(w, f, bc_value(w, f, LLVM_TYPE_INT(32), operands[0]), w->i32_type);
+            bc_push_typed_operand(w, f, bc_value(w, f, LLVM_TYPE_INT(32), operands[1]), w->i32_type);
+            bc_write_record(s, BC_FUNC_INST_GEP, &w->record, BC_FIRST_ABBREV + 1, &w->abbrevs.gep_instruction);
+            f->next_value++;
+        } break;
+        case LLVM_INSTR_ALLOCA: {
+            bc_push(&w->record, bc_type_id(w, instruction.type));
+            bc_push(&w->record, w->i32_type);
+            bc_push(&w->record, bc_value(w, f, LLVM_TYPE_INT(32), LLVM_REF(LLVM_REF_INT, 1))); // absolute
+            bc_push(&w->record, 1 << 6); // explicit type, default alignment
+            bc_write_record(s, BC_FUNC_INST_ALLOCA, &w->record, 0, NULL);
+            f->next_value++;
+        } break;
+        case LLVM_INSTR_LOAD: {
+            llvm_type_t pointer = LLVM_TYPE_POINTER(*llvm_type_by_id(w->gen, instruction.type));
+            bc_push_typed_operand(w, f, bc_value(w, f, pointer, operands[0]), bc_type(w, pointer));
+            bc_push(&w->record, bc_type_id(w, instruction.type));
+            bc_push(&w->record, 0); // default alignment
+            bc_push(&w->record, 0); // not volatile
+            bc_write_record(s, BC_FUNC_INST_LOAD, &w->record, 0, NULL);
+            f->next_value++;
+        } break;
+        case LLVM_INSTR_STORE: {
+            llvm_type_t pointer = LLVM_TYPE_POINTER(*llvm_type_by_id(w->gen, instruction.type));
+            bc_push_typed_operand(w, f, bc_value(w, f, pointer, operands[1]), bc_type(w, pointer));
+            bc_push_typed_operand(w, f, bc_value_of_type_id(w, f, instruction.type, operands[0]), bc_type_id(w, instruction.type));
+            bc_push(&w->record, 0);
+            bc_push(&w->record, 0);
+            bc_write_record(s, BC_FUNC_INST_STORE, &w->record, 0, NULL);
+        } break;
+        case LLVM_INSTR_BR: {
+            bc_push(&w->record, operands[0]);
+            bc_write_record(s, BC_FUNC_INST_BR, &w->record, 0, NULL);
+        } break;
+        case LLVM_INSTR_COND_BR: {
+            bc_push(&w->record, operands[1]);
+            bc_push(&w->record, operands[2]);
+            bc_push_operand(w, f, bc_value_of_type_id(w, f, instruction.type, operands[0]));
+            bc_write_record(s, BC_FUNC_INST_BR, &w->record, 0, NULL);
+        } break;
+        case LLVM_INSTR_PHI: {
+            u32 count = instruction.operand_count / 2;
+            bc_push(&w->record, bc_type_id(w, instruction.type));
+            for (u32 i = 0; i < count; i++) {
+                bc_push_signed_operand(w, f, bc_value_of_type_id(w, f, instruction.type, operands[i]));
+                bc_push(&w->record, operands[count + i]);
+            }
+            bc_write_record(s, BC_FUNC_INST_PHI, &w->record, 0, NULL);
+            f->next_value++;
+        } break;
+    }
+}
+
+static void bc_write_function(bc_writer_t *w, llvm_function_t *function, u32 module_values) {
+    bc_stream_t *s = &w->stream;
+    llvm_code_t *code = function->code;
+    if (code == NULL)
+        fatal("function body is null.");
+
+    bc_function_state_t f = {function, code, module_values, (u32)(module_values + function->args.size), 0, 0};
+    bc_clear_constants(w);
+    for (u32 i = 0; i < code->instruction_count; i++)
+        bc_collect_constants(w, &f, code->instructions[i]);
+    f.first_instruction = f.first_constant + (u32)w->constant_count;
+    f.next_value = f.first_instruction;
+
+    if (code->instruction_count > w->result_capacity) {
+        w->result_capacity = MAX((size_t)code->instruction_count, w->result_capacity * 2);
+        free(w->results);
+        w->results = malloc(w->result_capacity * sizeof(u32));
+    }
+    llvm_code_results(code, w->results, w->result_capacity);
+
+    bc_enter_block(s, BC_FUNCTION_BLOCK, 4);
+    bc_push(&w->record, code->block_count);
+    bc_write_record(s, BC_FUNC_DECLAREBLOCKS, &w->record, 0, NULL);
+    bc_write_constants(w, f.first_constant);
+
+    for (u32 i = 0; i < code->instruction_count; i++)
+        bc_write_instruction(w, &f, code->instructions[i]);
+
+    bc_enter_block(s, BC_VALUE_SYMTAB_BLOCK, 4);
+    for (u32 i = 0; i < code->block_count; i++) {
+        str name = code->blocks[i].name;
+        if (name.count == 0)
+            continue;
+        bc_push(&w->record, i);
+        for (size_t j = 0; j < name.count; j++)
+            bc_push(&w->record, (u8)name.chars[j]);
+        bc_write_record(s, BC_VST_BBENTRY, &w->record, BC_FIRST_ABBREV, &w->abbrevs.bbentry);
+    }
+    bc_exit_block(s);
+
+    bc_exit_block(s);
+}
+
+static void bc_write_module(bc_writer_t *w) {
+    llvm_generator_t *gen = w->gen;
+    bc_stream_t *s = &w->stream;
+
+    bc_enter_block(s, BC_MODULE_BLOCK, 3);
+    bc_push(&w->record, 2); // relative value ids and a string table
+    bc_write_record(s, BC_MODULE_VERSION, &w->record, 0, NULL);
+    bc_write_blockinfo(w);
+    bc_write_types(w);
+
+    // Value ids: globals, then functions, then the module-level constants
+    // holding global initializers.
+    u32 first_constant = (u32)(gen->globals.size + gen->functions.size);
+    bc_clear_constants(w);
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        u32 init = first_constant + bc_add_constant(w, bc_constant(w, *global->type, global->value));
+        bc_push(&w->record, bc_strtab_add(w, global->name));
+        bc_push(&w->record, global->name.count);
+        bc_push(&w->record, bc_type(w, *global->type));
+        bc_push(&w->record, (u64)global->is_constant | 2 | ((u64)global->address_space << 2));
+        bc_push(&w->record, init + 1);
+        bc_push(&w->record, bc_linkage(global->linkage));
+        bc_push(&w->record, bc_alignment(global->alignment));
+        bc_push(&w->record, 0); // section
+        bc_push(&w->record, global->visibility);
+        bc_push(&w->record, 0); // thread_local
+        bc_push(&w->record, global->is_unnamed_addr);
+        bc_push(&w->record, 0); // externally_initialized
+        bc_push(&w->record, global->dll_storage_class);
+        bc_push(&w->record, 0); // comdat
+        bc_push(&w->record, 0); // attributes
+        bc_push(&w->record, 0); // dso_local, inferred by the reader
+        bc_push(&w->record, 0); // partition
+        bc_push(&w->record, 0);
+        bc_write_record(s, BC_MODULE_GLOBALVAR, &w->record, 0, NULL);
+    }
+
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        bc_push(&w->record, bc_strtab_add(w, function->name));
+        bc_push(&w->record, function->name.count);
+        bc_push(&w->record, w->function_types[i]);
+        bc_push(&w->record, bc_call_convention(function->call_convention));
+        bc_push(&w->record, function->is_native);
+        bc_push(&w->record, bc_linkage(function->linkage));
+        bc_push(&w->record, 0); // paramattr
+        bc_push(&w->record, bc_alignment(function->alignment));
+        bc_push(&w->record, 0); // section
+        bc_push(&w->record, function->visibility);
+        bc_push(&w->record, 0); // gc
+        bc_push(&w->record, 0); // unnamed_addr
+        bc_push(&w->record, 0); // prologue
+        bc_push(&w->record, function->dll_storage_class);
+        bc_push(&w->record, 0); // comdat
+        bc_push(&w->record, 0); // prefix
+        bc_push(&w->record, 0); // personality
+        bc_push(&w->record, 0); // dso_local, inferred by the reader
+        bc_push(&w->record, (u64)function->address_space);
+        bc_push(&w->record, 0); // partition
+        bc_push(&w->record, 0);
+        bc_write_record(s, BC_MODULE_FUNCTION, &w->record, 0, NULL);
+    }
+
+    bc_write_constants(w, first_constant);
+
+    u32 module_values = first_constant + (u32)w->constant_count;
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        if (!function->is_native)
+            bc_write_function(w, function, module_values);
+    }
+
+    bc_exit_block(s);
+}
+
+str llvm_generate_bitcode(llvm_generator_t *gen) {
+    bc_writer_t w = {0};
+    w.gen = gen;
+    str_builder_init(&w.stream.out);
+    str_builder_init(&w.strtab);
+    w.stream.width = 2;
+
+    bc_collect_types(&w);
+
+    bc_emit(&w.stream, 'B', 8);
+    bc_emit(&w.stream, 'C', 8);
+    bc_emit(&w.stream, 0x0, 4);
+    bc_emit(&w.stream, 0xC, 4);
+    bc_emit(&w.stream, 0xE, 4);
+    bc_emit(&w.stream, 0xD, 4);
+
+    bc_enter_block(&w.stream, BC_IDENTIFICATION_BLOCK, 5);
+    bc_abbrev_t producer = BC_ABBREV(BC_LIT(BC_IDENTIFICATION_STRING), BC_ARRAY(), BC_CHAR6());
+    bc_define_abbrev(&w.stream, &producer);
+    char *name = "llvm.ir";
+    for (char *c = name; *c; c++)
+        bc_push(&w.record, (u8)*c);
+    bc_write_record(&w.stream, BC_IDENTIFICATION_STRING, &w.record, BC_FIRST_ABBREV, &producer);
+    bc_push(&w.record, 0);
+    bc_write_record(&w.stream, BC_IDENTIFICATION_EPOCH, &w.record, 0, NULL);
+    bc_exit_block(&w.stream);
+
+    bc_write_module(&w);
+
+    bc_enter_block(&w.stream, BC_STRTAB_BLOCK, 3);
+    bc_abbrev_t blob = BC_ABBREV(BC_LIT(BC_STRTAB_BLOB), BC_BLOB());
+    bc_define_abbrev(&w.stream, &blob);
+    bc_write_blob(&w.stream, BC_FIRST_ABBREV, (str){w.strtab.chars, w.strtab.count});
+    bc_exit_block(&w.stream);
+
+    free(w.record.data);
+    free(w.types);
+    free(w.type_ops);
+    free(w.type_slots);
+    free(w.canonical);
+    free(w.function_types);
+    free(w.named_structs);
+    free(w.constants);
+    free(w.constant_slots);
+    free(w.results);
+    str_builder_free(&w.strtab);
+    return str_builder_take(&w.stream.out);
+}
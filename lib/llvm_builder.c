@@ -0,0 +1,704 @@
+#include "llvm.h"
+
+#define LLVM_NO_RESULT ((u32)-1)
+#define LLVM_NO_REPLACEMENT ((u32)-1)
+#define LLVM_BUILDER_MIN_DEFINITIONS 64
+
+void llvm_builder_init(llvm_builder_t *builder, llvm_generator_t *gen) {
+    builder->gen = gen;
+    builder->function = (llvm_function_t){0};
+    builder->block = 0;
+    array_init(llvm_builder_block_t)(&builder->blocks);
+    array_init(llvm_builder_instruction_t)(&builder->instructions);
+    array_init(u32)(&builder->operands);
+    array_init(llvm_value_t)(&builder->constants);
+    array_init(u32)(&builder->symbols);
+    array_init(u32)(&builder->locals);
+    builder->maps_locals = false;
+    array_init(u32)(&builder->variables);
+    array_init(llvm_builder_edge_t)(&builder->edges);
+    array_init(llvm_builder_incomplete_t)(&builder->incomplete);
+    array_init(u32)(&builder->pending);
+    array_init(u32)(&builder->unfilled);
+    builder->definitions = NULL;
+    builder->definition_slots = 0;
+    builder->definition_count = 0;
+}
+
+void llvm_builder_free(llvm_builder_t *builder) {
+    array_free(llvm_builder_block_t)(&builder->blocks);
+    array_free(llvm_builder_instruction_t)(&builder->instructions);
+    array_free(u32)(&builder->operands);
+    array_free(llvm_value_t)(&builder->constants);
+    array_free(u32)(&builder->symbols);
+    array_free(u32)(&builder->locals);
+    array_free(u32)(&builder->variables);
+    array_free(llvm_builder_edge_t)(&builder->edges);
+    array_free(llvm_builder_incomplete_t)(&builder->incomplete);
+    array_free(u32)(&builder->pending);
+    array_free(u32)(&builder->unfilled);
+    free(builder->definitions);
+    builder->definitions = NULL;
+    builder->definition_slots = 0;
+}
+
+// Empties the scratch arrays but keeps their storage for the next function.
+static void llvm_builder_clear(llvm_builder_t *builder) {
+    builder->block = 0;
+    builder->blocks.size = 0;
+    builder->instructions.size = 0;
+    builder->operands.size = 0;
+    builder->constants.size = 0;
+    builder->symbols.size = 0;
+    builder->locals.size = 0;
+    builder->variables.size = 0;
+    builder->edges.size = 0;
+    builder->incomplete.size = 0;
+    builder->pending.size = 0;
+    builder->unfilled.size = 0;
+    if (builder->definition_count > 0)
+        memset(builder->definitions, 0, builder->definition_slots * sizeof(llvm_builder_definition_t));
+    builder->definition_count = 0;
+}
+
+void llvm_builder_begin(llvm_builder_t *builder, llvm_function_t function) {
+    // The signature is kept in canonical types, like every instruction.
+    llvm_generator_t *gen = builder->gen;
+    array(llvm_type_t) args = array_new_arena(llvm_type_t)(&gen->arena);
+    for (size_t i = 0; i < function.args.size; i++)
+        array_push(llvm_type_t)(&args, *llvm_type_get(gen, function.args.data[i]));
+    function.return_type = *llvm_type_get(gen, function.return_type);
+    function.args = args;
+    function.body = NULL;
+    function.code = NULL;
+    builder->function = function;
+    llvm_builder_clear(builder);
+}
+
+uint llvm_builder_create_block(llvm_builder_t *builder, str name) {
+    name = arena_strdup(&builder->gen->arena, name);
+    array_push(llvm_builder_block_t)(&builder->blocks, (llvm_builder_block_t){.name = name});
+    return (uint)builder->blocks.size - 1;
+}
+
+void llvm_builder_position(llvm_builder_t *builder, uint block) {
+    if (block >= builder->blocks.size)
+        fatal("unknown block %u.", block);
+    builder->block = block;
+}
+
+llvm_value_t llvm_builder_arg(llvm_builder_t *builder, uint index) {
+    if (index >= builder->function.args.size)
+        fatal("function '" STR_ARG "' has no argument %u.", STR_FMT(builder->function.name), index);
+    return LLVM_VALUE_LOCAL(index);
+}
+
+static llvm_ref_t llvm_builder_ref(llvm_builder_t *builder, llvm_value_t value) {
+    switch (value.type) {
+        case LLVM_VALUE_LOCAL_: {
+            // Unknown locals are kept as such for `llvm_verify` to report.
+            uint idx = value.local.idx;
+            if (builder->maps_locals && idx >= builder->function.args.size) {
+                u32 handle = idx < builder->locals.size ? builder->locals.data[idx] : 0;
+                if (handle == 0)
+                    return LLVM_REF(LLVM_REF_UNDEFINED, idx);
+                idx = handle - 1;
+            }
+            if (idx >= builder->function.args.size + builder->instructions.size)
+                return LLVM_REF(LLVM_REF_UNDEFINED, idx);
+            return LLVM_REF(LLVM_REF_LOCAL, idx);
+        }
+        case LLVM_VALUE_INT_: {
+            if (LLVM_REF_INT_FITS(value.int_))
+                return LLVM_REF(LLVM_REF_INT, value.int_);
+        } break;
+        default: break;
+    }
+    array_push(llvm_value_t)(&builder->constants, value);
+    return LLVM_REF(LLVM_REF_CONSTANT, builder->constants.size - 1);
+}
+
+static u32 llvm_builder_symbol(llvm_builder_t *builder, str name) {
+    u32 id = llvm_name_intern(builder->gen, name);
+    // Consecutive uses of the same callee are the common case.
+    if (builder->symbols.size > 0 && builder->symbols.data[builder->symbols.size - 1] == id)
+        return (u32)builder->symbols.size - 1;
+    array_push(u32)(&builder->symbols, id);
+    return (u32)builder->symbols.size - 1;
+}
+
+static u32 llvm_builder_type(llvm_builder_t *builder, llvm_type_t type) {
+    return llvm_type_get(builder->gen, type)->id;
+}
+
+// Operand count of a call or phi with `count` arguments or incoming values.
+static u16 llvm_builder_entry_count(llvm_builder_t *builder, size_t count) {
+    if (count > LLVM_CODE_MAX_ENTRIES)
+        fatal("%zu arguments or incoming values in '" STR_ARG "', where at most %u fit.",
+              count, STR_FMT(builder->function.name), LLVM_CODE_MAX_ENTRIES);
+    return (u16)(count * 2);
+}
+
+// Targets that do not exist are kept for `llvm_verify` to report, but are
+// no predecessor of anything.
+static void llvm_builder_edge(llvm_builder_t *builder, uint from, uint to) {
+    array_push(u32)(&builder->operands, to);
+    if (to >= builder->blocks.size)
+        return;
+    llvm_builder_block_t *block = &builder->blocks.data[to];
+    if (block->is_sealed)
+        fatal("branch to block '" STR_ARG "', which is already sealed.", STR_FMT(block->name));
+    array_push(llvm_builder_edge_t)(&builder->edges, (llvm_builder_edge_t){from, block->predecessors});
+    block->predecessors = (u32)builder->edges.size;
+}
+
+llvm_value_t llvm_builder_append(llvm_builder_t *builder, llvm_instruction_t instruction) {
+    if (builder->block >= builder->blocks.size)
+        fatal("no block to append to in '" STR_ARG "'.", STR_FMT(builder->function.name));
+
+    llvm_code_instruction_t code = {(u8)instruction.type, 0, 0, 0, (u32)builder->operands.size, 0};
+    uint block = builder->block;
+    switch (instruction.type) {
+        case LLVM_INSTR_CALL: {
+            size_t count = instruction.call.args.size;
+            code.type = llvm_builder_type(builder, instruction.call.return_type);
+            code.symbol = llvm_builder_symbol(builder, instruction.call.function_name);
+            code.operand_count = llvm_builder_entry_count(builder, count);
+            for (size_t i = 0; i < count; i++)
+                array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.call.args.data[i].arg_value));
+            for (size_t i = 0; i < count; i++)
+                array_push(u32)(&builder->operands, llvm_builder_type(builder, instruction.call.args.data[i].arg_type));
+        } break;
+        case LLVM_INSTR_RETURN: {
+            code.type = llvm_builder_type(builder, instruction.return_.return_type);
+            code.operand_count = 1;
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.return_.value));
+        } break;
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            code.type = llvm_builder_type(builder, instruction.getelementptr.type);
+            code.symbol = llvm_builder_symbol(builder, instruction.getelementptr.name);
+            code.operand_count = 2;
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, *instruction.getelementptr.value));
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, *instruction.getelementptr.index));
+        } break;
+        case LLVM_INSTR_ALLOCA: {
+            code.type = llvm_builder_type(builder, instruction.alloca_.type);
+        } break;
+        case LLVM_INSTR_LOAD: {
+            code.type = llvm_builder_type(builder, instruction.load.type);
+            code.operand_count = 1;
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.load.pointer));
+        } break;
+        case LLVM_INSTR_STORE: {
+            code.type = llvm_builder_type(builder, instruction.store.type);
+            code.operand_count = 2;
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.store.value));
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.store.pointer));
+        } break;
+        case LLVM_INSTR_BR: {
+            code.operand_count = 1;
+            llvm_builder_edge(builder, block, instruction.br.block);
+        } break;
+        case LLVM_INSTR_COND_BR: {
+            code.type = llvm_builder_type(builder, LLVM_TYPE_INT(1));
+            code.operand_count = 3;
+            array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.cond_br.condition));
+            llvm_builder_edge(builder, block, instruction.cond_br.if_true);
+            llvm_builder_edge(builder, block, instruction.cond_br.if_false);
+        } break;
+        case LLVM_INSTR_PHI: {
+            size_t count = instruction.phi.incoming.size;
+            code.type = llvm_builder_type(builder, instruction.phi.type);
+            code.operand_count = llvm_builder_entry_count(builder, count);
+            for (size_t i = 0; i < count; i++)
+                array_push(u32)(&builder->operands, llvm_builder_ref(builder, instruction.phi.incoming.data[i].value));
+            for (size_t i = 0; i < count; i++)
+                array_push(u32)(&builder->operands, instruction.phi.incoming.data[i].block);
+        } break;
+    }
+
+    uint handle = (uint)(builder->function.args.size + builder->instructions.size);
+    array_push(llvm_builder_instruction_t)(&builder->instructions, (llvm_builder_instruction_t){code, block, LLVM_NO_REPLACEMENT});
+    builder->blocks.data[block].count++;
+    return LLVM_VALUE_LOCAL(handle);
+}
+
+llvm_value_t llvm_builder_call(llvm_builder_t *builder, llvm_type_t return_type, str name, const llvm_function_arg_t *args, size_t count) {
+    array(llvm_function_arg_t) view = {(llvm_function_arg_t *)args, count, count, NULL};
+    return llvm_builder_append(builder, (llvm_instruction_t){LLVM_INSTR_CALL, .call={return_type, name, view}});
+}
+
+llvm_value_t llvm_builder_gep(llvm_builder_t *builder, bool is_inbounds, str name, llvm_type_t type, llvm_value_t value, llvm_value_t index) {
+    llvm_instruction_t instruction = {is_inbounds ? LLVM_INSTR_GETELEMENTPTR_INBOUNDS : LLVM_INSTR_GETELEMENTPTR, .getelementptr={name, type, &value, &index}};
+    return llvm_builder_append(builder, instruction);
+}
+
+void llvm_builder_ret(llvm_builder_t *builder, llvm_type_t type, llvm_value_t value) {
+    llvm_builder_append(builder, LLVM_INSTR_RETURN(type, value));
+}
+
+llvm_value_t llvm_builder_alloca(llvm_builder_t *builder, llvm_type_t type) {
+    return llvm_builder_append(builder, LLVM_INSTR_ALLOCA(type));
+}
+
+llvm_value_t llvm_builder_load(llvm_builder_t *builder, llvm_type_t type, llvm_value_t pointer) {
+    return llvm_builder_append(builder, LLVM_INSTR_LOAD(type, pointer));
+}
+
+void llvm_builder_store(llvm_builder_t *builder, llvm_type_t type, llvm_value_t value, llvm_value_t pointer) {
+    llvm_builder_append(builder, LLVM_INSTR_STORE(type, value, pointer));
+}
+
+void llvm_builder_br(llvm_builder_t *builder, uint block) {
+    llvm_builder_append(builder, LLVM_INSTR_BR(block));
+}
+
+void llvm_builder_cond_br(llvm_builder_t *builder, llvm_value_t condition, uint if_true, uint if_false) {
+    llvm_builder_append(builder, LLVM_INSTR_COND_BR(condition, if_true, if_false));
+}
+
+llvm_value_t llvm_builder_phi(llvm_builder_t *builder, llvm_type_t type, const llvm_phi_incoming_t *incoming, size_t count) {
+    array(llvm_phi_incoming_t) view = {(llvm_phi_incoming_t *)incoming, count, count, NULL};
+    return llvm_builder_append(builder, LLVM_INSTR_PHI(type, view));
+}
+
+// ---------------------------------------------------------------------------
+// SSA variables
+// ---------------------------------------------------------------------------
+
+// The block is in the high half of a key, out of reach of the mask unless
+// it is mixed in on its own.
+static u64 llvm_builder_definition_hash(u64 key) {
+    return hash_combine(hash_combine(0, (key - 1) >> 32), (u32)(key - 1));
+}
+
+static void llvm_builder_definitions_grow(llvm_builder_t *builder) {
+    size_t slot_count = MAX(builder->definition_slots * 2, LLVM_BUILDER_MIN_DEFINITIONS);
+    llvm_builder_definition_t *slots = calloc(slot_count, sizeof(llvm_builder_definition_t));
+    for (size_t i = 0; i < builder->definition_slots; i++) {
+        llvm_builder_definition_t old = builder->definitions[i];
+        if (old.key == 0)
+            continue;
+        size_t slot = llvm_builder_definition_hash(old.key) & (slot_count - 1);
+        while (slots[slot].key != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = old;
+    }
+    free(builder->definitions);
+    builder->definitions = slots;
+    builder->definition_slots = slot_count;
+}
+
+// Returns the slot for `variable` in `block`, or the empty slot where it
+// would go.
+static llvm_builder_definition_t *llvm_builder_probe(llvm_builder_t *builder, u32 block, u32 variable) {
+    if (builder->definition_slots == 0)
+        llvm_builder_definitions_grow(builder);
+    u64 key = ((u64)block << 32 | variable) + 1;
+    size_t slot = llvm_builder_definition_hash(key) & (builder->definition_slots - 1);
+    while (builder->definitions[slot].key != 0 && builder->definitions[slot].key != key)
+        slot = (slot + 1) & (builder->definition_slots - 1);
+    return &builder->definitions[slot];
+}
+
+static void llvm_builder_define(llvm_builder_t *builder, u32 block, u32 variable, llvm_ref_t ref) {
+    if ((builder->definition_count + 1) * 2 > builder->definition_slots)
+        llvm_builder_definitions_grow(builder);
+    llvm_builder_definition_t *slot = llvm_builder_probe(builder, block, variable);
+    if (slot->key == 0) {
+        slot->key = ((u64)block << 32 | variable) + 1;
+        builder->definition_count++;
+    }
+    slot->ref = ref;
+}
+
+static u32 llvm_builder_new_phi(llvm_builder_t *builder, u32 block, u32 variable) {
+    llvm_code_instruction_t code = {LLVM_INSTR_PHI, 0, 0, builder->variables.data[variable], (u32)builder->operands.size, 0};
+    u32 handle = (u32)(builder->function.args.size + builder->instructions.size);
+    array_push(llvm_builder_instruction_t)(&builder->instructions, (llvm_builder_instruction_t){code, block, LLVM_NO_REPLACEMENT});
+    builder->blocks.data[block].count++;
+    return handle;
+}
+
+static llvm_ref_t llvm_builder_read(llvm_builder_t *builder, u32 block, u32 variable);
+
+// Gives the phi one operand per predecessor of its block. The operands are
+// gathered on `pending` first, since reading them may add other phis. Those
+// are only queued on `unfilled`, so long chains of joins do not recurse.
+static void llvm_builder_complete_phi(llvm_builder_t *builder, u32 phi, u32 block, u32 variable) {
+    size_t base = builder->pending.size;
+    for (u32 edge = builder->blocks.data[block].predecessors; edge != 0; edge = builder->edges.data[edge - 1].next) {
+        u32 from = builder->edges.data[edge - 1].block;
+        llvm_ref_t ref = llvm_builder_read(builder, from, variable);
+        array_push(u32)(&builder->pending, ref);
+        array_push(u32)(&builder->pending, from);
+    }
+    size_t count = (builder->pending.size - base) / 2;
+    llvm_code_instruction_t *code = &builder->instructions.data[phi - builder->function.args.size].code;
+    code->operands = (u32)builder->operands.size;
+    code->operand_count = llvm_builder_entry_count(builder, count);
+    for (size_t i = 0; i < count; i++)
+        array_push(u32)(&builder->operands, builder->pending.data[base + i * 2]);
+    for (size_t i = 0; i < count; i++)
+        array_push(u32)(&builder->operands, builder->pending.data[base + i * 2 + 1]);
+    builder->pending.size = base;
+}
+
+// Completes the queued phis, and the ones completing them queues in turn.
+static void llvm_builder_fill_phis(llvm_builder_t *builder) {
+    while (builder->unfilled.size > 0) {
+        builder->unfilled.size -= 2;
+        u32 phi = builder->unfilled.data[builder->unfilled.size];
+        u32 variable = builder->unfilled.data[builder->unfilled.size + 1];
+        u32 block = builder->instructions.data[phi - builder->function.args.size].block;
+        llvm_builder_complete_phi(builder, phi, block, variable);
+    }
+}
+
+// Walks up through sealed blocks with a single predecessor without
+// recursing, then records the value found for every block passed on the way.
+// A phi placed in a sealed block is queued on `unfilled`; the caller sees to
+// its operands with `llvm_builder_fill_phis`.
+static llvm_ref_t llvm_builder_read(llvm_builder_t *builder, u32 block, u32 variable) {
+    size_t base = builder->pending.size;
+    llvm_ref_t ref;
+    for (;;) {
+        llvm_builder_definition_t *definition = llvm_builder_probe(builder, block, variable);
+        if (definition->key != 0) {
+            ref = definition->ref;
+            break;
+        }
+        llvm_builder_block_t *b = &builder->blocks.data[block];
+        if (b->is_sealed && b->predecessors != 0 && builder->edges.data[b->predecessors - 1].next == 0) {
+            array_push(u32)(&builder->pending, block);
+            block = builder->edges.data[b->predecessors - 1].block;
+            continue;
+        }
+        if (b->is_sealed && b->predecessors == 0) {
+            ref = llvm_builder_ref(builder, LLVM_VALUE_UNDEF());
+            llvm_builder_define(builder, block, variable, ref);
+            break;
+        }
+        u32 phi = llvm_builder_new_phi(builder, block, variable);
+        ref = LLVM_REF(LLVM_REF_LOCAL, phi);
+        // Defined before its operands are read, which ends the search along
+        // loops that lead back here.
+        llvm_builder_define(builder, block, variable, ref);
+        if (b->is_sealed) {
+            array_push(u32)(&builder->unfilled, phi);
+            array_push(u32)(&builder->unfilled, variable);
+        } else {
+            array_push(llvm_builder_incomplete_t)(&builder->incomplete, (llvm_builder_incomplete_t){variable, phi, b->incomplete});
+            b->incomplete = (u32)builder->incomplete.size;
+        }
+        break;
+    }
+    for (size_t i = base; i < builder->pending.size; i++)
+        llvm_builder_define(builder, builder->pending.data[i], variable, ref);
+    builder->pending.size = base;
+    return ref;
+}
+
+uint llvm_builder_declare_variable(llvm_builder_t *builder, llvm_type_t type) {
+    array_push(u32)(&builder->variables, llvm_builder_type(builder, type));
+    return (uint)builder->variables.size - 1;
+}
+
+static void llvm_builder_check_variable(llvm_builder_t *builder, uint variable) {
+    if (variable >= builder->variables.size)
+        fatal("unknown variable %u.", variable);
+    if (builder->block >= builder->blocks.size)
+        fatal("no block to use variables in, in '" STR_ARG "'.", STR_FMT(builder->function.name));
+}
+
+void llvm_builder_write_variable(llvm_builder_t *builder, uint variable, llvm_value_t value) {
+    llvm_builder_check_variable(builder, variable);
+    llvm_builder_define(builder, builder->block, variable, llvm_builder_ref(builder, value));
+}
+
+llvm_value_t llvm_builder_read_variable(llvm_builder_t *builder, uint variable) {
+    llvm_builder_check_variable(builder, variable);
+    llvm_ref_t ref = llvm_builder_read(builder, builder->block, variable);
+    llvm_builder_fill_phis(builder);
+    switch (LLVM_REF_KIND(ref)) {
+        case LLVM_REF_INT: return LLVM_VALUE_INT(LLVM_REF_INT_VALUE(ref));
+        case LLVM_REF_CONSTANT: return builder->constants.data[LLVM_REF_PAYLOAD(ref)];
+        default: return LLVM_VALUE_LOCAL(LLVM_REF_PAYLOAD(ref));
+    }
+}
+
+void llvm_builder_seal_block(llvm_builder_t *builder, uint block) {
+    if (block >= builder->blocks.size)
+        fatal("unknown block %u.", block);
+    if (builder->blocks.data[block].is_sealed)
+        return;
+    // Completing a phi may add incomplete phis to other blocks, so the list
+    // is walked by index.
+    for (u32 link = builder->blocks.data[block].incomplete; link != 0; link = builder->incomplete.data[link - 1].next) {
+        llvm_builder_incomplete_t incomplete = builder->incomplete.data[link - 1];
+        llvm_builder_complete_phi(builder, incomplete.phi, block, incomplete.variable);
+        llvm_builder_fill_phis(builder);
+    }
+    builder->blocks.data[block].incomplete = 0;
+    builder->blocks.data[block].is_sealed = true;
+}
+
+static llvm_ref_t llvm_builder_resolve(llvm_builder_t *builder, llvm_ref_t ref) {
+    u32 arg_count = (u32)builder->function.args.size;
+    while (LLVM_REF_KIND(ref) == LLVM_REF_LOCAL && LLVM_REF_PAYLOAD(ref) >= arg_count
+           && LLVM_REF_PAYLOAD(ref) - arg_count < builder->instructions.size
+           && builder->instructions.data[LLVM_REF_PAYLOAD(ref) - arg_count].replacement != LLVM_NO_REPLACEMENT)
+        ref = builder->instructions.data[LLVM_REF_PAYLOAD(ref) - arg_count].replacement;
+    return ref;
+}
+
+// Each read of an undefined variable makes its own `undef` constant.
+static bool llvm_builder_is_undef(llvm_builder_t *builder, llvm_ref_t ref) {
+    return LLVM_REF_KIND(ref) == LLVM_REF_CONSTANT && builder->constants.data[LLVM_REF_PAYLOAD(ref)].type == LLVM_VALUE_UNDEF_;
+}
+
+#define LLVM_ARENA_ARRAY(arena, type, count) ((type *)arena_alloc_aligned(arena, (count) * sizeof(type), _Alignof(type)))
+
+// Index of the phi that `ref` names, or `LLVM_NO_RESULT` when it names none.
+static u32 llvm_builder_phi_of(llvm_builder_t *builder, llvm_ref_t ref) {
+    u32 arg_count = (u32)builder->function.args.size;
+    if (LLVM_REF_KIND(ref) != LLVM_REF_LOCAL || LLVM_REF_PAYLOAD(ref) < arg_count || LLVM_REF_PAYLOAD(ref) - arg_count >= builder->instructions.size)
+        return LLVM_NO_RESULT;
+    u32 index = LLVM_REF_PAYLOAD(ref) - arg_count;
+    return builder->instructions.data[index].code.opcode == LLVM_INSTR_PHI ? index : LLVM_NO_RESULT;
+}
+
+// Seals what is still open, then drops phis that only ever see one value
+// besides themselves. Each one dropped may make the phis using it redundant
+// in turn, so those are checked again, with `pending` as the worklist.
+static void llvm_builder_settle(llvm_builder_t *builder) {
+    for (uint i = 0; i < builder->blocks.size; i++)
+        llvm_builder_seal_block(builder, i);
+    arena_t *arena = &builder->gen->arena;
+    u32 arg_count = (u32)builder->function.args.size;
+    u32 created = (u32)builder->instructions.size, use_count = 0;
+    for (u32 i = 0; i < created; i++)
+        if (builder->instructions.data[i].code.opcode == LLVM_INSTR_PHI)
+            use_count += builder->instructions.data[i].code.operand_count / 2u;
+
+    // The phis using each phi, as lists linked through `next`, plus one. A
+    // phi dropped in favour of another hands its list on to that one.
+    arena_mark_t mark = arena_mark(arena);
+    u32 *first = LLVM_ARENA_ARRAY(arena, u32, created);
+    u32 *last = LLVM_ARENA_ARRAY(arena, u32, created);
+    u32 *users = LLVM_ARENA_ARRAY(arena, u32, use_count);
+    u32 *next = LLVM_ARENA_ARRAY(arena, u32, use_count);
+    memset(first, 0, created * sizeof(u32));
+    size_t base = builder->pending.size;
+    u32 links = 0;
+    for (u32 i = 0; i < created; i++) {
+        llvm_code_instruction_t code = builder->instructions.data[i].code;
+        if (code.opcode != LLVM_INSTR_PHI)
+            continue;
+        array_push(u32)(&builder->pending, i);
+        for (u32 j = 0; j < code.operand_count / 2u; j++) {
+            u32 used = llvm_builder_phi_of(builder, builder->operands.data[code.operands + j]);
+            if (used == LLVM_NO_RESULT)
+                continue;
+            users[links] = i;
+            next[links] = 0;
+            if (first[used] == 0)
+                first[used] = links + 1;
+            else
+                next[last[used] - 1] = links + 1;
+            last[used] = ++links;
+        }
+    }
+
+    while (builder->pending.size > base) {
+        u32 i = builder->pending.data[--builder->pending.size];
+        llvm_builder_instruction_t *instruction = &builder->instructions.data[i];
+        if (instruction->replacement != LLVM_NO_REPLACEMENT)
+            continue;
+        llvm_ref_t self = LLVM_REF(LLVM_REF_LOCAL, arg_count + i), same = LLVM_NO_REPLACEMENT;
+        bool is_trivial = true;
+        for (u32 j = 0; j < instruction->code.operand_count / 2u; j++) {
+            llvm_ref_t ref = llvm_builder_resolve(builder, builder->operands.data[instruction->code.operands + j]);
+            if (ref == self || ref == same || (same != LLVM_NO_REPLACEMENT && llvm_builder_is_undef(builder, ref) && llvm_builder_is_undef(builder, same)))
+                continue;
+            if (same != LLVM_NO_REPLACEMENT) {
+                is_trivial = false;
+                break;
+            }
+            same = ref;
+        }
+        if (!is_trivial)
+            continue;
+        if (same == LLVM_NO_REPLACEMENT)
+            same = llvm_builder_ref(builder, LLVM_VALUE_UNDEF());
+        instruction->replacement = same;
+        builder->blocks.data[instruction->block].count--;
+        for (u32 link = first[i]; link != 0; link = next[link - 1])
+            array_push(u32)(&builder->pending, users[link - 1]);
+        u32 heir = llvm_builder_phi_of(builder, same);
+        if (heir != LLVM_NO_RESULT && first[i] != 0) {
+            if (first[heir] == 0)
+                first[heir] = first[i];
+            else
+                next[last[heir] - 1] = first[i];
+            last[heir] = last[i];
+        }
+    }
+    arena_rollback(arena, mark);
+}
+
+void llvm_builder_name_local(llvm_builder_t *builder, uint idx, llvm_value_t handle) {
+    while (builder->locals.size <= idx)
+        array_push(u32)(&builder->locals, 0);
+    builder->locals.data[idx] = handle.local.idx + 1;
+}
+
+bool llvm_builder_has_local(llvm_builder_t *builder, uint idx) {
+    return idx < builder->function.args.size || (idx < builder->locals.size && builder->locals.data[idx] != 0);
+}
+
+void llvm_builder_discard(llvm_builder_t *builder) {
+    if (builder->instructions.size > 0)
+        builder->instructions.data[builder->instructions.size - 1].code.flags |= LLVM_CODE_DISCARD;
+}
+
+llvm_code_t *llvm_builder_finish_code(llvm_builder_t *builder) {
+    arena_t *arena = &builder->gen->arena;
+    u32 arg_count = (u32)builder->function.args.size;
+    if (builder->variables.size > 0)
+        llvm_builder_settle(builder);
+    u32 created = (u32)builder->instructions.size;
+    u32 count = 0;
+    for (u32 i = 0; i < created; i++)
+        count += builder->instructions.data[i].replacement == LLVM_NO_REPLACEMENT;
+
+    // The code and everything it points to are allocated in one go.
+    llvm_code_t *code = LLVM_NEW(builder->gen, llvm_code_t, {0});
+    code->blocks = LLVM_ARENA_ARRAY(arena, llvm_code_block_t, builder->blocks.size);
+    code->instructions = LLVM_ARENA_ARRAY(arena, llvm_code_instruction_t, count);
+    code->operands = LLVM_ARENA_ARRAY(arena, u32, builder->operands.size);
+    code->constants = LLVM_ARENA_ARRAY(arena, llvm_value_t, builder->constants.size);
+    code->symbols = LLVM_ARENA_ARRAY(arena, u32, builder->symbols.size);
+    code->block_count = (u32)builder->blocks.size;
+    code->instruction_count = count;
+    code->operand_count = (u32)builder->operands.size;
+    code->constant_count = (u32)builder->constants.size;
+    code->symbol_count = (u32)builder->symbols.size;
+    if (builder->constants.size > 0)
+        memcpy(code->constants, builder->constants.data, builder->constants.size * sizeof(llvm_value_t));
+    if (builder->symbols.size > 0)
+        memcpy(code->symbols, builder->symbols.data, builder->symbols.size * sizeof(u32));
+
+    u32 first = 0;
+    for (u32 i = 0; i < code->block_count; i++) {
+        llvm_builder_block_t *block = &builder->blocks.data[i];
+        code->blocks[i] = (llvm_code_block_t){block->name, first, block->count};
+        block->count = first; // from here on, the block's next free position
+        first += code->blocks[i].count;
+    }
+
+    // A block's instructions become adjacent no matter when they were
+    // appended, phis first, so handles are moved to their final position.
+    // Phis that were dropped have none; their uses go to what replaced them.
+    // `positions` is only needed until the operands are rewritten.
+    arena_mark_t mark = arena_mark(arena);
+    u32 *positions = LLVM_ARENA_ARRAY(arena, u32, created);
+    for (int pass = 0; pass < 2; pass++) {
+        for (u32 i = 0; i < created; i++) {
+            llvm_builder_instruction_t *instruction = &builder->instructions.data[i];
+            if ((instruction->code.opcode == LLVM_INSTR_PHI) != (pass == 0))
+                continue;
+            positions[i] = instruction->replacement != LLVM_NO_REPLACEMENT ? LLVM_NO_RESULT
+                         : builder->blocks.data[instruction->block].count++;
+        }
+    }
+
+    for (u32 i = 0; i < created; i++) {
+        if (positions[i] == LLVM_NO_RESULT)
+            continue;
+        llvm_code_instruction_t instruction = builder->instructions.data[i].code;
+        u32 ref_count = LLVM_CODE_REF_COUNT(instruction);
+        for (u32 j = 0; j < instruction.operand_count; j++) {
+            u32 operand = builder->operands.data[instruction.operands + j];
+            if (j < ref_count)
+                operand = llvm_builder_resolve(builder, operand);
+            if (j < ref_count && LLVM_REF_KIND(operand) == LLVM_REF_LOCAL && LLVM_REF_PAYLOAD(operand) >= arg_count)
+                operand = LLVM_REF(LLVM_REF_LOCAL, arg_count + positions[LLVM_REF_PAYLOAD(operand) - arg_count]);
+            code->operands[instruction.operands + j] = operand;
+        }
+        code->instructions[positions[i]] = instruction;
+    }
+    arena_rollback(arena, mark);
+
+    // Refs to instructions without a value can only be caught once all of
+    // them are in place. They stand for no value at all.
+    for (u32 i = 0; i < count; i++) {
+        llvm_code_instruction_t instruction = code->instructions[i];
+        for (u32 j = 0; j < LLVM_CODE_REF_COUNT(instruction); j++) {
+            u32 *operand = &code->operands[instruction.operands + j];
+            if (LLVM_REF_KIND(*operand) != LLVM_REF_LOCAL || LLVM_REF_PAYLOAD(*operand) < arg_count)
+                continue;
+            if (!llvm_code_has_result(code->instructions[LLVM_REF_PAYLOAD(*operand) - arg_count]))
+                *operand = LLVM_REF(LLVM_REF_UNDEFINED, LLVM_REF_PAYLOAD(*operand));
+        }
+    }
+
+    llvm_builder_clear(builder);
+    return code;
+}
+
+bool llvm_builder_finish(llvm_builder_t *builder) {
+    llvm_function_t function = builder->function;
+    function.code = llvm_builder_finish_code(builder);
+    builder->function = (llvm_function_t){0};
+    return llvm_add_function(builder->gen, function);
+}
+
+bool llvm_code_has_result(llvm_code_instruction_t instruction) {
+    return !llvm_code_is_terminator(instruction) && instruction.opcode != LLVM_INSTR_STORE && !(instruction.flags & LLVM_CODE_DISCARD);
+}
+
+bool llvm_code_is_terminator(llvm_code_instruction_t instruction) {
+    switch (instruction.opcode) {
+        case LLVM_INSTR_RETURN:
+        case LLVM_INSTR_BR:
+        case LLVM_INSTR_COND_BR: return true;
+        default: return false;
+    }
+}
+
+u32 llvm_code_successors(llvm_code_t *code, u32 block, u32 successors[2]) {
+    llvm_code_block_t b = code->blocks[block];
+    if (b.count == 0)
+        return 0;
+    llvm_code_instruction_t last = code->instructions[b.first + b.count - 1];
+    u32 *operands = &code->operands[last.operands];
+    switch (last.opcode) {
+        case LLVM_INSTR_BR: {
+            successors[0] = operands[0];
+        } return 1;
+        case LLVM_INSTR_COND_BR: {
+            successors[0] = operands[1];
+            successors[1] = operands[2];
+        } return 2;
+        default: return 0;
+    }
+}
+
+u32 *llvm_code_results(llvm_code_t *code, u32 *scratch, size_t scratch_count) {
+    u32 *results = code->instruction_count <= scratch_count ? scratch : malloc(code->instruction_count * sizeof(u32));
+    u32 next = 0;
+    for (u32 i = 0; i < code->instruction_count; i++)
+        results[i] = llvm_code_has_result(code->instructions[i]) ? next++ : LLVM_NO_RESULT;
+    return results;
+}
+
+llvm_value_t llvm_code_value(llvm_code_t *code, llvm_ref_t ref) {
+    switch (LLVM_REF_KIND(ref)) {
+        case LLVM_REF_INT: return LLVM_VALUE_INT(LLVM_REF_INT_VALUE(ref));
+        case LLVM_REF_CONSTANT: return code->constants[LLVM_REF_PAYLOAD(ref)];
+        case LLVM_REF_UNDEFINED: fatal("use of undefined value %%%u, which llvm_verify reports.", LLVM_REF_PAYLOAD(ref));
+    }
+    fatal("value %u is not a constant.", ref);
+}
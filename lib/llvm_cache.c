@@ -0,0 +1,147 @@
+#include "llvm.h"
+
+// Every section is kept exactly as long as the module list it mirrors, so an
+// index is valid in both. Entries of entities that went away stop counting
+// as live and are dropped by the next compaction.
+static void llvm_cache_section_resize(llvm_cache_t *cache, llvm_cache_section_t *section, size_t count) {
+    for (size_t i = count; i < section->count; i++)
+        if (section->entries[i].revision != 0)
+            cache->live -= section->entries[i].count;
+    if (count > section->count) {
+        section->entries = realloc(section->entries, count * sizeof(llvm_cache_entry_t));
+        memset(section->entries + section->count, 0, (count - section->count) * sizeof(llvm_cache_entry_t));
+    }
+    section->count = count;
+}
+
+static void llvm_cache_section_free(llvm_cache_section_t *section) {
+    free(section->entries);
+    section->entries = NULL;
+    section->count = 0;
+}
+
+void llvm_cache_enable(llvm_generator_t *gen, bool enable) {
+    llvm_cache_t *cache = &gen->cache;
+    if (enable == cache->is_enabled)
+        return;
+    if (enable) {
+        str_builder_init(&cache->text);
+    } else {
+        str_builder_free(&cache->text);
+        llvm_cache_section_free(&cache->type_declarations);
+        llvm_cache_section_free(&cache->globals);
+        llvm_cache_section_free(&cache->functions);
+        cache->live = 0;
+        cache->variadic = 0;
+    }
+    cache->is_enabled = enable;
+}
+
+void llvm_cache_prepare(llvm_generator_t *gen) {
+    llvm_cache_t *cache = &gen->cache;
+    if (!cache->is_enabled)
+        return;
+    llvm_cache_section_resize(cache, &cache->type_declarations, gen->type_declarations.size);
+    llvm_cache_section_resize(cache, &cache->globals, gen->globals.size);
+    llvm_cache_section_resize(cache, &cache->functions, gen->functions.size);
+
+    // A call is written with `, ...` when its callee is variadic, so the
+    // text of a function also depends on its callees. Whenever the set of
+    // variadic functions changes, however that happened, no function's
+    // text is reused.
+    u64 variadic = 0;
+    for (size_t i = 0; i < gen->functions.size; i++)
+        if (gen->functions.data[i].is_vararg)
+            variadic += str_hash(gen->functions.data[i].name) | 1;
+    if (variadic == cache->variadic)
+        return;
+    cache->variadic = variadic;
+    llvm_cache_section_t *functions = &cache->functions;
+    for (size_t i = 0; i < functions->count; i++) {
+        if (functions->entries[i].revision != 0)
+            cache->live -= functions->entries[i].count;
+        functions->entries[i].revision = 0;
+    }
+}
+
+bool llvm_cache_is_fresh(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision) {
+    return gen->cache.is_enabled && revision != 0 && section->entries[index].revision == revision;
+}
+
+bool llvm_cache_fetch(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision, str_builder_t *out) {
+    if (!gen->cache.is_enabled)
+        return false;
+    if (!llvm_cache_is_fresh(gen, section, index, revision)) {
+        LLVM_STATS_ADD(gen, cache_misses, 1);
+        return false;
+    }
+    llvm_cache_entry_t entry = section->entries[index];
+    str_builder_append(out, (str){gen->cache.text.chars + entry.offset, entry.count});
+    LLVM_STATS_ADD(gen, cache_hits, 1);
+    return true;
+}
+
+void llvm_cache_store(llvm_generator_t *gen, llvm_cache_section_t *section, size_t index, u64 revision, str text) {
+    llvm_cache_t *cache = &gen->cache;
+    if (!cache->is_enabled || revision == 0)
+        return;
+    llvm_cache_entry_t *entry = &section->entries[index];
+    if (entry->revision != 0)
+        cache->live -= entry->count;
+    *entry = (llvm_cache_entry_t){revision, cache->text.count, text.count};
+    str_builder_append(&cache->text, text);
+    cache->live += text.count;
+}
+
+static void llvm_cache_section_move(llvm_cache_t *cache, llvm_cache_section_t *section, str_builder_t *text) {
+    for (size_t i = 0; i < section->count; i++) {
+        llvm_cache_entry_t *entry = &section->entries[i];
+        if (entry->revision == 0)
+            continue;
+        str piece = {cache->text.chars + entry->offset, entry->count};
+        entry->offset = text->count;
+        str_builder_append(text, piece);
+    }
+}
+
+// Re-rendered entities leave their old text behind. Once that outweighs the
+// text still in use, the live pieces are copied into a fresh buffer.
+void llvm_cache_compact(llvm_generator_t *gen) {
+    llvm_cache_t *cache = &gen->cache;
+    if (!cache->is_enabled || cache->text.count - cache->live <= MAX(cache->live, LLVM_SINK_CHUNK_SIZE))
+        return;
+    str_builder_t text;
+    str_builder_init(&text);
+    str_builder_reserve(&text, cache->live);
+    llvm_cache_section_move(cache, &cache->type_declarations, &text);
+    llvm_cache_section_move(cache, &cache->globals, &text);
+    llvm_cache_section_move(cache, &cache->functions, &text);
+    str_builder_free(&cache->text);
+    cache->text = text;
+}
+
+void llvm_cache_retain(llvm_generator_t *gen, llvm_cache_section_t *section, const bool *keep) {
+    llvm_cache_t *cache = &gen->cache;
+    if (!cache->is_enabled)
+        return;
+    size_t kept = 0;
+    for (size_t i = 0; i < section->count; i++) {
+        if (keep[i])
+            section->entries[kept++] = section->entries[i];
+        else if (section->entries[i].revision != 0)
+            cache->live -= section->entries[i].count;
+    }
+    section->count = kept;
+}
+
+void llvm_touch_type_declaration(llvm_generator_t *gen, llvm_type_declaration_t *type_declaration) {
+    type_declaration->revision = ++gen->revision;
+}
+
+void llvm_touch_global(llvm_generator_t *gen, llvm_global_t *global) {
+    global->revision = ++gen->revision;
+}
+
+void llvm_touch_function(llvm_generator_t *gen, llvm_function_t *function) {
+    function->revision = ++gen->revision;
+}
@@ -0,0 +1,102 @@
+#include "llvm.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LLVM_ESCAPE_SSE2
+#endif
+
+// Input is escaped this many bytes at a time, so that the output never
+// needs more than three times as much room reserved up front.
+#define LLVM_ESCAPE_BLOCK 4096
+
+static inline bool llvm_escape_is_clean(u8 c) {
+    return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+}
+
+static inline bool llvm_escape_is_hex(u8 c) {
+    return (unsigned)(c - '0') < 10 || (unsigned)((c | 0x20) - 'a') < 6;
+}
+
+// Copies the run of bytes at the start of `src` that need no escaping and
+// returns its length. Whole vectors are stored before they are checked, so
+// `dst` must have room for all `n` bytes.
+static size_t llvm_escape_copy_clean(char *dst, const char *src, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    // Bytes below 0x20 and from 0x80 up are both below 0x20 when compared
+    // as signed, which leaves 0x7f, '"' and '\\' to be matched exactly.
+    const __m256i space = _mm256_set1_epi8(0x20), del = _mm256_set1_epi8(0x7f);
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+        __m256i dirty = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del)),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)));
+        u32 mask = (u32)_mm256_movemask_epi8(dirty);
+        if (mask != 0)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+#elif defined(LLVM_ESCAPE_SSE2)
+    // See above; the same test on 16 bytes.
+    const __m128i space = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7f);
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+        __m128i dirty = _mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+        u32 mask = (u32)_mm_movemask_epi8(dirty);
+        if (mask != 0)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+#endif
+    for (; i < n && llvm_escape_is_clean((u8)src[i]); i++)
+        dst[i] = src[i];
+    return i;
+}
+
+static void llvm_escape(str_builder_t *out, str s, bool keep_escapes) {
+    static const char digits[] = "0123456789ABCDEF";
+    const char *src = s.chars;
+    size_t i = 0;
+    while (i < s.count) {
+        size_t end = i + MIN(s.count - i, (size_t)LLVM_ESCAPE_BLOCK);
+        // A kept escape may run up to two bytes past the block.
+        str_builder_reserve(out, (end - i) * 3 + 2);
+        char *dst = out->chars + out->count;
+        while (i < end) {
+            size_t run = llvm_escape_copy_clean(dst, src + i, end - i);
+            dst += run;
+            i += run;
+            if (i == end)
+                break;
+            u8 c = (u8)src[i];
+            if (keep_escapes && c == '\\' && i + 1 < s.count && src[i + 1] == '\\') {
+                *dst++ = '\\';
+                *dst++ = '\\';
+                i += 2;
+            } else if (keep_escapes && c == '\\' && i + 2 < s.count && llvm_escape_is_hex((u8)src[i + 1]) && llvm_escape_is_hex((u8)src[i + 2])) {
+                memcpy(dst, src + i, 3);
+                dst += 3;
+                i += 3;
+            } else {
+                // As LLVM prints it, so a backslash never appears doubled.
+                *dst++ = '\\';
+                *dst++ = digits[c >> 4];
+                *dst++ = digits[c & 15];
+                i++;
+            }
+        }
+        out->count = (size_t)(dst - out->chars);
+    }
+}
+
+void llvm_generate_escaped(str_builder_t *out, str bytes) {
+    llvm_escape(out, bytes, false);
+}
+
+void llvm_generate_escaped_text(str_builder_t *out, str text) {
+    llvm_escape(out, text, true);
+}
@@ -0,0 +1,414 @@
+#include "llvm.h"
+
+#include <stdarg.h>
+
+// How strongly a symbol claims its name. The higher claim wins; of two
+// equal ones the first is kept, except that two strong definitions clash.
+typedef enum llvm_link_rank_t {
+    LLVM_LINK_DECLARATION,
+    LLVM_LINK_AVAILABLE, // `available_externally`: any other definition replaces it
+    LLVM_LINK_WEAK,      // `linkonce`, `weak` and `common`
+    LLVM_LINK_STRONG,
+} llvm_link_rank_t;
+
+// What is known about one name of the destination, indexed by its id.
+typedef struct llvm_link_name_t {
+    u32 module;      // where the definition that wins comes from, 0 is `dst`
+    u32 index;       // in that module's globals or functions
+    u8 rank;
+    bool is_function;
+    bool is_public;  // some module has it without internal linkage
+    u32 declaration; // type declaration of that name in `dst`, plus one
+} llvm_link_name_t;
+
+typedef struct llvm_linker_t {
+    llvm_generator_t *dst;
+    array(llvm_diagnostic_t) *diagnostics;
+    size_t error_count;
+    llvm_link_name_t *names;
+    size_t name_count;
+    u32 next_suffix; // for names that have to be made unique
+    // Per source module, while it is copied.
+    llvm_generator_t *src;
+    u32 *name_map;  // source name id -> destination name id, 0 until needed
+    u32 *type_map;  // source type id -> destination type id, 0 until needed
+    u32 *global_ids; // source global -> its name id
+    u32 *function_ids;
+} llvm_linker_t;
+
+static void llvm_link_fail(llvm_linker_t *l, str symbol, const char *format, ...) {
+    l->error_count++;
+    if (l->diagnostics == NULL)
+        return;
+    llvm_diagnostic_t diagnostic = {LLVM_DIAGNOSTIC_SYMBOL_CONFLICT, symbol, {0}, 0, {0}};
+    va_list args;
+    va_start(args, format);
+    vsnprintf(diagnostic.message, sizeof(diagnostic.message), format, args);
+    va_end(args);
+    array_push(llvm_diagnostic_t)(l->diagnostics, diagnostic);
+}
+
+// The entry of a destination name id, growing the table as names are
+// interned.
+static llvm_link_name_t *llvm_link_name(llvm_linker_t *l, u32 id) {
+    if (id > l->name_count) {
+        size_t count = MAX(l->name_count * 2, l->dst->names.names.size);
+        l->names = realloc(l->names, count * sizeof(llvm_link_name_t));
+        memset(l->names + l->name_count, 0, (count - l->name_count) * sizeof(llvm_link_name_t));
+        l->name_count = count;
+    }
+    return &l->names[id - 1];
+}
+
+static llvm_link_rank_t llvm_link_rank(llvm_linkage_type_t linkage, bool is_declaration) {
+    if (is_declaration)
+        return LLVM_LINK_DECLARATION;
+    switch (linkage) {
+        case LLVM_LINKAGE_EXTERN_WEAK: return LLVM_LINK_DECLARATION;
+        case LLVM_LINKAGE_AVAILABLE_EXTERNALLY: return LLVM_LINK_AVAILABLE;
+        case LLVM_LINKAGE_LINKONCE:
+        case LLVM_LINKAGE_WEAK:
+        case LLVM_LINKAGE_COMMON: return LLVM_LINK_WEAK;
+        default: return LLVM_LINK_STRONG;
+    }
+}
+
+// Records the claim module `module` makes on a name through the symbol
+// `ref` of `gen`. Internal symbols make none; they are renamed instead.
+static void llvm_link_claim(llvm_linker_t *l, llvm_generator_t *gen, u32 module, str name, uint ref) {
+    bool is_function = LLVM_SYMBOL_IS_FUNCTION(ref);
+    u32 index = LLVM_SYMBOL_INDEX(ref);
+    llvm_linkage_type_t linkage;
+    llvm_link_rank_t rank;
+    if (is_function) {
+        llvm_function_t *function = &gen->functions.data[index];
+        linkage = function->linkage;
+        rank = llvm_link_rank(linkage, function->is_native || function->code == NULL);
+    } else {
+        linkage = gen->globals.data[index].linkage;
+        rank = llvm_link_rank(linkage, false);
+    }
+    if (linkage == LLVM_LINKAGE_INTERNAL)
+        return;
+
+    llvm_link_name_t *entry = llvm_link_name(l, llvm_name_intern(l->dst, name));
+    if (!entry->is_public) {
+        *entry = (llvm_link_name_t){module, index, (u8)rank, is_function, true, entry->declaration};
+    } else if (entry->is_function != is_function) {
+        llvm_link_fail(l, name, "'@" STR_ARG "' is a function in one module and a global in another", STR_FMT(name));
+    } else if (rank == LLVM_LINK_STRONG && entry->rank == LLVM_LINK_STRONG) {
+        llvm_link_fail(l, name, "'@" STR_ARG "' is defined in modules %u and %u", STR_FMT(name), entry->module, module);
+    } else if (rank > entry->rank) {
+        entry->module = module;
+        entry->index = index;
+        entry->rank = (u8)rank;
+    }
+}
+
+static void llvm_link_claim_all(llvm_linker_t *l, llvm_generator_t *gen, u32 module) {
+    for (size_t i = 0; i < gen->names.names.size; i++) {
+        llvm_name_t *name = &gen->names.names.data[i];
+        if (name->symbol != 0)
+            llvm_link_claim(l, gen, module, name->text, name->symbol);
+    }
+}
+
+// Interns `base` with the first suffix that gives a name nothing uses:
+// neither a symbol of `dst` nor any public name, or for a type declaration,
+// no other type declaration.
+static u32 llvm_link_unique(llvm_linker_t *l, str base, bool is_type) {
+    str_builder_t candidate;
+    str_builder_init(&candidate);
+    for (;;) {
+        candidate.count = 0;
+        str_builder_append(&candidate, base);
+        str_builder_append_char(&candidate, '.');
+        str_builder_append_u64(&candidate, l->next_suffix++);
+        u32 id = llvm_name_intern(l->dst, str_builder_view(&candidate));
+        llvm_link_name_t *entry = llvm_link_name(l, id);
+        bool taken = is_type ? entry->declaration != 0 : entry->is_public || llvm_symbol_of(l->dst, id) != 0;
+        if (!taken) {
+            str_builder_free(&candidate);
+            return id;
+        }
+    }
+}
+
+// Internal symbols of `dst` whose names another module made public move
+// out of the way. References to them are all in `dst` and are rewritten.
+static void llvm_link_rename_internals(llvm_linker_t *l) {
+    llvm_generator_t *dst = l->dst;
+    size_t count = dst->names.names.size;
+    u32 *renames = NULL;
+    for (size_t i = 0; i < count && i < l->name_count; i++) {
+        uint ref = dst->names.names.data[i].symbol;
+        if (ref == 0 || !l->names[i].is_public)
+            continue;
+        bool is_function = LLVM_SYMBOL_IS_FUNCTION(ref);
+        llvm_global_t *global = is_function ? NULL : &dst->globals.data[LLVM_SYMBOL_INDEX(ref)];
+        llvm_function_t *function = is_function ? &dst->functions.data[LLVM_SYMBOL_INDEX(ref)] : NULL;
+        if ((is_function ? function->linkage : global->linkage) != LLVM_LINKAGE_INTERNAL)
+            continue;
+        if (renames == NULL)
+            renames = calloc(count + 1, sizeof(u32));
+        u32 id = llvm_link_unique(l, dst->names.names.data[i].text, false);
+        renames[i + 1] = id;
+        dst->names.names.data[i].symbol = 0;
+        dst->names.symbol_count--;
+        llvm_symbol_bind(dst, id, ref);
+        if (is_function) {
+            function->name = llvm_name_text(dst, id);
+            llvm_touch_function(dst, function);
+        } else {
+            global->name = llvm_name_text(dst, id);
+            llvm_touch_global(dst, global);
+        }
+    }
+    if (renames == NULL)
+        return;
+
+    for (size_t i = 0; i < dst->globals.size; i++) {
+        llvm_global_t *global = &dst->globals.data[i];
+        if (global->value.type != LLVM_VALUE_GETELEMENTPTR_)
+            continue;
+        u32 id = llvm_name_find(dst, global->value.getelementptr.name);
+        if (id != 0 && id <= count && renames[id] != 0) {
+            global->value.getelementptr.name = llvm_name_text(dst, renames[id]);
+            llvm_touch_global(dst, global);
+        }
+    }
+    for (size_t i = 0; i < dst->functions.size; i++) {
+        llvm_function_t *function = &dst->functions.data[i];
+        llvm_code_t *code = function->code;
+        if (function->is_native || code == NULL)
+            continue;
+        bool changed = false;
+        for (u32 j = 0; j < code->symbol_count; j++) {
+            if (code->symbols[j] <= count && renames[code->symbols[j]] != 0) {
+                llvm_code_own(dst, code);
+                code->symbols[j] = renames[code->symbols[j]];
+                changed = true;
+            }
+        }
+        for (u32 j = 0; j < code->constant_count; j++) {
+            llvm_value_t *value = &code->constants[j];
+            if (value->type != LLVM_VALUE_GETELEMENTPTR_)
+                continue;
+            u32 id = llvm_name_find(dst, value->getelementptr.name);
+            if (id != 0 && id <= count && renames[id] != 0) {
+                value->getelementptr.name = llvm_name_text(dst, renames[id]);
+                changed = true;
+            }
+        }
+        if (changed)
+            llvm_touch_function(dst, function);
+    }
+    // The constant pool finds its globals by name.
+    for (size_t i = 0; i < dst->constants.slot_count; i++) {
+        llvm_constant_slot_t *slot = &dst->constants.slots[i];
+        u32 id = slot->name.count > 0 ? llvm_name_find(dst, slot->name) : 0;
+        if (id != 0 && id <= count && renames[id] != 0)
+            slot->name = llvm_name_text(dst, renames[id]);
+    }
+    free(renames);
+}
+
+static llvm_type_t *llvm_link_type(llvm_linker_t *l, llvm_type_t *type) {
+    llvm_generator_t *src = l->src;
+    bool is_canonical = type->id != 0 && type->id <= src->types.entries.size && llvm_type_by_id(src, type->id) == type;
+    if (!is_canonical)
+        return llvm_type_get(l->dst, *type);
+    if (l->type_map[type->id] == 0)
+        l->type_map[type->id] = llvm_type_get(l->dst, *type)->id;
+    return llvm_type_by_id(l->dst, l->type_map[type->id]);
+}
+
+static u32 llvm_link_type_id(llvm_linker_t *l, u32 id) {
+    return id == 0 ? 0 : llvm_link_type(l, llvm_type_by_id(l->src, id))->id;
+}
+
+// Where a name of the source module ends up. Names that were not bound to
+// a symbol there, such as callees that were never declared, are kept.
+static u32 llvm_link_name_id(llvm_linker_t *l, u32 id) {
+    if (l->name_map[id] == 0)
+        l->name_map[id] = llvm_name_intern(l->dst, llvm_name_text(l->src, id));
+    return l->name_map[id];
+}
+
+static str llvm_link_symbol_text(llvm_linker_t *l, str name) {
+    u32 id = llvm_name_find(l->src, name);
+    return llvm_name_text(l->dst, id != 0 ? llvm_link_name_id(l, id) : llvm_name_intern(l->dst, name));
+}
+
+// A copy of `value` that only points into `dst`.
+static llvm_value_t llvm_link_value(llvm_linker_t *l, llvm_value_t value) {
+    arena_t *arena = &l->dst->arena;
+    switch (value.type) {
+        case LLVM_VALUE_STRING_: value.string_ = arena_strdup(arena, value.string_); break;
+        case LLVM_VALUE_CSTRING_: value.cstring_ = arena_strdup(arena, value.cstring_); break;
+        case LLVM_VALUE_BYTES_: value.bytes_ = arena_strdup(arena, value.bytes_); break;
+        case LLVM_VALUE_TYPE_: value.type_ = *llvm_link_type(l, &value.type_); break;
+        case LLVM_VALUE_GETELEMENTPTR_:
+            value.getelementptr.name = llvm_link_symbol_text(l, value.getelementptr.name);
+            value.getelementptr.type = llvm_link_type(l, value.getelementptr.type);
+            break;
+        default: break;
+    }
+    return value;
+}
+
+static llvm_code_t *llvm_link_code(llvm_linker_t *l, llvm_code_t *code) {
+    llvm_generator_t *dst = l->dst;
+    llvm_code_t *copy = LLVM_NEW(dst, llvm_code_t, *code);
+    copy->blocks = arena_dup(&dst->arena, code->blocks, code->block_count * sizeof(llvm_code_block_t), _Alignof(llvm_code_block_t));
+    copy->instructions = arena_dup(&dst->arena, code->instructions, code->instruction_count * sizeof(llvm_code_instruction_t), _Alignof(llvm_code_instruction_t));
+    copy->operands = arena_dup(&dst->arena, code->operands, code->operand_count * sizeof(u32), _Alignof(u32));
+    copy->constants = arena_dup(&dst->arena, code->constants, code->constant_count * sizeof(llvm_value_t), _Alignof(llvm_value_t));
+    copy->symbols = arena_dup(&dst->arena, code->symbols, code->symbol_count * sizeof(u32), _Alignof(u32));
+    for (u32 i = 0; i < code->block_count; i++)
+        copy->blocks[i].name = arena_strdup(&dst->arena, code->blocks[i].name);
+    for (u32 i = 0; i < code->instruction_count; i++) {
+        llvm_code_instruction_t *instruction = &copy->instructions[i];
+        instruction->type = llvm_link_type_id(l, instruction->type);
+        if (instruction->opcode == LLVM_INSTR_CALL)
+            for (u32 j = instruction->operand_count / 2u; j < instruction->operand_count; j++)
+                copy->operands[instruction->operands + j] = llvm_link_type_id(l, copy->operands[instruction->operands + j]);
+    }
+    for (u32 i = 0; i < code->constant_count; i++)
+        copy->constants[i] = llvm_link_value(l, code->constants[i]);
+    for (u32 i = 0; i < code->symbol_count; i++)
+        copy->symbols[i] = llvm_link_name_id(l, code->symbols[i]);
+    return copy;
+}
+
+static llvm_global_t llvm_link_global(llvm_linker_t *l, llvm_global_t *global, u32 name) {
+    llvm_global_t copy = *global;
+    copy.name = llvm_name_text(l->dst, name);
+    copy.type = global->type != NULL ? llvm_link_type(l, global->type) : NULL;
+    copy.value = llvm_link_value(l, global->value);
+    return copy;
+}
+
+static llvm_function_t llvm_link_function(llvm_linker_t *l, llvm_function_t *function, u32 name) {
+    llvm_function_t copy = *function;
+    copy.name = llvm_name_text(l->dst, name);
+    copy.return_type = *llvm_link_type(l, &function->return_type);
+    copy.args = array_new_arena(llvm_type_t)(&l->dst->arena);
+    for (size_t i = 0; i < function->args.size; i++)
+        array_push(llvm_type_t)(&copy.args, *llvm_link_type(l, &function->args.data[i]));
+    copy.body = NULL;
+    copy.code = function->is_native || function->code == NULL ? NULL : llvm_link_code(l, function->code);
+    return copy;
+}
+
+// Type declarations only name a structure for the reader; types are always
+// spelled out where they are used. Equal ones are kept once, and one that
+// reuses a name for another type is renamed.
+static void llvm_link_type_declarations(llvm_linker_t *l) {
+    llvm_generator_t *dst = l->dst, *src = l->src;
+    for (size_t i = 0; i < src->type_declarations.size; i++) {
+        llvm_type_declaration_t declaration = src->type_declarations.data[i];
+        llvm_type_t *type = llvm_link_type(l, &declaration.type);
+        u32 id = llvm_name_intern(dst, declaration.name);
+        u32 existing = llvm_link_name(l, id)->declaration;
+        if (existing != 0 && llvm_type_get(dst, dst->type_declarations.data[existing - 1].type) == type)
+            continue;
+        if (existing != 0)
+            id = llvm_link_unique(l, declaration.name, true);
+        llvm_link_name(l, id)->declaration = (u32)dst->type_declarations.size + 1;
+        llvm_add_type_declaration(dst, (llvm_type_declaration_t){.name = llvm_name_text(dst, id), .type = *type});
+    }
+}
+
+// Copies module `module` into `dst`. Internal symbols always come along,
+// renamed when their name is taken. A public symbol is added where its
+// name is first seen and replaced in place by the module that wins it.
+static void llvm_link_module(llvm_linker_t *l, llvm_generator_t *src, u32 module) {
+    llvm_generator_t *dst = l->dst;
+    l->src = src;
+    l->name_map = calloc(src->names.names.size + 1, sizeof(u32));
+    l->type_map = calloc(src->types.entries.size + 1, sizeof(u32));
+    l->global_ids = calloc(src->globals.size + 1, sizeof(u32));
+    l->function_ids = calloc(src->functions.size + 1, sizeof(u32));
+
+    for (size_t i = 0; i < src->names.names.size; i++) {
+        uint ref = src->names.names.data[i].symbol;
+        if (ref == 0)
+            continue;
+        str text = src->names.names.data[i].text;
+        bool is_function = LLVM_SYMBOL_IS_FUNCTION(ref);
+        u32 index = LLVM_SYMBOL_INDEX(ref);
+        llvm_linkage_type_t linkage = is_function ? src->functions.data[index].linkage : src->globals.data[index].linkage;
+        u32 id = llvm_name_intern(dst, text);
+        if (linkage == LLVM_LINKAGE_INTERNAL && (llvm_link_name(l, id)->is_public || llvm_symbol_of(dst, id) != 0))
+            id = llvm_link_unique(l, text, false);
+        // Reserve the name right away, so that no other internal symbol of
+        // this module is renamed onto it.
+        if (linkage == LLVM_LINKAGE_INTERNAL)
+            llvm_symbol_bind(dst, id, ref);
+        l->name_map[i + 1] = id;
+        (is_function ? l->function_ids : l->global_ids)[index] = (u32)i + 1;
+    }
+
+    llvm_link_type_declarations(l);
+    for (size_t i = 0; i < src->globals.size; i++) {
+        llvm_global_t *global = &src->globals.data[i];
+        u32 name = l->name_map[l->global_ids[i]];
+        llvm_link_name_t *entry = llvm_link_name(l, name);
+        uint existing = llvm_symbol_of(dst, name);
+        if (global->linkage == LLVM_LINKAGE_INTERNAL) {
+            // Bound above to a placeholder; the real position comes now.
+            dst->names.names.data[name - 1].symbol = 0;
+            dst->names.symbol_count--;
+            llvm_add_global(dst, llvm_link_global(l, global, name));
+        } else if (existing == 0) {
+            llvm_add_global(dst, llvm_link_global(l, global, name));
+        } else if (entry->module == module && entry->index == i) {
+            llvm_global_t *target = &dst->globals.data[LLVM_SYMBOL_INDEX(existing)];
+            *target = llvm_link_global(l, global, name);
+            llvm_touch_global(dst, target);
+        }
+    }
+    for (size_t i = 0; i < src->functions.size; i++) {
+        llvm_function_t *function = &src->functions.data[i];
+        u32 name = l->name_map[l->function_ids[i]];
+        llvm_link_name_t *entry = llvm_link_name(l, name);
+        uint existing = llvm_symbol_of(dst, name);
+        if (function->linkage == LLVM_LINKAGE_INTERNAL) {
+            dst->names.names.data[name - 1].symbol = 0;
+            dst->names.symbol_count--;
+            llvm_add_function(dst, llvm_link_function(l, function, name));
+        } else if (existing == 0) {
+            llvm_add_function(dst, llvm_link_function(l, function, name));
+        } else if (entry->module == module && entry->index == i) {
+            llvm_replace_function(dst, llvm_link_function(l, function, name));
+        }
+    }
+
+    free(l->name_map);
+    free(l->type_map);
+    free(l->global_ids);
+    free(l->function_ids);
+}
+
+bool llvm_link_modules(llvm_generator_t *dst, llvm_generator_t *const *srcs, size_t n, array(llvm_diagnostic_t) *diagnostics) {
+    llvm_linker_t l = {.dst = dst, .diagnostics = diagnostics, .next_suffix = 1};
+    for (size_t i = 0; i < dst->type_declarations.size; i++) {
+        llvm_link_name_t *entry = llvm_link_name(&l, llvm_name_intern(dst, dst->type_declarations.data[i].name));
+        if (entry->declaration == 0)
+            entry->declaration = (u32)i + 1;
+    }
+    llvm_link_claim_all(&l, dst, 0);
+    for (size_t i = 0; i < n; i++)
+        llvm_link_claim_all(&l, srcs[i], (u32)i + 1);
+    if (l.error_count > 0) {
+        free(l.names);
+        return false;
+    }
+
+    llvm_link_rename_internals(&l);
+    for (size_t i = 0; i < n; i++)
+        llvm_link_module(&l, srcs[i], (u32)i + 1);
+    free(l.names);
+    return true;
+}
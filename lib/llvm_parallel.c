@@ -0,0 +1,188 @@
+#include "llvm.h"
+
+#include <stdatomic.h>
+#include <threads.h>
+
+// Functions are split into one contiguous range per worker. A worker takes
+// indices from the front of its own range and, once that is empty, steals
+// the back half of the fullest range it can find. Both ends of a range are
+// packed into one word so that either move is a single compare-and-swap.
+#define LLVM_RANGE(begin, end) (((u64)(end) << 32) | (u64)(begin))
+#define LLVM_RANGE_BEGIN(range) ((u32)(range))
+#define LLVM_RANGE_END(range) ((u32)((range) >> 32))
+
+typedef struct llvm_piece_t {
+    uint worker;
+    size_t offset;
+    size_t count;
+} llvm_piece_t;
+
+typedef struct llvm_worker_t {
+    _Atomic u64 range;
+    str_builder_t out;
+    uint index;
+    struct llvm_parallel_t *shared;
+} llvm_worker_t;
+
+typedef struct llvm_parallel_t {
+    llvm_generator_t *gen;
+    llvm_worker_t *workers;
+    uint worker_count;
+    llvm_piece_t *pieces; // one per function, in declaration order
+} llvm_parallel_t;
+
+static bool llvm_worker_pop(llvm_worker_t *worker, u32 *index) {
+    u64 range = atomic_load(&worker->range);
+    while (LLVM_RANGE_BEGIN(range) < LLVM_RANGE_END(range)) {
+        u64 next = LLVM_RANGE(LLVM_RANGE_BEGIN(range) + 1, LLVM_RANGE_END(range));
+        if (atomic_compare_exchange_weak(&worker->range, &range, next)) {
+            *index = LLVM_RANGE_BEGIN(range);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool llvm_worker_steal(llvm_worker_t *thief) {
+    llvm_parallel_t *shared = thief->shared;
+    for (;;) {
+        llvm_worker_t *victim = NULL;
+        u64 victim_range = 0;
+        u32 most = 0;
+        for (uint i = 0; i < shared->worker_count; i++) {
+            if (i == thief->index)
+                continue;
+            u64 range = atomic_load(&shared->workers[i].range);
+            u32 remaining = LLVM_RANGE_END(range) - LLVM_RANGE_BEGIN(range);
+            if (LLVM_RANGE_BEGIN(range) < LLVM_RANGE_END(range) && remaining > most) {
+                victim = &shared->workers[i];
+                victim_range = range;
+                most = remaining;
+            }
+        }
+        if (victim == NULL)
+            return false;
+
+        u32 begin = LLVM_RANGE_BEGIN(victim_range);
+        u32 end = LLVM_RANGE_END(victim_range);
+        u32 split = end - (end - begin + 1) / 2;
+        if (atomic_compare_exchange_strong(&victim->range, &victim_range, LLVM_RANGE(begin, split))) {
+            atomic_store(&thief->range, LLVM_RANGE(split, end));
+            return true;
+        }
+    }
+}
+
+static int llvm_worker_run(void *arg) {
+    llvm_worker_t *worker = arg;
+    llvm_parallel_t *shared = worker->shared;
+    for (;;) {
+        u32 index;
+        while (llvm_worker_pop(worker, &index)) {
+            // Current text is copied from the cache while the pieces are joined.
+            if (llvm_cache_is_fresh(shared->gen, &shared->gen->cache.functions, index, shared->gen->functions.data[index].revision))
+                continue;
+            size_t offset = worker->out.count;
+            LLVM_STATS_START(function_timer, &worker->out);
+            llvm_generate_function(shared->gen, &worker->out, shared->gen->functions.data[index]);
+            LLVM_STATS_FUNCTION(shared->gen, index, function_timer, &worker->out);
+            shared->pieces[index] = (llvm_piece_t){worker->index, offset, worker->out.count - offset};
+        }
+        if (!llvm_worker_steal(worker))
+            return 0;
+    }
+}
+
+str llvm_generate_parallel(llvm_generator_t *gen, int nthreads) {
+    size_t function_count = gen->functions.size;
+    if (nthreads <= 1 || function_count < 2)
+        return llvm_generate(gen);
+    uint worker_count = (uint)MIN((size_t)nthreads, function_count);
+
+    LLVM_STATS_ADD(gen, generations, 1);
+    llvm_stats_reserve_functions(gen);
+    llvm_cache_prepare(gen);
+    llvm_cache_t *cache = &gen->cache;
+    str_builder_t out;
+    str_builder_init(&out);
+    LLVM_STATS_START(total_timer, &out);
+    LLVM_STATS_START(types_timer, &out);
+    for (size_t i = 0; i < gen->type_declarations.size; i++) {
+        llvm_type_declaration_t *type_declaration = &gen->type_declarations.data[i];
+        if (!llvm_cache_fetch(gen, &cache->type_declarations, i, type_declaration->revision, &out)) {
+            size_t start = out.count;
+            llvm_generate_type_declaration(gen, &out, *type_declaration);
+            llvm_cache_store(gen, &cache->type_declarations, i, type_declaration->revision, (str){out.chars + start, out.count - start});
+        }
+    }
+    LLVM_STATS_PHASE(gen, type_declarations_ns, types_timer);
+    LLVM_STATS_START(globals_timer, &out);
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        if (!llvm_cache_fetch(gen, &cache->globals, i, global->revision, &out)) {
+            size_t start = out.count;
+            llvm_generate_global(gen, &out, *global);
+            llvm_cache_store(gen, &cache->globals, i, global->revision, (str){out.chars + start, out.count - start});
+        }
+    }
+    LLVM_STATS_PHASE(gen, globals_ns, globals_timer);
+
+    llvm_parallel_t shared = {
+        .gen = gen,
+        .workers = calloc(worker_count, sizeof(llvm_worker_t)),
+        .worker_count = worker_count,
+        .pieces = calloc(function_count, sizeof(llvm_piece_t)),
+    };
+    for (uint i = 0; i < worker_count; i++) {
+        llvm_worker_t *worker = &shared.workers[i];
+        size_t begin = function_count * i / worker_count;
+        size_t end = function_count * (i + 1) / worker_count;
+        atomic_init(&worker->range, LLVM_RANGE(begin, end));
+        str_builder_init(&worker->out);
+        worker->index = i;
+        worker->shared = &shared;
+    }
+
+    // Workers only read the module; types that were never interned are
+    // rendered on the fly instead of being added to the shared context.
+    gen->types.is_frozen = true;
+    LLVM_STATS_START(functions_timer, &out);
+    thrd_t *threads = calloc(worker_count, sizeof(thrd_t));
+    for (uint i = 1; i < worker_count; i++)
+        if (thrd_create(&threads[i], llvm_worker_run, &shared.workers[i]) != thrd_success)
+            fatal("failed to start emission worker %u.", i);
+    llvm_worker_run(&shared.workers[0]);
+    for (uint i = 1; i < worker_count; i++)
+        thrd_join(threads[i], NULL);
+    gen->types.is_frozen = false;
+    LLVM_STATS_PHASE(gen, functions_ns, functions_timer);
+
+    size_t total = out.count;
+    for (uint i = 0; i < worker_count; i++)
+        total += shared.workers[i].out.count;
+    str_builder_reserve(&out, total - out.count);
+    for (size_t i = 0; i < function_count; i++) {
+        u64 revision = gen->functions.data[i].revision;
+        if (llvm_cache_fetch(gen, &cache->functions, i, revision, &out))
+            continue;
+        llvm_piece_t piece = shared.pieces[i];
+        str text = {shared.workers[piece.worker].out.chars + piece.offset, piece.count};
+        str_builder_append(&out, text);
+        llvm_cache_store(gen, &cache->functions, i, revision, text);
+    }
+    llvm_cache_compact(gen);
+
+    LLVM_STATS_ADD(gen, bytes_emitted, out.count);
+    LLVM_STATS_PHASE(gen, total_ns, total_timer);
+    LLVM_STATS_ADD(gen, appends, out.appends);
+    LLVM_STATS_ADD(gen, buffer_growths, out.growths);
+    for (uint i = 0; i < worker_count; i++) {
+        LLVM_STATS_ADD(gen, appends, shared.workers[i].out.appends);
+        LLVM_STATS_ADD(gen, buffer_growths, shared.workers[i].out.growths);
+        str_builder_free(&shared.workers[i].out);
+    }
+    free(threads);
+    free(shared.workers);
+    free(shared.pieces);
+    return str_builder_take(&out);
+}
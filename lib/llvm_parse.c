@@ -0,0 +1,935 @@
+#include "llvm.h"
+
+#include <ctype.h>
+#include <stdint.h>
+
+// Reader for the textual IR subset that `llvm_generate` produces. The lexer
+// never copies: every token is a `str` into the source buffer, and so are the
+// names and string constants stored in the resulting module.
+
+typedef enum llvm_token_kind_t {
+    LLVM_TOKEN_EOF,
+    LLVM_TOKEN_WORD,     // keywords and primitive types
+    LLVM_TOKEN_LABEL,    // `name:`, without the colon
+    LLVM_TOKEN_GLOBAL,   // `@name`, without the sigil
+    LLVM_TOKEN_LOCAL,    // `%name`, without the sigil
+    LLVM_TOKEN_INT,
+    LLVM_TOKEN_FLOAT,
+    LLVM_TOKEN_STRING,   // `"..."`, without the quotes
+    LLVM_TOKEN_CSTRING,  // `c"..."`, without the quotes
+    LLVM_TOKEN_ELLIPSIS,
+    LLVM_TOKEN_PUNCT,    // a single character
+} llvm_token_kind_t;
+
+typedef struct llvm_token_t {
+    llvm_token_kind_t kind;
+    str text;
+} llvm_token_t;
+
+// An operand naming a block, or a local that a phi uses before its
+// definition. Both are only known once the whole body has been read.
+typedef struct llvm_parse_fixup_t {
+    u32 operand; // index into the builder's operands
+    bool is_block;
+    str name;
+} llvm_parse_fixup_t;
+
+typedef struct llvm_parser_t {
+    llvm_generator_t *gen;
+    const char *start, *cur, *end;
+    llvm_token_t token;
+    llvm_parse_error_t *error;
+    bool failed;
+    llvm_type_ptr_t *members; // struct members being collected, used as a stack
+    size_t member_count, member_capacity;
+    // Lists are collected here and copied into the arena once their length
+    // is known, rather than grown in place inside the arena.
+    array(llvm_type_t) params;
+    array(llvm_function_arg_t) args;
+    array(llvm_phi_incoming_t) incoming;
+    llvm_parse_fixup_t *fixups;
+    size_t fixup_count, fixup_capacity;
+    llvm_builder_t builder;   // the body being read, numbered as in the text
+    uint next_local;          // number the next named value has to use
+    llvm_type_t *ints[65];    // canonical iN for the common widths
+    llvm_type_t **pointers;   // canonical pointer to each type, by its id
+    size_t pointer_capacity;
+} llvm_parser_t;
+
+// Character classes, looked up rather than compared in the lexer's loops.
+#define LLVM_CHAR_SPACE 1
+#define LLVM_CHAR_DIGIT 2
+#define LLVM_CHAR_IDENT 4 // may appear in a name or keyword
+
+#define LLVM_CHAR_LETTERS(first) \
+    [first + 0] = LLVM_CHAR_IDENT, [first + 1] = LLVM_CHAR_IDENT, [first + 2] = LLVM_CHAR_IDENT, [first + 3] = LLVM_CHAR_IDENT, \
+    [first + 4] = LLVM_CHAR_IDENT, [first + 5] = LLVM_CHAR_IDENT, [first + 6] = LLVM_CHAR_IDENT, [first + 7] = LLVM_CHAR_IDENT, \
+    [first + 8] = LLVM_CHAR_IDENT, [first + 9] = LLVM_CHAR_IDENT, [first + 10] = LLVM_CHAR_IDENT, [first + 11] = LLVM_CHAR_IDENT, \
+    [first + 12] = LLVM_CHAR_IDENT, [first + 13] = LLVM_CHAR_IDENT, [first + 14] = LLVM_CHAR_IDENT, [first + 15] = LLVM_CHAR_IDENT, \
+    [first + 16] = LLVM_CHAR_IDENT, [first + 17] = LLVM_CHAR_IDENT, [first + 18] = LLVM_CHAR_IDENT, [first + 19] = LLVM_CHAR_IDENT, \
+    [first + 20] = LLVM_CHAR_IDENT, [first + 21] = LLVM_CHAR_IDENT, [first + 22] = LLVM_CHAR_IDENT, [first + 23] = LLVM_CHAR_IDENT, \
+    [first + 24] = LLVM_CHAR_IDENT, [first + 25] = LLVM_CHAR_IDENT
+
+static const u8 llvm_char_classes[256] = {
+    [' '] = LLVM_CHAR_SPACE, ['\n'] = LLVM_CHAR_SPACE, ['\t'] = LLVM_CHAR_SPACE, ['\r'] = LLVM_CHAR_SPACE,
+    ['0'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['1'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['2'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT,
+    ['3'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['4'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['5'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT,
+    ['6'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['7'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT, ['8'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT,
+    ['9'] = LLVM_CHAR_DIGIT | LLVM_CHAR_IDENT,
+    LLVM_CHAR_LETTERS('a'), LLVM_CHAR_LETTERS('A'),
+    ['_'] = LLVM_CHAR_IDENT, ['.'] = LLVM_CHAR_IDENT, ['$'] = LLVM_CHAR_IDENT, ['-'] = LLVM_CHAR_IDENT,
+};
+
+static inline bool llvm_is_space(char c) {
+    return llvm_char_classes[(u8)c] & LLVM_CHAR_SPACE;
+}
+
+static inline bool llvm_is_digit(char c) {
+    return llvm_char_classes[(u8)c] & LLVM_CHAR_DIGIT;
+}
+
+static inline bool llvm_is_ident(char c) {
+    return llvm_char_classes[(u8)c] & LLVM_CHAR_IDENT;
+}
+
+#define LLVM_ARENA_COPY(type, arena, from) \
+    ((array(type)){arena_dup(arena, (from).data, (from).size * sizeof(type), _Alignof(type)), (from).size, (from).size, arena})
+
+#define LLVM_WORD_IS(token, lit) ((token).text.count == sizeof(lit) - 1 && memcmp((token).text.chars, lit, sizeof(lit) - 1) == 0)
+
+static void llvm_parse_fail(llvm_parser_t *p, const char *fmt, ...) {
+    if (p->failed)
+        return;
+    p->failed = true;
+    if (p->error != NULL) {
+        const char *at = p->token.text.chars != NULL ? p->token.text.chars : p->cur;
+        p->error->line = 1;
+        p->error->column = 1;
+        for (const char *c = p->start; c < at; c++) {
+            if (*c == '\n') {
+                p->error->line++;
+                p->error->column = 1;
+            } else {
+                p->error->column++;
+            }
+        }
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(p->error->message, sizeof(p->error->message), fmt, args);
+        va_end(args);
+    }
+    // Everything after the first error reads as end of input, so the callers
+    // unwind without checking after every step.
+    p->cur = p->end;
+    p->token = (llvm_token_t){LLVM_TOKEN_EOF, {(char *)p->end, 0}};
+}
+
+static const char *llvm_scan_name(const char *c, const char *end) {
+    while (c < end && llvm_is_ident(*c))
+        c++;
+    return c;
+}
+
+static const char *llvm_scan_string(llvm_parser_t *p, const char *c) {
+    const char *close = memchr(c, '"', (size_t)(p->end - c));
+    if (close == NULL) {
+        llvm_parse_fail(p, "unterminated string");
+        return p->end;
+    }
+    return close;
+}
+
+static void llvm_next(llvm_parser_t *p) {
+    const char *c = p->cur, *end = p->end;
+    for (;;) {
+        while (c < end && llvm_is_space(*c))
+            c++;
+        if (c < end && *c == ';') {
+            const char *newline = memchr(c, '\n', (size_t)(end - c));
+            c = newline != NULL ? newline : end;
+            continue;
+        }
+        break;
+    }
+    if (c == end) {
+        p->cur = c;
+        p->token = (llvm_token_t){LLVM_TOKEN_EOF, {(char *)c, 0}};
+        return;
+    }
+
+    const char *begin = c;
+    llvm_token_kind_t kind;
+    switch (*c) {
+        case '@':
+        case '%': {
+            kind = *c == '@' ? LLVM_TOKEN_GLOBAL : LLVM_TOKEN_LOCAL;
+            begin = ++c;
+            c = llvm_scan_name(c, end);
+            if (c == begin) {
+                p->token.text = (str){(char *)begin - 1, 1};
+                llvm_parse_fail(p, "expected a name after '%c'", begin[-1]);
+                return;
+            }
+            p->cur = c;
+            p->token = (llvm_token_t){kind, {(char *)begin, (size_t)(c - begin)}};
+        } return;
+        case '"': {
+            begin = ++c;
+            c = llvm_scan_string(p, c);
+            if (p->failed)
+                return;
+            p->cur = c + 1;
+            p->token = (llvm_token_t){LLVM_TOKEN_STRING, {(char *)begin, (size_t)(c - begin)}};
+        } return;
+        case '.': {
+            if (end - c >= 3 && c[1] == '.' && c[2] == '.') {
+                p->cur = c + 3;
+                p->token = (llvm_token_t){LLVM_TOKEN_ELLIPSIS, {(char *)c, 3}};
+                return;
+            }
+        } break;
+    }
+
+    if (*c == 'c' && c + 1 < end && c[1] == '"') {
+        begin = c + 2;
+        c = llvm_scan_string(p, begin);
+        if (p->failed)
+            return;
+        p->cur = c + 1;
+        p->token = (llvm_token_t){LLVM_TOKEN_CSTRING, {(char *)begin, (size_t)(c - begin)}};
+        return;
+    }
+
+    if (llvm_is_digit(*c) || (*c == '-' && c + 1 < end && llvm_is_digit(c[1]))) {
+        kind = LLVM_TOKEN_INT;
+        c++;
+        if (*begin == '0' && c < end && *c == 'x') {
+            kind = LLVM_TOKEN_FLOAT; // LLVM spells exact floating point constants in hex
+            c++;
+            while (c < end && isxdigit((u8)*c))
+                c++;
+        } else {
+            while (c < end && llvm_is_digit(*c))
+                c++;
+            if (c < end && *c == '.') {
+                kind = LLVM_TOKEN_FLOAT;
+                c++;
+                while (c < end && llvm_is_digit(*c))
+                    c++;
+            }
+            if (c < end && (*c == 'e' || *c == 'E')) {
+                kind = LLVM_TOKEN_FLOAT;
+                c++;
+                if (c < end && (*c == '+' || *c == '-'))
+                    c++;
+                while (c < end && llvm_is_digit(*c))
+                    c++;
+            }
+        }
+        if (c < end && *c == ':' && kind == LLVM_TOKEN_INT) {
+            p->cur = c + 1;
+            p->token = (llvm_token_t){LLVM_TOKEN_LABEL, {(char *)begin, (size_t)(c - begin)}};
+            return;
+        }
+        p->cur = c;
+        p->token = (llvm_token_t){kind, {(char *)begin, (size_t)(c - begin)}};
+        return;
+    }
+
+    if (llvm_is_ident(*c)) {
+        c = llvm_scan_name(c, end);
+        if (c < end && *c == ':') {
+            p->cur = c + 1;
+            p->token = (llvm_token_t){LLVM_TOKEN_LABEL, {(char *)begin, (size_t)(c - begin)}};
+            return;
+        }
+        p->cur = c;
+        p->token = (llvm_token_t){LLVM_TOKEN_WORD, {(char *)begin, (size_t)(c - begin)}};
+        return;
+    }
+
+    p->cur = c + 1;
+    p->token = (llvm_token_t){LLVM_TOKEN_PUNCT, {(char *)begin, 1}};
+}
+
+static bool llvm_accept(llvm_parser_t *p, char c) {
+    if (p->token.kind != LLVM_TOKEN_PUNCT || p->token.text.chars[0] != c)
+        return false;
+    llvm_next(p);
+    return true;
+}
+
+static void llvm_expect(llvm_parser_t *p, char c) {
+    if (!llvm_accept(p, c))
+        llvm_parse_fail(p, "expected '%c'", c);
+}
+
+static bool llvm_accept_word(llvm_parser_t *p, const char *word, size_t count) {
+    if (p->token.kind != LLVM_TOKEN_WORD || p->token.text.count != count || memcmp(p->token.text.chars, word, count) != 0)
+        return false;
+    llvm_next(p);
+    return true;
+}
+
+#define LLVM_ACCEPT_WORD(p, lit) llvm_accept_word(p, lit, sizeof(lit) - 1)
+
+static str llvm_expect_token(llvm_parser_t *p, llvm_token_kind_t kind, const char *what) {
+    str text = p->token.text;
+    if (p->token.kind != kind) {
+        llvm_parse_fail(p, "expected %s", what);
+        return (str){(char *)p->end, 0};
+    }
+    llvm_next(p);
+    return text;
+}
+
+static s64 llvm_parse_integer(llvm_parser_t *p, str text) {
+    size_t i = 0;
+    bool negative = text.count > 0 && text.chars[0] == '-';
+    if (negative)
+        i++;
+    u64 value = 0;
+    for (; i < text.count; i++) {
+        u64 digit = (u64)(text.chars[i] - '0');
+        if (value > (UINT64_MAX - digit) / 10) {
+            llvm_parse_fail(p, "integer '" STR_ARG "' is too large", STR_FMT(text));
+            return 0;
+        }
+        value = value * 10 + digit;
+    }
+    return negative ? -(s64)value : (s64)value;
+}
+
+static s64 llvm_expect_integer(llvm_parser_t *p) {
+    str text = llvm_expect_token(p, LLVM_TOKEN_INT, "an integer");
+    return p->failed ? 0 : llvm_parse_integer(p, text);
+}
+
+static double llvm_parse_double(llvm_parser_t *p, str text) {
+    if (text.count >= 2 && text.chars[1] == 'x') {
+        // Exactly the 64 bits of a double; anything else would be read as
+        // some other value.
+        bool is_exact = text.count == 18;
+        for (size_t i = 2; is_exact && i < text.count; i++)
+            is_exact = isxdigit((u8)text.chars[i]);
+        if (!is_exact) {
+            llvm_parse_fail(p, "floating point constant '" STR_ARG "' is not 0x and 16 hexadecimal digits", STR_FMT(text));
+            return 0;
+        }
+        u64 bits = 0;
+        for (size_t i = 2; i < text.count; i++) {
+            char c = text.chars[i];
+            bits = bits << 4 | (u64)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+        }
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    char buffer[64];
+    if (text.count >= sizeof(buffer)) {
+        llvm_parse_fail(p, "floating point constant is too long");
+        return 0;
+    }
+    memcpy(buffer, text.chars, text.count);
+    buffer[text.count] = '\0';
+    return strtod(buffer, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Types
+// ---------------------------------------------------------------------------
+
+static llvm_type_t *llvm_parse_type(llvm_parser_t *p);
+
+static llvm_type_t *llvm_parse_int_type(llvm_parser_t *p, int bits) {
+    if (bits <= 64) {
+        if (p->ints[bits] == NULL)
+            p->ints[bits] = llvm_type_get(p->gen, LLVM_TYPE_INT(bits));
+        return p->ints[bits];
+    }
+    return llvm_type_get(p->gen, LLVM_TYPE_INT(bits));
+}
+
+static llvm_type_t *llvm_parse_struct_type(llvm_parser_t *p, bool is_packed) {
+    size_t base = p->member_count;
+    if (!llvm_accept(p, '}')) {
+        do {
+            llvm_type_t *member = llvm_parse_type(p);
+            if (p->member_count == p->member_capacity) {
+                p->member_capacity = MAX(p->member_capacity * 2, 16);
+                p->members = realloc(p->members, p->member_capacity * sizeof(llvm_type_ptr_t));
+            }
+            p->members[p->member_count++] = member;
+        } while (llvm_accept(p, ','));
+        llvm_expect(p, '}');
+    }
+    if (is_packed)
+        llvm_expect(p, '>');
+
+    size_t count = p->member_count - base;
+    array(llvm_type_ptr_t) members = {p->members + base, count, count, NULL};
+    llvm_type_t *type = llvm_type_get(p->gen, LLVM_TYPE_STRUCTURE(members, is_packed));
+    p->member_count = base;
+    return type;
+}
+
+static llvm_type_t *llvm_parse_named_type(llvm_parser_t *p, str name) {
+    llvm_generator_t *gen = p->gen;
+    for (size_t i = gen->type_declarations.size; i-- > 0;)
+        if (str_eq(gen->type_declarations.data[i].name, name))
+            return llvm_type_get(gen, gen->type_declarations.data[i].type);
+    llvm_parse_fail(p, "use of undefined type '%%" STR_ARG "'", STR_FMT(name));
+    return llvm_parse_int_type(p, 8);
+}
+
+static llvm_type_t *llvm_parse_base_type(llvm_parser_t *p) {
+    llvm_token_t token = p->token;
+    switch (token.kind) {
+        case LLVM_TOKEN_WORD: {
+            if (token.text.count > 1 && token.text.chars[0] == 'i') {
+                int bits = 0;
+                size_t i = 1;
+                for (; i < token.text.count && llvm_is_digit(token.text.chars[i]) && bits < (1 << 23); i++)
+                    bits = bits * 10 + (token.text.chars[i] - '0');
+                if (i == token.text.count && bits > 0) {
+                    llvm_next(p);
+                    return llvm_parse_int_type(p, bits);
+                }
+            }
+            if (LLVM_WORD_IS(token, "float")) {
+                llvm_next(p);
+                return llvm_type_get(p->gen, LLVM_TYPE_FLOAT());
+            }
+            if (LLVM_WORD_IS(token, "double")) {
+                llvm_next(p);
+                return llvm_type_get(p->gen, LLVM_TYPE_DOUBLE());
+            }
+        } break;
+        case LLVM_TOKEN_LOCAL: {
+            llvm_next(p);
+            return llvm_parse_named_type(p, token.text);
+        }
+        case LLVM_TOKEN_PUNCT: {
+            char c = token.text.chars[0];
+            if (c == '{') {
+                llvm_next(p);
+                return llvm_parse_struct_type(p, false);
+            }
+            if (c == '[' || c == '<') {
+                llvm_next(p);
+                if (c == '<' && llvm_accept(p, '{'))
+                    return llvm_parse_struct_type(p, true);
+                int size = (int)llvm_expect_integer(p);
+                if (!LLVM_ACCEPT_WORD(p, "x"))
+                    llvm_parse_fail(p, "expected 'x'");
+                llvm_type_t *inner = llvm_parse_type(p);
+                llvm_expect(p, c == '[' ? ']' : '>');
+                return llvm_type_get(p->gen, c == '[' ? LLVM_TYPE_ARRAY(*inner, size) : LLVM_TYPE_VECTOR(*inner, size));
+            }
+        } break;
+        default: break;
+    }
+    llvm_parse_fail(p, "expected a type");
+    return llvm_parse_int_type(p, 8);
+}
+
+static llvm_type_t *llvm_parse_pointer_type(llvm_parser_t *p, llvm_type_t *inner) {
+    if (inner->id >= p->pointer_capacity) {
+        size_t capacity = MAX(p->pointer_capacity * 2, MAX((size_t)inner->id + 1, 64));
+        p->pointers = realloc(p->pointers, capacity * sizeof(llvm_type_t *));
+        memset(p->pointers + p->pointer_capacity, 0, (capacity - p->pointer_capacity) * sizeof(llvm_type_t *));
+        p->pointer_capacity = capacity;
+    }
+    if (p->pointers[inner->id] == NULL)
+        p->pointers[inner->id] = llvm_type_get(p->gen, LLVM_TYPE_POINTER(*inner));
+    return p->pointers[inner->id];
+}
+
+static llvm_type_t *llvm_parse_type(llvm_parser_t *p) {
+    llvm_type_t *type = llvm_parse_base_type(p);
+    while (llvm_accept(p, '*'))
+        type = llvm_parse_pointer_type(p, type);
+    return type;
+}
+
+// ---------------------------------------------------------------------------
+// Values and instructions
+// ---------------------------------------------------------------------------
+
+static uint llvm_parse_local_index(llvm_parser_t *p, str name) {
+    uint idx = 0;
+    for (size_t i = 0; i < name.count; i++) {
+        if (!llvm_is_digit(name.chars[i]) || idx > (UINT32_MAX - 9) / 10) {
+            llvm_parse_fail(p, "only numbered locals are supported, got '%%" STR_ARG "'", STR_FMT(name));
+            return 0;
+        }
+        idx = idx * 10 + (uint)(name.chars[i] - '0');
+    }
+    return idx;
+}
+
+static llvm_value_t llvm_parse_value(llvm_parser_t *p, llvm_type_t *type) {
+    llvm_token_t token = p->token;
+    bool is_float = type->type == LLVM_TYPE_FLOAT_;
+    switch (token.kind) {
+        case LLVM_TOKEN_INT:
+        case LLVM_TOKEN_FLOAT: {
+            llvm_next(p);
+            if (!is_float) {
+                if (token.kind == LLVM_TOKEN_FLOAT)
+                    llvm_parse_fail(p, "floating point constant for an integer type");
+                return LLVM_VALUE_INT((int)llvm_parse_integer(p, token.text));
+            }
+            double d = llvm_parse_double(p, token.text);
+            if (type->float_ == 32)
+                return LLVM_VALUE_FLOAT((float)d);
+            return LLVM_VALUE_DOUBLE(d);
+        }
+        case LLVM_TOKEN_LOCAL: {
+            llvm_next(p);
+            uint idx = llvm_parse_local_index(p, token.text);
+            if (p->builder.maps_locals && !llvm_builder_has_local(&p->builder, idx)) {
+                llvm_parse_fail(p, "use of undefined value '%%%u'", idx);
+                return LLVM_VALUE_INT(0);
+            }
+            return LLVM_VALUE_LOCAL(idx);
+        }
+        case LLVM_TOKEN_STRING: {
+            llvm_next(p);
+            return (llvm_value_t){LLVM_VALUE_STRING_, .string_=token.text};
+        }
+        case LLVM_TOKEN_CSTRING: {
+            // The model appends the terminator of a C string itself. Anything
+            // else is kept as raw bytes.
+            str text = token.text;
+            llvm_next(p);
+            if (text.count < 3 || memcmp(text.chars + text.count - 3, "\\00", 3) != 0)
+                return (llvm_value_t){LLVM_VALUE_BYTES_, .bytes_=text};
+            return (llvm_value_t){LLVM_VALUE_CSTRING_, .cstring_={text.chars, text.count - 3}};
+        }
+        case LLVM_TOKEN_WORD: {
+            if (LLVM_ACCEPT_WORD(p, "type"))
+                return LLVM_VALUE_TYPE(*llvm_parse_type(p));
+            if (LLVM_ACCEPT_WORD(p, "undef"))
+                return LLVM_VALUE_UNDEF();
+            if (LLVM_ACCEPT_WORD(p, "getelementptr")) {
+                // Only the constant form over a global, with two indices.
+                llvm_value_t value = {LLVM_VALUE_GETELEMENTPTR_, .getelementptr={.is_inbounds = LLVM_ACCEPT_WORD(p, "inbounds")}};
+                llvm_expect(p, '(');
+                value.getelementptr.type = llvm_parse_type(p);
+                llvm_expect(p, ',');
+                llvm_parse_type(p);
+                value.getelementptr.name = llvm_expect_token(p, LLVM_TOKEN_GLOBAL, "a global name");
+                for (int i = 0; i < 2; i++) {
+                    llvm_expect(p, ',');
+                    llvm_value_t index = llvm_parse_value(p, llvm_parse_type(p));
+                    if (index.type != LLVM_VALUE_INT_)
+                        llvm_parse_fail(p, "constant getelementptr indices must be integers");
+                    value.getelementptr.indices[i] = index.int_;
+                }
+                llvm_expect(p, ')');
+                return value;
+            }
+        } break;
+        default: break;
+    }
+    llvm_parse_fail(p, "expected a value");
+    return LLVM_VALUE_INT(0);
+}
+
+static void llvm_parse_add_fixup(llvm_parser_t *p, llvm_parse_fixup_t fixup) {
+    if (p->fixup_count == p->fixup_capacity) {
+        p->fixup_capacity = MAX(p->fixup_capacity * 2, 16);
+        p->fixups = realloc(p->fixups, p->fixup_capacity * sizeof(llvm_parse_fixup_t));
+    }
+    p->fixups[p->fixup_count++] = fixup;
+}
+
+// Block operands are filled in by `llvm_parse_fixups`.
+static void llvm_parse_label(llvm_parser_t *p, u32 operand) {
+    if (!LLVM_ACCEPT_WORD(p, "label"))
+        llvm_parse_fail(p, "expected 'label'");
+    str name = llvm_expect_token(p, LLVM_TOKEN_LOCAL, "a block name");
+    llvm_parse_add_fixup(p, (llvm_parse_fixup_t){operand, true, name});
+}
+
+static llvm_value_t llvm_parse_phi(llvm_parser_t *p) {
+    llvm_type_t *type = llvm_parse_type(p);
+    u32 base = (u32)p->builder.operands.size;
+    size_t first_fixup = p->fixup_count;
+    p->incoming.size = 0;
+    do {
+        llvm_expect(p, '[');
+        // Values coming around a back edge are defined further down.
+        llvm_value_t value = LLVM_VALUE_INT(0);
+        if (p->token.kind == LLVM_TOKEN_LOCAL && !llvm_builder_has_local(&p->builder, llvm_parse_local_index(p, p->token.text))) {
+            llvm_parse_add_fixup(p, (llvm_parse_fixup_t){(u32)p->incoming.size, false, p->token.text});
+            llvm_next(p);
+        } else {
+            value = llvm_parse_value(p, type);
+        }
+        llvm_expect(p, ',');
+        str name = llvm_expect_token(p, LLVM_TOKEN_LOCAL, "a block name");
+        llvm_parse_add_fixup(p, (llvm_parse_fixup_t){(u32)p->incoming.size, true, name});
+        llvm_expect(p, ']');
+        array_push(llvm_phi_incoming_t)(&p->incoming, (llvm_phi_incoming_t){value, (uint)-1});
+    } while (!p->failed && llvm_accept(p, ','));
+    // Positions were recorded relative to the phi's own operands.
+    u32 count = (u32)p->incoming.size;
+    for (size_t i = first_fixup; i < p->fixup_count; i++)
+        p->fixups[i].operand += base + (p->fixups[i].is_block ? count : 0);
+    return llvm_builder_phi(&p->builder, *type, p->incoming.data, p->incoming.size);
+}
+
+// Appends the instruction to the body being built and returns its handle.
+static llvm_value_t llvm_parse_instruction(llvm_parser_t *p) {
+    llvm_builder_t *builder = &p->builder;
+    if (LLVM_ACCEPT_WORD(p, "ret")) {
+        llvm_type_t *type = llvm_parse_type(p);
+        llvm_value_t value = llvm_parse_value(p, type);
+        return llvm_builder_append(builder, LLVM_INSTR_RETURN(*type, value));
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "call")) {
+        llvm_type_t *return_type = llvm_parse_type(p);
+        // The explicit signature is derived from the arguments on output.
+        if (llvm_accept(p, '(')) {
+            while (!p->failed && !llvm_accept(p, ')')) {
+                if (p->token.kind == LLVM_TOKEN_ELLIPSIS)
+                    llvm_next(p);
+                else
+                    llvm_parse_type(p);
+                if (p->token.kind != LLVM_TOKEN_PUNCT || p->token.text.chars[0] != ')')
+                    llvm_expect(p, ',');
+            }
+        }
+        str name = llvm_expect_token(p, LLVM_TOKEN_GLOBAL, "a function name");
+        p->args.size = 0;
+        llvm_expect(p, '(');
+        if (!llvm_accept(p, ')')) {
+            do {
+                llvm_type_t *type = llvm_parse_type(p);
+                llvm_value_t value = llvm_parse_value(p, type);
+                array_push(llvm_function_arg_t)(&p->args, (llvm_function_arg_t){*type, value});
+            } while (llvm_accept(p, ','));
+            llvm_expect(p, ')');
+        }
+        return llvm_builder_call(builder, *return_type, name, p->args.data, p->args.size);
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "getelementptr")) {
+        bool is_inbounds = LLVM_ACCEPT_WORD(p, "inbounds");
+        bool is_parenthesized = llvm_accept(p, '(');
+        llvm_type_t *type = llvm_parse_type(p);
+        llvm_expect(p, ',');
+        llvm_parse_type(p);
+        str name = llvm_expect_token(p, LLVM_TOKEN_GLOBAL, "a global name");
+        llvm_expect(p, ',');
+        llvm_value_t value = llvm_parse_value(p, llvm_parse_type(p));
+        llvm_expect(p, ',');
+        llvm_value_t index = llvm_parse_value(p, llvm_parse_type(p));
+        if (is_parenthesized)
+            llvm_expect(p, ')');
+        return llvm_builder_gep(builder, is_inbounds, name, *type, value, index);
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "alloca"))
+        return llvm_builder_alloca(builder, *llvm_parse_type(p));
+
+    if (LLVM_ACCEPT_WORD(p, "load")) {
+        llvm_type_t *type = llvm_parse_type(p);
+        llvm_expect(p, ',');
+        llvm_value_t pointer = llvm_parse_value(p, llvm_parse_type(p));
+        return llvm_builder_load(builder, *type, pointer);
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "store")) {
+        llvm_type_t *type = llvm_parse_type(p);
+        llvm_value_t value = llvm_parse_value(p, type);
+        llvm_expect(p, ',');
+        llvm_value_t pointer = llvm_parse_value(p, llvm_parse_type(p));
+        return llvm_builder_append(builder, LLVM_INSTR_STORE(*type, value, pointer));
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "br")) {
+        u32 base = (u32)builder->operands.size;
+        if (p->token.kind == LLVM_TOKEN_WORD && str_eq(p->token.text, STR("label"))) {
+            llvm_parse_label(p, base);
+            return llvm_builder_append(builder, LLVM_INSTR_BR((uint)-1));
+        }
+        llvm_value_t condition = llvm_parse_value(p, llvm_parse_type(p));
+        llvm_expect(p, ',');
+        llvm_parse_label(p, base + 1);
+        llvm_expect(p, ',');
+        llvm_parse_label(p, base + 2);
+        return llvm_builder_append(builder, LLVM_INSTR_COND_BR(condition, (uint)-1, (uint)-1));
+    }
+
+    if (LLVM_ACCEPT_WORD(p, "phi"))
+        return llvm_parse_phi(p);
+
+    llvm_parse_fail(p, "expected an instruction");
+    return LLVM_VALUE_INT(0);
+}
+
+// Block names are looked up in a table built once per body, since a
+// function may have many of them.
+static void llvm_parse_fixups(llvm_parser_t *p) {
+    llvm_builder_t *builder = &p->builder;
+    arena_t *arena = &p->gen->arena;
+    arena_mark_t mark = arena_mark(arena);
+    size_t mask = 15;
+    while (mask + 1 < builder->blocks.size * 2)
+        mask = mask * 2 + 1;
+    u32 *slots = arena_alloc_aligned(arena, (mask + 1) * sizeof(u32), _Alignof(u32));
+    memset(slots, 0, (mask + 1) * sizeof(u32));
+    for (u32 i = 0; i < builder->blocks.size; i++) {
+        size_t slot = str_hash(builder->blocks.data[i].name) & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+
+    // The lookahead is borrowed so that errors point at the name in
+    // question, and put back afterwards: it is what follows the body.
+    llvm_token_t lookahead = p->token;
+    for (size_t i = 0; i < p->fixup_count && !p->failed; i++) {
+        llvm_parse_fixup_t fixup = p->fixups[i];
+        p->token.text = fixup.name;
+        if (!fixup.is_block) {
+            uint idx = llvm_parse_local_index(p, fixup.name);
+            if (!p->failed && !llvm_builder_has_local(builder, idx))
+                llvm_parse_fail(p, "use of undefined value '%%%u'", idx);
+            else if (!p->failed)
+                builder->operands.data[fixup.operand] = LLVM_REF(LLVM_REF_LOCAL, builder->locals.data[idx] - 1);
+            continue;
+        }
+        size_t slot = str_hash(fixup.name) & mask;
+        while (slots[slot] != 0 && !str_eq(builder->blocks.data[slots[slot] - 1].name, fixup.name))
+            slot = (slot + 1) & mask;
+        if (slots[slot] == 0)
+            llvm_parse_fail(p, "use of undefined block '%%" STR_ARG "'", STR_FMT(fixup.name));
+        else
+            builder->operands.data[fixup.operand] = slots[slot] - 1;
+    }
+    p->token = lookahead;
+    p->fixup_count = 0;
+    arena_rollback(arena, mark);
+}
+
+static llvm_code_t *llvm_parse_body(llvm_parser_t *p, llvm_function_t function) {
+    llvm_builder_t *builder = &p->builder;
+    llvm_builder_begin(builder, function);
+    builder->maps_locals = true;
+    p->next_local = (uint)function.args.size;
+    llvm_expect(p, '{');
+    while (!p->failed && !llvm_accept(p, '}')) {
+        str name = llvm_expect_token(p, LLVM_TOKEN_LABEL, "a basic block label");
+        llvm_builder_position(builder, llvm_builder_create_block(builder, name));
+        while (!p->failed && p->token.kind != LLVM_TOKEN_LABEL && !(p->token.kind == LLVM_TOKEN_PUNCT && p->token.text.chars[0] == '}')) {
+            if (p->token.kind == LLVM_TOKEN_LOCAL) {
+                uint idx = llvm_parse_local_index(p, p->token.text);
+                if (idx != p->next_local) {
+                    llvm_parse_fail(p, "expected value number %u, got '%%%u'", p->next_local, idx);
+                    break;
+                }
+                llvm_next(p);
+                llvm_expect(p, '=');
+                llvm_value_t handle = llvm_parse_instruction(p);
+                if (p->failed)
+                    break;
+                llvm_builder_name_local(builder, idx, handle);
+                p->next_local++;
+            } else {
+                llvm_parse_instruction(p);
+                llvm_builder_discard(builder);
+            }
+        }
+    }
+    if (!p->failed)
+        llvm_parse_fixups(p);
+    p->fixup_count = 0;
+    builder->maps_locals = false;
+    return p->failed ? NULL : llvm_builder_finish_code(builder);
+}
+
+// ---------------------------------------------------------------------------
+// Top-level entities
+// ---------------------------------------------------------------------------
+
+static llvm_linkage_type_t llvm_parse_linkage(llvm_parser_t *p) {
+    if (p->token.kind != LLVM_TOKEN_WORD)
+        return LLVM_LINKAGE_PRIVATE;
+    static const struct { const char *word; llvm_linkage_type_t linkage; } words[] = {
+        {"private", LLVM_LINKAGE_PRIVATE},
+        {"internal", LLVM_LINKAGE_INTERNAL},
+        {"available_externally", LLVM_LINKAGE_AVAILABLE_EXTERNALLY},
+        {"linkonce", LLVM_LINKAGE_LINKONCE},
+        {"weak", LLVM_LINKAGE_WEAK},
+        {"common", LLVM_LINKAGE_COMMON},
+        {"appending", LLVM_LINKAGE_APPENDING},
+        {"extern_weak", LLVM_LINKAGE_EXTERN_WEAK},
+        {"external", LLVM_LINKAGE_EXTERNAL},
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        if (llvm_accept_word(p, words[i].word, strlen(words[i].word)))
+            return words[i].linkage;
+    return LLVM_LINKAGE_PRIVATE;
+}
+
+static llvm_visibility_t llvm_parse_visibility(llvm_parser_t *p) {
+    if (LLVM_ACCEPT_WORD(p, "hidden")) return LLVM_VISIBILITY_HIDDEN;
+    if (LLVM_ACCEPT_WORD(p, "protected")) return LLVM_VISIBILITY_PROTECTED;
+    LLVM_ACCEPT_WORD(p, "default");
+    return LLVM_VISIBILITY_DEFAULT;
+}
+
+static llvm_dll_storage_class_t llvm_parse_dll_storage_class(llvm_parser_t *p) {
+    if (LLVM_ACCEPT_WORD(p, "dllimport")) return LLVM_DLL_STORAGE_CLASS_DLLIMPORT;
+    if (LLVM_ACCEPT_WORD(p, "dllexport")) return LLVM_DLL_STORAGE_CLASS_DLLEXPORT;
+    return LLVM_DLL_STORAGE_CLASS_DEFAULT;
+}
+
+static llvm_call_convention_t llvm_parse_call_convention(llvm_parser_t *p) {
+    if (LLVM_ACCEPT_WORD(p, "ccc")) return LLVM_CALL_CONVENTION_C;
+    if (LLVM_ACCEPT_WORD(p, "fastcc")) return LLVM_CALL_CONVENTION_FAST;
+    if (LLVM_ACCEPT_WORD(p, "coldcc")) return LLVM_CALL_CONVENTION_COLD;
+    if (LLVM_ACCEPT_WORD(p, "ghccc")) return LLVM_CALL_CONVENTION_GHC;
+    if (LLVM_ACCEPT_WORD(p, "cc")) {
+        switch (llvm_expect_integer(p)) {
+            case 0: return LLVM_CALL_CONVENTION_C;
+            case 8: return LLVM_CALL_CONVENTION_FAST;
+            case 9: return LLVM_CALL_CONVENTION_COLD;
+            case 10: return LLVM_CALL_CONVENTION_GHC;
+        }
+        llvm_parse_fail(p, "unsupported calling convention");
+    }
+    return LLVM_CALL_CONVENTION_C;
+}
+
+static int llvm_parse_address_space(llvm_parser_t *p) {
+    if (!LLVM_ACCEPT_WORD(p, "addrspace"))
+        return 0;
+    llvm_expect(p, '(');
+    int address_space = (int)llvm_expect_integer(p);
+    llvm_expect(p, ')');
+    return address_space;
+}
+
+static void llvm_parse_type_declaration(llvm_parser_t *p, str name) {
+    llvm_expect(p, '=');
+    if (!LLVM_ACCEPT_WORD(p, "type"))
+        llvm_parse_fail(p, "expected 'type'");
+    llvm_type_t *type = llvm_parse_type(p);
+    if (!p->failed)
+        llvm_add_type_declaration(p->gen, (llvm_type_declaration_t){.name = name, .type = *type});
+}
+
+static void llvm_parse_global(llvm_parser_t *p, str name) {
+    llvm_global_t global = {.name = name};
+    llvm_expect(p, '=');
+    global.linkage = llvm_parse_linkage(p);
+    global.visibility = llvm_parse_visibility(p);
+    global.dll_storage_class = llvm_parse_dll_storage_class(p);
+    global.is_unnamed_addr = LLVM_ACCEPT_WORD(p, "unnamed_addr");
+    global.address_space = llvm_parse_address_space(p);
+    if (LLVM_ACCEPT_WORD(p, "constant"))
+        global.is_constant = true;
+    else if (LLVM_ACCEPT_WORD(p, "global"))
+        global.is_global = true;
+    global.type = llvm_parse_type(p);
+    global.value = llvm_parse_value(p, global.type);
+    if (llvm_accept(p, ',')) {
+        if (!LLVM_ACCEPT_WORD(p, "align"))
+            llvm_parse_fail(p, "expected 'align'");
+        global.alignment = (int)llvm_expect_integer(p);
+    }
+    if (!p->failed && !llvm_add_global(p->gen, global))
+        llvm_parse_fail(p, "redefinition of '@" STR_ARG "'", STR_FMT(name));
+}
+
+static void llvm_parse_function(llvm_parser_t *p, bool is_native) {
+    llvm_generator_t *gen = p->gen;
+    llvm_function_t function = {.is_native = is_native};
+    function.linkage = llvm_parse_linkage(p);
+    function.visibility = llvm_parse_visibility(p);
+    function.dll_storage_class = llvm_parse_dll_storage_class(p);
+    function.call_convention = llvm_parse_call_convention(p);
+    function.return_type = *llvm_parse_type(p);
+    function.name = llvm_expect_token(p, LLVM_TOKEN_GLOBAL, "a function name");
+
+    p->params.size = 0;
+    llvm_expect(p, '(');
+    // A variadic function without fixed arguments is written as `(, ...)`.
+    llvm_accept(p, ',');
+    while (!p->failed && !llvm_accept(p, ')')) {
+        if (p->token.kind == LLVM_TOKEN_ELLIPSIS) {
+            llvm_next(p);
+            function.is_vararg = true;
+        } else {
+            array_push(llvm_type_t)(&p->params, *llvm_parse_type(p));
+            if (p->token.kind == LLVM_TOKEN_LOCAL)
+                llvm_next(p);
+        }
+        if (p->token.kind != LLVM_TOKEN_PUNCT || p->token.text.chars[0] != ')')
+            llvm_expect(p, ',');
+    }
+    function.args = LLVM_ARENA_COPY(llvm_type_t, &gen->arena, p->params);
+    function.address_space = llvm_parse_address_space(p);
+    if (LLVM_ACCEPT_WORD(p, "align"))
+        function.alignment = (int)llvm_expect_integer(p);
+
+    if (!is_native)
+        function.code = llvm_parse_body(p, function);
+    if (!p->failed && !llvm_add_function(gen, function))
+        llvm_parse_fail(p, "redefinition of '@" STR_ARG "'", STR_FMT(function.name));
+}
+
+bool llvm_parse(llvm_generator_t *gen, str source, llvm_parse_error_t *error) {
+    llvm_parser_t p = {0};
+    p.gen = gen;
+    p.start = p.cur = source.chars;
+    p.end = source.chars + source.count;
+    p.error = error;
+    llvm_builder_init(&p.builder, gen);
+    llvm_next(&p);
+
+    while (!p.failed && p.token.kind != LLVM_TOKEN_EOF) {
+        llvm_token_t token = p.token;
+        switch (token.kind) {
+            case LLVM_TOKEN_LOCAL: {
+                llvm_next(&p);
+                llvm_parse_type_declaration(&p, token.text);
+            } break;
+            case LLVM_TOKEN_GLOBAL: {
+                llvm_next(&p);
+                llvm_parse_global(&p, token.text);
+            } break;
+            case LLVM_TOKEN_WORD: {
+                if (LLVM_ACCEPT_WORD(&p, "define")) {
+                    llvm_parse_function(&p, false);
+                } else if (LLVM_ACCEPT_WORD(&p, "declare")) {
+                    llvm_parse_function(&p, true);
+                } else if (LLVM_ACCEPT_WORD(&p, "source_filename") || LLVM_ACCEPT_WORD(&p, "target")) {
+                    // Module metadata has no place in the model.
+                    if (p.token.kind == LLVM_TOKEN_WORD)
+                        llvm_next(&p);
+                    llvm_expect(&p, '=');
+                    llvm_expect_token(&p, LLVM_TOKEN_STRING, "a string");
+                } else {
+                    llvm_parse_fail(&p, "unexpected '" STR_ARG "'", STR_FMT(token.text));
+                }
+            } break;
+            default: llvm_parse_fail(&p, "expected a declaration"); break;
+        }
+    }
+
+    free(p.members);
+    free(p.pointers);
+    array_free(llvm_type_t)(&p.params);
+    array_free(llvm_function_arg_t)(&p.args);
+    array_free(llvm_phi_incoming_t)(&p.incoming);
+    free(p.fixups);
+    llvm_builder_free(&p.builder);
+    return !p.failed;
+}
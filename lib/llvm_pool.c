@@ -0,0 +1,99 @@
+#include "llvm.h"
+
+#define LLVM_CONSTANT_POOL_MIN_SLOTS 64
+
+void llvm_constant_pool_free(llvm_constant_pool_t *pool) {
+    free(pool->slots);
+    str_builder_free(&pool->scratch);
+    memset(pool, 0, sizeof(*pool));
+}
+
+static void llvm_constant_pool_grow(llvm_constant_pool_t *pool) {
+    size_t slot_count = MAX(pool->slot_count * 2, LLVM_CONSTANT_POOL_MIN_SLOTS);
+    llvm_constant_slot_t *slots = calloc(slot_count, sizeof(llvm_constant_slot_t));
+    for (size_t i = 0; i < pool->slot_count; i++) {
+        llvm_constant_slot_t old = pool->slots[i];
+        if (old.name.count == 0)
+            continue;
+        size_t slot = old.hash & (slot_count - 1);
+        while (slots[slot].name.count != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = old;
+    }
+    free(pool->slots);
+    pool->slots = slots;
+    pool->slot_count = slot_count;
+}
+
+// Adds the global a slot describes under the slot's name, or under a fresh
+// one when the slot is new.
+static llvm_global_t *llvm_constant_pool_define(llvm_generator_t *gen, llvm_constant_slot_t *slot, size_t size) {
+    llvm_global_t global = {
+        .linkage = LLVM_LINKAGE_INTERNAL,
+        .is_constant = true,
+        .is_unnamed_addr = true,
+        .type = llvm_type_get(gen, LLVM_TYPE_ARRAY(LLVM_TYPE_CHAR(), (int)size)),
+        .value = slot->is_cstring ? (llvm_value_t){LLVM_VALUE_CSTRING_, .cstring_ = slot->text}
+                                  : (llvm_value_t){LLVM_VALUE_BYTES_, .bytes_ = slot->text},
+        .alignment = 1,
+    };
+    if (slot->name.count != 0) {
+        global.name = slot->name;
+        if (!llvm_add_global(gen, global))
+            fatal("'@" STR_ARG "' of the constant pool is taken by another symbol.", STR_FMT(slot->name));
+        return &gen->globals.data[gen->globals.size - 1];
+    }
+    str_builder_t *name = &gen->constants.scratch;
+    do {
+        str_builder_clear(name);
+        str_builder_append_cstr(name, slot->is_cstring ? ".str." : ".bytes.");
+        str_builder_append_int(name, (int)gen->constants.next_name++);
+        global.name = str_builder_view(name);
+    } while (llvm_symbol_find(gen, global.name) != 0);
+    global.name = arena_strdup(&gen->arena, global.name);
+    llvm_add_global(gen, global);
+    slot->name = global.name;
+    return &gen->globals.data[gen->globals.size - 1];
+}
+
+static llvm_global_t *llvm_constant_pool_intern(llvm_generator_t *gen, str data, bool is_cstring) {
+    llvm_constant_pool_t *pool = &gen->constants;
+    if ((pool->count + 1) * 4 > pool->slot_count * 3)
+        llvm_constant_pool_grow(pool);
+
+    // Contents are compared in their escaped form, which is what the global
+    // keeps.
+    str_builder_clear(&pool->scratch);
+    llvm_generate_escaped(&pool->scratch, data);
+    str text = str_builder_view(&pool->scratch);
+    u64 hash = hash_combine(str_hash(text), is_cstring);
+    size_t size = data.count + is_cstring;
+
+    size_t index = hash & (pool->slot_count - 1);
+    while (pool->slots[index].name.count != 0) {
+        llvm_constant_slot_t *slot = &pool->slots[index];
+        if (slot->hash == hash && slot->is_cstring == is_cstring && str_eq(slot->text, text)) {
+            // `llvm_prune` may have dropped the global since.
+            uint ref = llvm_symbol_find(gen, slot->name);
+            if (ref == 0)
+                return llvm_constant_pool_define(gen, slot, size);
+            if (LLVM_SYMBOL_IS_FUNCTION(ref))
+                fatal("'@" STR_ARG "' of the constant pool is taken by another symbol.", STR_FMT(slot->name));
+            return &gen->globals.data[LLVM_SYMBOL_INDEX(ref)];
+        }
+        index = (index + 1) & (pool->slot_count - 1);
+    }
+
+    llvm_constant_slot_t *slot = &pool->slots[index];
+    *slot = (llvm_constant_slot_t){hash, arena_strdup(&gen->arena, text), {0}, is_cstring};
+    pool->count++;
+    return llvm_constant_pool_define(gen, slot, size);
+}
+
+llvm_global_t *llvm_intern_cstring(llvm_generator_t *gen, str s) {
+    return llvm_constant_pool_intern(gen, s, true);
+}
+
+llvm_global_t *llvm_intern_bytes(llvm_generator_t *gen, str data) {
+    return llvm_constant_pool_intern(gen, data, false);
+}
@@ -0,0 +1,188 @@
+#include "llvm.h"
+
+// Scratch for one run: what has been reached, and what is still to be
+// looked at. Symbols are queued as refs from the symbol table.
+typedef struct llvm_pruner_t {
+    llvm_generator_t *gen;
+    bool *functions; // parallel to the module's lists
+    bool *globals;
+    bool *types;     // by canonical type id, grown as types are interned
+    size_t type_count;
+    array(u32) pending;
+} llvm_pruner_t;
+
+// Definitions other modules may refer to stay, whether used here or not.
+// Declarations only matter to this module's own code. The zero linkage is
+// emitted as external, so `internal` is the only one that stays local.
+static bool llvm_prune_is_root(llvm_linkage_type_t linkage) {
+    return linkage != LLVM_LINKAGE_INTERNAL;
+}
+
+static void llvm_prune_reach_ref(llvm_pruner_t *p, uint ref) {
+    if (ref == 0)
+        return;
+    bool *seen = LLVM_SYMBOL_IS_FUNCTION(ref) ? &p->functions[LLVM_SYMBOL_INDEX(ref)] : &p->globals[LLVM_SYMBOL_INDEX(ref)];
+    if (*seen)
+        return;
+    *seen = true;
+    array_push(u32)(&p->pending, ref);
+}
+
+static void llvm_prune_reach(llvm_pruner_t *p, str name) {
+    llvm_prune_reach_ref(p, llvm_symbol_find(p->gen, name));
+}
+
+// Queues the symbols a function body or a global's initializer names.
+static void llvm_prune_follow(llvm_pruner_t *p, uint ref) {
+    if (!LLVM_SYMBOL_IS_FUNCTION(ref)) {
+        llvm_global_t *global = &p->gen->globals.data[LLVM_SYMBOL_INDEX(ref)];
+        if (global->value.type == LLVM_VALUE_GETELEMENTPTR_)
+            llvm_prune_reach(p, global->value.getelementptr.name);
+        return;
+    }
+    llvm_function_t *function = &p->gen->functions.data[LLVM_SYMBOL_INDEX(ref)];
+    llvm_code_t *code = function->code;
+    if (function->is_native || code == NULL)
+        return;
+    // Every symbol a body names is a callee or a `getelementptr` base.
+    for (u32 i = 0; i < code->symbol_count; i++)
+        llvm_prune_reach_ref(p, llvm_symbol_of(p->gen, code->symbols[i]));
+    for (u32 i = 0; i < code->constant_count; i++)
+        if (code->constants[i].type == LLVM_VALUE_GETELEMENTPTR_)
+            llvm_prune_reach(p, code->constants[i].getelementptr.name);
+}
+
+// Marks a canonical type and everything it is built from.
+static void llvm_prune_type(llvm_pruner_t *p, llvm_type_t *type) {
+    size_t needed = p->gen->types.entries.size + 1;
+    if (needed > p->type_count) {
+        p->types = realloc(p->types, needed * sizeof(bool));
+        memset(p->types + p->type_count, 0, (needed - p->type_count) * sizeof(bool));
+        p->type_count = needed;
+    }
+    while (type != NULL && !p->types[type->id]) {
+        p->types[type->id] = true;
+        switch (type->type) {
+            case LLVM_TYPE_POINTER_: type = type->pointer.inner; break;
+            case LLVM_TYPE_ARRAY_: type = type->array.inner; break;
+            case LLVM_TYPE_VECTOR_: type = type->vector.inner; break;
+            case LLVM_TYPE_STRUCTURE_: {
+                for (size_t i = 0; i < type->structure.members.size; i++)
+                    llvm_prune_type(p, type->structure.members.data[i]);
+            } return;
+            default: return;
+        }
+    }
+}
+
+static void llvm_prune_value_types(llvm_pruner_t *p, llvm_value_t value) {
+    if (value.type == LLVM_VALUE_GETELEMENTPTR_)
+        llvm_prune_type(p, llvm_type_get(p->gen, *value.getelementptr.type));
+    else if (value.type == LLVM_VALUE_TYPE_)
+        llvm_prune_type(p, llvm_type_get(p->gen, value.type_));
+}
+
+static void llvm_prune_function_types(llvm_pruner_t *p, llvm_function_t *function) {
+    llvm_prune_type(p, llvm_type_get(p->gen, function->return_type));
+    for (size_t i = 0; i < function->args.size; i++)
+        llvm_prune_type(p, llvm_type_get(p->gen, function->args.data[i]));
+    llvm_code_t *code = function->code;
+    if (function->is_native || code == NULL)
+        return;
+    for (u32 i = 0; i < code->constant_count; i++)
+        llvm_prune_value_types(p, code->constants[i]);
+    for (u32 i = 0; i < code->instruction_count; i++) {
+        llvm_code_instruction_t instruction = code->instructions[i];
+        if (instruction.type != 0)
+            llvm_prune_type(p, llvm_type_by_id(p->gen, instruction.type));
+        if (instruction.opcode == LLVM_INSTR_CALL)
+            for (u32 j = instruction.operand_count / 2u; j < instruction.operand_count; j++)
+                llvm_prune_type(p, llvm_type_by_id(p->gen, code->operands[instruction.operands + j]));
+    }
+}
+
+size_t llvm_prune(llvm_generator_t *gen, const str *roots, size_t root_count) {
+    size_t function_count = gen->functions.size, global_count = gen->globals.size;
+    size_t declaration_count = gen->type_declarations.size;
+    llvm_pruner_t p = {.gen = gen};
+    p.functions = calloc(function_count + 1, sizeof(bool));
+    p.globals = calloc(global_count + 1, sizeof(bool));
+    array_init(u32)(&p.pending);
+
+    for (size_t i = 0; i < root_count; i++)
+        llvm_prune_reach(&p, roots[i]);
+    for (size_t i = 0; i < function_count; i++)
+        if (!gen->functions.data[i].is_native && llvm_prune_is_root(gen->functions.data[i].linkage))
+            llvm_prune_reach(&p, gen->functions.data[i].name);
+    for (size_t i = 0; i < global_count; i++)
+        if (llvm_prune_is_root(gen->globals.data[i].linkage))
+            llvm_prune_reach(&p, gen->globals.data[i].name);
+    while (p.pending.size > 0)
+        llvm_prune_follow(&p, array_pop(u32)(&p.pending));
+
+    // Structures are written out in full wherever they are used, so nothing
+    // names a type declaration. One is kept as long as its type still
+    // appears in what is left.
+    for (size_t i = 0; i < function_count; i++)
+        if (p.functions[i])
+            llvm_prune_function_types(&p, &gen->functions.data[i]);
+    for (size_t i = 0; i < global_count; i++) {
+        if (!p.globals[i])
+            continue;
+        if (gen->globals.data[i].type != NULL)
+            llvm_prune_type(&p, llvm_type_get(gen, *gen->globals.data[i].type));
+        llvm_prune_value_types(&p, gen->globals.data[i].value);
+    }
+    bool *declarations = calloc(declaration_count + 1, sizeof(bool));
+    for (size_t i = 0; i < declaration_count; i++) {
+        llvm_type_t *type = llvm_type_find(gen, gen->type_declarations.data[i].type);
+        declarations[i] = type != NULL && type->id < p.type_count && p.types[type->id];
+    }
+
+    // Compact the lists in place, then index the names again, since every
+    // symbol ref is a position.
+    size_t removed = 0, kept = 0;
+    for (size_t i = 0; i < declaration_count; i++)
+        if (declarations[i])
+            gen->type_declarations.data[kept++] = gen->type_declarations.data[i];
+    removed += declaration_count - kept;
+    gen->type_declarations.size = kept;
+    kept = 0;
+    for (size_t i = 0; i < global_count; i++)
+        if (p.globals[i])
+            gen->globals.data[kept++] = gen->globals.data[i];
+    removed += global_count - kept;
+    gen->globals.size = kept;
+    kept = 0;
+    for (size_t i = 0; i < function_count; i++)
+        if (p.functions[i])
+            gen->functions.data[kept++] = gen->functions.data[i];
+    removed += function_count - kept;
+    gen->functions.size = kept;
+#ifdef LLVM_STATS
+    // Per-function counters are kept by position as well.
+    kept = 0;
+    for (size_t i = 0; i < gen->stats.function_count; i++)
+        if (p.functions[i])
+            gen->stats.functions[kept++] = gen->stats.functions[i];
+    gen->stats.function_count = kept;
+#endif
+
+    if (removed > 0) {
+        llvm_cache_retain(gen, &gen->cache.type_declarations, declarations);
+        llvm_cache_retain(gen, &gen->cache.globals, p.globals);
+        llvm_cache_retain(gen, &gen->cache.functions, p.functions);
+        llvm_symbol_clear(gen);
+        for (size_t i = 0; i < gen->globals.size; i++)
+            llvm_symbol_insert(gen, gen->globals.data[i].name, LLVM_SYMBOL_GLOBAL(i));
+        for (size_t i = 0; i < gen->functions.size; i++)
+            llvm_symbol_insert(gen, gen->functions.data[i].name, LLVM_SYMBOL_FUNCTION(i));
+    }
+
+    array_free(u32)(&p.pending);
+    free(p.functions);
+    free(p.globals);
+    free(p.types);
+    free(declarations);
+    return removed;
+}
@@ -0,0 +1,379 @@
+#include "llvm.h"
+
+#define LLVM_SIMPLIFY_KEEP ((u32)-1)
+
+// Scratch for one function, reused across the module.
+typedef struct llvm_simplifier_t {
+    llvm_generator_t *gen;
+    array(u32) replacements; // per instruction: the ref that now stands for its value
+    array(u32) uses;         // per instruction, or `LLVM_SIMPLIFY_KEEP` once removed
+    array(llvm_value_t) constants; // folded expressions, appended to the function's pool
+    array(u32) blocks;       // per block, its new index, or `LLVM_SIMPLIFY_KEEP` if it never runs
+    array(u32) ends;         // per block, one past its first terminator
+    array(u32) stack;
+} llvm_simplifier_t;
+
+// Linkages under which the body seen here is the one that runs.
+static bool llvm_simplify_is_exact(llvm_function_t *function) {
+    switch (function->linkage) {
+        case LLVM_LINKAGE_PRIVATE:
+        case LLVM_LINKAGE_INTERNAL:
+        case LLVM_LINKAGE_EXTERNAL: return !function->is_native && function->code != NULL;
+        default: return false;
+    }
+}
+
+static bool llvm_simplify_int(llvm_code_t *code, llvm_ref_t ref, int *value) {
+    if (LLVM_REF_KIND(ref) == LLVM_REF_INT) {
+        *value = LLVM_REF_INT_VALUE(ref);
+        return true;
+    }
+    if (LLVM_REF_KIND(ref) == LLVM_REF_CONSTANT && code->constants[LLVM_REF_PAYLOAD(ref)].type == LLVM_VALUE_INT_) {
+        *value = code->constants[LLVM_REF_PAYLOAD(ref)].int_;
+        return true;
+    }
+    return false;
+}
+
+// A `getelementptr` over a global with constant indices is a constant.
+static bool llvm_simplify_gep(llvm_simplifier_t *s, llvm_code_t *code, llvm_code_instruction_t instruction, llvm_value_t *folded) {
+    u32 *operands = &code->operands[instruction.operands];
+    int indices[2];
+    if (!llvm_simplify_int(code, operands[0], &indices[0]) || !llvm_simplify_int(code, operands[1], &indices[1]))
+        return false;
+    u32 name = code->symbols[instruction.symbol];
+    if (llvm_find_global_id(s->gen, name) == NULL)
+        return false;
+    *folded = (llvm_value_t){LLVM_VALUE_GETELEMENTPTR_, .getelementptr = {
+        llvm_name_text(s->gen, name), llvm_type_by_id(s->gen, instruction.type), {indices[0], indices[1]},
+        instruction.opcode == LLVM_INSTR_GETELEMENTPTR_INBOUNDS,
+    }};
+    return true;
+}
+
+// The callee can be dropped when its result is unused: its entry block only
+// computes addresses before returning.
+static llvm_function_t *llvm_simplify_pure_callee(llvm_simplifier_t *s, u32 name) {
+    llvm_function_t *callee = llvm_find_function_id(s->gen, name);
+    if (callee == NULL || !llvm_simplify_is_exact(callee) || callee->code->block_count == 0)
+        return NULL;
+    llvm_code_t *code = callee->code;
+    llvm_code_block_t entry = code->blocks[0];
+    for (u32 i = entry.first; i < entry.first + entry.count; i++) {
+        u8 opcode = code->instructions[i].opcode;
+        if (opcode == LLVM_INSTR_RETURN)
+            return callee;
+        if (opcode != LLVM_INSTR_GETELEMENTPTR && opcode != LLVM_INSTR_GETELEMENTPTR_INBOUNDS)
+            return NULL;
+    }
+    return NULL;
+}
+
+// Finds what a call to a pure callee returns, in terms of the caller: one of
+// the call's own arguments, or a constant.
+static bool llvm_simplify_call(llvm_simplifier_t *s, llvm_code_t *code, llvm_code_instruction_t instruction, llvm_ref_t *folded) {
+    llvm_function_t *callee = llvm_simplify_pure_callee(s, code->symbols[instruction.symbol]);
+    if (callee == NULL || llvm_type_get(s->gen, callee->return_type)->id != instruction.type)
+        return false;
+    llvm_code_t *body = callee->code;
+    llvm_code_instruction_t ret = body->instructions[body->blocks[0].first];
+    for (u32 i = body->blocks[0].first; body->instructions[i].opcode != LLVM_INSTR_RETURN; i++)
+        ret = body->instructions[i + 1];
+    llvm_ref_t value = body->operands[ret.operands];
+    u32 arg_count = (u32)callee->args.size;
+    u32 count = instruction.operand_count / 2;
+    u32 *operands = &code->operands[instruction.operands];
+
+    llvm_value_t constant;
+    switch (LLVM_REF_KIND(value)) {
+        case LLVM_REF_INT: {
+            *folded = value;
+        } return true;
+        case LLVM_REF_CONSTANT: {
+            constant = body->constants[LLVM_REF_PAYLOAD(value)];
+        } break;
+        case LLVM_REF_LOCAL: {
+            u32 index = LLVM_REF_PAYLOAD(value);
+            if (index < arg_count) {
+                if (index >= count || operands[count + index] != instruction.type)
+                    return false;
+                *folded = operands[index];
+                return true;
+            }
+            if (!llvm_simplify_gep(s, body, body->instructions[index - arg_count], &constant))
+                return false;
+        } break;
+        default: return false;
+    }
+    array_push(llvm_value_t)(&s->constants, constant);
+    *folded = LLVM_REF(LLVM_REF_CONSTANT, code->constant_count + s->constants.size - 1);
+    return true;
+}
+
+static bool llvm_simplify_has_side_effects(llvm_simplifier_t *s, llvm_code_t *code, llvm_code_instruction_t instruction) {
+    switch (instruction.opcode) {
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS:
+        case LLVM_INSTR_ALLOCA:
+        case LLVM_INSTR_LOAD:
+        case LLVM_INSTR_PHI: return false;
+        case LLVM_INSTR_CALL: return llvm_simplify_pure_callee(s, code->symbols[instruction.symbol]) == NULL;
+        default: return true;
+    }
+}
+
+static llvm_ref_t llvm_simplify_resolve(llvm_simplifier_t *s, u32 arg_count, llvm_ref_t ref) {
+    while (LLVM_REF_KIND(ref) == LLVM_REF_LOCAL && LLVM_REF_PAYLOAD(ref) >= arg_count
+           && s->replacements.data[LLVM_REF_PAYLOAD(ref) - arg_count] != LLVM_SIMPLIFY_KEEP)
+        ref = s->replacements.data[LLVM_REF_PAYLOAD(ref) - arg_count];
+    return ref;
+}
+
+// Adds `delta` to the use count of every instruction `instruction` uses.
+static void llvm_simplify_count_uses(llvm_simplifier_t *s, llvm_code_t *code, u32 arg_count, llvm_code_instruction_t instruction, u32 delta) {
+    u32 *operands = &code->operands[instruction.operands];
+    for (u32 j = 0; j < LLVM_CODE_REF_COUNT(instruction); j++)
+        if (LLVM_REF_KIND(operands[j]) == LLVM_REF_LOCAL && LLVM_REF_PAYLOAD(operands[j]) >= arg_count)
+            s->uses.data[LLVM_REF_PAYLOAD(operands[j]) - arg_count] += delta;
+}
+
+// Marks the blocks that can run, and where each of them stops. Returns
+// false if one of them has no terminator.
+static bool llvm_simplify_reachable(llvm_simplifier_t *s, llvm_code_t *code) {
+    s->blocks.size = 0;
+    s->ends.size = 0;
+    s->stack.size = 0;
+    for (u32 i = 0; i < code->block_count; i++) {
+        array_push(u32)(&s->blocks, LLVM_SIMPLIFY_KEEP);
+        array_push(u32)(&s->ends, 0);
+    }
+    s->blocks.data[0] = 0;
+    array_push(u32)(&s->stack, 0);
+    while (s->stack.size > 0) {
+        u32 block = array_pop(u32)(&s->stack);
+        llvm_code_block_t b = code->blocks[block];
+        u32 end = b.first;
+        while (end < b.first + b.count && !llvm_code_is_terminator(code->instructions[end]))
+            end++;
+        if (end == b.first + b.count)
+            return false; // see `llvm_verify`
+        s->ends.data[block] = end + 1;
+        // `llvm_code_successors` looks at the last instruction, which may
+        // not be the first terminator.
+        llvm_code_instruction_t terminator = code->instructions[end];
+        u32 *operands = &code->operands[terminator.operands];
+        u32 first = terminator.opcode == LLVM_INSTR_COND_BR ? 1 : 0;
+        u32 count = terminator.opcode == LLVM_INSTR_RETURN ? 0 : terminator.operand_count - first;
+        for (u32 i = first; i < first + count; i++) {
+            if (operands[i] >= code->block_count)
+                return false;
+            if (s->blocks.data[operands[i]] == LLVM_SIMPLIFY_KEEP) {
+                s->blocks.data[operands[i]] = 0;
+                array_push(u32)(&s->stack, operands[i]);
+            }
+        }
+    }
+    return true;
+}
+
+// Keeps only the incoming values of a phi that come from blocks that run.
+static bool llvm_simplify_prune_phi(llvm_simplifier_t *s, llvm_code_t *code, llvm_code_instruction_t *instruction) {
+    u32 *operands = &code->operands[instruction->operands];
+    u32 count = instruction->operand_count / 2, kept = 0;
+    for (u32 i = 0; i < count; i++)
+        kept += operands[count + i] < code->block_count && s->blocks.data[operands[count + i]] != LLVM_SIMPLIFY_KEEP;
+    if (kept == count)
+        return false;
+    // Values first, then blocks: neither overwrites anything still unread.
+    for (u32 i = 0, k = 0; i < count; i++)
+        if (operands[count + i] < code->block_count && s->blocks.data[operands[count + i]] != LLVM_SIMPLIFY_KEEP)
+            operands[k++] = operands[i];
+    for (u32 i = 0, k = 0; i < count; i++)
+        if (operands[count + i] < code->block_count && s->blocks.data[operands[count + i]] != LLVM_SIMPLIFY_KEEP)
+            operands[kept + k++] = operands[count + i];
+    instruction->operand_count = (u16)(kept * 2); // fewer than before, so it fits
+    return true;
+}
+
+// A phi that only ever sees one value besides itself is that value. Values
+// defined later are not resolved yet, so only exact matches count.
+static void llvm_simplify_phi(llvm_code_t *code, u32 self, llvm_code_instruction_t instruction, u32 *replacement) {
+    u32 *operands = &code->operands[instruction.operands];
+    llvm_ref_t same = LLVM_SIMPLIFY_KEEP;
+    for (u32 i = 0; i < instruction.operand_count / 2u; i++) {
+        if (operands[i] == LLVM_REF(LLVM_REF_LOCAL, self) || operands[i] == same)
+            continue;
+        if (same != LLVM_SIMPLIFY_KEEP)
+            return;
+        same = operands[i];
+    }
+    if (same != LLVM_SIMPLIFY_KEEP)
+        *replacement = same;
+}
+
+// Returns how many instructions were folded away or removed.
+static size_t llvm_simplify_function(llvm_simplifier_t *s, llvm_function_t *function) {
+    llvm_code_t *code = function->code;
+    u32 arg_count = (u32)function->args.size;
+    u32 count = code->instruction_count;
+    if (code->block_count == 0)
+        return 0;
+    llvm_code_own(s->gen, code);
+    s->replacements.size = 0;
+    s->uses.size = 0;
+    s->constants.size = 0;
+    for (u32 i = 0; i < count; i++) {
+        array_push(u32)(&s->replacements, LLVM_SIMPLIFY_KEEP);
+        array_push(u32)(&s->uses, LLVM_SIMPLIFY_KEEP);
+    }
+
+    // Only blocks reachable from the entry run, and each only up to its
+    // first terminator. Everything else starts out removed.
+    if (!llvm_simplify_reachable(s, code))
+        return 0;
+    for (u32 block = 0; block < code->block_count; block++) {
+        if (s->blocks.data[block] == LLVM_SIMPLIFY_KEEP)
+            continue;
+        for (u32 i = code->blocks[block].first; i < s->ends.data[block]; i++)
+            s->uses.data[i] = 0;
+    }
+    for (u32 i = 0; i < count; i++) {
+        if (s->uses.data[i] == LLVM_SIMPLIFY_KEEP)
+            continue;
+        llvm_code_instruction_t instruction = code->instructions[i];
+        u32 *operands = &code->operands[instruction.operands];
+        for (u32 j = 0; j < LLVM_CODE_REF_COUNT(instruction); j++) {
+            u32 kind = LLVM_REF_KIND(operands[j]), index = LLVM_REF_PAYLOAD(operands[j]);
+            if (instruction.opcode == LLVM_INSTR_PHI) {
+                u32 from = operands[instruction.operand_count / 2 + j];
+                if (from >= code->block_count || s->blocks.data[from] == LLVM_SIMPLIFY_KEEP)
+                    continue; // pruned below
+            }
+            if (kind == LLVM_REF_UNDEFINED || (kind == LLVM_REF_LOCAL && index >= arg_count
+                && (index >= arg_count + count || s->uses.data[index - arg_count] == LLVM_SIMPLIFY_KEEP)))
+                return 0; // not well-formed, see `llvm_verify`
+        }
+    }
+
+    // Forward: substitute folded values into their users. Uses that come
+    // before their definition, as in phis, are caught up with afterwards.
+    bool changed = false;
+    for (u32 i = 0; i < count; i++) {
+        if (s->uses.data[i] == LLVM_SIMPLIFY_KEEP)
+            continue;
+        llvm_code_instruction_t *instruction = &code->instructions[i];
+        u32 *operands = &code->operands[instruction->operands];
+        for (u32 j = 0; j < LLVM_CODE_REF_COUNT(*instruction); j++)
+            operands[j] = llvm_simplify_resolve(s, arg_count, operands[j]);
+        if (instruction->opcode == LLVM_INSTR_PHI) {
+            changed |= llvm_simplify_prune_phi(s, code, instruction);
+            llvm_simplify_phi(code, arg_count + i, *instruction, &s->replacements.data[i]);
+            continue;
+        }
+        llvm_value_t constant;
+        llvm_ref_t folded;
+        if ((instruction->opcode == LLVM_INSTR_GETELEMENTPTR || instruction->opcode == LLVM_INSTR_GETELEMENTPTR_INBOUNDS)
+            && llvm_simplify_gep(s, code, *instruction, &constant)) {
+            array_push(llvm_value_t)(&s->constants, constant);
+            s->replacements.data[i] = LLVM_REF(LLVM_REF_CONSTANT, code->constant_count + s->constants.size - 1);
+        } else if (instruction->opcode == LLVM_INSTR_CALL && llvm_simplify_call(s, code, *instruction, &folded)) {
+            s->replacements.data[i] = folded;
+        }
+    }
+    for (u32 i = 0; i < count; i++) {
+        if (s->uses.data[i] == LLVM_SIMPLIFY_KEEP)
+            continue;
+        llvm_code_instruction_t instruction = code->instructions[i];
+        u32 *operands = &code->operands[instruction.operands];
+        for (u32 j = 0; j < LLVM_CODE_REF_COUNT(instruction); j++)
+            operands[j] = llvm_simplify_resolve(s, arg_count, operands[j]);
+    }
+
+    // Backward: drop what nothing uses and what has no effect, which may
+    // leave its own operands unused in turn. Uses across blocks can point
+    // either way, so this repeats until nothing more goes.
+    for (u32 i = 0; i < count; i++)
+        if (s->uses.data[i] != LLVM_SIMPLIFY_KEEP)
+            llvm_simplify_count_uses(s, code, arg_count, code->instructions[i], 1);
+    for (bool dropped = true; dropped;) {
+        dropped = false;
+        for (u32 i = count; i-- > 0;) {
+            llvm_code_instruction_t instruction = code->instructions[i];
+            if (s->uses.data[i] != 0 || llvm_simplify_has_side_effects(s, code, instruction))
+                continue;
+            s->uses.data[i] = LLVM_SIMPLIFY_KEEP;
+            llvm_simplify_count_uses(s, code, arg_count, instruction, (u32)-1);
+            dropped = true;
+        }
+    }
+
+    // Compact what is left and renumber the blocks and locals, reusing
+    // `replacements` for the new positions.
+    u32 kept = 0, block_count = 0;
+    for (u32 block = 0; block < code->block_count; block++) {
+        if (s->blocks.data[block] == LLVM_SIMPLIFY_KEEP) {
+            changed = true;
+            continue;
+        }
+        s->blocks.data[block] = block_count;
+        llvm_code_block_t b = code->blocks[block];
+        code->blocks[block_count++] = (llvm_code_block_t){b.name, kept, 0};
+        for (u32 i = b.first; i < b.first + b.count; i++) {
+            s->replacements.data[i] = kept;
+            if (s->uses.data[i] != LLVM_SIMPLIFY_KEEP)
+                code->instructions[kept++] = code->instructions[i];
+        }
+        code->blocks[block_count - 1].count = kept - code->blocks[block_count - 1].first;
+    }
+    for (u32 i = 0; i < kept; i++) {
+        llvm_code_instruction_t instruction = code->instructions[i];
+        u32 *operands = &code->operands[instruction.operands];
+        u32 ref_count = LLVM_CODE_REF_COUNT(instruction);
+        bool has_blocks = instruction.opcode == LLVM_INSTR_BR || instruction.opcode == LLVM_INSTR_COND_BR || instruction.opcode == LLVM_INSTR_PHI;
+        for (u32 j = 0; j < instruction.operand_count; j++) {
+            if (j >= ref_count && has_blocks)
+                operands[j] = s->blocks.data[operands[j]];
+            else if (j < ref_count && LLVM_REF_KIND(operands[j]) == LLVM_REF_LOCAL && LLVM_REF_PAYLOAD(operands[j]) >= arg_count)
+                operands[j] = LLVM_REF(LLVM_REF_LOCAL, arg_count + s->replacements.data[LLVM_REF_PAYLOAD(operands[j]) - arg_count]);
+        }
+    }
+    size_t removed = count - kept;
+    if (removed == 0 && !changed)
+        return 0;
+    code->instruction_count = kept;
+    code->block_count = block_count;
+
+    if (s->constants.size > 0) {
+        llvm_value_t *constants = arena_alloc_aligned(&s->gen->arena, (code->constant_count + s->constants.size) * sizeof(llvm_value_t), _Alignof(llvm_value_t));
+        if (code->constant_count > 0)
+            memcpy(constants, code->constants, code->constant_count * sizeof(llvm_value_t));
+        memcpy(constants + code->constant_count, s->constants.data, s->constants.size * sizeof(llvm_value_t));
+        code->constants = constants;
+        code->constant_count += (u32)s->constants.size;
+    }
+    llvm_touch_function(s->gen, function);
+    return removed;
+}
+
+size_t llvm_simplify(llvm_generator_t *gen) {
+    llvm_simplifier_t s = {.gen = gen};
+    array_init(u32)(&s.replacements);
+    array_init(u32)(&s.uses);
+    array_init(llvm_value_t)(&s.constants);
+    array_init(u32)(&s.blocks);
+    array_init(u32)(&s.ends);
+    array_init(u32)(&s.stack);
+    size_t removed = 0;
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        if (!function->is_native && function->code != NULL)
+            removed += llvm_simplify_function(&s, function);
+    }
+    array_free(u32)(&s.replacements);
+    array_free(u32)(&s.uses);
+    array_free(llvm_value_t)(&s.constants);
+    array_free(u32)(&s.blocks);
+    array_free(u32)(&s.ends);
+    array_free(u32)(&s.stack);
+    return removed;
+}
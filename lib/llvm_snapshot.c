@@ -0,0 +1,708 @@
+#include "llvm.h"
+
+#include <stdint.h>
+
+// A snapshot is the header, then one section per kind of record, then the
+// strings. Records refer to each other by index and to strings by offset,
+// never by address. Sections are 8-byte aligned, so a snapshot that starts
+// at an aligned address, as a mapping does, can be read in place.
+// Instructions, operands and symbols are stored exactly as `llvm_code_t`
+// holds them and are used from the snapshot without being copied.
+
+#define LLVM_SNAPSHOT_MAGIC "llvmsnap"
+#define LLVM_SNAPSHOT_VERSION 1
+#define LLVM_SNAPSHOT_BYTE_ORDER 0x01020304u
+#define LLVM_SNAPSHOT_ALIGN 8
+
+enum {
+    LLVM_SNAPSHOT_NAMES,
+    LLVM_SNAPSHOT_TYPES,
+    LLVM_SNAPSHOT_MEMBERS,      // u32 type ids of structure members
+    LLVM_SNAPSHOT_DECLARATIONS, // type declarations
+    LLVM_SNAPSHOT_GLOBALS,
+    LLVM_SNAPSHOT_FUNCTIONS,
+    LLVM_SNAPSHOT_ARGS,         // u32 type ids of function arguments
+    LLVM_SNAPSHOT_CODES,
+    LLVM_SNAPSHOT_BLOCKS,
+    LLVM_SNAPSHOT_INSTRUCTIONS, // llvm_code_instruction_t
+    LLVM_SNAPSHOT_OPERANDS,     // u32
+    LLVM_SNAPSHOT_CONSTANTS,
+    LLVM_SNAPSHOT_SYMBOLS,      // u32 name ids
+    LLVM_SNAPSHOT_POOL,         // constant pool slots, empty ones included
+    LLVM_SNAPSHOT_STRINGS,      // bytes
+    LLVM_SNAPSHOT_SECTION_COUNT,
+};
+
+typedef struct llvm_snapshot_str_t {
+    u64 offset; // into the strings
+    u64 count;
+} llvm_snapshot_str_t;
+
+typedef struct llvm_snapshot_section_t {
+    u64 offset; // from the start of the snapshot
+    u64 count;  // records, or bytes for the strings
+} llvm_snapshot_section_t;
+
+typedef struct llvm_snapshot_header_t {
+    char magic[8];
+    u32 version;
+    u32 byte_order;
+    u32 instruction_size; // `sizeof(llvm_code_instruction_t)` of the writer
+    u32 next_pool_name;
+    u64 size;
+    llvm_snapshot_section_t sections[LLVM_SNAPSHOT_SECTION_COUNT];
+} llvm_snapshot_header_t;
+
+typedef struct llvm_snapshot_name_t {
+    llvm_snapshot_str_t text;
+    u64 hash;
+} llvm_snapshot_name_t;
+
+typedef struct llvm_snapshot_type_t {
+    u32 kind;
+    i32 size;  // bits of an integer or float, elements of an array or vector
+    u32 inner; // type id
+    u32 is_packed;
+    u32 member_first;
+    u32 member_count;
+} llvm_snapshot_type_t;
+
+typedef struct llvm_snapshot_declaration_t {
+    llvm_snapshot_str_t name;
+    u32 type;
+    u32 reserved;
+} llvm_snapshot_declaration_t;
+
+typedef struct llvm_snapshot_value_t {
+    u32 kind;
+    u32 type; // of a type value or a `getelementptr`
+    i32 indices[2];
+    u32 is_inbounds;
+    u32 reserved;
+    u64 bits; // integer, float or double, or local index
+    llvm_snapshot_str_t text; // string contents, or the global a `getelementptr` indexes into
+} llvm_snapshot_value_t;
+
+#define LLVM_SNAPSHOT_CONSTANT 1
+#define LLVM_SNAPSHOT_GLOBAL 2
+#define LLVM_SNAPSHOT_UNNAMED_ADDR 4
+#define LLVM_SNAPSHOT_NATIVE 1
+#define LLVM_SNAPSHOT_VARARG 2
+
+typedef struct llvm_snapshot_global_t {
+    u32 name; // name id
+    u32 flags;
+    u32 linkage;
+    u32 visibility;
+    u32 dll_storage_class;
+    u32 type; // 0 when there is none
+    i32 address_space;
+    i32 alignment;
+    llvm_snapshot_value_t value;
+} llvm_snapshot_global_t;
+
+typedef struct llvm_snapshot_function_t {
+    u32 name;
+    u32 flags;
+    u32 linkage;
+    u32 visibility;
+    u32 dll_storage_class;
+    u32 call_convention;
+    u32 return_type;
+    u32 arg_first;
+    u32 arg_count;
+    i32 address_space;
+    i32 alignment;
+    u32 code; // index into the codes, plus one
+} llvm_snapshot_function_t;
+
+// Where one body's pieces start in the shared sections; the counts are the
+// ones in `llvm_code_t`.
+typedef struct llvm_snapshot_code_t {
+    u64 block_first;
+    u64 instruction_first;
+    u64 operand_first;
+    u64 constant_first;
+    u64 symbol_first;
+    u32 block_count;
+    u32 instruction_count;
+    u32 operand_count;
+    u32 constant_count;
+    u32 symbol_count;
+    u32 reserved;
+} llvm_snapshot_code_t;
+
+typedef struct llvm_snapshot_block_t {
+    llvm_snapshot_str_t name;
+    u32 first;
+    u32 count;
+} llvm_snapshot_block_t;
+
+typedef struct llvm_snapshot_slot_t {
+    u64 hash;
+    llvm_snapshot_str_t text;
+    llvm_snapshot_str_t name;
+    u32 is_cstring;
+    u32 reserved;
+} llvm_snapshot_slot_t;
+
+static const size_t llvm_snapshot_record_sizes[LLVM_SNAPSHOT_SECTION_COUNT] = {
+    [LLVM_SNAPSHOT_NAMES] = sizeof(llvm_snapshot_name_t),
+    [LLVM_SNAPSHOT_TYPES] = sizeof(llvm_snapshot_type_t),
+    [LLVM_SNAPSHOT_MEMBERS] = sizeof(u32),
+    [LLVM_SNAPSHOT_DECLARATIONS] = sizeof(llvm_snapshot_declaration_t),
+    [LLVM_SNAPSHOT_GLOBALS] = sizeof(llvm_snapshot_global_t),
+    [LLVM_SNAPSHOT_FUNCTIONS] = sizeof(llvm_snapshot_function_t),
+    [LLVM_SNAPSHOT_ARGS] = sizeof(u32),
+    [LLVM_SNAPSHOT_CODES] = sizeof(llvm_snapshot_code_t),
+    [LLVM_SNAPSHOT_BLOCKS] = sizeof(llvm_snapshot_block_t),
+    [LLVM_SNAPSHOT_INSTRUCTIONS] = sizeof(llvm_code_instruction_t),
+    [LLVM_SNAPSHOT_OPERANDS] = sizeof(u32),
+    [LLVM_SNAPSHOT_CONSTANTS] = sizeof(llvm_snapshot_value_t),
+    [LLVM_SNAPSHOT_SYMBOLS] = sizeof(u32),
+    [LLVM_SNAPSHOT_POOL] = sizeof(llvm_snapshot_slot_t),
+    [LLVM_SNAPSHOT_STRINGS] = 1,
+};
+
+typedef struct llvm_snapshot_string_slot_t {
+    u64 hash;
+    llvm_snapshot_str_t text; // `count` is one more than the length, 0 is empty
+} llvm_snapshot_string_slot_t;
+
+typedef struct llvm_snapshot_writer_t {
+    llvm_generator_t *gen;
+    str_builder_t out;
+    size_t strings; // where the strings start in `out`
+    size_t next[LLVM_SNAPSHOT_SECTION_COUNT]; // next free record of each section
+    // Equal strings, such as block names, are stored once.
+    llvm_snapshot_string_slot_t *slots;
+    size_t slot_count;
+    size_t string_count;
+} llvm_snapshot_writer_t;
+
+#define LLVM_SNAPSHOT_MIN_SLOTS 256
+
+static void llvm_snapshot_grow_strings(llvm_snapshot_writer_t *w) {
+    size_t slot_count = MAX(w->slot_count * 2, LLVM_SNAPSHOT_MIN_SLOTS);
+    llvm_snapshot_string_slot_t *slots = calloc(slot_count, sizeof(llvm_snapshot_string_slot_t));
+    for (size_t i = 0; i < w->slot_count; i++) {
+        if (w->slots[i].text.count == 0)
+            continue;
+        size_t slot = w->slots[i].hash & (slot_count - 1);
+        while (slots[slot].text.count != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = w->slots[i];
+    }
+    free(w->slots);
+    w->slots = slots;
+    w->slot_count = slot_count;
+}
+
+static llvm_snapshot_str_t llvm_snapshot_string(llvm_snapshot_writer_t *w, str s) {
+    if ((w->string_count + 1) * 4 > w->slot_count * 3)
+        llvm_snapshot_grow_strings(w);
+    u64 hash = str_hash(s);
+    size_t slot = hash & (w->slot_count - 1);
+    for (; w->slots[slot].text.count != 0; slot = (slot + 1) & (w->slot_count - 1)) {
+        llvm_snapshot_string_slot_t *it = &w->slots[slot];
+        if (it->hash == hash && it->text.count == s.count + 1 && str_eq((str){w->out.chars + w->strings + it->text.offset, s.count}, s))
+            return (llvm_snapshot_str_t){it->text.offset, s.count};
+    }
+    llvm_snapshot_str_t text = {w->out.count - w->strings, s.count};
+    str_builder_append(&w->out, s);
+    w->slots[slot] = (llvm_snapshot_string_slot_t){hash, {text.offset, s.count + 1}};
+    w->string_count++;
+    return text;
+}
+
+// Claims the next record of `section`. Records are filled in place, so the
+// pointer is only good until the next string is added.
+static void *llvm_snapshot_record(llvm_snapshot_writer_t *w, int section) {
+    const llvm_snapshot_header_t *header = (const llvm_snapshot_header_t *)w->out.chars;
+    return w->out.chars + header->sections[section].offset + w->next[section]++ * llvm_snapshot_record_sizes[section];
+}
+
+static llvm_snapshot_header_t *llvm_snapshot_header(llvm_snapshot_writer_t *w) {
+    return (llvm_snapshot_header_t *)w->out.chars;
+}
+
+static void llvm_snapshot_copy(llvm_snapshot_writer_t *w, int section, const void *records, u32 count) {
+    if (count == 0)
+        return;
+    void *first = llvm_snapshot_record(w, section);
+    memcpy(first, records, count * llvm_snapshot_record_sizes[section]);
+    w->next[section] += count - 1;
+}
+
+static llvm_snapshot_value_t llvm_snapshot_value(llvm_snapshot_writer_t *w, llvm_value_t value) {
+    llvm_snapshot_value_t record = {.kind = value.type};
+    switch (value.type) {
+        case LLVM_VALUE_STRING_: record.text = llvm_snapshot_string(w, value.string_); break;
+        case LLVM_VALUE_CSTRING_: record.text = llvm_snapshot_string(w, value.cstring_); break;
+        case LLVM_VALUE_BYTES_: record.text = llvm_snapshot_string(w, value.bytes_); break;
+        case LLVM_VALUE_INT_: record.bits = (u64)(i64)value.int_; break;
+        case LLVM_VALUE_FLOAT_: memcpy(&record.bits, &value.float_, sizeof(value.float_)); break;
+        case LLVM_VALUE_DOUBLE_: memcpy(&record.bits, &value.double_, sizeof(value.double_)); break;
+        case LLVM_VALUE_LOCAL_: record.bits = value.local.idx; break;
+        case LLVM_VALUE_TYPE_: record.type = llvm_type_get(w->gen, value.type_)->id; break;
+        case LLVM_VALUE_GETELEMENTPTR_:
+            record.type = llvm_type_get(w->gen, *value.getelementptr.type)->id;
+            record.indices[0] = value.getelementptr.indices[0];
+            record.indices[1] = value.getelementptr.indices[1];
+            record.is_inbounds = value.getelementptr.is_inbounds;
+            record.text = llvm_snapshot_string(w, value.getelementptr.name);
+            break;
+        case LLVM_VALUE_UNDEF_: break;
+    }
+    return record;
+}
+
+static void llvm_snapshot_code(llvm_snapshot_writer_t *w, llvm_code_t *code) {
+    llvm_snapshot_code_t record = {
+        w->next[LLVM_SNAPSHOT_BLOCKS], w->next[LLVM_SNAPSHOT_INSTRUCTIONS], w->next[LLVM_SNAPSHOT_OPERANDS],
+        w->next[LLVM_SNAPSHOT_CONSTANTS], w->next[LLVM_SNAPSHOT_SYMBOLS],
+        code->block_count, code->instruction_count, code->operand_count, code->constant_count, code->symbol_count, 0,
+    };
+    *(llvm_snapshot_code_t *)llvm_snapshot_record(w, LLVM_SNAPSHOT_CODES) = record;
+    for (u32 i = 0; i < code->block_count; i++) {
+        llvm_snapshot_block_t block = {llvm_snapshot_string(w, code->blocks[i].name), code->blocks[i].first, code->blocks[i].count};
+        *(llvm_snapshot_block_t *)llvm_snapshot_record(w, LLVM_SNAPSHOT_BLOCKS) = block;
+    }
+    for (u32 i = 0; i < code->constant_count; i++) {
+        llvm_snapshot_value_t value = llvm_snapshot_value(w, code->constants[i]);
+        *(llvm_snapshot_value_t *)llvm_snapshot_record(w, LLVM_SNAPSHOT_CONSTANTS) = value;
+    }
+    // Pointer-free already, so copied as they are.
+    llvm_snapshot_copy(w, LLVM_SNAPSHOT_INSTRUCTIONS, code->instructions, code->instruction_count);
+    llvm_snapshot_copy(w, LLVM_SNAPSHOT_OPERANDS, code->operands, code->operand_count);
+    llvm_snapshot_copy(w, LLVM_SNAPSHOT_SYMBOLS, code->symbols, code->symbol_count);
+}
+
+str llvm_snapshot_save(llvm_generator_t *gen) {
+    // Every type the module uses has to be in the table before it is
+    // written, and bodies always refer to canonical ids already.
+    for (size_t i = 0; i < gen->type_declarations.size; i++)
+        llvm_type_get(gen, gen->type_declarations.data[i].type);
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        if (global->type != NULL)
+            llvm_type_get(gen, *global->type);
+        if (global->value.type == LLVM_VALUE_TYPE_)
+            llvm_type_get(gen, global->value.type_);
+        else if (global->value.type == LLVM_VALUE_GETELEMENTPTR_)
+            llvm_type_get(gen, *global->value.getelementptr.type);
+    }
+    u64 counts[LLVM_SNAPSHOT_SECTION_COUNT] = {0};
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        llvm_type_get(gen, function->return_type);
+        for (size_t j = 0; j < function->args.size; j++)
+            llvm_type_get(gen, function->args.data[j]);
+        counts[LLVM_SNAPSHOT_ARGS] += function->args.size;
+        llvm_code_t *code = function->code;
+        if (function->is_native || code == NULL)
+            continue;
+        for (u32 j = 0; j < code->constant_count; j++) {
+            llvm_value_t value = code->constants[j];
+            if (value.type == LLVM_VALUE_TYPE_)
+                llvm_type_get(gen, value.type_);
+            else if (value.type == LLVM_VALUE_GETELEMENTPTR_)
+                llvm_type_get(gen, *value.getelementptr.type);
+        }
+        counts[LLVM_SNAPSHOT_CODES]++;
+        counts[LLVM_SNAPSHOT_BLOCKS] += code->block_count;
+        counts[LLVM_SNAPSHOT_INSTRUCTIONS] += code->instruction_count;
+        counts[LLVM_SNAPSHOT_OPERANDS] += code->operand_count;
+        counts[LLVM_SNAPSHOT_CONSTANTS] += code->constant_count;
+        counts[LLVM_SNAPSHOT_SYMBOLS] += code->symbol_count;
+    }
+    counts[LLVM_SNAPSHOT_NAMES] = gen->names.names.size;
+    counts[LLVM_SNAPSHOT_TYPES] = gen->types.entries.size;
+    for (size_t i = 0; i < gen->types.entries.size; i++) {
+        llvm_type_t *type = gen->types.entries.data[i].type;
+        if (type->type == LLVM_TYPE_STRUCTURE_)
+            counts[LLVM_SNAPSHOT_MEMBERS] += type->structure.members.size;
+    }
+    counts[LLVM_SNAPSHOT_DECLARATIONS] = gen->type_declarations.size;
+    counts[LLVM_SNAPSHOT_GLOBALS] = gen->globals.size;
+    counts[LLVM_SNAPSHOT_FUNCTIONS] = gen->functions.size;
+    counts[LLVM_SNAPSHOT_POOL] = gen->constants.slot_count;
+
+    // Fixed-size sections are laid out up front and filled in place; the
+    // strings go last, as they come.
+    llvm_snapshot_writer_t w = {.gen = gen};
+    str_builder_init(&w.out);
+    llvm_snapshot_header_t header = {
+        .magic = LLVM_SNAPSHOT_MAGIC,
+        .version = LLVM_SNAPSHOT_VERSION,
+        .byte_order = LLVM_SNAPSHOT_BYTE_ORDER,
+        .instruction_size = sizeof(llvm_code_instruction_t),
+        .next_pool_name = gen->constants.next_name,
+    };
+    size_t offset = sizeof(header);
+    for (int i = 0; i < LLVM_SNAPSHOT_SECTION_COUNT; i++) {
+        offset = (offset + LLVM_SNAPSHOT_ALIGN - 1) & ~(size_t)(LLVM_SNAPSHOT_ALIGN - 1);
+        header.sections[i] = (llvm_snapshot_section_t){offset, counts[i]};
+        offset += counts[i] * llvm_snapshot_record_sizes[i];
+    }
+    str_builder_reserve(&w.out, offset);
+    memset(w.out.chars, 0, offset);
+    memcpy(w.out.chars, &header, sizeof(header));
+    w.out.count = w.strings = header.sections[LLVM_SNAPSHOT_STRINGS].offset;
+
+    for (size_t i = 0; i < gen->names.names.size; i++) {
+        llvm_snapshot_name_t name = {llvm_snapshot_string(&w, gen->names.names.data[i].text), gen->names.names.data[i].hash};
+        *(llvm_snapshot_name_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_NAMES) = name;
+    }
+    for (size_t i = 0; i < gen->types.entries.size; i++) {
+        llvm_type_t *type = gen->types.entries.data[i].type;
+        llvm_snapshot_type_t record = {.kind = type->type};
+        switch (type->type) {
+            case LLVM_TYPE_INT_: record.size = type->int_; break;
+            case LLVM_TYPE_FLOAT_: record.size = type->float_; break;
+            case LLVM_TYPE_POINTER_: record.inner = type->pointer.inner->id; break;
+            case LLVM_TYPE_ARRAY_: record.inner = type->array.inner->id; record.size = type->array.size; break;
+            case LLVM_TYPE_VECTOR_: record.inner = type->vector.inner->id; record.size = type->vector.size; break;
+            case LLVM_TYPE_STRUCTURE_:
+                record.is_packed = type->structure.is_packed;
+                record.member_first = (u32)w.next[LLVM_SNAPSHOT_MEMBERS];
+                record.member_count = (u32)type->structure.members.size;
+                for (size_t j = 0; j < type->structure.members.size; j++)
+                    *(u32 *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_MEMBERS) = type->structure.members.data[j]->id;
+                break;
+        }
+        *(llvm_snapshot_type_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_TYPES) = record;
+    }
+    for (size_t i = 0; i < gen->type_declarations.size; i++) {
+        llvm_type_declaration_t *declaration = &gen->type_declarations.data[i];
+        llvm_snapshot_declaration_t record = {llvm_snapshot_string(&w, declaration->name), llvm_type_get(gen, declaration->type)->id, 0};
+        *(llvm_snapshot_declaration_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_DECLARATIONS) = record;
+    }
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        llvm_snapshot_global_t record = {
+            .name = llvm_name_find(gen, global->name),
+            .flags = (global->is_constant ? LLVM_SNAPSHOT_CONSTANT : 0) | (global->is_global ? LLVM_SNAPSHOT_GLOBAL : 0) | (global->is_unnamed_addr ? LLVM_SNAPSHOT_UNNAMED_ADDR : 0),
+            .linkage = global->linkage,
+            .visibility = global->visibility,
+            .dll_storage_class = global->dll_storage_class,
+            .type = global->type != NULL ? llvm_type_get(gen, *global->type)->id : 0,
+            .address_space = global->address_space,
+            .alignment = global->alignment,
+            .value = llvm_snapshot_value(&w, global->value),
+        };
+        *(llvm_snapshot_global_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_GLOBALS) = record;
+    }
+    for (size_t i = 0; i < gen->functions.size; i++) {
+        llvm_function_t *function = &gen->functions.data[i];
+        bool has_code = !function->is_native && function->code != NULL;
+        llvm_snapshot_function_t record = {
+            .name = llvm_name_find(gen, function->name),
+            .flags = (function->is_native ? LLVM_SNAPSHOT_NATIVE : 0) | (function->is_vararg ? LLVM_SNAPSHOT_VARARG : 0),
+            .linkage = function->linkage,
+            .visibility = function->visibility,
+            .dll_storage_class = function->dll_storage_class,
+            .call_convention = function->call_convention,
+            .return_type = llvm_type_get(gen, function->return_type)->id,
+            .arg_first = (u32)w.next[LLVM_SNAPSHOT_ARGS],
+            .arg_count = (u32)function->args.size,
+            .address_space = function->address_space,
+            .alignment = function->alignment,
+            .code = has_code ? (u32)w.next[LLVM_SNAPSHOT_CODES] + 1 : 0,
+        };
+        for (size_t j = 0; j < function->args.size; j++)
+            *(u32 *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_ARGS) = llvm_type_get(gen, function->args.data[j])->id;
+        if (has_code)
+            llvm_snapshot_code(&w, function->code);
+        *(llvm_snapshot_function_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_FUNCTIONS) = record;
+    }
+    for (size_t i = 0; i < gen->constants.slot_count; i++) {
+        llvm_constant_slot_t *slot = &gen->constants.slots[i];
+        llvm_snapshot_slot_t record = {0};
+        if (slot->name.count != 0)
+            record = (llvm_snapshot_slot_t){slot->hash, llvm_snapshot_string(&w, slot->text), llvm_snapshot_string(&w, slot->name), slot->is_cstring, 0};
+        *(llvm_snapshot_slot_t *)llvm_snapshot_record(&w, LLVM_SNAPSHOT_POOL) = record;
+    }
+
+    llvm_snapshot_header(&w)->sections[LLVM_SNAPSHOT_STRINGS].count = w.out.count - w.strings;
+    llvm_snapshot_header(&w)->size = w.out.count;
+    free(w.slots);
+    return str_builder_take(&w.out);
+}
+
+// Reading side. Offsets, ids and ranges are checked before they are
+// followed, so a damaged snapshot is refused rather than read out of bounds.
+// The refs inside a body are not: a snapshot is only as trustworthy as IR
+// handed to `llvm_add_function` ready-made.
+typedef struct llvm_snapshot_reader_t {
+    llvm_generator_t *gen;
+    str data;
+    const llvm_snapshot_header_t *header;
+} llvm_snapshot_reader_t;
+
+static const void *llvm_snapshot_section(llvm_snapshot_reader_t *r, int section) {
+    return r->data.chars + r->header->sections[section].offset;
+}
+
+static bool llvm_snapshot_range(llvm_snapshot_reader_t *r, int section, u64 first, u64 count) {
+    return first <= r->header->sections[section].count && count <= r->header->sections[section].count - first;
+}
+
+static bool llvm_snapshot_text(llvm_snapshot_reader_t *r, llvm_snapshot_str_t text, str *out) {
+    if (!llvm_snapshot_range(r, LLVM_SNAPSHOT_STRINGS, text.offset, text.count))
+        return false;
+    *out = (str){(char *)llvm_snapshot_section(r, LLVM_SNAPSHOT_STRINGS) + text.offset, text.count};
+    return true;
+}
+
+static llvm_type_t *llvm_snapshot_type(llvm_snapshot_reader_t *r, u32 id) {
+    return id != 0 && id <= r->gen->types.entries.size ? llvm_type_by_id(r->gen, id) : NULL;
+}
+
+static bool llvm_snapshot_read_value(llvm_snapshot_reader_t *r, const llvm_snapshot_value_t *record, llvm_value_t *value) {
+    *value = (llvm_value_t){.type = record->kind};
+    switch (record->kind) {
+        case LLVM_VALUE_STRING_: return llvm_snapshot_text(r, record->text, &value->string_);
+        case LLVM_VALUE_CSTRING_: return llvm_snapshot_text(r, record->text, &value->cstring_);
+        case LLVM_VALUE_BYTES_: return llvm_snapshot_text(r, record->text, &value->bytes_);
+        case LLVM_VALUE_INT_: value->int_ = (int)(i64)record->bits; return true;
+        case LLVM_VALUE_FLOAT_: memcpy(&value->float_, &record->bits, sizeof(value->float_)); return true;
+        case LLVM_VALUE_DOUBLE_: memcpy(&value->double_, &record->bits, sizeof(value->double_)); return true;
+        case LLVM_VALUE_LOCAL_: value->local.idx = (uint)record->bits; return true;
+        case LLVM_VALUE_TYPE_: {
+            llvm_type_t *type = llvm_snapshot_type(r, record->type);
+            if (type != NULL)
+                value->type_ = *type;
+            return type != NULL;
+        }
+        case LLVM_VALUE_GETELEMENTPTR_:
+            value->getelementptr.type = llvm_snapshot_type(r, record->type);
+            value->getelementptr.indices[0] = record->indices[0];
+            value->getelementptr.indices[1] = record->indices[1];
+            value->getelementptr.is_inbounds = record->is_inbounds != 0;
+            return value->getelementptr.type != NULL && llvm_snapshot_text(r, record->text, &value->getelementptr.name);
+        case LLVM_VALUE_UNDEF_: return true;
+        default: return false;
+    }
+}
+
+static bool llvm_snapshot_read_types(llvm_snapshot_reader_t *r) {
+    const llvm_snapshot_type_t *types = llvm_snapshot_section(r, LLVM_SNAPSHOT_TYPES);
+    const u32 *members = llvm_snapshot_section(r, LLVM_SNAPSHOT_MEMBERS);
+    array(llvm_type_ptr_t) scratch = array_new(llvm_type_ptr_t)();
+    bool ok = true;
+    // Members are interned before what contains them, so interning the
+    // table in order hands out the same ids again.
+    for (u64 i = 0; ok && i < r->header->sections[LLVM_SNAPSHOT_TYPES].count; i++) {
+        const llvm_snapshot_type_t *record = &types[i];
+        llvm_type_t type = {.type = record->kind};
+        switch (record->kind) {
+            case LLVM_TYPE_INT_: type.int_ = record->size; break;
+            case LLVM_TYPE_FLOAT_: type.float_ = record->size; break;
+            case LLVM_TYPE_POINTER_: type.pointer.inner = llvm_snapshot_type(r, record->inner); ok = type.pointer.inner != NULL; break;
+            case LLVM_TYPE_ARRAY_:
+                type.array.inner = llvm_snapshot_type(r, record->inner);
+                type.array.size = record->size;
+                ok = type.array.inner != NULL;
+                break;
+            case LLVM_TYPE_VECTOR_:
+                type.vector.inner = llvm_snapshot_type(r, record->inner);
+                type.vector.size = record->size;
+                ok = type.vector.inner != NULL;
+                break;
+            case LLVM_TYPE_STRUCTURE_:
+                ok = llvm_snapshot_range(r, LLVM_SNAPSHOT_MEMBERS, record->member_first, record->member_count);
+                scratch.size = 0;
+                for (u32 j = 0; ok && j < record->member_count; j++) {
+                    llvm_type_t *member = llvm_snapshot_type(r, members[record->member_first + j]);
+                    ok = member != NULL;
+                    array_push(llvm_type_ptr_t)(&scratch, member);
+                }
+                type.structure.members = scratch;
+                type.structure.is_packed = record->is_packed != 0;
+                break;
+            default: ok = false; break;
+        }
+        ok = ok && llvm_type_get(r->gen, type)->id == i + 1;
+    }
+    array_free(llvm_type_ptr_t)(&scratch);
+    return ok;
+}
+
+static bool llvm_snapshot_read_code(llvm_snapshot_reader_t *r, const llvm_snapshot_code_t *record, llvm_code_t **out) {
+    llvm_generator_t *gen = r->gen;
+    if (!llvm_snapshot_range(r, LLVM_SNAPSHOT_BLOCKS, record->block_first, record->block_count)
+        || !llvm_snapshot_range(r, LLVM_SNAPSHOT_INSTRUCTIONS, record->instruction_first, record->instruction_count)
+        || !llvm_snapshot_range(r, LLVM_SNAPSHOT_OPERANDS, record->operand_first, record->operand_count)
+        || !llvm_snapshot_range(r, LLVM_SNAPSHOT_CONSTANTS, record->constant_first, record->constant_count)
+        || !llvm_snapshot_range(r, LLVM_SNAPSHOT_SYMBOLS, record->symbol_first, record->symbol_count))
+        return false;
+    llvm_code_t *code = LLVM_NEW(gen, llvm_code_t, {0});
+    code->block_count = record->block_count;
+    code->instruction_count = record->instruction_count;
+    code->operand_count = record->operand_count;
+    code->constant_count = record->constant_count;
+    code->symbol_count = record->symbol_count;
+    code->instructions = (llvm_code_instruction_t *)llvm_snapshot_section(r, LLVM_SNAPSHOT_INSTRUCTIONS) + record->instruction_first;
+    code->operands = (u32 *)llvm_snapshot_section(r, LLVM_SNAPSHOT_OPERANDS) + record->operand_first;
+    code->symbols = (u32 *)llvm_snapshot_section(r, LLVM_SNAPSHOT_SYMBOLS) + record->symbol_first;
+    code->is_borrowed = true;
+    for (u32 i = 0; i < code->symbol_count; i++)
+        if (code->symbols[i] == 0 || code->symbols[i] > gen->names.names.size)
+            return false;
+    for (u32 i = 0; i < code->instruction_count; i++) {
+        llvm_code_instruction_t instruction = code->instructions[i];
+        if (instruction.type > gen->types.entries.size || instruction.operands > code->operand_count
+            || instruction.operand_count > code->operand_count - instruction.operands)
+            return false;
+    }
+
+    code->blocks = arena_alloc_aligned(&gen->arena, code->block_count * sizeof(llvm_code_block_t), _Alignof(llvm_code_block_t));
+    const llvm_snapshot_block_t *blocks = (const llvm_snapshot_block_t *)llvm_snapshot_section(r, LLVM_SNAPSHOT_BLOCKS) + record->block_first;
+    for (u32 i = 0; i < code->block_count; i++) {
+        code->blocks[i] = (llvm_code_block_t){{0}, blocks[i].first, blocks[i].count};
+        if (!llvm_snapshot_text(r, blocks[i].name, &code->blocks[i].name) || blocks[i].first > code->instruction_count || blocks[i].count > code->instruction_count - blocks[i].first)
+            return false;
+    }
+    code->constants = arena_alloc_aligned(&gen->arena, code->constant_count * sizeof(llvm_value_t), _Alignof(llvm_value_t));
+    const llvm_snapshot_value_t *constants = (const llvm_snapshot_value_t *)llvm_snapshot_section(r, LLVM_SNAPSHOT_CONSTANTS) + record->constant_first;
+    for (u32 i = 0; i < code->constant_count; i++)
+        if (!llvm_snapshot_read_value(r, &constants[i], &code->constants[i]))
+            return false;
+    *out = code;
+    return true;
+}
+
+static bool llvm_snapshot_read_symbols(llvm_snapshot_reader_t *r) {
+    llvm_generator_t *gen = r->gen;
+    const llvm_snapshot_global_t *globals = llvm_snapshot_section(r, LLVM_SNAPSHOT_GLOBALS);
+    for (u64 i = 0; i < r->header->sections[LLVM_SNAPSHOT_GLOBALS].count; i++) {
+        const llvm_snapshot_global_t *record = &globals[i];
+        if (record->name == 0 || record->name > gen->names.names.size)
+            return false;
+        llvm_global_t global = {
+            .name = llvm_name_text(gen, record->name),
+            .linkage = record->linkage,
+            .visibility = record->visibility,
+            .dll_storage_class = record->dll_storage_class,
+            .address_space = record->address_space,
+            .is_constant = (record->flags & LLVM_SNAPSHOT_CONSTANT) != 0,
+            .is_global = (record->flags & LLVM_SNAPSHOT_GLOBAL) != 0,
+            .type = llvm_snapshot_type(r, record->type),
+            .alignment = record->alignment,
+            .is_unnamed_addr = (record->flags & LLVM_SNAPSHOT_UNNAMED_ADDR) != 0,
+        };
+        // The name is interned already, so adding it neither copies nor
+        // hashes anything.
+        if ((record->type != 0 && global.type == NULL) || !llvm_snapshot_read_value(r, &record->value, &global.value)
+            || !llvm_add_global(gen, global))
+            return false;
+    }
+
+    const llvm_snapshot_function_t *functions = llvm_snapshot_section(r, LLVM_SNAPSHOT_FUNCTIONS);
+    const llvm_snapshot_code_t *codes = llvm_snapshot_section(r, LLVM_SNAPSHOT_CODES);
+    const u32 *args = llvm_snapshot_section(r, LLVM_SNAPSHOT_ARGS);
+    for (u64 i = 0; i < r->header->sections[LLVM_SNAPSHOT_FUNCTIONS].count; i++) {
+        const llvm_snapshot_function_t *record = &functions[i];
+        llvm_type_t *return_type = llvm_snapshot_type(r, record->return_type);
+        if (record->name == 0 || record->name > gen->names.names.size || return_type == NULL
+            || !llvm_snapshot_range(r, LLVM_SNAPSHOT_ARGS, record->arg_first, record->arg_count)
+            || !llvm_snapshot_range(r, LLVM_SNAPSHOT_CODES, 0, record->code))
+            return false;
+        llvm_function_t function = {
+            .is_native = (record->flags & LLVM_SNAPSHOT_NATIVE) != 0,
+            .name = llvm_name_text(gen, record->name),
+            .linkage = record->linkage,
+            .visibility = record->visibility,
+            .dll_storage_class = record->dll_storage_class,
+            .call_convention = record->call_convention,
+            .return_type = *return_type,
+            .args = array_new_arena(llvm_type_t)(&gen->arena),
+            .is_vararg = (record->flags & LLVM_SNAPSHOT_VARARG) != 0,
+            .address_space = record->address_space,
+            .alignment = record->alignment,
+        };
+        for (u32 j = 0; j < record->arg_count; j++) {
+            llvm_type_t *arg = llvm_snapshot_type(r, args[record->arg_first + j]);
+            if (arg == NULL)
+                return false;
+            array_push(llvm_type_t)(&function.args, *arg);
+        }
+        if (record->code != 0 && !llvm_snapshot_read_code(r, &codes[record->code - 1], &function.code))
+            return false;
+        if (!llvm_add_function(gen, function))
+            return false;
+    }
+    return true;
+}
+
+static bool llvm_snapshot_read_pool(llvm_snapshot_reader_t *r) {
+    llvm_constant_pool_t *pool = &r->gen->constants;
+    u64 slot_count = r->header->sections[LLVM_SNAPSHOT_POOL].count;
+    if (slot_count & (slot_count - 1))
+        return false;
+    pool->next_name = r->header->next_pool_name;
+    if (slot_count == 0)
+        return true;
+    const llvm_snapshot_slot_t *slots = llvm_snapshot_section(r, LLVM_SNAPSHOT_POOL);
+    pool->slots = calloc(slot_count, sizeof(llvm_constant_slot_t));
+    pool->slot_count = slot_count;
+    for (u64 i = 0; i < slot_count; i++) {
+        if (slots[i].name.count == 0)
+            continue;
+        llvm_constant_slot_t *slot = &pool->slots[i];
+        slot->hash = slots[i].hash;
+        slot->is_cstring = slots[i].is_cstring != 0;
+        if (!llvm_snapshot_text(r, slots[i].text, &slot->text) || !llvm_snapshot_text(r, slots[i].name, &slot->name))
+            return false;
+        pool->count++;
+    }
+    return true;
+}
+
+void llvm_code_own(llvm_generator_t *gen, llvm_code_t *code) {
+    if (!code->is_borrowed)
+        return;
+    code->instructions = arena_dup(&gen->arena, code->instructions, code->instruction_count * sizeof(llvm_code_instruction_t), _Alignof(llvm_code_instruction_t));
+    code->operands = arena_dup(&gen->arena, code->operands, code->operand_count * sizeof(u32), _Alignof(u32));
+    code->symbols = arena_dup(&gen->arena, code->symbols, code->symbol_count * sizeof(u32), _Alignof(u32));
+    code->is_borrowed = false;
+}
+
+bool llvm_snapshot_load(llvm_generator_t *gen, str data) {
+    llvm_snapshot_reader_t r = {gen, data, (const llvm_snapshot_header_t *)data.chars};
+    if (data.count < sizeof(llvm_snapshot_header_t) || ((uintptr_t)data.chars & (LLVM_SNAPSHOT_ALIGN - 1)) != 0)
+        return false;
+    const llvm_snapshot_header_t *header = r.header;
+    if (memcmp(header->magic, LLVM_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != LLVM_SNAPSHOT_VERSION
+        || header->byte_order != LLVM_SNAPSHOT_BYTE_ORDER || header->instruction_size != sizeof(llvm_code_instruction_t)
+        || header->size != data.count)
+        return false;
+    for (int i = 0; i < LLVM_SNAPSHOT_SECTION_COUNT; i++) {
+        llvm_snapshot_section_t section = header->sections[i];
+        if ((section.offset & (LLVM_SNAPSHOT_ALIGN - 1)) != 0 || section.offset > data.count
+            || section.count > (data.count - section.offset) / llvm_snapshot_record_sizes[i])
+            return false;
+    }
+    if (gen->names.names.size != 0 || gen->types.entries.size != 0 || gen->type_declarations.size != 0 || gen->constants.slot_count != 0)
+        return false;
+
+    // Names keep their ids, so bodies can name symbols by them unchanged.
+    const llvm_snapshot_name_t *names = llvm_snapshot_section(&r, LLVM_SNAPSHOT_NAMES);
+    for (u64 i = 0; i < header->sections[LLVM_SNAPSHOT_NAMES].count; i++) {
+        str text;
+        if (!llvm_snapshot_text(&r, names[i].text, &text) || llvm_name_adopt(gen, text, names[i].hash) != i + 1)
+            return false;
+    }
+    if (!llvm_snapshot_read_types(&r))
+        return false;
+    const llvm_snapshot_declaration_t *declarations = llvm_snapshot_section(&r, LLVM_SNAPSHOT_DECLARATIONS);
+    for (u64 i = 0; i < header->sections[LLVM_SNAPSHOT_DECLARATIONS].count; i++) {
+        llvm_type_t *type = llvm_snapshot_type(&r, declarations[i].type);
+        str name;
+        if (type == NULL || !llvm_snapshot_text(&r, declarations[i].name, &name))
+            return false;
+        llvm_add_type_declaration(gen, (llvm_type_declaration_t){.name = name, .type = *type});
+    }
+    return llvm_snapshot_read_symbols(&r) && llvm_snapshot_read_pool(&r);
+}
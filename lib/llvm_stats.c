@@ -0,0 +1,140 @@
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#endif
+#include "llvm.h"
+
+#include <time.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif // defined(_WIN32) || defined(_WIN64)
+
+u64 llvm_stats_now(void) {
+#if defined(_WIN32) || defined(_WIN64)
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (u64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif // defined(_WIN32) || defined(_WIN64)
+}
+
+#ifdef LLVM_STATS
+
+const llvm_stats_t *llvm_get_stats(llvm_generator_t *gen) {
+    return &gen->stats;
+}
+
+void llvm_stats_reset(llvm_generator_t *gen) {
+    free(gen->stats.functions);
+    memset(&gen->stats, 0, sizeof(gen->stats));
+}
+
+// Makes room for every function of the module, so that workers rendering
+// different functions never touch the same entry.
+void llvm_stats_reserve_functions(llvm_generator_t *gen) {
+    llvm_stats_t *stats = &gen->stats;
+    size_t count = gen->functions.size;
+    if (count <= stats->function_count)
+        return;
+    stats->functions = realloc(stats->functions, count * sizeof(llvm_function_stats_t));
+    memset(stats->functions + stats->function_count, 0, (count - stats->function_count) * sizeof(llvm_function_stats_t));
+    stats->function_count = count;
+}
+
+void llvm_stats_record_function(llvm_generator_t *gen, size_t index, llvm_stats_timer_t timer, size_t offset) {
+    llvm_function_stats_t *function = &gen->stats.functions[index];
+    function->nanoseconds += llvm_stats_now() - timer.start;
+    function->bytes += offset - timer.offset;
+}
+
+static void llvm_stats_json_counter(str_builder_t *out, char *name, u64 value) {
+    str_builder_append_char(out, '"');
+    str_builder_append_cstr(out, name);
+    str_builder_append_cstr(out, "\":");
+    str_builder_append_u64(out, value);
+    str_builder_append_char(out, ',');
+}
+
+static void llvm_stats_json_string(str_builder_t *out, str s) {
+    str_builder_append_char(out, '"');
+    for (size_t i = 0; i < s.count; i++) {
+        char c = s.chars[i];
+        if (c == '"' || c == '\\') {
+            str_builder_append_char(out, '\\');
+            str_builder_append_char(out, c);
+        } else if ((u8)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", (u8)c);
+            str_builder_append_cstr(out, escape);
+        } else {
+            str_builder_append_char(out, c);
+        }
+    }
+    str_builder_append_char(out, '"');
+}
+
+void llvm_stats_to_json(llvm_generator_t *gen, str_builder_t *out) {
+    llvm_stats_t *stats = &gen->stats;
+    str_builder_append_char(out, '{');
+    llvm_stats_json_counter(out, "bytes_emitted", stats->bytes_emitted);
+    llvm_stats_json_counter(out, "appends", stats->appends);
+    llvm_stats_json_counter(out, "buffer_growths", stats->buffer_growths);
+    llvm_stats_json_counter(out, "type_renderings", stats->type_renderings);
+    llvm_stats_json_counter(out, "symbol_lookups", stats->symbol_lookups);
+    llvm_stats_json_counter(out, "symbol_probes", stats->symbol_probes);
+    llvm_stats_json_counter(out, "generations", stats->generations);
+    llvm_stats_json_counter(out, "cache_hits", stats->cache_hits);
+    llvm_stats_json_counter(out, "cache_misses", stats->cache_misses);
+    str_builder_append_cstr(out, "\"phases_ns\":{");
+    llvm_stats_json_counter(out, "type_declarations", stats->type_declarations_ns);
+    llvm_stats_json_counter(out, "globals", stats->globals_ns);
+    llvm_stats_json_counter(out, "functions", stats->functions_ns);
+    llvm_stats_json_counter(out, "total", stats->total_ns);
+    out->count--; // trailing comma
+    str_builder_append_cstr(out, "},\"functions\":[");
+    size_t count = MIN(stats->function_count, gen->functions.size);
+    for (size_t i = 0; i < count; i++) {
+        str_builder_append_cstr(out, i == 0 ? "{\"name\":" : ",{\"name\":");
+        llvm_stats_json_string(out, gen->functions.data[i].name);
+        str_builder_append_char(out, ',');
+        llvm_stats_json_counter(out, "ns", stats->functions[i].nanoseconds);
+        llvm_stats_json_counter(out, "bytes", stats->functions[i].bytes);
+        out->count--;
+        str_builder_append_char(out, '}');
+    }
+    str_builder_append_cstr(out, "]}");
+}
+
+#else
+
+const llvm_stats_t *llvm_get_stats(llvm_generator_t *gen) {
+    UNUSED(gen);
+    return NULL;
+}
+
+void llvm_stats_reset(llvm_generator_t *gen) {
+    UNUSED(gen);
+}
+
+void llvm_stats_reserve_functions(llvm_generator_t *gen) {
+    UNUSED(gen);
+}
+
+void llvm_stats_record_function(llvm_generator_t *gen, size_t index, llvm_stats_timer_t timer, size_t offset) {
+    UNUSED(gen);
+    UNUSED(index);
+    UNUSED(timer);
+    UNUSED(offset);
+}
+
+void llvm_stats_to_json(llvm_generator_t *gen, str_builder_t *out) {
+    UNUSED(gen);
+    str_builder_append_cstr(out, "null");
+}
+
+#endif // LLVM_STATS
@@ -0,0 +1,116 @@
+#include "llvm.h"
+
+#define LLVM_NAME_TABLE_MIN_SLOTS 64
+// A slot holds an id below the high half of the name's hash, so that most
+// names that are not the one looked for are passed over without reading
+// their entry, let alone their text.
+#define LLVM_NAME_SLOT(hash, id) (((hash) & 0xffffffff00000000ull) | (id))
+#define LLVM_NAME_SLOT_ID(slot) ((u32)(slot))
+#define LLVM_NAME_SLOT_TAG(slot) ((slot) & 0xffffffff00000000ull)
+
+void llvm_name_table_init(llvm_name_table_t *table) {
+    array_init(llvm_name_t)(&table->names);
+    table->slots = NULL;
+    table->slot_count = 0;
+    table->symbol_count = 0;
+}
+
+void llvm_name_table_free(llvm_name_table_t *table) {
+    array_free(llvm_name_t)(&table->names);
+    free(table->slots);
+    llvm_name_table_init(table);
+}
+
+static void llvm_name_table_grow(llvm_name_table_t *table) {
+    size_t slot_count = MAX(table->slot_count * 2, LLVM_NAME_TABLE_MIN_SLOTS);
+    u64 *slots = calloc(slot_count, sizeof(u64));
+    for (size_t i = 0; i < table->names.size; i++) {
+        u64 hash = table->names.data[i].hash;
+        size_t slot = hash & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = LLVM_NAME_SLOT(hash, (u32)i + 1);
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_count = slot_count;
+}
+
+// Returns the slot holding `name`, or the empty slot where it would go.
+static u64 *llvm_name_probe(llvm_generator_t *gen, str name, u64 hash) {
+    llvm_name_table_t *table = &gen->names;
+    size_t slot = hash & (table->slot_count - 1);
+    LLVM_STATS_ADD(gen, symbol_lookups, 1);
+    while (table->slots[slot] != 0) {
+        LLVM_STATS_ADD(gen, symbol_probes, 1);
+        if (LLVM_NAME_SLOT_TAG(table->slots[slot]) != LLVM_NAME_SLOT_TAG(hash)) {
+            slot = (slot + 1) & (table->slot_count - 1);
+            continue;
+        }
+        llvm_name_t *it = &table->names.data[LLVM_NAME_SLOT_ID(table->slots[slot]) - 1];
+        if (it->hash == hash && str_eq(it->text, name))
+            return &table->slots[slot];
+        slot = (slot + 1) & (table->slot_count - 1);
+    }
+    return &table->slots[slot];
+}
+
+static u32 llvm_name_add(llvm_generator_t *gen, str name, u64 hash, bool copy) {
+    llvm_name_table_t *table = &gen->names;
+    if ((table->names.size + 1) * 4 > table->slot_count * 3)
+        llvm_name_table_grow(table);
+
+    u64 *slot = llvm_name_probe(gen, name, hash);
+    if (*slot != 0)
+        return LLVM_NAME_SLOT_ID(*slot);
+    array_push(llvm_name_t)(&table->names, (llvm_name_t){copy ? arena_strdup(&gen->arena, name) : name, hash, 0});
+    *slot = LLVM_NAME_SLOT(hash, (u32)table->names.size);
+    return (u32)table->names.size;
+}
+
+u32 llvm_name_intern(llvm_generator_t *gen, str name) {
+    return llvm_name_add(gen, name, str_hash(name), true);
+}
+
+u32 llvm_name_adopt(llvm_generator_t *gen, str name, u64 hash) {
+    return llvm_name_add(gen, name, hash, false);
+}
+
+u32 llvm_name_find(llvm_generator_t *gen, str name) {
+    if (gen->names.names.size == 0)
+        return 0;
+    return LLVM_NAME_SLOT_ID(*llvm_name_probe(gen, name, str_hash(name)));
+}
+
+str llvm_name_text(llvm_generator_t *gen, u32 name) {
+    return gen->names.names.data[name - 1].text;
+}
+
+uint llvm_symbol_bind(llvm_generator_t *gen, u32 name, uint ref) {
+    llvm_name_t *entry = &gen->names.names.data[name - 1];
+    if (entry->symbol != 0)
+        return entry->symbol;
+    entry->symbol = ref;
+    gen->names.symbol_count++;
+    return 0;
+}
+
+uint llvm_symbol_insert(llvm_generator_t *gen, str name, uint ref) {
+    return llvm_symbol_bind(gen, llvm_name_intern(gen, name), ref);
+}
+
+uint llvm_symbol_of(llvm_generator_t *gen, u32 name) {
+    return name == 0 ? 0 : gen->names.names.data[name - 1].symbol;
+}
+
+uint llvm_symbol_find(llvm_generator_t *gen, str name) {
+    if (gen->names.symbol_count == 0)
+        return 0;
+    return llvm_symbol_of(gen, llvm_name_find(gen, name));
+}
+
+void llvm_symbol_clear(llvm_generator_t *gen) {
+    for (size_t i = 0; i < gen->names.names.size; i++)
+        gen->names.names.data[i].symbol = 0;
+    gen->names.symbol_count = 0;
+}
@@ -0,0 +1,298 @@
+#include "llvm.h"
+
+#define LLVM_TYPE_CONTEXT_MIN_SLOTS 64
+
+void llvm_type_context_init(llvm_type_context_t *ctx, arena_t *arena) {
+    ctx->arena = arena;
+    array_init_arena(llvm_type_entry_t)(&ctx->entries, arena);
+    ctx->slots = NULL;
+    ctx->slot_count = 0;
+    str_builder_init(&ctx->texts);
+    str_builder_init(&ctx->scratch);
+    ctx->is_frozen = false;
+}
+
+// Canonical nodes belong to the arena and go away with it.
+void llvm_type_context_free(llvm_type_context_t *ctx) {
+    array_free(llvm_type_entry_t)(&ctx->entries);
+    free(ctx->slots);
+    str_builder_free(&ctx->texts);
+    str_builder_free(&ctx->scratch);
+    llvm_type_context_init(ctx, ctx->arena);
+}
+
+// Both hashing and comparison are shallow: children of the types involved
+// are already canonical, so they are identified by their ids.
+static u64 llvm_type_hash(llvm_type_t *type) {
+    u64 hash = hash_combine(0, type->type);
+    switch (type->type) {
+        case LLVM_TYPE_INT_: hash = hash_combine(hash, (u64)type->int_); break;
+        case LLVM_TYPE_FLOAT_: hash = hash_combine(hash, (u64)type->float_); break;
+        case LLVM_TYPE_POINTER_: hash = hash_combine(hash, type->pointer.inner->id); break;
+        case LLVM_TYPE_ARRAY_: {
+            hash = hash_combine(hash, type->array.inner->id);
+            hash = hash_combine(hash, (u64)type->array.size);
+        } break;
+        case LLVM_TYPE_VECTOR_: {
+            hash = hash_combine(hash, type->vector.inner->id);
+            hash = hash_combine(hash, (u64)type->vector.size);
+        } break;
+        case LLVM_TYPE_STRUCTURE_: {
+            hash = hash_combine(hash, type->structure.is_packed);
+            for (size_t i = 0; i < type->structure.members.size; i++)
+                hash = hash_combine(hash, type->structure.members.data[i]->id);
+        } break;
+    }
+    return hash;
+}
+
+static bool llvm_type_shallow_eq(llvm_type_t *a, llvm_type_t *b) {
+    if (a->type != b->type)
+        return false;
+    switch (a->type) {
+        case LLVM_TYPE_INT_: return a->int_ == b->int_;
+        case LLVM_TYPE_FLOAT_: return a->float_ == b->float_;
+        case LLVM_TYPE_POINTER_: return a->pointer.inner == b->pointer.inner;
+        case LLVM_TYPE_ARRAY_: return a->array.inner == b->array.inner && a->array.size == b->array.size;
+        case LLVM_TYPE_VECTOR_: return a->vector.inner == b->vector.inner && a->vector.size == b->vector.size;
+        case LLVM_TYPE_STRUCTURE_: {
+            if (a->structure.is_packed != b->structure.is_packed)
+                return false;
+            if (a->structure.members.size != b->structure.members.size)
+                return false;
+            for (size_t i = 0; i < a->structure.members.size; i++)
+                if (a->structure.members.data[i] != b->structure.members.data[i])
+                    return false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static str llvm_type_entry_text(llvm_type_context_t *ctx, llvm_type_entry_t *entry) {
+    return (str){ctx->texts.chars + entry->text_offset, entry->text_count};
+}
+
+// A by-value copy of a canonical node keeps its id, which makes the common
+// case a direct index instead of a hash lookup.
+static llvm_type_t *llvm_type_from_id(llvm_type_context_t *ctx, llvm_type_t *type) {
+    if (type->id == 0 || type->id > ctx->entries.size)
+        return NULL;
+    llvm_type_t *canonical = ctx->entries.data[type->id - 1].type;
+    return llvm_type_shallow_eq(canonical, type) ? canonical : NULL;
+}
+
+static llvm_type_t *llvm_type_lookup(llvm_type_context_t *ctx, llvm_type_t *key, u64 hash) {
+    if (ctx->slot_count == 0)
+        return NULL;
+    size_t slot = hash & (ctx->slot_count - 1);
+    while (ctx->slots[slot] != 0) {
+        llvm_type_entry_t *entry = &ctx->entries.data[ctx->slots[slot] - 1];
+        if (entry->hash == hash && llvm_type_shallow_eq(entry->type, key))
+            return entry->type;
+        slot = (slot + 1) & (ctx->slot_count - 1);
+    }
+    return NULL;
+}
+
+static llvm_type_t *llvm_type_find_in(llvm_type_context_t *ctx, llvm_type_t *type) {
+    llvm_type_t *canonical = llvm_type_from_id(ctx, type);
+    if (canonical != NULL)
+        return canonical;
+
+    llvm_type_t key = *type;
+    key.id = 0;
+    switch (type->type) {
+        case LLVM_TYPE_INT_:
+        case LLVM_TYPE_FLOAT_:
+            break;
+        case LLVM_TYPE_POINTER_: {
+            if ((key.pointer.inner = llvm_type_find_in(ctx, type->pointer.inner)) == NULL)
+                return NULL;
+        } break;
+        case LLVM_TYPE_ARRAY_: {
+            if ((key.array.inner = llvm_type_find_in(ctx, type->array.inner)) == NULL)
+                return NULL;
+        } break;
+        case LLVM_TYPE_VECTOR_: {
+            if ((key.vector.inner = llvm_type_find_in(ctx, type->vector.inner)) == NULL)
+                return NULL;
+        } break;
+        case LLVM_TYPE_STRUCTURE_: {
+            size_t size = type->structure.members.size;
+            llvm_type_ptr_t small[8];
+            llvm_type_ptr_t *members = size <= 8 ? small : malloc(size * sizeof(llvm_type_ptr_t));
+            bool found = true;
+            for (size_t i = 0; i < size && found; i++) {
+                members[i] = llvm_type_find_in(ctx, type->structure.members.data[i]);
+                found = members[i] != NULL;
+            }
+            if (found) {
+                key.structure.members = (array(llvm_type_ptr_t)){members, size, size, NULL};
+                canonical = llvm_type_lookup(ctx, &key, llvm_type_hash(&key));
+            }
+            if (members != small)
+                free(members);
+            return canonical;
+        }
+    }
+    return llvm_type_lookup(ctx, &key, llvm_type_hash(&key));
+}
+
+// Copies the cached text when the type is known and renders it structurally
+// otherwise. Never modifies the context, so it is safe to call concurrently.
+static void llvm_type_write_in(llvm_type_context_t *ctx, str_builder_t *out, llvm_type_t *type) {
+    llvm_type_t *canonical = llvm_type_find_in(ctx, type);
+    if (canonical != NULL) {
+        str_builder_append(out, llvm_type_entry_text(ctx, &ctx->entries.data[canonical->id - 1]));
+        return;
+    }
+
+    switch (type->type) {
+        case LLVM_TYPE_INT_: {
+            str_builder_append_char(out, 'i');
+            str_builder_append_int(out, type->int_);
+        } break;
+        case LLVM_TYPE_FLOAT_: {
+            if (type->float_ == 32)
+                str_builder_append_cstr(out, "float");
+            else if (type->float_ == 64)
+                str_builder_append_cstr(out, "double");
+            else
+                fatal("invalid float size.");
+        } break;
+        case LLVM_TYPE_POINTER_: {
+            llvm_type_write_in(ctx, out, type->pointer.inner);
+            str_builder_append_char(out, '*');
+        } break;
+        case LLVM_TYPE_ARRAY_: {
+            str_builder_append_char(out, '[');
+            str_builder_append_int(out, type->array.size);
+            str_builder_append_cstr(out, " x ");
+            llvm_type_write_in(ctx, out, type->array.inner);
+            str_builder_append_char(out, ']');
+        } break;
+        case LLVM_TYPE_VECTOR_: {
+            str_builder_append_char(out, '<');
+            str_builder_append_int(out, type->vector.size);
+            str_builder_append_cstr(out, " x ");
+            llvm_type_write_in(ctx, out, type->vector.inner);
+            str_builder_append_char(out, '>');
+        } break;
+        case LLVM_TYPE_STRUCTURE_: {
+            if (type->structure.is_packed) str_builder_append_char(out, '<');
+            str_builder_append_char(out, '{');
+            for (size_t i = 0; i < type->structure.members.size; i++) {
+                llvm_type_write_in(ctx, out, type->structure.members.data[i]);
+                if (i < type->structure.members.size - 1)
+                    str_builder_append_cstr(out, ", ");
+            }
+            str_builder_append_char(out, '}');
+            if (type->structure.is_packed) str_builder_append_char(out, '>');
+        } break;
+    }
+}
+
+static void llvm_type_context_grow(llvm_type_context_t *ctx) {
+    size_t slot_count = MAX(ctx->slot_count * 2, LLVM_TYPE_CONTEXT_MIN_SLOTS);
+    uint *slots = calloc(slot_count, sizeof(uint));
+    for (size_t i = 0; i < ctx->entries.size; i++) {
+        size_t slot = ctx->entries.data[i].hash & (slot_count - 1);
+        while (slots[slot] != 0)
+            slot = (slot + 1) & (slot_count - 1);
+        slots[slot] = (uint)(i + 1);
+    }
+    free(ctx->slots);
+    ctx->slots = slots;
+    ctx->slot_count = slot_count;
+}
+
+// Looks up `key`, whose children must already be canonical, and inserts a
+// copy of it when it is not in the table yet.
+static llvm_type_t *llvm_type_intern(llvm_type_context_t *ctx, llvm_type_t *key) {
+    u64 hash = llvm_type_hash(key);
+    llvm_type_t *existing = llvm_type_lookup(ctx, key, hash);
+    if (existing != NULL)
+        return existing;
+
+    if ((ctx->entries.size + 1) * 4 > ctx->slot_count * 3)
+        llvm_type_context_grow(ctx);
+
+    llvm_type_t *type = arena_dup(ctx->arena, key, sizeof(llvm_type_t), _Alignof(llvm_type_t));
+    if (type->type == LLVM_TYPE_STRUCTURE_) {
+        size_t size = key->structure.members.size;
+        type->structure.members.data = arena_dup(ctx->arena, key->structure.members.data, size * sizeof(llvm_type_ptr_t), _Alignof(llvm_type_ptr_t));
+        type->structure.members.capacity = size;
+        type->structure.members.arena = ctx->arena;
+    }
+    type->id = (uint)(ctx->entries.size + 1);
+
+    // The children are canonical, so this only concatenates cached texts.
+    str_builder_clear(&ctx->scratch);
+    llvm_type_write_in(ctx, &ctx->scratch, type);
+    llvm_type_entry_t entry = {type, hash, ctx->texts.count, ctx->scratch.count};
+    str_builder_append(&ctx->texts, (str){ctx->scratch.chars, ctx->scratch.count});
+    array_push(llvm_type_entry_t)(&ctx->entries, entry);
+
+    size_t slot = hash & (ctx->slot_count - 1);
+    while (ctx->slots[slot] != 0)
+        slot = (slot + 1) & (ctx->slot_count - 1);
+    ctx->slots[slot] = type->id;
+    return type;
+}
+
+llvm_type_t *llvm_type_get(llvm_generator_t *gen, llvm_type_t type) {
+    llvm_type_context_t *ctx = &gen->types;
+    llvm_type_t *canonical = llvm_type_from_id(ctx, &type);
+    if (canonical != NULL)
+        return canonical;
+
+    llvm_type_t key = type;
+    key.id = 0;
+    switch (type.type) {
+        case LLVM_TYPE_INT_:
+        case LLVM_TYPE_FLOAT_:
+            break;
+        case LLVM_TYPE_POINTER_: key.pointer.inner = llvm_type_get(gen, *type.pointer.inner); break;
+        case LLVM_TYPE_ARRAY_: key.array.inner = llvm_type_get(gen, *type.array.inner); break;
+        case LLVM_TYPE_VECTOR_: key.vector.inner = llvm_type_get(gen, *type.vector.inner); break;
+        case LLVM_TYPE_STRUCTURE_: {
+            size_t size = type.structure.members.size;
+            llvm_type_ptr_t small[8];
+            llvm_type_ptr_t *members = size <= 8 ? small : malloc(size * sizeof(llvm_type_ptr_t));
+            for (size_t i = 0; i < size; i++)
+                members[i] = llvm_type_get(gen, *type.structure.members.data[i]);
+            key.structure.members = (array(llvm_type_ptr_t)){members, size, size, NULL};
+            canonical = llvm_type_intern(ctx, &key);
+            if (members != small)
+                free(members);
+            return canonical;
+        }
+    }
+    return llvm_type_intern(ctx, &key);
+}
+
+str llvm_type_text(llvm_generator_t *gen, llvm_type_t type) {
+    llvm_type_t *canonical = llvm_type_get(gen, type);
+    return llvm_type_entry_text(&gen->types, &gen->types.entries.data[canonical->id - 1]);
+}
+
+llvm_type_t *llvm_type_by_id(llvm_generator_t *gen, u32 id) {
+    return gen->types.entries.data[id - 1].type;
+}
+
+str llvm_type_id_text(llvm_generator_t *gen, u32 id) {
+    return llvm_type_entry_text(&gen->types, &gen->types.entries.data[id - 1]);
+}
+
+bool llvm_type_eq(llvm_generator_t *gen, llvm_type_t a, llvm_type_t b) {
+    return llvm_type_get(gen, a) == llvm_type_get(gen, b);
+}
+
+llvm_type_t *llvm_type_find(llvm_generator_t *gen, llvm_type_t type) {
+    return llvm_type_find_in(&gen->types, &type);
+}
+
+void llvm_type_write(llvm_generator_t *gen, str_builder_t *out, llvm_type_t type) {
+    llvm_type_write_in(&gen->types, out, &type);
+}
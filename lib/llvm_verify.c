@@ -0,0 +1,556 @@
+#include "llvm.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+
+// Value types are canonical type ids. A value whose type is not tracked
+// matches anything.
+#define LLVM_VERIFY_ANY_TYPE 0
+#define LLVM_VERIFY_UNREACHABLE ((u32)-1)
+#define LLVM_VERIFY_UNDECIDED ((u32)-2)
+
+typedef struct llvm_verifier_t {
+    llvm_generator_t *gen;
+    array(llvm_diagnostic_t) *diagnostics;
+    size_t error_count;
+    str symbol; // where the next problem is reported
+    str block;
+    u32 instruction;
+    array(u32) value_types; // of the current function's arguments, then its instructions
+    // Control flow of the current function.
+    array(u32) blocks_of;    // per instruction, the block holding it
+    array(u32) first_predecessor; // per block, into `predecessors`, plus one past the end
+    array(u32) predecessors; // one entry per edge, so duplicates are kept
+    array(u32) dominators;   // per block, its immediate dominator, or `LLVM_VERIFY_UNREACHABLE`
+    array(u32) postorder;    // per block, its number in a depth-first postorder
+    array(u32) order;        // the reachable blocks in that postorder
+    // The dominator tree, numbered once per function so that dominance is a
+    // comparison: a block dominates another if it is entered before it and
+    // left after it in a depth-first walk of the tree.
+    array(u32) first_child;  // per block, into `children`, plus one past the end
+    array(u32) children;
+    array(u32) enter;        // per block, or `LLVM_VERIFY_UNREACHABLE`
+    array(u32) leave;
+    array(u32) predecessor_of; // per block, the last block it was found to branch to
+    array(u32) stack;
+} llvm_verifier_t;
+
+static void llvm_verify_fail(llvm_verifier_t *v, llvm_diagnostic_kind_t kind, const char *format, ...) {
+    v->error_count++;
+    if (v->diagnostics == NULL)
+        return;
+    llvm_diagnostic_t diagnostic = {kind, v->symbol, v->block, v->instruction, {0}};
+    va_list args;
+    va_start(args, format);
+    vsnprintf(diagnostic.message, sizeof(diagnostic.message), format, args);
+    va_end(args);
+    array_push(llvm_diagnostic_t)(v->diagnostics, diagnostic);
+}
+
+static u32 llvm_verify_type_id(llvm_verifier_t *v, llvm_type_t type) {
+    return type.id != 0 ? type.id : llvm_type_get(v->gen, type)->id;
+}
+
+static str llvm_verify_type_name(llvm_verifier_t *v, u32 id) {
+    return llvm_type_id_text(v->gen, id);
+}
+
+static bool llvm_verify_is_int(llvm_verifier_t *v, u32 id) {
+    return llvm_type_by_id(v->gen, id)->type == LLVM_TYPE_INT_;
+}
+
+// Bytes the contents of a string constant stand for. A backslash that
+// starts no escape is a byte of its own, as `llvm_generate_escaped_text`
+// writes it.
+static size_t llvm_verify_cstring_size(str s) {
+    size_t size = 0;
+    for (size_t i = 0; i < s.count; i++, size++) {
+        if (s.chars[i] != '\\')
+            continue;
+        if (i + 1 < s.count && s.chars[i + 1] == '\\')
+            i++;
+        else if (i + 2 < s.count && isxdigit((u8)s.chars[i + 1]) && isxdigit((u8)s.chars[i + 2]))
+            i += 2;
+    }
+    return size;
+}
+
+static void llvm_verify_gep_base(llvm_verifier_t *v, str name, u32 source) {
+    llvm_global_t *global = llvm_find_global(v->gen, name);
+    if (global == NULL)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_UNKNOWN_SYMBOL, "getelementptr on unknown global '@" STR_ARG "'", STR_FMT(name));
+    else if (global->type == NULL || llvm_verify_type_id(v, *global->type) != source)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "getelementptr on '@" STR_ARG "' with source type '" STR_ARG "'",
+                         STR_FMT(name), STR_FMT(llvm_verify_type_name(v, source)));
+}
+
+// Type the second index of a `getelementptr` selects within `source`, or
+// NULL when there is none. Structures need a constant index.
+static llvm_type_t *llvm_verify_element(llvm_verifier_t *v, u32 source, bool is_constant, int index) {
+    llvm_type_t *type = llvm_type_by_id(v->gen, source);
+    switch (type->type) {
+        case LLVM_TYPE_ARRAY_: return type->array.inner;
+        case LLVM_TYPE_VECTOR_: return type->vector.inner;
+        case LLVM_TYPE_STRUCTURE_: {
+            if (is_constant && index >= 0 && (size_t)index < type->structure.members.size)
+                return type->structure.members.data[index];
+        } break;
+        default: break;
+    }
+    return NULL;
+}
+
+// Same as `llvm_verify_element`, reporting why there is no element.
+static llvm_type_t *llvm_verify_gep_element(llvm_verifier_t *v, u32 source, bool is_constant, int index) {
+    llvm_type_t *type = llvm_type_by_id(v->gen, source);
+    llvm_type_t *element = llvm_verify_element(v, source, is_constant, index);
+    if (element != NULL)
+        return element;
+    switch (type->type) {
+        case LLVM_TYPE_ARRAY_:
+        case LLVM_TYPE_VECTOR_: break;
+        case LLVM_TYPE_STRUCTURE_: {
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_INVALID_TYPE, "structure index is not a constant member number");
+        } break;
+        default: {
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_INVALID_TYPE, "getelementptr into non-aggregate type '" STR_ARG "'",
+                             STR_FMT(llvm_verify_type_name(v, source)));
+        } break;
+    }
+    return NULL;
+}
+
+static void llvm_verify_constant(llvm_verifier_t *v, llvm_value_t value, u32 expected, const char *what) {
+    if (expected == LLVM_VERIFY_ANY_TYPE)
+        return;
+    llvm_type_t *type = llvm_type_by_id(v->gen, expected);
+    bool ok = true;
+    switch (value.type) {
+        case LLVM_VALUE_INT_: ok = type->type == LLVM_TYPE_INT_; break;
+        case LLVM_VALUE_FLOAT_: ok = type->type == LLVM_TYPE_FLOAT_ && type->float_ == 32; break;
+        case LLVM_VALUE_DOUBLE_: ok = type->type == LLVM_TYPE_FLOAT_ && type->float_ == 64; break;
+        case LLVM_VALUE_CSTRING_: {
+            // The terminating NUL is added on output.
+            ok = type->type == LLVM_TYPE_ARRAY_
+                && type->array.inner->type == LLVM_TYPE_INT_ && type->array.inner->int_ == 8
+                && (size_t)type->array.size == llvm_verify_cstring_size(value.cstring_) + 1;
+        } break;
+        case LLVM_VALUE_BYTES_: {
+            ok = type->type == LLVM_TYPE_ARRAY_
+                && type->array.inner->type == LLVM_TYPE_INT_ && type->array.inner->int_ == 8
+                && (size_t)type->array.size == llvm_verify_cstring_size(value.bytes_);
+        } break;
+        case LLVM_VALUE_GETELEMENTPTR_: {
+            u32 source = llvm_verify_type_id(v, *value.getelementptr.type);
+            llvm_verify_gep_base(v, value.getelementptr.name, source);
+            llvm_type_t *element = llvm_verify_gep_element(v, source, true, value.getelementptr.indices[1]);
+            ok = element == NULL || llvm_verify_type_id(v, LLVM_TYPE_POINTER(*element)) == expected;
+        } break;
+        default: break;
+    }
+    if (!ok)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "%s is not a constant of type '" STR_ARG "'",
+                         what, STR_FMT(llvm_verify_type_name(v, expected)));
+}
+
+// Whether the value of instruction `definition` is available right before
+// `position`, which lies in `block`. Anything goes in code that never runs.
+static bool llvm_verify_dominates(llvm_verifier_t *v, u32 definition, u32 block, u32 position) {
+    u32 defined_in = v->blocks_of.data[definition];
+    if (defined_in == block)
+        return definition < position;
+    if (v->dominators.data[block] == LLVM_VERIFY_UNREACHABLE)
+        return true;
+    return v->enter.data[defined_in] <= v->enter.data[block] && v->leave.data[block] <= v->leave.data[defined_in];
+}
+
+// Checks one operand of the instruction at `position` and returns its type.
+static u32 llvm_verify_ref(llvm_verifier_t *v, llvm_code_t *code, u32 arg_count, u32 position, llvm_ref_t ref, u32 expected, const char *what) {
+    switch (LLVM_REF_KIND(ref)) {
+        case LLVM_REF_LOCAL: {
+            u32 index = LLVM_REF_PAYLOAD(ref);
+            if (index >= arg_count && (index - arg_count >= code->instruction_count
+                || !llvm_verify_dominates(v, index - arg_count, v->blocks_of.data[position], position))) {
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_UNDEFINED_VALUE, "%s is used before it is defined", what);
+                return LLVM_VERIFY_ANY_TYPE;
+            }
+            u32 type = v->value_types.data[index];
+            if (type != LLVM_VERIFY_ANY_TYPE && expected != LLVM_VERIFY_ANY_TYPE && type != expected)
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "%s has type '" STR_ARG "', expected '" STR_ARG "'",
+                                 what, STR_FMT(llvm_verify_type_name(v, type)), STR_FMT(llvm_verify_type_name(v, expected)));
+            return type;
+        }
+        case LLVM_REF_UNDEFINED: {
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_UNDEFINED_VALUE, "%s uses undefined value %%%u", what, LLVM_REF_PAYLOAD(ref));
+            return LLVM_VERIFY_ANY_TYPE;
+        }
+        default: {
+            llvm_verify_constant(v, llvm_code_value(code, ref), expected, what);
+            return expected;
+        }
+    }
+}
+
+// Type of the pointer a `getelementptr` with indices `0, index` yields.
+static u32 llvm_verify_gep(llvm_verifier_t *v, llvm_code_t *code, u32 arg_count, u32 position, llvm_code_instruction_t instruction) {
+    u32 *operands = &code->operands[instruction.operands];
+    for (u32 i = 0; i < 2; i++) {
+        u32 type = llvm_verify_ref(v, code, arg_count, position, operands[i], LLVM_VERIFY_ANY_TYPE, "an index");
+        if (type != LLVM_VERIFY_ANY_TYPE && !llvm_verify_is_int(v, type))
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "index of type '" STR_ARG "' is not an integer",
+                             STR_FMT(llvm_verify_type_name(v, type)));
+        else if (LLVM_REF_KIND(operands[i]) == LLVM_REF_CONSTANT && llvm_code_value(code, operands[i]).type != LLVM_VALUE_INT_)
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "index is not an integer constant");
+    }
+    llvm_verify_gep_base(v, llvm_name_text(v->gen, code->symbols[instruction.symbol]), instruction.type);
+    bool is_constant = LLVM_REF_KIND(operands[1]) == LLVM_REF_INT;
+    llvm_type_t *element = llvm_verify_gep_element(v, instruction.type, is_constant, LLVM_REF_INT_VALUE(operands[1]));
+    if (element == NULL)
+        return LLVM_VERIFY_ANY_TYPE;
+    return llvm_verify_type_id(v, LLVM_TYPE_POINTER(*element));
+}
+
+static u32 llvm_verify_call(llvm_verifier_t *v, llvm_code_t *code, u32 arg_count, u32 position, llvm_code_instruction_t instruction) {
+    u32 *operands = &code->operands[instruction.operands];
+    u32 count = instruction.operand_count / 2;
+    str name = llvm_name_text(v->gen, code->symbols[instruction.symbol]);
+    llvm_function_t *callee = llvm_find_function_id(v->gen, code->symbols[instruction.symbol]);
+    if (callee == NULL) {
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_UNKNOWN_SYMBOL, "call to unknown function '@" STR_ARG "'", STR_FMT(name));
+    } else {
+        size_t params = callee->args.size;
+        if (count < params || (count > params && !callee->is_vararg))
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_ARGUMENT_COUNT, "call to '@" STR_ARG "' passes %u arguments, expected %zu",
+                             STR_FMT(name), count, params);
+        u32 return_type = llvm_verify_type_id(v, callee->return_type);
+        if (return_type != instruction.type)
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "call to '@" STR_ARG "' returning '" STR_ARG "' as '" STR_ARG "'",
+                             STR_FMT(name), STR_FMT(llvm_verify_type_name(v, return_type)),
+                             STR_FMT(llvm_verify_type_name(v, instruction.type)));
+        for (u32 i = 0; i < count && i < params; i++) {
+            u32 param = llvm_verify_type_id(v, callee->args.data[i]);
+            if (param != operands[count + i])
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "argument %u of '@" STR_ARG "' passed as '" STR_ARG "', declared '" STR_ARG "'",
+                                 i, STR_FMT(name), STR_FMT(llvm_verify_type_name(v, operands[count + i])),
+                                 STR_FMT(llvm_verify_type_name(v, param)));
+        }
+    }
+    for (u32 i = 0; i < count; i++)
+        llvm_verify_ref(v, code, arg_count, position, operands[i], operands[count + i], "an argument");
+    return instruction.type;
+}
+
+// Predecessors, then immediate dominators as in Cooper, Harvey and Kennedy,
+// "A Simple, Fast Dominance Algorithm". Blocks are few enough that the
+// iterative form is the quickest.
+static void llvm_verify_control_flow(llvm_verifier_t *v, llvm_code_t *code) {
+    u32 block_count = code->block_count, successors[2];
+    v->first_predecessor.size = 0;
+    v->predecessors.size = 0;
+    v->dominators.size = 0;
+    v->postorder.size = 0;
+    v->first_child.size = 0;
+    v->children.size = 0;
+    v->enter.size = 0;
+    v->leave.size = 0;
+    v->predecessor_of.size = 0;
+    v->stack.size = 0;
+    for (u32 i = 0; i <= block_count; i++) {
+        array_push(u32)(&v->first_predecessor, 0);
+        array_push(u32)(&v->dominators, LLVM_VERIFY_UNREACHABLE);
+        array_push(u32)(&v->postorder, LLVM_VERIFY_UNREACHABLE);
+        array_push(u32)(&v->enter, LLVM_VERIFY_UNREACHABLE);
+        array_push(u32)(&v->leave, LLVM_VERIFY_UNREACHABLE);
+        array_push(u32)(&v->predecessor_of, LLVM_VERIFY_UNREACHABLE);
+    }
+    for (u32 i = 0; i < block_count; i++) {
+        u32 count = llvm_code_successors(code, i, successors);
+        for (u32 j = 0; j < count; j++)
+            if (successors[j] < block_count)
+                v->first_predecessor.data[successors[j] + 1]++;
+    }
+    for (u32 i = 0; i < block_count; i++)
+        v->first_predecessor.data[i + 1] += v->first_predecessor.data[i];
+    for (u32 i = 0; i < v->first_predecessor.data[block_count]; i++)
+        array_push(u32)(&v->predecessors, 0);
+    // Filled back to front, reusing `postorder` as the fill positions.
+    for (u32 i = 0; i < block_count; i++)
+        v->postorder.data[i] = v->first_predecessor.data[i + 1];
+    for (u32 i = 0; i < block_count; i++) {
+        u32 count = llvm_code_successors(code, i, successors);
+        for (u32 j = 0; j < count; j++)
+            if (successors[j] < block_count)
+                v->predecessors.data[--v->postorder.data[successors[j]]] = i;
+    }
+    if (block_count == 0)
+        return;
+
+    // Depth-first from the entry, with (block, next successor) pairs on the
+    // stack. `order` collects the blocks in postorder.
+    for (u32 i = 0; i < block_count; i++)
+        v->postorder.data[i] = LLVM_VERIFY_UNREACHABLE;
+    v->order.size = 0;
+    v->dominators.data[0] = 0; // seen; the real dominators come below
+    array_push(u32)(&v->stack, 0);
+    array_push(u32)(&v->stack, 0);
+    while (v->stack.size > 0) {
+        u32 *top = &v->stack.data[v->stack.size - 2];
+        u32 count = llvm_code_successors(code, top[0], successors);
+        if (top[1] < count) {
+            u32 successor = successors[top[1]++];
+            if (successor < block_count && v->dominators.data[successor] == LLVM_VERIFY_UNREACHABLE) {
+                v->dominators.data[successor] = successor;
+                array_push(u32)(&v->stack, successor);
+                array_push(u32)(&v->stack, 0);
+            }
+            continue;
+        }
+        v->postorder.data[top[0]] = (u32)v->order.size;
+        array_push(u32)(&v->order, top[0]);
+        v->stack.size -= 2;
+    }
+
+    for (u32 i = 1; i < block_count; i++)
+        if (v->dominators.data[i] != LLVM_VERIFY_UNREACHABLE)
+            v->dominators.data[i] = LLVM_VERIFY_UNDECIDED;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = v->order.size - 1; i-- > 0;) { // reverse postorder, past the entry
+            u32 block = v->order.data[i], dominator = LLVM_VERIFY_UNDECIDED;
+            for (u32 j = v->first_predecessor.data[block]; j < v->first_predecessor.data[block + 1]; j++) {
+                u32 predecessor = v->predecessors.data[j];
+                if (v->dominators.data[predecessor] == LLVM_VERIFY_UNDECIDED || v->dominators.data[predecessor] == LLVM_VERIFY_UNREACHABLE)
+                    continue;
+                if (dominator == LLVM_VERIFY_UNDECIDED) {
+                    dominator = predecessor;
+                    continue;
+                }
+                while (predecessor != dominator) {
+                    while (v->postorder.data[predecessor] < v->postorder.data[dominator])
+                        predecessor = v->dominators.data[predecessor];
+                    while (v->postorder.data[dominator] < v->postorder.data[predecessor])
+                        dominator = v->dominators.data[dominator];
+                }
+            }
+            if (v->dominators.data[block] != dominator) {
+                v->dominators.data[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    // Children of every block in the dominator tree, then the walk that
+    // numbers it, again with (block, next child) pairs on the stack.
+    for (u32 i = 0; i <= block_count; i++)
+        array_push(u32)(&v->first_child, 0);
+    for (u32 i = 1; i < block_count; i++)
+        if (v->dominators.data[i] != LLVM_VERIFY_UNREACHABLE)
+            v->first_child.data[v->dominators.data[i] + 1]++;
+    for (u32 i = 0; i < block_count; i++)
+        v->first_child.data[i + 1] += v->first_child.data[i];
+    for (u32 i = 0; i < v->first_child.data[block_count]; i++)
+        array_push(u32)(&v->children, 0);
+    for (u32 i = 0; i < block_count; i++)
+        v->enter.data[i] = v->first_child.data[i];
+    for (u32 i = 1; i < block_count; i++)
+        if (v->dominators.data[i] != LLVM_VERIFY_UNREACHABLE)
+            v->children.data[v->enter.data[v->dominators.data[i]]++] = i;
+    for (u32 i = 0; i < block_count; i++)
+        v->enter.data[i] = LLVM_VERIFY_UNREACHABLE;
+
+    u32 time = 0;
+    v->enter.data[0] = time++;
+    array_push(u32)(&v->stack, 0);
+    array_push(u32)(&v->stack, v->first_child.data[0]);
+    while (v->stack.size > 0) {
+        u32 *top = &v->stack.data[v->stack.size - 2];
+        if (top[1] < v->first_child.data[top[0] + 1]) {
+            u32 child = v->children.data[top[1]++];
+            v->enter.data[child] = time++;
+            array_push(u32)(&v->stack, child);
+            array_push(u32)(&v->stack, v->first_child.data[child]);
+            continue;
+        }
+        v->leave.data[top[0]] = time++;
+        v->stack.size -= 2;
+    }
+}
+
+// Type of the value an instruction defines, before any of it is checked, so
+// that phis can refer ahead.
+static u32 llvm_verify_result_type(llvm_verifier_t *v, llvm_code_t *code, llvm_code_instruction_t instruction) {
+    u32 *operands = &code->operands[instruction.operands];
+    switch (instruction.opcode) {
+        case LLVM_INSTR_CALL:
+        case LLVM_INSTR_LOAD:
+        case LLVM_INSTR_PHI: return instruction.type;
+        case LLVM_INSTR_ALLOCA: return llvm_verify_type_id(v, LLVM_TYPE_POINTER(*llvm_type_by_id(v->gen, instruction.type)));
+        case LLVM_INSTR_GETELEMENTPTR:
+        case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+            bool is_constant = LLVM_REF_KIND(operands[1]) == LLVM_REF_INT;
+            llvm_type_t *element = llvm_verify_element(v, instruction.type, is_constant, LLVM_REF_INT_VALUE(operands[1]));
+            return element != NULL ? llvm_verify_type_id(v, LLVM_TYPE_POINTER(*element)) : LLVM_VERIFY_ANY_TYPE;
+        }
+        default: return LLVM_VERIFY_ANY_TYPE;
+    }
+}
+
+static void llvm_verify_branch(llvm_verifier_t *v, llvm_code_t *code, u32 target) {
+    if (target >= code->block_count)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_INVALID_BLOCK, "branch to block %u of %u", target, code->block_count);
+}
+
+// A phi has one incoming value per edge into its block, each available at
+// the end of the block it comes from. The predecessors of `block` are marked
+// in `predecessor_of` beforehand.
+static void llvm_verify_phi(llvm_verifier_t *v, llvm_code_t *code, u32 arg_count, u32 block, llvm_code_instruction_t instruction) {
+    u32 *operands = &code->operands[instruction.operands];
+    u32 count = instruction.operand_count / 2;
+    u32 edges = v->first_predecessor.data[block + 1] - v->first_predecessor.data[block];
+    if (count != edges)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_INVALID_BLOCK, "phi has %u incoming values for %u predecessors", count, edges);
+    for (u32 i = 0; i < count; i++) {
+        u32 from = operands[count + i];
+        if (from >= code->block_count || v->predecessor_of.data[from] != block) {
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_INVALID_BLOCK, "phi has a value for block %u, which does not branch here", from);
+            continue;
+        }
+        // Available at the end of `from`, so before its terminator.
+        llvm_code_block_t source = code->blocks[from];
+        if (source.count > 0)
+            llvm_verify_ref(v, code, arg_count, source.first + source.count - 1, operands[i], instruction.type, "an incoming value");
+    }
+}
+
+static void llvm_verify_function(llvm_verifier_t *v, llvm_function_t *function) {
+    v->symbol = function->name;
+    v->block = (str){0};
+    v->instruction = 0;
+    if (function->is_native)
+        return;
+    llvm_code_t *code = function->code;
+    if (code == NULL) {
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISSING_BODY, "'@" STR_ARG "' is defined without a body", STR_FMT(function->name));
+        return;
+    }
+    if (code->block_count == 0)
+        llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISSING_TERMINATOR, "'@" STR_ARG "' has no basic blocks", STR_FMT(function->name));
+
+    u32 arg_count = (u32)function->args.size;
+    v->value_types.size = 0;
+    v->blocks_of.size = 0;
+    for (u32 i = 0; i < arg_count; i++)
+        array_push(u32)(&v->value_types, llvm_verify_type_id(v, function->args.data[i]));
+    for (u32 i = 0; i < code->block_count; i++) {
+        llvm_code_block_t block = code->blocks[i];
+        for (u32 j = block.first; j < block.first + block.count; j++) {
+            array_push(u32)(&v->value_types, llvm_verify_result_type(v, code, code->instructions[j]));
+            array_push(u32)(&v->blocks_of, i);
+        }
+    }
+    llvm_verify_control_flow(v, code);
+    u32 return_type = llvm_verify_type_id(v, function->return_type);
+
+    for (u32 i = 0; i < code->block_count; i++) {
+        llvm_code_block_t block = code->blocks[i];
+        v->block = block.name;
+        v->instruction = 0;
+        if (block.count == 0)
+            llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISSING_TERMINATOR, "block is empty");
+        for (u32 j = v->first_predecessor.data[i]; j < v->first_predecessor.data[i + 1]; j++)
+            v->predecessor_of.data[v->predecessors.data[j]] = i;
+        bool has_phis = true;
+        for (u32 j = block.first; j < block.first + block.count; j++) {
+            llvm_code_instruction_t instruction = code->instructions[j];
+            u32 *operands = &code->operands[instruction.operands];
+            bool is_last = j == block.first + block.count - 1;
+            v->instruction = j - block.first;
+            if (llvm_code_is_terminator(instruction) && !is_last)
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISPLACED_TERMINATOR, "'%s' before the end of the block",
+                                 instruction.opcode == LLVM_INSTR_RETURN ? "ret" : "br");
+            if (instruction.opcode == LLVM_INSTR_PHI && !has_phis)
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISPLACED_PHI, "phi after the start of the block");
+            has_phis &= instruction.opcode == LLVM_INSTR_PHI;
+            switch (instruction.opcode) {
+                case LLVM_INSTR_RETURN: {
+                    if (instruction.type != return_type)
+                        llvm_verify_fail(v, LLVM_DIAGNOSTIC_TYPE_MISMATCH, "returns '" STR_ARG "' from a function returning '" STR_ARG "'",
+                                         STR_FMT(llvm_verify_type_name(v, instruction.type)), STR_FMT(llvm_verify_type_name(v, return_type)));
+                    llvm_verify_ref(v, code, arg_count, j, operands[0], instruction.type, "the returned value");
+                } break;
+                case LLVM_INSTR_CALL: {
+                    llvm_verify_call(v, code, arg_count, j, instruction);
+                } break;
+                case LLVM_INSTR_GETELEMENTPTR:
+                case LLVM_INSTR_GETELEMENTPTR_INBOUNDS: {
+                    llvm_verify_gep(v, code, arg_count, j, instruction);
+                } break;
+                case LLVM_INSTR_ALLOCA: break;
+                case LLVM_INSTR_LOAD:
+                case LLVM_INSTR_STORE: {
+                    u32 pointer = llvm_verify_type_id(v, LLVM_TYPE_POINTER(*llvm_type_by_id(v->gen, instruction.type)));
+                    if (instruction.opcode == LLVM_INSTR_STORE)
+                        llvm_verify_ref(v, code, arg_count, j, operands[0], instruction.type, "the stored value");
+                    llvm_verify_ref(v, code, arg_count, j, operands[instruction.operand_count - 1], pointer, "the pointer");
+                } break;
+                case LLVM_INSTR_BR: {
+                    llvm_verify_branch(v, code, operands[0]);
+                } break;
+                case LLVM_INSTR_COND_BR: {
+                    llvm_verify_ref(v, code, arg_count, j, operands[0], instruction.type, "the condition");
+                    llvm_verify_branch(v, code, operands[1]);
+                    llvm_verify_branch(v, code, operands[2]);
+                } break;
+                case LLVM_INSTR_PHI: {
+                    llvm_verify_phi(v, code, arg_count, i, instruction);
+                } break;
+            }
+            if (is_last && !llvm_code_is_terminator(instruction))
+                llvm_verify_fail(v, LLVM_DIAGNOSTIC_MISSING_TERMINATOR, "block does not end in a terminator");
+        }
+    }
+}
+
+bool llvm_verify(llvm_generator_t *gen, array(llvm_diagnostic_t) *diagnostics) {
+    llvm_verifier_t v = {.gen = gen, .diagnostics = diagnostics};
+    array_init(u32)(&v.value_types);
+    array_init(u32)(&v.blocks_of);
+    array_init(u32)(&v.first_predecessor);
+    array_init(u32)(&v.predecessors);
+    array_init(u32)(&v.dominators);
+    array_init(u32)(&v.postorder);
+    array_init(u32)(&v.order);
+    array_init(u32)(&v.first_child);
+    array_init(u32)(&v.children);
+    array_init(u32)(&v.enter);
+    array_init(u32)(&v.leave);
+    array_init(u32)(&v.predecessor_of);
+    array_init(u32)(&v.stack);
+
+    for (size_t i = 0; i < gen->globals.size; i++) {
+        llvm_global_t *global = &gen->globals.data[i];
+        v.symbol = global->name;
+        if (global->type == NULL)
+            llvm_verify_fail(&v, LLVM_DIAGNOSTIC_INVALID_TYPE, "'@" STR_ARG "' has no type", STR_FMT(global->name));
+        else
+            llvm_verify_constant(&v, global->value, llvm_verify_type_id(&v, *global->type), "the initializer");
+    }
+    for (size_t i = 0; i < gen->functions.size; i++)
+        llvm_verify_function(&v, &gen->functions.data[i]);
+
+    array_free(u32)(&v.value_types);
+    array_free(u32)(&v.blocks_of);
+    array_free(u32)(&v.first_predecessor);
+    array_free(u32)(&v.predecessors);
+    array_free(u32)(&v.dominators);
+    array_free(u32)(&v.postorder);
+    array_free(u32)(&v.order);
+    array_free(u32)(&v.first_child);
+    array_free(u32)(&v.children);
+    array_free(u32)(&v.enter);
+    array_free(u32)(&v.leave);
+    array_free(u32)(&v.predecessor_of);
+    array_free(u32)(&v.stack);
+    return v.error_count == 0;
+}
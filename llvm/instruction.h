@@ -5,12 +5,25 @@
 #include "type.h"
 #include "value.h"
 
+// One incoming edge of a `phi`.
+typedef struct llvm_phi_incoming_t {
+    llvm_value_t value;
+    uint block; // index of the predecessor among the function's blocks
+} llvm_phi_incoming_t;
+array_proto(llvm_phi_incoming_t); array_impl(llvm_phi_incoming_t);
+
 typedef struct llvm_instruction_t {
     enum {
         LLVM_INSTR_CALL,
         LLVM_INSTR_RETURN,
         LLVM_INSTR_GETELEMENTPTR,
         LLVM_INSTR_GETELEMENTPTR_INBOUNDS,
+        LLVM_INSTR_ALLOCA,
+        LLVM_INSTR_LOAD,
+        LLVM_INSTR_STORE,
+        LLVM_INSTR_BR,
+        LLVM_INSTR_COND_BR,
+        LLVM_INSTR_PHI,
     } type;
     union {
         struct {
@@ -28,6 +41,30 @@ typedef struct llvm_instruction_t {
             struct llvm_value_t *value;
             struct llvm_value_t *index;
         } getelementptr; // also used for getelementptr inbounds
+        struct {
+            llvm_type_t type;
+        } alloca_;
+        struct {
+            llvm_type_t type;
+            llvm_value_t pointer;
+        } load;
+        struct {
+            llvm_type_t type;
+            llvm_value_t value;
+            llvm_value_t pointer;
+        } store;
+        struct {
+            uint block;
+        } br;
+        struct {
+            llvm_value_t condition; // an i1
+            uint if_true;
+            uint if_false;
+        } cond_br;
+        struct {
+            llvm_type_t type;
+            array(llvm_phi_incoming_t) incoming;
+        } phi;
     };
 } llvm_instruction_t;
 array_proto(llvm_instruction_t); array_impl(llvm_instruction_t);
@@ -36,5 +73,11 @@ array_proto(llvm_instruction_t); array_impl(llvm_instruction_t);
 #define LLVM_INSTR_RETURN(r, v) ((llvm_instruction_t){LLVM_INSTR_RETURN, .return_={r, v}})
 #define LLVM_INSTR_GETELEMENTPTR(n, t, v, i) ((llvm_instruction_t){LLVM_INSTR_GETELEMENTPTR, .getelementptr={STR(n), t, &(v), &(i)}})
 #define LLVM_INSTR_GETELEMENTPTR_INBOUNDS(n, t, v, i) ((llvm_instruction_t){LLVM_INSTR_GETELEMENTPTR_INBOUNDS, .getelementptr={STR(n), t, &(v), &(i)}})
+#define LLVM_INSTR_ALLOCA(t) ((llvm_instruction_t){LLVM_INSTR_ALLOCA, .alloca_={t}})
+#define LLVM_INSTR_LOAD(t, p) ((llvm_instruction_t){LLVM_INSTR_LOAD, .load={t, p}})
+#define LLVM_INSTR_STORE(t, v, p) ((llvm_instruction_t){LLVM_INSTR_STORE, .store={t, v, p}})
+#define LLVM_INSTR_BR(b) ((llvm_instruction_t){LLVM_INSTR_BR, .br={b}})
+#define LLVM_INSTR_COND_BR(c, t, f) ((llvm_instruction_t){LLVM_INSTR_COND_BR, .cond_br={c, t, f}})
+#define LLVM_INSTR_PHI(t, i) ((llvm_instruction_t){LLVM_INSTR_PHI, .phi={t, i}})
 
 #endif // __LLVM_INSTRUCTION_H
\ No newline at end of file
@@ -34,6 +34,9 @@ typedef struct llvm_type_t {
             bool is_packed;
         } structure;
     };
+    // Non-zero for canonical types handed out by `llvm_type_get`; only
+    // meaningful to the generator that produced it.
+    uint id;
 } llvm_type_t;
 array_proto(llvm_type_t); array_impl(llvm_type_t);
 
@@ -13,10 +13,14 @@ typedef struct llvm_value_t {
         LLVM_VALUE_DOUBLE_,
         LLVM_VALUE_LOCAL_,
         LLVM_VALUE_TYPE_,
+        LLVM_VALUE_GETELEMENTPTR_,
+        LLVM_VALUE_UNDEF_,
+        LLVM_VALUE_BYTES_,
     } type;
     union {
         str string_;
         str cstring_;
+        str bytes_; // escaped like `cstring_`, but written without a terminator
         int int_;
         float float_;
         double double_;
@@ -24,6 +28,12 @@ typedef struct llvm_value_t {
             uint idx;
         } local;
         llvm_type_t type_;
+        struct {
+            str name;                  // the global indexed into
+            struct llvm_type_t *type;  // its type, canonical
+            int indices[2];
+            bool is_inbounds;
+        } getelementptr; // constant expression, see `llvm_simplify`
     };
 } llvm_value_t;
 array_proto(llvm_value_t); array_impl(llvm_value_t);
@@ -35,5 +45,9 @@ array_proto(llvm_value_t); array_impl(llvm_value_t);
 #define LLVM_VALUE_DOUBLE(n) ((llvm_value_t){LLVM_VALUE_DOUBLE_, .double_=n})
 #define LLVM_VALUE_LOCAL(i) ((llvm_value_t){LLVM_VALUE_LOCAL_, .local={i}})
 #define LLVM_VALUE_TYPE(t) ((llvm_value_t){LLVM_VALUE_TYPE_, .type_=t})
+#define LLVM_VALUE_GETELEMENTPTR(n, t, i, j) ((llvm_value_t){LLVM_VALUE_GETELEMENTPTR_, .getelementptr={STR(n), &(t), {i, j}, false}})
+#define LLVM_VALUE_GETELEMENTPTR_INBOUNDS(n, t, i, j) ((llvm_value_t){LLVM_VALUE_GETELEMENTPTR_, .getelementptr={STR(n), &(t), {i, j}, true}})
+#define LLVM_VALUE_UNDEF() ((llvm_value_t){.type=LLVM_VALUE_UNDEF_})
+#define LLVM_VALUE_BYTES(s) ((llvm_value_t){LLVM_VALUE_BYTES_, .bytes_=STR(s)})
 
 #endif // __LLVM_VALUE_H
\ No newline at end of file
@@ -0,0 +1,15 @@
+%T1 = type {i32, i32}
+%T2 = type <{i32, i32}>
+@msg = internal constant [13 x i8] c"Hello world!\00"
+@G = hidden addrspace(5) constant float 1.000000, align 4
+define protected coldcc i32 @f(i32, i32, i32) addrspace(5) align 4 {
+entry:
+  ret i32 0
+}
+declare i32 @printf(i8*, ...) 
+define i32 @main() {
+entry:
+  %0 = getelementptr [13 x i8], [13 x i8]* @msg, i32 0, i32 0
+  %1 = call i32 (i8*, ...) @printf(i8* %0)
+  ret i32 0
+}
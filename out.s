@@ -0,0 +1,49 @@
+	.text
+	.file	"<stdin>"
+	.protected	f                       # -- Begin function f
+	.globl	f
+	.p2align	4, 0x90
+	.type	f,@function
+f:                                      # @f
+	.cfi_startproc
+# %bb.0:                                # %entry
+	xorl	%eax, %eax
+	retq
+.Lfunc_end0:
+	.size	f, .Lfunc_end0-f
+	.cfi_endproc
+                                        # -- End function
+	.globl	main                            # -- Begin function main
+	.p2align	4, 0x90
+	.type	main,@function
+main:                                   # @main
+	.cfi_startproc
+# %bb.0:                                # %entry
+	pushq	%rax
+	.cfi_def_cfa_offset 16
+	movl	$msg, %edi
+	xorl	%eax, %eax
+	callq	printf@PLT
+	xorl	%eax, %eax
+	popq	%rcx
+	.cfi_def_cfa_offset 8
+	retq
+.Lfunc_end1:
+	.size	main, .Lfunc_end1-main
+	.cfi_endproc
+                                        # -- End function
+	.type	msg,@object                     # @msg
+	.section	.rodata,"a",@progbits
+msg:
+	.asciz	"Hello world!"
+	.size	msg, 13
+
+	.hidden	G                               # @G
+	.type	G,@object
+	.globl	G
+	.p2align	2
+G:
+	.long	0x3f800000                      # float 1
+	.size	G, 4
+
+	.section	".note.GNU-stack","",@progbits
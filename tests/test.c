@@ -55,46 +55,325 @@ int main(void) {
         .is_native = true,
     });
     
-    array(llvm_basic_block_instruction_t) main_instructions = array_new(llvm_basic_block_instruction_t)();
-    array(llvm_type_t) main_args = array_new(llvm_type_t)();
-
-    array_push(llvm_basic_block_instruction_t)(&main_instructions,
-        LLVM_BASIC_BLOCK_INSTRUCTION_LOCAL(LLVM_LOCAL(0,
-            LLVM_LOCAL_INSTRUCTION(
-                LLVM_INSTR_GETELEMENTPTR("msg", LLVM_TYPE_ARRAY(LLVM_TYPE_CHAR(), 13), LLVM_VALUE_INT(0), LLVM_VALUE_INT(0))))));
-    
-    array(llvm_function_arg_t) args = array_new_with_values(llvm_function_arg_t)(1, (llvm_function_arg_t){ LLVM_TYPE_STRING(), LLVM_VALUE_LOCAL(0), });
-
-    array_push(llvm_basic_block_instruction_t)(&main_instructions,
-        LLVM_BASIC_BLOCK_INSTRUCTION_LOCAL(LLVM_LOCAL(1, LLVM_LOCAL_INSTRUCTION(
-            LLVM_INSTR_CALL(LLVM_TYPE_INT(32), "printf", args)))));
-    array_push(llvm_basic_block_instruction_t)(&main_instructions,
-        LLVM_BASIC_BLOCK_INSTRUCTION_INSTRUCTION(LLVM_INSTR_RETURN(LLVM_TYPE_INT(32), LLVM_VALUE_INT(0))));
-    
-    llvm_function_body_t main_body = {array_new_with_values(llvm_basic_block_t)(1, LLVM_BASIC_BLOCK("entry", main_instructions))};
-    llvm_add_function(&gen, (llvm_function_t){
+    llvm_builder_t builder;
+    llvm_builder_init(&builder, &gen);
+    llvm_builder_begin(&builder, (llvm_function_t){
         .name = STR("main"),
         .return_type = LLVM_TYPE_INT(32),
-        .args = main_args,
-        .body = &main_body,
+        .args = array_new_arena(llvm_type_t)(&gen.arena),
     });
+    llvm_builder_create_block(&builder, STR("entry"));
+    llvm_value_t message = llvm_builder_gep(&builder, false, STR("msg"), LLVM_TYPE_ARRAY(LLVM_TYPE_CHAR(), 13), LLVM_VALUE_INT(0), LLVM_VALUE_INT(0));
+    llvm_builder_call(&builder, LLVM_TYPE_INT(32), STR("printf"), &(llvm_function_arg_t){LLVM_TYPE_STRING(), message}, 1);
+    llvm_builder_ret(&builder, LLVM_TYPE_INT(32), LLVM_VALUE_INT(0));
+    if (!llvm_builder_finish(&builder))
+        fatal("Function 'main' is already defined.");
+    llvm_builder_free(&builder);
     
-    str output = llvm_generate(&gen);
-    file_write(STR("out.ll"), output);
-    
-    array_free(llvm_type_t)(&main_args);
-    array_free(llvm_function_arg_t)(&args);
-    llvm_free(&gen);
+    array(llvm_diagnostic_t) diagnostics = array_new(llvm_diagnostic_t)();
+    if (!llvm_verify(&gen, &diagnostics))
+        fatal("@" STR_ARG ": %s", STR_FMT(diagnostics.data[0].symbol), diagnostics.data[0].message);
+
+    file_writer_t out;
+    if (!file_writer_open(&out, STR("out.ll")))
+        fatal("Failed to open file 'out.ll' for writing.");
+    if (!llvm_generate_to_sink(&gen, file_writer_sink(&out)) || !file_writer_commit(&out))
+        fatal("Failed to write 'out.ll'.");
+
+    str bitcode = llvm_generate_bitcode(&gen);
+    file_write(STR("out.bc"), bitcode);
+    str_free(&bitcode);
+
+    // Reading the emitted text back must reproduce it exactly.
+    str text = llvm_generate(&gen);
+    file_view_t source;
+    if (!file_view_open(&source, STR("out.ll")))
+        fatal("Failed to open file 'out.ll' for reading.");
+    llvm_generator_t parsed;
+    llvm_init(&parsed);
+    llvm_parse_error_t parse_error;
+    if (!llvm_parse(&parsed, source.contents, &parse_error))
+        fatal("out.ll:%zu:%zu: %s", parse_error.line, parse_error.column, parse_error.message);
+    str reparsed = llvm_generate(&parsed);
+    if (!str_eq(text, reparsed))
+        fatal("Re-emitting the parsed 'out.ll' changed it.");
+    str_free(&reparsed);
+
+    // Branches in a function that is not the last one resolve too.
+    str branching = STR("define i32 @a(i1) {\nentry:\n  br i1 %0, label %b, label %c\nb:\n  br label %c\nc:\n  %1 = phi i32 [ 1, %entry ], [ 2, %b ]\n  ret i32 %1\n}\n"
+                        "define i32 @d(i1) {\nentry:\n  br i1 %0, label %b, label %c\nb:\n  br label %c\nc:\n  %1 = phi i32 [ 1, %entry ], [ 2, %b ]\n  ret i32 %1\n}\n");
+    llvm_generator_t two;
+    llvm_init(&two);
+    if (!llvm_parse(&two, branching, &parse_error))
+        fatal("%zu:%zu: %s", parse_error.line, parse_error.column, parse_error.message);
+    str two_text = llvm_generate(&two);
+    if (!str_eq(two_text, branching))
+        fatal("Re-emitting two branching functions changed them.");
+    str_free(&two_text);
+    llvm_free(&two);
+
+    // A value from one arm of a branch is not available where the arms join.
+    str arms = STR("define i32 @e(i1) {\nentry:\n  br i1 %0, label %b, label %c\nb:\n  %1 = alloca i32\n  br label %c\nc:\n  %2 = load i32, i32* %1\n  ret i32 %2\n}\n");
+    llvm_init(&two);
+    if (!llvm_parse(&two, arms, &parse_error))
+        fatal("%zu:%zu: %s", parse_error.line, parse_error.column, parse_error.message);
+    if (llvm_verify(&two, &diagnostics) || diagnostics.size != 1 || diagnostics.data[0].kind != LLVM_DIAGNOSTIC_UNDEFINED_VALUE)
+        fatal("A value used outside the blocks it dominates was not reported.");
+    diagnostics.size = 0;
+    llvm_free(&two);
+
+    // Cached output must track in-place edits to the module.
+    llvm_cache_enable(&parsed, true);
+    str warm = llvm_generate(&parsed);
+    str_free(&warm);
+    llvm_function_t *edited = llvm_find_function(&parsed, STR("main"));
+    edited->alignment = 16;
+    llvm_touch_function(&parsed, edited);
+    str cached = llvm_generate(&parsed);
+    llvm_cache_enable(&parsed, false);
+    str rendered = llvm_generate(&parsed);
+    if (!str_eq(cached, rendered))
+        fatal("Cached output differs from a full rendering.");
+    str_free(&cached);
+    str_free(&rendered);
+
+    // Calls are written differently once their callee becomes variadic.
+    llvm_generator_t calls;
+    llvm_init(&calls);
+    if (!llvm_parse(&calls, STR("declare i32 @p(i32)\ndefine i32 @main() {\nentry:\n  %0 = call i32 (i32) @p(i32 1)\n  ret i32 %0\n}\n"), &parse_error))
+        fatal("%zu:%zu: %s", parse_error.line, parse_error.column, parse_error.message);
+    llvm_cache_enable(&calls, true);
+    warm = llvm_generate(&calls);
+    str_free(&warm);
+    llvm_function_t variadic = *llvm_find_function(&calls, STR("p"));
+    variadic.is_vararg = true;
+    llvm_replace_function(&calls, variadic);
+    cached = llvm_generate(&calls);
+    llvm_cache_enable(&calls, false);
+    rendered = llvm_generate(&calls);
+    if (!str_eq(cached, rendered))
+        fatal("A cached call kept its callee's old signature.");
+    str_free(&cached);
+    str_free(&rendered);
+    llvm_free(&calls);
+
+    // Hex floating point constants spell exactly the 64 bits of a double.
+    const char *hex_floats[] = {"0x3FF0000000000000", "0x3FF00000000000001", "0x3FF0", "0x"};
+    for (size_t i = 0; i < 4; i++) {
+        char source[64];
+        snprintf(source, sizeof(source), "@d = global double %s\n", hex_floats[i]);
+        llvm_init(&calls);
+        if (llvm_parse(&calls, STR(source), &parse_error) != (i == 0))
+            fatal("The hex float '%s' was %s.", hex_floats[i], i == 0 ? "rejected" : "accepted");
+        llvm_free(&calls);
+    }
+
+    // The address of `msg` is a constant, so the `getelementptr` goes away.
+    if (llvm_simplify(&parsed) != 1 || edited->code->instruction_count != 2 || !llvm_verify(&parsed, &diagnostics))
+        fatal("Simplifying 'main' did not fold its 'getelementptr'.");
+
+    // A variable assigned in a loop gets a phi at the loop header.
+    llvm_builder_init(&builder, &parsed);
+    llvm_builder_begin(&builder, (llvm_function_t){.name = STR("loop"), .return_type = LLVM_TYPE_INT(32), .args = array_new_with_values(llvm_type_t)(1, LLVM_TYPE_INT(1))});
+    uint entry = llvm_builder_create_block(&builder, STR("entry"));
+    uint header = llvm_builder_create_block(&builder, STR("header"));
+    uint body = llvm_builder_create_block(&builder, STR("body"));
+    uint done = llvm_builder_create_block(&builder, STR("done"));
+    uint counter = llvm_builder_declare_variable(&builder, LLVM_TYPE_INT(32));
+    llvm_builder_position(&builder, entry);
+    llvm_builder_write_variable(&builder, counter, LLVM_VALUE_INT(0));
+    llvm_builder_br(&builder, header);
+    llvm_builder_position(&builder, header);
+    llvm_builder_cond_br(&builder, llvm_builder_arg(&builder, 0), body, done);
+    llvm_builder_position(&builder, body);
+    llvm_value_t count = llvm_builder_read_variable(&builder, counter);
+    llvm_function_arg_t f_args[3] = {{LLVM_TYPE_INT(32), count}, {LLVM_TYPE_INT(32), count}, {LLVM_TYPE_INT(32), count}};
+    llvm_builder_write_variable(&builder, counter, llvm_builder_call(&builder, LLVM_TYPE_INT(32), STR("f"), f_args, 3));
+    llvm_builder_br(&builder, header);
+    llvm_builder_position(&builder, done);
+    llvm_builder_ret(&builder, LLVM_TYPE_INT(32), llvm_builder_read_variable(&builder, counter));
+    llvm_builder_finish(&builder);
+    llvm_builder_free(&builder);
+    llvm_code_t *loop = llvm_find_function(&parsed, STR("loop"))->code;
+    if (!llvm_verify(&parsed, &diagnostics) || loop->instructions[loop->blocks[header].first].opcode != LLVM_INSTR_PHI)
+        fatal("The loop counter did not get a phi.");
+
+    // A variable read after a long run of diamonds is looked up one join at
+    // a time, without recursing, and every phi on the way merges one value.
+    llvm_generator_t deep;
+    llvm_init(&deep);
+    llvm_builder_init(&builder, &deep);
+    llvm_builder_begin(&builder, (llvm_function_t){.name = STR("deep"), .return_type = LLVM_TYPE_INT(32), .args = array_new_with_values(llvm_type_t)(1, LLVM_TYPE_INT(1))});
+    llvm_builder_create_block(&builder, STR("entry"));
+    uint deep_counter = llvm_builder_declare_variable(&builder, LLVM_TYPE_INT(32));
+    llvm_builder_write_variable(&builder, deep_counter, LLVM_VALUE_INT(7));
+    for (uint i = 0; i < 100000; i++) {
+        uint left = llvm_builder_create_block(&builder, STR("left"));
+        uint right = llvm_builder_create_block(&builder, STR("right"));
+        uint join = llvm_builder_create_block(&builder, STR("join"));
+        llvm_builder_cond_br(&builder, llvm_builder_arg(&builder, 0), left, right);
+        llvm_builder_seal_block(&builder, left);
+        llvm_builder_seal_block(&builder, right);
+        llvm_builder_position(&builder, left);
+        llvm_builder_br(&builder, join);
+        llvm_builder_position(&builder, right);
+        llvm_builder_br(&builder, join);
+        llvm_builder_seal_block(&builder, join);
+        llvm_builder_position(&builder, join);
+    }
+    llvm_value_t deep_value = llvm_builder_read_variable(&builder, deep_counter);
+    llvm_builder_ret(&builder, LLVM_TYPE_INT(32), deep_value);
+    llvm_builder_finish(&builder);
+    llvm_builder_free(&builder);
+    llvm_code_t *deep_code = llvm_find_function(&deep, STR("deep"))->code;
+    llvm_code_instruction_t deep_ret = deep_code->instructions[deep_code->instruction_count - 1];
+    if (deep_ret.opcode != LLVM_INSTR_RETURN || deep_code->operands[deep_ret.operands] != LLVM_REF(LLVM_REF_INT, 7))
+        fatal("A value read across many joins was not the one written before them.");
+    llvm_free(&deep);
+
+    // Block names are copied, so they may live in a buffer that is reused.
+    char label[16];
+    llvm_init(&deep);
+    llvm_builder_init(&builder, &deep);
+    llvm_builder_begin(&builder, (llvm_function_t){.name = STR("labels"), .return_type = LLVM_TYPE_INT(32)});
+    snprintf(label, sizeof(label), "first");
+    llvm_builder_create_block(&builder, STR(label));
+    snprintf(label, sizeof(label), "other");
+    llvm_builder_ret(&builder, LLVM_TYPE_INT(32), LLVM_VALUE_INT(0));
+    llvm_builder_finish(&builder);
+    llvm_builder_free(&builder);
+    if (!str_eq(llvm_find_function(&deep, STR("labels"))->code->blocks[0].name, STR("first")))
+        fatal("A block kept a name that was changed after it was created.");
+    llvm_free(&deep);
+
+    // A copy of a canonical struct that differs from it is a type of its own.
+    llvm_init(&deep);
+    llvm_type_t *pair = llvm_type_get(&deep, LLVM_TYPE_STRUCTURE(array_new_with_values(llvm_type_ptr_t)(2, &LLVM_TYPE_INT(32), &LLVM_TYPE_INT(8)), false));
+    llvm_type_t packed = *pair, shortened = *pair;
+    packed.structure.is_packed = true;
+    shortened.structure.members.size = 1;
+    if (llvm_type_get(&deep, packed) == pair || !str_eq(llvm_type_text(&deep, packed), STR("<{i32, i8}>"))
+        || llvm_type_get(&deep, shortened) == pair || !str_eq(llvm_type_text(&deep, shortened), STR("{i32}")))
+        fatal("A changed copy of a struct was taken for the original.");
+    llvm_free(&deep);
+
+    // Nothing uses `unused` or the type declarations; `f` is still called.
+    llvm_add_global(&parsed, (llvm_global_t){.name = STR("unused"), .linkage = LLVM_LINKAGE_INTERNAL, .type = &LLVM_TYPE_INT(32), .value = LLVM_VALUE_INT(0)});
+    if (llvm_prune(&parsed, &STR("main"), 1) != 3 || llvm_find_global(&parsed, STR("unused")) != NULL || llvm_find_function(&parsed, STR("f")) == NULL || !llvm_verify(&parsed, &diagnostics))
+        fatal("Pruning removed the wrong symbols.");
+
+    // Equal literals share one global.
+    str interned = llvm_intern_cstring(&parsed, STR("Hello world!"))->name;
+    if (!str_eq(interned, llvm_intern_cstring(&parsed, STR("Hello world!"))->name) || parsed.globals.size != 3 || !llvm_verify(&parsed, &diagnostics))
+        fatal("Interning the same string twice gave two globals.");
+
+    // A name is interned once, and its id leads back to the symbol.
+    u32 main_name = llvm_name_find(&parsed, STR("main"));
+    if (main_name == 0 || llvm_name_intern(&parsed, STR("main")) != main_name || llvm_find_function_id(&parsed, main_name) != llvm_find_function(&parsed, STR("main")))
+        fatal("Symbol names are not interned.");
+
+    // Linking keeps one `printf` and renames the second internal `msg`.
+    llvm_generator_t shard;
+    llvm_init(&shard);
+    if (!llvm_parse(&shard, STR("@msg = internal constant [3 x i8] c\"B\\0A\\00\"\n"
+                                "declare i32 @printf(i8*, ...)\n"
+                                "define i32 @g() {\nentry:\n"
+                                "  %0 = getelementptr [3 x i8], [3 x i8]* @msg, i32 0, i32 0\n"
+                                "  %1 = call i32 (i8*, ...) @printf(i8* %0)\n"
+                                "  ret i32 0\n}\n"), NULL))
+        fatal("Failed to parse the module to link.");
+    size_t function_count = parsed.functions.size;
+    if (!llvm_link_modules(&parsed, &(llvm_generator_t *){&shard}, 1, &diagnostics) || parsed.functions.size != function_count + 1 || llvm_find_global(&parsed, STR("msg.1")) == NULL || !llvm_verify(&parsed, &diagnostics))
+        fatal("Linking did not merge the modules.");
+    llvm_free(&shard);
+
+    // A snapshot loads back into the same module, straight from a mapping.
+    str snapshot = llvm_snapshot_save(&parsed);
+    file_write(STR("out.snap"), snapshot);
+    str_free(&snapshot);
+    file_view_t mapped;
+    if (!file_view_open(&mapped, STR("out.snap")))
+        fatal("Failed to open file 'out.snap' for reading.");
+    llvm_generator_t loaded;
+    llvm_init(&loaded);
+    if (!llvm_snapshot_load(&loaded, mapped.contents))
+        fatal("Failed to load the snapshot.");
+    str saved_text = llvm_generate(&parsed), loaded_text = llvm_generate(&loaded);
+    if (!str_eq(saved_text, loaded_text) || !llvm_verify(&loaded, &diagnostics))
+        fatal("The loaded snapshot differs from the saved module.");
+    str_free(&saved_text);
+    str_free(&loaded_text);
+
+    // Renaming the internal `msg.1` rewrites a body that is still in the mapping.
+    llvm_init(&shard);
+    if (!llvm_parse(&shard, STR("@msg.1 = constant i32 1\n"), NULL)
+        || !llvm_link_modules(&loaded, &(llvm_generator_t *){&shard}, 1, &diagnostics) || !llvm_verify(&loaded, &diagnostics))
+        fatal("Linking into a loaded snapshot failed.");
+    llvm_free(&shard);
+    llvm_free(&loaded);
+    file_view_close(&mapped);
+
+    // Floats are written exactly, in hex when no short decimal is.
+    str_builder_t piece;
+    str_builder_init(&piece);
+    llvm_generate_value(&parsed, &piece, LLVM_VALUE_FLOAT(0.1f));
+    str_builder_append_char(&piece, ' ');
+    llvm_generate_value(&parsed, &piece, LLVM_VALUE_DOUBLE(-2.5));
+    if (!str_eq(str_builder_view(&piece), STR("0x3FB99999A0000000 -2.500000")))
+        fatal("Floating point constants are not written exactly.");
+
+    // String constants keep their escapes and escape everything else.
+    str_builder_clear(&piece);
+    llvm_generate_value(&parsed, &piece, LLVM_VALUE_CSTRING("say \"hi\"\n\\0A"));
+    if (!str_eq(str_builder_view(&piece), STR("c\"say \\22hi\\22\\0A\\0A\\00\"")))
+        fatal("A string constant was not escaped.");
+    str_builder_free(&piece);
+
+    // A call that does not match its callee is reported, not emitted.
+    llvm_builder_init(&builder, &parsed);
+    llvm_builder_begin(&builder, (llvm_function_t){.name = STR("bad"), .return_type = LLVM_TYPE_INT(32), .args = array_new_arena(llvm_type_t)(&parsed.arena)});
+    llvm_builder_create_block(&builder, STR("entry"));
+    llvm_value_t result = llvm_builder_call(&builder, LLVM_TYPE_INT(32), STR("f"), NULL, 0);
+    llvm_builder_ret(&builder, LLVM_TYPE_INT(32), result);
+    llvm_builder_finish(&builder);
+    llvm_builder_free(&builder);
+    if (llvm_verify(&parsed, &diagnostics) || diagnostics.size != 1 || diagnostics.data[0].kind != LLVM_DIAGNOSTIC_ARGUMENT_COUNT)
+        fatal("A call with missing arguments was not reported.");
+    array_free(llvm_diagnostic_t)(&diagnostics);
+    llvm_free(&parsed);
+    file_view_close(&source);
+    str_free(&text);
 
 #if defined(_WIN32) || defined(_WIN64)
     system("llc out.ll -o out.s");
     system("gcc out.s -o out.exe");
     system("out.exe");
 #elif defined(__linux__)
-    system("llc out.ll -o out.s");
+    // A stand-in backend sees the whole module, and its failure is reported.
+    llvm_backend_result_t backend_result;
+    str expected = llvm_generate(&gen);
+    if (!llvm_backend_run(&(llvm_backend_t){(const char *[]){"wc", "-c", NULL}, 1}, &(llvm_backend_job_t){&gen, NULL}, 1, &backend_result) || (size_t)atol(backend_result.output.chars) != expected.count)
+        fatal("The backend did not receive the module.");
+    llvm_backend_result_free(&backend_result);
+    str_free(&expected);
+    if (llvm_backend_run(&(llvm_backend_t){(const char *[]){"sh", "-c", "cat >/dev/null; echo failed >&2; exit 3", NULL}, 1}, &(llvm_backend_job_t){&gen, NULL}, 1, &backend_result) || backend_result.status != 3 || !str_eq(backend_result.errors, STR("failed\n")))
+        fatal("A failing backend was not reported.");
+    llvm_backend_result_free(&backend_result);
+
+    if (!llvm_backend_run(&(llvm_backend_t){(const char *[]){"llc", NULL}, 1}, &(llvm_backend_job_t){&gen, "out.s"}, 1, &backend_result))
+        fatal("llc failed: " STR_ARG, STR_FMT(backend_result.errors));
+    llvm_backend_result_free(&backend_result);
     system("gcc out.s -o out");
     system("./out");
+
+    // The bitcode must describe the same module as the textual IR.
+    if (system("llvm-as out.ll -o out.ref.bc"
+               " && llvm-dis out.ref.bc -o - | grep -v -e '^; ModuleID' -e '^source_filename' > out.ref.ll"
+               " && llvm-dis out.bc -o - | grep -v -e '^; ModuleID' -e '^source_filename' > out.bc.ll"
+               " && cmp -s out.ref.ll out.bc.ll") != 0)
+        fatal("'out.bc' does not match 'out.ll'.");
 #endif // defined(_WIN32) || defined(_WIN64)
-    
+
+    llvm_free(&gen);
     return 0;
 }
\ No newline at end of file